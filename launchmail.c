@@ -56,6 +56,8 @@ I<launchmail> - an SMTP client with a I<sendmail>-compatible wrapper
   -o, --timeout=#            - Seconds to wait during SMTP dialogue
   -N, --noheaders            - Do not insert any headers
   -q, --quiet                - Remain silent when an error occurs
+  -D, --trace=filename       - Record debug messages in a binary trace file
+  -I, --stats[=filename]     - Report the time taken by each SMTP phase
 
 =head1 DESCRIPTION
 
@@ -155,7 +157,10 @@ dialogue.
 Scan the header section in the message for C<To:>, C<Cc:> and C<Bcc:>
 headers and use the addresses found as C<RCPT TO:> addresses suring the SMTP
 dialogue. Exclude any C<Bcc:> header found when sending the message. This
-option implies C<--noheaders>.
+option implies C<--noheaders>. The connection to the SMTP server is made
+while the headers are being read. If reading them takes longer than the
+C<--timeout>, that connection is closed and another one is made, so that
+the server isn't kept waiting for C<HELO>.
 
 =item C<-!>, C<--sendbcc>
 
@@ -177,7 +182,8 @@ done by default.
 =item C<-x>I<'name: value'>, C<--header=>I<'name: value'>
 
 Specify an arbitrary header to be included in the message (unless the
-C<--noheaders> option is supplied). For example:
+C<--noheaders> option is supplied). If no C<Message-ID:> header is
+supplied this way, a unique one is generated. For example:
 
  -x'Organization: n. the act or process of organizing or of being organized'
  --header='Sender: sender@f.q.d.n'
@@ -216,12 +222,72 @@ This defaults to 10. There's probably no need to change this.
 
 =item C<-N>, C<--noheaders>
 
-Do not insert any headers into the message.
+Do not insert any headers into the message. Without this option, the
+C<From:>, C<Message-ID:>, C<To:> and C<Cc:> headers are always inserted, as
+are C<Subject:> and C<Date:> if requested.
 
 =item C<-q>, C<--quiet>
 
 Remain silent when an error occurs.
 
+=item C<-I>I<[filename]>, C<--stats>I<[=filename]>
+
+Measure the time taken by each phase of the SMTP dialogue and report it
+when finished (whether or not the message was sent), as a single line of
+C<name=value> pairs. Without I<filename>, the line is written to standard
+error. With I<filename>, it is appended to that file, so that the stats for
+many messages can be collected in one place. All times are in seconds,
+measured with a monotonic clock. The names are:
+
+ status     ok or error
+ failed     the phase that failed (only when status=error)
+ server     the SMTP server
+ dns        looking up the server's address
+ connect    connecting to the server
+ greeting   waiting for the server's greeting
+ helo       HELO and its reply
+ mail       MAIL FROM and its reply
+ rcpt       all RCPT TOs and their replies
+ rcpts      the number of RCPT TOs
+ rcpt_each  each RCPT TO and its reply (comma separated)
+ data       DATA and its reply
+ body       sending the headers and the message body
+ final      waiting for the reply after the message body
+ total      everything, including QUIT and reading the message
+ bytes_sent bytes sent to the server
+ sends      calls that sent data to the server
+ expects    server replies read
+ syscr      read system calls (where /proc/self/io exists)
+ syscw      write system calls (where /proc/self/io exists)
+ heap_allocs  heap allocations (only with MEM_TRACK)
+ heap_frees   heap releases (only with MEM_TRACK)
+ heap_bytes   bytes allocated (only with MEM_TRACK)
+ heap_peak    the most bytes allocated at once (only with MEM_TRACK)
+
+With C<--readto>, the C<dns>, C<connect> and C<greeting> phases overlap
+with reading the headers, and only count the time spent on the connection.
+
+When built with C<MEM_TRACK> defined (e.g. C<make CPPFLAGS=-DMEM_TRACK>),
+the line also includes the heap usage between reading the message and
+reporting, and it is preceded (on standard error) by one line per
+allocating call site in I<launchmail> and I<libslack> (see
+I<mem_track_report(3)>). Both cover the same interval, so the call site
+lines add up to the totals.
+
+If most of the time is in C<greeting>, C<helo>, C<mail>, C<rcpt>, C<data> or
+C<final>, the SMTP server is slow to reply. If it's in C<dns> or
+C<connect>, it's the network (or the name service). If it's in C<body>, or
+C<total> is much larger than the sum of the phases, it's I<launchmail> (or
+the input).
+
+=item C<-D>I<filename>, C<--trace=>I<filename>
+
+Record debug messages (see C<--debug>) in the binary trace file
+I<filename>, rather than formatting them and writing them to standard
+error. Recording a debug message costs much less than formatting it. The
+I<decode-trace> program in the I<libslack> source distribution formats the
+messages in a trace file.
+
 =back
 
 =head1 FILES
@@ -291,6 +357,8 @@ L<mpack(1)|mpack(1)>
 #include <netdb.h>
 #include <time.h>
 #include <pwd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
 
 static struct
 {
@@ -301,12 +369,16 @@ static struct
 	List *cc;
 	List *bcc;
 	List *headers;
+	Pool *pool;
 	const char *mailfrom;
 	const char *hostname;
 	const char *server;
 	int port;
 	long timeout;
 	int quiet;
+	const char *trace;
+	int stats;
+	const char *stats_file;
 	int noheaders;
 	int readto;
 	int sendbcc;
@@ -322,12 +394,16 @@ g =
 	null, /* cc */
 	null, /* bcc */
 	null, /* headers */
+	null, /* pool */
 	null, /* mailfrom */
 	null, /* hostname */
 	null, /* server */
 	0,    /* port */
 	10,   /* timeout */
 	0,    /* quiet */
+	null, /* trace */
+	0,    /* stats */
+	null, /* stats_file */
 	0,    /* noheaders */
 	0,    /* readto */
 	0,    /* sendbcc */
@@ -339,47 +415,288 @@ static const char * const squote = "\"[(";
 static const char * const equote = "\"])";
 static const int comment[3] = { 0, 0, 1 };
 
+/*
+** With --stats, the SMTP dialogue is divided into phases. Each phase lasts
+** from when it starts until the next one starts, so the time spent waiting
+** for each reply is included in the phase of the command that it's a reply
+** to. Sends and replies are counted by try_send() and try_expect().
+*/
+
+enum
+{
+	STAT_NONE = -1,
+	STAT_DNS, STAT_CONNECT, STAT_GREETING, STAT_HELO, STAT_MAIL,
+	STAT_RCPT, STAT_DATA, STAT_BODY, STAT_FINAL, STAT_PHASES
+};
+
+static const char * const stat_name[STAT_PHASES] =
+{
+	"dns", "connect", "greeting", "helo", "mail", "rcpt", "data", "body", "final"
+};
+
+static struct
+{
+	int phase;                 /* the current phase */
+	double start;              /* when the current phase started */
+	double begin;              /* when the dialogue started */
+	double time[STAT_PHASES];  /* the time spent in each phase */
+	String *rcpt_each;         /* the time spent on each RCPT TO */
+	size_t rcpts;              /* the number of RCPT TOs */
+	size_t bytes_sent;         /* bytes sent to the server */
+	size_t sends;              /* calls that sent data */
+	size_t expects;            /* replies read */
+	long syscr, syscw;         /* read/write system calls at the start (or -1) */
+}
+stats = { STAT_NONE, 0.0, 0.0, { 0.0 }, null, 0, 0, 0, 0, -1, -1 };
+
+double stats_clock(void)
+{
+	struct timespec now[1];
+
+	clock_gettime(CLOCK_MONOTONIC, now);
+
+	return now->tv_sec + now->tv_nsec / 1e9;
+}
+
+/* Ends the current phase (if any), and starts the next one (if any) */
+
+void stats_phase(int phase)
+{
+	double now;
+
+	if (!g.stats)
+		return;
+
+	now = stats_clock();
+
+	if (stats.phase != STAT_NONE)
+		stats.time[stats.phase] += now - stats.start;
+
+	stats.phase = phase;
+	stats.start = now;
+}
+
+/* Records the time taken by one RCPT TO (which is still the current phase) */
+
+void stats_rcpt(void)
+{
+	if (!g.stats)
+		return;
+
+	++stats.rcpts;
+
+	if (stats.rcpt_each || (stats.rcpt_each = str_create("%s", "")))
+		str_append(stats.rcpt_each, "%s%.6f", (stats.rcpts == 1) ? "" : ",", stats_clock() - stats.start);
+}
+
+ssize_t stats_sent(ssize_t bytes)
+{
+	if (bytes != -1)
+		stats.bytes_sent += bytes, ++stats.sends;
+
+	return bytes;
+}
+
+ssize_t stats_expected(ssize_t rc)
+{
+	if (rc != -1)
+		++stats.expects;
+
+	return rc;
+}
+
+/* Gets the number of read and write system calls so far (Linux only) */
+
+void stats_syscalls(long *syscr, long *syscw)
+{
+	char line[128];
+	FILE *io;
+
+	*syscr = *syscw = -1;
+
+	if (!(io = fopen("/proc/self/io", "r")))
+		return;
+
+	while (fgets(line, sizeof line, io))
+	{
+		if (!strncmp(line, "syscr: ", 7))
+			*syscr = atol(line + 7);
+		else if (!strncmp(line, "syscw: ", 7))
+			*syscw = atol(line + 7);
+	}
+
+	fclose(io);
+}
+
+void stats_begin(void)
+{
+	if (!g.stats)
+		return;
+
+	stats_syscalls(&stats.syscr, &stats.syscw);
+	stats.begin = stats_clock();
+#ifdef MEM_TRACK
+	mem_track_reset();
+#endif
+}
+
+/* Reports the stats as a single line, to stderr or appended to a file */
+
+void stats_report(int rc)
+{
+	double total;
+	long syscr, syscw;
+	String *line;
+	int fd, i;
+#ifdef MEM_TRACK
+	MemStats heap;
+#endif
+
+	if (!g.stats)
+		return;
+
+	total = stats_clock() - stats.begin;
+#ifdef MEM_TRACK
+	/* Before building the line, so that its allocations aren't counted */
+	mem_track_totals(&heap);
+	mem_track_report(mem_track_print, stderr);
+#endif
+
+	if (!(line = str_create("status=%s", (rc == -1) ? "error" : "ok")))
+		return;
+
+	if (rc == -1 && stats.phase != STAT_NONE)
+		str_append(line, " failed=%s", stat_name[stats.phase]);
+
+	stats_phase(STAT_NONE);
+	str_append(line, " server=%s", g.server);
+
+	for (i = 0; i < STAT_PHASES; ++i)
+	{
+		str_append(line, " %s=%.6f", stat_name[i], stats.time[i]);
+
+		if (i == STAT_RCPT)
+			str_append(line, " rcpts=%d rcpt_each=%s", (int)stats.rcpts, (stats.rcpt_each) ? cstr(stats.rcpt_each) : "");
+	}
+
+	str_append(line, " total=%.6f bytes_sent=%lu sends=%lu expects=%lu", total, (unsigned long)stats.bytes_sent, (unsigned long)stats.sends, (unsigned long)stats.expects);
+
+	stats_syscalls(&syscr, &syscw);
+
+	if (syscr != -1 && stats.syscr != -1)
+		str_append(line, " syscr=%ld syscw=%ld", syscr - stats.syscr, syscw - stats.syscw);
+
+#ifdef MEM_TRACK
+	str_append(line, " heap_allocs=%lu heap_frees=%lu heap_bytes=%lu heap_peak=%lu", heap.allocs, heap.frees, (unsigned long)heap.bytes, (unsigned long)heap.peak);
+#endif
+
+	str_append(line, "\n");
+
+	/* One write so that concurrent launchmails don't interleave lines */
+
+	if (g.stats_file)
+	{
+		if ((fd = open(g.stats_file, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1)
+			errorsys("failed to open stats file %s", g.stats_file);
+		else
+		{
+			if (write(fd, cstr(line), str_length(line)) == -1)
+				errorsys("failed to write stats file %s", g.stats_file);
+
+			close(fd);
+		}
+	}
+	else if (write(STDERR_FILENO, cstr(line), str_length(line)) == -1)
+		/* Avoid gcc warning */;
+
+	str_release(line);
+	str_destroy(&stats.rcpt_each);
+}
+
 #define fail { close(smtp); return -1; }
 #define try_cleanup(action, cleanup) if ((action) == -1) { debugsys((1, "%s failed", #action)) cleanup; fail }
 #define try_str(action) if (!(action)) { debug((1, "%s failed", #action)) fail }
 #define try(action) try_cleanup(action, /* nop */)
-#define try_send(args) try(net_send args)
-#define try_send_cleanup(args, cleanup) try_cleanup(net_send args, cleanup)
+#define try_send(args) try(stats_sent(net_send args))
+#define try_send_cleanup(args, cleanup) try_cleanup(stats_sent(net_send args), cleanup)
 #define try_expect(args, cnv, resp) \
-	try(rc = net_expect args) \
+	try(rc = stats_expected(net_expect args)) \
 	if (rc != (cnv) || code != (resp)) { debug((1, "SMTP protocol error")) close(smtp); return set_errno(EPROTO); }
 
+#define HEADER_WIDTH 78
+#define MESSAGE_POOL_SIZE 8192
+
 int header(int smtp, List *headers, const char *name)
 {
-	String *tmp, *header;
-	List *para;
+	size_t size, length, column, len, count;
+	char *buf, *b;
+	int i;
 
 	if (!headers || !list_length(headers))
 		return 0;
 
-	if (!(tmp = str_join(headers, ", ")))
-		return set_errno(ENOMEM);
+	/*
+	** Render the whole folded header into a single buffer. Each address
+	** costs at most its own length plus ",\r\n\t" so the buffer can be
+	** sized exactly once up front and sent with a single write.
+	*/
 
-	para = str_fmt(tmp, 72, ALIGN_LEFT);
-	str_release(tmp);
-	if (!para)
-		return set_errno(ENOMEM);
+	count = list_length(headers);
+	size = strlen(name) + 2 + 2 + 1;
+	for (i = 0; i < count; ++i)
+		size += str_length((String *)list_item(headers, i)) + 4;
 
-	header = str_join(para, "\r\n\t");
-	list_release(para);
-	if (!header)
+	if (!(buf = mem_create(size, char)))
 		return set_errno(ENOMEM);
 
-	debug((1, "Sending: %s: %s", name, cstr(header)))
-	try_send_cleanup((smtp, g.timeout, "%s: %s\r\n", name, cstr(header)), str_release(header))
-	str_release(header);
+	len = strlen(name);
+	memcpy(buf, name, len);
+	memcpy(buf + len, ": ", 2);
+	b = buf + len + 2;
+	column = len + 2;
+
+	for (i = 0; i < count; ++i)
+	{
+		String *addr = (String *)list_item(headers, i);
+
+		length = str_length(addr);
+
+		if (i)
+		{
+			*b++ = ',';
+			++column;
+
+			if (column + 1 + length + (i + 1 < count) > HEADER_WIDTH)
+			{
+				memcpy(b, "\r\n\t", 3);
+				b += 3;
+				column = 1;
+			}
+			else
+			{
+				*b++ = ' ';
+				++column;
+			}
+		}
+
+		memcpy(b, cstr(addr), length);
+		b += length;
+		column += length;
+	}
+
+	memcpy(b, "\r\n", 3);
+	b += 2;
+
+	debug((1, "Sending: %.*s", (int)(b - buf - 2), buf))
+	try_cleanup(stats_sent(net_write(smtp, g.timeout, buf, b - buf)), mem_release(buf))
+	mem_release(buf);
 
 	return 0;
 }
 
 int headers(int smtp, List *headers)
 {
-	while (list_has_next(headers))
+	while (list_has_next(headers) == 1)
 	{
 		String *header = list_next(headers);
 		debug((1, "Sending: %s", cstr(header)))
@@ -389,6 +706,25 @@ int headers(int smtp, List *headers)
 	return 0;
 }
 
+int has_header(List *headers, const char *name)
+{
+	size_t length = strlen(name);
+	int i;
+
+	if (!headers)
+		return 0;
+
+	for (i = 0; i < list_length(headers); ++i)
+	{
+		const char *header = cstr((String *)list_item(headers, i));
+
+		if (!strncasecmp(header, name, length) && header[length] == ':')
+			return 1;
+	}
+
+	return 0;
+}
+
 int body(int smtp, FILE *input)
 {
 	char buf[BUFSIZ];
@@ -405,7 +741,7 @@ int body(int smtp, FILE *input)
 		if (newline)
 			strcpy(buf + len - 1, "\r\n"), ++len;
 
-		if (net_write(smtp, g.timeout, buf, len) == -1)
+		if (stats_sent(net_write(smtp, g.timeout, buf, len)) == -1)
 			return errorsys("An error occurred while sending the message");
 	}
 
@@ -469,22 +805,25 @@ int readto(FILE *input, String **hdrs)
 	const char *start, *end, *t, *b = null;
 	char *s = null;
 
-	if (!(*hdrs = str_create("")))
+	if (!(*hdrs = str_create_in(g.pool, "")))
 		fatal("out of memory");
 
 	for (;;)
 	{
+		size_t len;
+		int eol;
+
 		if (!fgetline(buf, BUFSIZ, input))
 			break;
 
-		if (!str_append(*hdrs, "%s", buf))
-			fatal("out of memory");
+		len = strlen(buf);
+		if ((eol = (len && buf[len - 1] == '\n')))
+			buf[--len] = '\0';
 
-		if (cstr(*hdrs)[str_length(*hdrs) - 1] == '\n')
-			if (!str_insert(*hdrs, str_length(*hdrs) - 1, "\r"))
-				fatal("out of memory");
+		if (!str_append(*hdrs, (eol) ? "%s\r\n" : "%s", buf))
+			fatal("out of memory");
 
-		if (*buf == '\n' || *buf == '\0')
+		if (*buf == '\0')
 			break;
 	}
 
@@ -506,10 +845,10 @@ int readto(FILE *input, String **hdrs)
 			if (target) /* Previous header was interesting */
 			{
 				String *addr;
-				if (!*target && !(*target = list_create((list_release_t *)str_release)))
+				if (!*target && !(*target = list_create_in(g.pool, (list_release_t *)str_release)))
 					fatal("out of memory");
 				*s = '\0';
-				if (!(addr = str_create("%s", rcpt)))
+				if (!(addr = str_create_in(g.pool, "%s", rcpt)))
 					fatal("out of memory");
 				if (!list_append(*target, str_squeeze(str_trim(addr))))
 					fatal("out of memory");
@@ -566,9 +905,9 @@ int readto(FILE *input, String **hdrs)
 			{
 				String *addr;
 				*s = '\0';
-				if (!*target && !(*target = list_create((list_release_t *)str_release)))
+				if (!*target && !(*target = list_create_in(g.pool, (list_release_t *)str_release)))
 					fatal("out of memory");
-				if (!(addr = str_create("%s", rcpt)))
+				if (!(addr = str_create_in(g.pool, "%s", rcpt)))
 					fatal("out of memory");
 				if (!list_append(*target, str_squeeze(str_trim(addr))))
 					fatal("out of memory");
@@ -584,26 +923,6 @@ int readto(FILE *input, String **hdrs)
 	return 0;
 }
 
-char *rfc822(char *buf, size_t max, struct tm *tm)
-{
-	size_t size = strftime(buf, max, "%a, %d %b %Y %H:%M:%S %z", tm);
-
-	if (size == 0)
-		return null;
-
-	return buf;
-}
-
-char *rfc822_localtime(char *buf, size_t max, time_t time)
-{
-	return rfc822(buf, max, localtime(&time));
-}
-
-char *rfc822_gmtime(char *buf, size_t max, time_t time)
-{
-	return rfc822(buf, max, gmtime(&time));
-}
-
 String *addressof(const char *addr)
 {
 	const char *a, *l = null, *r = null;
@@ -628,55 +947,181 @@ String *addressof(const char *addr)
 
 int rcpt(int smtp, List *recipients)
 {
-	while (list_has_next(recipients))
+	while (list_has_next(recipients) == 1)
 	{
 		String *recipient = list_next(recipients);
 		String *addr;
 		int rc, code;
 
 		try_str(addr = addressof(cstr(recipient)))
+		stats_phase(STAT_RCPT);
 		debug((1, "Sending: RCPT TO: %s", cstr(addr)))
 		try_send((smtp, g.timeout, "RCPT TO: %s\r\n", cstr(addr)))
 		str_destroy(&addr);
 		debug((2, "Expecting server response"))
 		try_expect((smtp, g.timeout, "%d", &code), 1, 250)
+		stats_rcpt();
 	}
 
 	return 0;
 }
 
-int launch(FILE *input)
+/*
+** With --stats, look up the server's addresses before connecting so that
+** the time taken by the name service isn't counted as connecting. Then try
+** each address in turn, like net_client() does.
+*/
+
+int stats_connect(void)
+{
+	struct hostent hostbuf[1], *hostent;
+	char addr[INET6_ADDRSTRLEN];
+	void *buf = null;
+	size_t size = 0;
+	int herrno, smtp, i;
+
+	stats_phase(STAT_DNS);
+
+	if (!strcmp(g.server, "/unix") || !(hostent = net_gethostbyname(g.server, hostbuf, &buf, &size, &herrno)))
+	{
+		/* Let net_client() handle it (and report any error) */
+		free(buf);
+		stats_phase(STAT_CONNECT);
+
+		return net_client(g.server, null, g.port, g.timeout, 0, 0, null, null);
+	}
+
+	stats_phase(STAT_CONNECT);
+
+	for (smtp = -1, i = 0; smtp == -1 && hostent->h_addr_list[i]; ++i)
+	{
+		if (!inet_ntop(hostent->h_addrtype, hostent->h_addr_list[i], addr, sizeof addr))
+			continue;
+
+		debug((2, "Connecting to %s:%d", addr, g.port))
+		smtp = net_client(addr, null, g.port, g.timeout, 0, 0, null, null);
+	}
+
+	free(buf);
+
+	return smtp;
+}
+
+int greet(void)
 {
 	int smtp;
 	int code;
-	String *hdrs = null, *addr;
 	int rc;
 	char c;
 
+	debug((1, "Connecting to %s:%d", g.server, g.port))
+	smtp = (g.stats) ? stats_connect() : net_client(g.server, null, g.port, g.timeout, 0, 0, null, null);
+	if (smtp == -1)
+		return -1;
+
+	stats_phase(STAT_GREETING);
+	debug((1, "Expecting server greeting"))
+	try_expect((smtp, g.timeout, "%d%c", &code, &c), 2, 220)
+	while (c == '-')
+		try_expect((smtp, g.timeout, "%d%c", &code, &c), 2, 220)
+	stats_phase(STAT_NONE);
+
+	return smtp;
+}
+
+typedef struct Greeting Greeting;
+
+struct Greeting
+{
+	int smtp;
+	int errnum;
+	double greeted; /* when the greeting was read */
+};
+
+void *greeter(void *arg)
+{
+	Greeting *greeting = (Greeting *)arg;
+
+	greeting->smtp = greet();
+	greeting->errnum = errno;
+	greeting->greeted = stats_clock();
+
+	return null;
+}
+
+int launch(FILE *input)
+{
+	int smtp = -1;
+	int code;
+	String *hdrs = null, *addr;
+	int rc;
+
 	if (g.readto)
 	{
+		Greeting greeting[1];
+		pthread_t thread;
+		int threaded;
+
+		/*
+		** The connection and greeting don't depend on the headers so, when
+		** the message is arriving slowly (e.g. on a pipe), get them out of
+		** the way while the headers are still being read and parsed.
+		*/
+
+		threaded = (pthread_create(&thread, null, greeter, greeting) == 0);
+
 		debug((1, "Reading headers in message"))
-		if (readto(input, &hdrs) == -1)
+		rc = readto(input, &hdrs);
+
+		if (threaded)
+		{
+			pthread_join(thread, null);
+			smtp = greeting->smtp;
+			errno = greeting->errnum;
+
+			/*
+			** Don't keep the server waiting for HELO for longer than we
+			** would wait for it. If the headers took that long, start again.
+			*/
+
+			if (rc != -1 && smtp != -1 && stats_clock() - greeting->greeted > g.timeout)
+			{
+				debug((1, "Reconnecting (greeted more than %ld seconds ago)", g.timeout))
+				close(smtp);
+				smtp = -1;
+				threaded = 0;
+			}
+		}
+
+		if (rc == -1)
+		{
+			if (smtp != -1)
+				close(smtp);
+			str_destroy(&hdrs);
 			return -1;
+		}
 
 		if (!list_length(g.to))
 			fatal("No recipients given");
+
+		if (!threaded)
+			smtp = greet();
 	}
+	else
+		smtp = greet();
 
-	debug((1, "Connecting to %s:%d", g.server, g.port))
-	smtp = net_client(g.server, null, g.port, g.timeout, 0, 0, null, null);
 	if (smtp == -1)
+	{
+		str_destroy(&hdrs);
 		return -1;
+	}
 
-	debug((1, "Expecting server greeting"))
-	try_expect((smtp, g.timeout, "%d%c", &code, &c), 2, 220)
-	while (c == '-')
-		try_expect((smtp, g.timeout, "%d%c", &code, &c), 2, 220)
-
+	stats_phase(STAT_HELO);
 	debug((1, "Sending: HELO %s", g.hostname))
 	try_send((smtp, g.timeout, "HELO %s\r\n", g.hostname))
 	debug((2, "Expecting server response"))
 	try_expect((smtp, g.timeout, "%d", &code), 1, 250)
+	stats_phase(STAT_MAIL);
 	try_str(addr = addressof(g.mailfrom))
 	debug((1, "Sending: MAIL FROM: %s", cstr(addr)))
 	try_send((smtp, g.timeout, "MAIL FROM: %s\r\n", cstr(addr)))
@@ -686,26 +1131,33 @@ int launch(FILE *input)
 	try(rcpt(smtp, g.to))
 	try(rcpt(smtp, g.cc))
 	try(rcpt(smtp, g.bcc))
+	stats_phase(STAT_DATA);
 	debug((1, "Sending: DATA"))
 	try_send((smtp, g.timeout, "DATA\r\n"))
 	debug((2, "Expecting server response"))
 	try_expect((smtp, g.timeout, "%d", &code), 1, 354)
+	stats_phase(STAT_BODY);
 
 	if (!g.noheaders)
 	{
-		char buf[BUFSIZ];
+		char buf[DATE_SIZE];
 
 		if (g.gmtime || g.localtime)
 		{
-			if (g.gmtime)
-				rfc822_gmtime(buf, BUFSIZ, time(null));
-			else
-				rfc822_localtime(buf, BUFSIZ, time(null));
-
+			try_str(date_rfc5322_now(buf, DATE_SIZE, g.gmtime))
 			debug((1, "Sending: Date: %s", buf))
 			try_send((smtp, g.timeout, "Date: %s\r\n", buf))
 		}
 
+		if (!has_header(g.headers, "Message-ID"))
+		{
+			char msgid[DATE_MSGID_SIZE];
+
+			try_str(date_msgid(msgid, DATE_MSGID_SIZE, g.hostname))
+			debug((1, "Sending: Message-ID: %s", msgid))
+			try_send((smtp, g.timeout, "Message-ID: %s\r\n", msgid))
+		}
+
 		debug((1, "Sending: From: %s", g.from))
 		try_send((smtp, g.timeout, "From: %s\r\n", g.from))
 
@@ -727,7 +1179,7 @@ int launch(FILE *input)
 	if (hdrs)
 	{
 		debug((1, "Sending headers in message"))
-		try_send((smtp, g.timeout, "%s", cstr(hdrs)))
+		try_cleanup(stats_sent(net_write(smtp, g.timeout, cstr(hdrs), str_length(hdrs))), str_destroy(&hdrs))
 		str_destroy(&hdrs);
 	}
 
@@ -735,8 +1187,10 @@ int launch(FILE *input)
 	try(body(smtp, input))
 	debug((1, "Ending message body"))
 	try_send((smtp, g.timeout, "\r\n.\r\n"))
+	stats_phase(STAT_FINAL);
 	debug((2, "Expecting server response"))
 	try_expect((smtp, g.timeout, "%d", &code), 1, 250)
+	stats_phase(STAT_NONE);
 	debug((1, "Sending: QUIT"))
 	try_send((smtp, g.timeout, "QUIT\r\n"))
 	debug((2, "Expecting server response"))
@@ -749,20 +1203,32 @@ int launch(FILE *input)
 
 int launchmail()
 {
+	FILE *input = stdin;
+	int rc;
+
 	debug((1, "launchmail %s", (g.message) ? g.message : "<stdin>"))
 
+	if (g.message && !(input = fopen(g.message, "rb")))
+		fatalsys("Failed to open %s for reading", g.message);
+
+	/*
+	** The headers and recipients read from the message are allocated from
+	** a pool so the whole per-message working set is freed in one go.
+	*/
+
+	if (!(g.pool = pool_create_growable(MESSAGE_POOL_SIZE)))
+		fatal("out of memory");
+
+	stats_begin();
+	rc = launch(input);
+	stats_report(rc);
+
 	if (g.message)
-	{
-		int rc;
-		FILE *input = fopen(g.message, "rb");
-		if (!input)
-			fatalsys("Failed to open %s for reading", g.message);
-		rc = launch(input);
 		fclose(input);
-		return rc;
-	}
 
-	return launch(stdin);
+	pool_destroy(&g.pool);
+
+	return rc;
 }
 
 void *null_copy(const void *item)
@@ -873,6 +1339,12 @@ void addfile_headers(const char *arg)
 	addfile(&g.headers, arg, null);
 }
 
+void set_stats(const char *arg)
+{
+	g.stats = 1;
+	g.stats_file = arg;
+}
+
 void check_config()
 {
 	if (!g.readto && !list_length(g.to))
@@ -1014,6 +1486,14 @@ static Option launchmail_options_table[] =
 		"quiet", 'q', null, "Remain silent when an error occurs",
 		no_argument, OPT_INTEGER, OPT_VARIABLE, &g.quiet, null
 	},
+	{
+		"trace", 'D', "filename", "Record debug messages in a binary trace file",
+		required_argument, OPT_STRING, OPT_VARIABLE, &g.trace, null
+	},
+	{
+		"stats", 'I', "filename", "Report the time taken by each SMTP phase",
+		optional_argument, OPT_STRING, OPT_FUNCTION, null, (func_t *)set_stats
+	},
 	{
 		null, '\0', null, null, 0, 0, 0, null, null
 	}
@@ -1028,19 +1508,19 @@ void show_config()
 	debug((1, "From: %s", g.from))
 	debug((1, "Subject: %s", (g.subject) ? g.subject: ""))
 
-	while (list_has_next(g.to))
+	while (list_has_next(g.to) == 1)
 	{
 		String *rcpt = list_next(g.to);
 		debug((1, "To: %s", cstr(rcpt)))
 	}
 
-	while (list_has_next(g.cc))
+	while (list_has_next(g.cc) == 1)
 	{
 		String *rcpt = list_next(g.cc);
 		debug((1, "Cc: %s", cstr(rcpt)))
 	}
 
-	while (list_has_next(g.bcc))
+	while (list_has_next(g.bcc) == 1)
 	{
 		String *rcpt = list_next(g.bcc);
 		debug((1, "Bcc: %s", cstr(rcpt)))
@@ -1048,7 +1528,7 @@ void show_config()
 
 	debug((1, "Date: %s", (g.gmtime) ? "gmtime" : (g.localtime) ? "localtime" : "none"))
 
-	while (list_has_next(g.headers))
+	while (list_has_next(g.headers) == 1)
 	{
 		String *header = list_next(g.headers);
 		debug((1, "Header: %s", cstr(header)))
@@ -1063,6 +1543,8 @@ void show_config()
 	debug((1, "SendBcc: %d", g.sendbcc))
 	debug((1, "NoHeaders: %d", g.noheaders))
 	debug((1, "Quiet: %d", g.quiet))
+	debug((1, "Trace: %s", (g.trace) ? g.trace : ""))
+	debug((1, "Stats: %s", (!g.stats) ? "no" : (g.stats_file) ? g.stats_file : "stderr"))
 }
 #endif
 
@@ -1123,9 +1605,19 @@ int main(int ac, char **av)
 	if (g.quiet)
 		prog_err_none();
 
+	if (g.trace && !prog_set_trace(trace_create_file(g.trace)))
+		fatalsys("failed to create trace file %s", g.trace);
+
 #ifndef NDEBUG
 	if (prog_debug_level() >= 1)
+	{
+		/* Keep debug output off the SMTP conversation's critical path */
+
+		if (!prog_set_dbg(msg_create_async(msg_create_stderr(), 65536)))
+			fatalsys("failed to create asynchronous debug messages");
+
 		show_config();
+	}
 #endif
 
 	if (launchmail() == -1)
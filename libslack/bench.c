@@ -0,0 +1,680 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+/*
+
+Microbenchmarks for libslack: times a fixed workload for each of a set of
+commonly used functions and prints, for each one, the median time per
+operation over several runs and the number of heap allocations per
+operation.
+
+    usage: bench [-r runs] [name...]
+
+Each benchmark runs a fixed number of operations with a fixed random seed,
+after an untimed warmup run, so that successive runs (and runs on
+different revisions) do the same work. Only the timed parts of each run
+are counted, so setup (e.g. making the data for a sort) is excluded. If
+any names are given, only the benchmarks whose names start with one of
+them are run (e.g. "bench map_ list_sort").
+
+Allocations are counted by wrapping malloc(3), calloc(3) and realloc(3).
+That needs glibc's __libc_malloc() family. Elsewhere, the allocation
+column shows "-".
+
+*/
+
+#include "config.h"
+#include "std.h"
+
+#include <time.h>
+
+#include "str.h"
+#include "list.h"
+#include "map.h"
+#include "mem.h"
+#include "hsort.h"
+#include "psort.h"
+#include "net.h"
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long allocs;
+
+void *malloc(size_t size)
+{
+	++allocs;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	++allocs;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	++allocs;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+#define COUNTING_ALLOCS 1
+#else
+static unsigned long allocs;
+#define COUNTING_ALLOCS 0
+#endif
+
+#define RUNS 5
+#define MAX_RUNS 99
+#define SEED 0x2545f4914f6cdd1dULL
+
+/* The time and allocations of the timed parts of the current run */
+
+static struct
+{
+	double start;
+	double secs;
+	unsigned long allocs_start;
+	unsigned long allocs;
+}
+timer;
+
+static unsigned long long rand_state;
+
+static double wall(void)
+{
+	struct timespec ts[1];
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+static void resume(void)
+{
+	timer.allocs_start = allocs;
+	timer.start = wall();
+}
+
+static void pause_timer(void)
+{
+	timer.secs += wall() - timer.start;
+	timer.allocs += allocs - timer.allocs_start;
+}
+
+/* xorshift64*, so the data is the same on every platform */
+
+static unsigned long long rnd(void)
+{
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+
+	return rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+	int x = *(const int *)a;
+	int y = *(const int *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int item_cmp(const void *a, const void *b)
+{
+	long x = (long)*(void * const *)a;
+	long y = (long)*(void * const *)b;
+
+	return (x > y) - (x < y);
+}
+
+static char **make_keys(size_t n)
+{
+	char **keys;
+	size_t i;
+
+	if (!(keys = malloc(n * sizeof *keys)))
+		exit(EXIT_FAILURE);
+
+	for (i = 0; i < n; ++i)
+	{
+		if (!(keys[i] = malloc(24)))
+			exit(EXIT_FAILURE);
+		snprintf(keys[i], 24, "key-%llu", rnd() % 1000000000);
+	}
+
+	return keys;
+}
+
+static void free_keys(char **keys, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		free(keys[i]);
+	free(keys);
+}
+
+/*
+
+Each benchmark performs ops operations (on data of the given size, where
+that matters), with the timer running only around the work being measured.
+
+*/
+
+/*
+
+Before Strings kept short strings inline, these measured (median of three
+-r 7 runs on one x86-64 CPU, with this file linked against each revision's
+libslack.a):
+
+    benchmark            size        ns/op    allocs/op
+    str_create              -        152.3         2.00
+    str_append             16        158.1         2.31
+    str_append           1024        137.7         2.01
+
+and just after:
+
+    str_create              -        132.3         1.00
+    str_append             16        136.6         1.28
+    str_append           1024        113.4         1.01
+
+Since then, the object caches have taken str_create down to 0.00 allocs/op.
+
+*/
+
+static void bench_str_create(size_t size, size_t ops)
+{
+	size_t i;
+
+	resume();
+	for (i = 0; i < ops; ++i)
+		str_release(str_create("%s-%d-%s", "message", (int)i, "queued"));
+	pause_timer();
+}
+
+static void bench_str_append(size_t size, size_t ops)
+{
+	String *str = NULL;
+	size_t i;
+
+	resume();
+	for (i = 0; i < ops; ++i)
+	{
+		if (i % size == 0)
+		{
+			str_release(str);
+			str = str_create("%s", "");
+		}
+
+		str_append(str, "%s=%d;", "rcpt", (int)i);
+	}
+	str_release(str);
+	pause_timer();
+}
+
+static void bench_str_join(size_t size, size_t ops)
+{
+	List *list = list_create((list_release_t *)str_release);
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		list_append(list, str_create("%s", (i & 1) ? "user@example.org" : "postmaster"));
+
+	resume();
+	for (i = 0; i < ops; ++i)
+		str_release(str_join(list, ", "));
+	pause_timer();
+
+	list_release(list);
+}
+
+static void bench_str_fmt(size_t size, size_t ops)
+{
+	String *text = str_create("%s", "");
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		str_append(text, "%.*s ", (int)(1 + rnd() % 10), "abcdefghij");
+
+	resume();
+	for (i = 0; i < ops; ++i)
+		list_release(str_fmt(text, 72, ALIGN_FULL));
+	pause_timer();
+
+	str_release(text);
+}
+
+static void bench_regexpr_split(size_t size, size_t ops)
+{
+	String *text = str_create("%s", "");
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		str_append(text, "%sfield%d", i ? " ,  " : "", (int)i);
+
+	resume();
+	for (i = 0; i < ops; ++i)
+		list_release(regexpr_split(cstr(text), " *, *", REG_EXTENDED, 0));
+	pause_timer();
+
+	str_release(text);
+}
+
+static void bench_list_append(size_t size, size_t ops)
+{
+	List *list = NULL;
+	size_t i;
+
+	resume();
+	for (i = 0; i < ops; ++i)
+	{
+		if (i % size == 0)
+		{
+			list_release(list);
+			list = list_create(NULL);
+		}
+
+		list_append(list, (void *)i);
+	}
+	list_release(list);
+	pause_timer();
+}
+
+static void bench_list_shift(size_t size, size_t ops)
+{
+	List *list = list_create(NULL);
+	size_t i;
+
+	for (i = 0; i < ops; ++i)
+	{
+		if (i % size == 0)
+		{
+			size_t j;
+
+			for (j = 0; j < size; ++j)
+				list_append(list, (void *)j);
+			resume();
+		}
+
+		list_shift(list);
+
+		if (i % size == size - 1)
+			pause_timer();
+	}
+
+	list_release(list);
+}
+
+static void bench_list_sort(size_t size, size_t ops)
+{
+	List *list = list_create(NULL);
+	size_t i, j;
+
+	for (i = 0; i < ops; ++i)
+	{
+		list_remove_range(list, 0, -1);
+		for (j = 0; j < size; ++j)
+			list_append(list, (void *)(long)(rnd() % 1000000000));
+
+		resume();
+		list_sort(list, item_cmp);
+		pause_timer();
+	}
+
+	list_release(list);
+}
+
+static void bench_map_put(size_t size, size_t ops)
+{
+	char **keys = make_keys(size);
+	Map *map = NULL;
+	size_t i;
+
+	resume();
+	for (i = 0; i < ops; ++i)
+	{
+		if (i % size == 0)
+		{
+			map_release(map);
+			map = map_create(NULL);
+		}
+
+		map_put(map, keys[i % size], keys[i % size]);
+	}
+	map_release(map);
+	pause_timer();
+
+	free_keys(keys, size);
+}
+
+static void bench_map_get(size_t size, size_t ops)
+{
+	char **keys = make_keys(size);
+	Map *map = map_create(NULL);
+	size_t *order;
+	size_t i;
+
+	if (!(order = malloc(ops * sizeof *order)))
+		exit(EXIT_FAILURE);
+
+	for (i = 0; i < size; ++i)
+		map_put(map, keys[i], keys[i]);
+
+	for (i = 0; i < ops; ++i)
+		order[i] = rnd() % size;
+
+	resume();
+	for (i = 0; i < ops; ++i)
+		if (!map_get(map, keys[order[i]]))
+			exit(EXIT_FAILURE);
+	pause_timer();
+
+	free(order);
+	map_release(map);
+	free_keys(keys, size);
+}
+
+static int *make_ints(size_t size)
+{
+	int *ints;
+
+	if (!(ints = malloc(size * sizeof *ints)))
+		exit(EXIT_FAILURE);
+
+	return ints;
+}
+
+static void fill_ints(int *ints, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		ints[i] = (int)(rnd() % 1000000000);
+}
+
+static void bench_hsort(size_t size, size_t ops)
+{
+	int *ints = make_ints(size);
+	size_t i;
+
+	for (i = 0; i < ops; ++i)
+	{
+		fill_ints(ints, size);
+		resume();
+		hsort(ints, size, sizeof *ints, int_cmp);
+		pause_timer();
+	}
+
+	free(ints);
+}
+
+static void bench_qsort(size_t size, size_t ops)
+{
+	int *ints = make_ints(size);
+	size_t i;
+
+	for (i = 0; i < ops; ++i)
+	{
+		fill_ints(ints, size);
+		resume();
+		qsort(ints, size, sizeof *ints, int_cmp);
+		pause_timer();
+	}
+
+	free(ints);
+}
+
+static void bench_psort(size_t size, size_t ops)
+{
+	int *ints = make_ints(size);
+	size_t i;
+
+	for (i = 0; i < ops; ++i)
+	{
+		fill_ints(ints, size);
+		resume();
+		psort(ints, size, sizeof *ints, int_cmp);
+		pause_timer();
+	}
+
+	free(ints);
+}
+
+static void bench_pool_alloc(size_t size, size_t ops)
+{
+	Pool *pool = pool_create(1024 * 1024);
+	size_t used = 0;
+	size_t i;
+
+	resume();
+	for (i = 0; i < ops; ++i)
+	{
+		if (used + size > 1024 * 1024)
+		{
+			pool_clear(pool);
+			used = 0;
+		}
+
+		if (!pool_alloc(pool, size))
+			exit(EXIT_FAILURE);
+		used += size;
+	}
+	pause_timer();
+
+	pool_release(pool);
+}
+
+static void bench_malloc(size_t size, size_t ops)
+{
+	void *ptrs[256];
+	size_t i;
+
+	resume();
+	for (i = 0; i < ops; ++i)
+	{
+		if (i % 256 == 0 && i)
+		{
+			size_t j;
+
+			for (j = 0; j < 256; ++j)
+				free(ptrs[j]);
+		}
+
+		if (!(ptrs[i % 256] = malloc(size)))
+			exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < (ops - 1) % 256 + 1; ++i)
+		free(ptrs[i]);
+	pause_timer();
+}
+
+static void bench_pack(size_t size, size_t ops)
+{
+	unsigned char buf[512];
+	size_t i;
+
+	resume();
+	for (i = 0; i < ops; ++i)
+		if (pack(buf, sizeof buf, "iscz32", (int)i, 25, 'x', "recipient@example.org") == -1)
+			exit(EXIT_FAILURE);
+	pause_timer();
+}
+
+static void bench_unpack(size_t size, size_t ops)
+{
+	unsigned char buf[512];
+	char addr[32];
+	int n;
+	short port;
+	char c;
+	size_t i;
+
+	pack(buf, sizeof buf, "iscz32", 42, 25, 'x', "recipient@example.org");
+
+	resume();
+	for (i = 0; i < ops; ++i)
+		if (unpack(buf, sizeof buf, "iscz32", &n, &port, &c, addr) == -1)
+			exit(EXIT_FAILURE);
+	pause_timer();
+}
+
+/* The benchmarks, with the size (if it matters) and number of operations */
+
+static const struct
+{
+	const char *name;
+	void (*func)(size_t size, size_t ops);
+	size_t size;
+	size_t ops;
+}
+benchmarks[] =
+{
+	{ "str_create", bench_str_create, 0, 200000 },
+	{ "str_append", bench_str_append, 16, 200000 },
+	{ "str_append", bench_str_append, 1024, 200000 },
+	{ "str_join", bench_str_join, 10, 50000 },
+	{ "str_join", bench_str_join, 1000, 500 },
+	{ "str_fmt", bench_str_fmt, 100, 5000 },
+	{ "str_fmt", bench_str_fmt, 1000, 500 },
+	{ "regexpr_split", bench_regexpr_split, 10, 10000 },
+	{ "regexpr_split", bench_regexpr_split, 100, 1000 },
+	{ "list_append", bench_list_append, 16, 500000 },
+	{ "list_append", bench_list_append, 10000, 500000 },
+	{ "list_shift", bench_list_shift, 16, 500000 },
+	{ "list_shift", bench_list_shift, 10000, 500000 },
+	{ "list_sort", bench_list_sort, 100, 2000 },
+	{ "list_sort", bench_list_sort, 100000, 5 },
+	{ "map_put", bench_map_put, 10, 200000 },
+	{ "map_put", bench_map_put, 1000, 200000 },
+	{ "map_put", bench_map_put, 100000, 200000 },
+	{ "map_get", bench_map_get, 10, 500000 },
+	{ "map_get", bench_map_get, 1000, 500000 },
+	{ "map_get", bench_map_get, 100000, 500000 },
+	{ "hsort", bench_hsort, 100, 2000 },
+	{ "hsort", bench_hsort, 100000, 5 },
+	{ "qsort", bench_qsort, 100, 2000 },
+	{ "qsort", bench_qsort, 100000, 5 },
+	{ "psort", bench_psort, 100, 2000 },
+	{ "psort", bench_psort, 100000, 5 },
+	{ "pool_alloc", bench_pool_alloc, 16, 1000000 },
+	{ "pool_alloc", bench_pool_alloc, 256, 1000000 },
+	{ "malloc", bench_malloc, 16, 1000000 },
+	{ "malloc", bench_malloc, 256, 1000000 },
+	{ "pack", bench_pack, 0, 500000 },
+	{ "unpack", bench_unpack, 0, 500000 },
+	{ NULL, NULL, 0, 0 }
+};
+
+static int selected(const char *name, int ac, char **av)
+{
+	int i;
+
+	if (ac == 0)
+		return 1;
+
+	for (i = 0; i < ac; ++i)
+		if (!strncmp(name, av[i], strlen(av[i])))
+			return 1;
+
+	return 0;
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int ac, char **av)
+{
+	double ns[MAX_RUNS];
+	double per_op[MAX_RUNS];
+	int runs = RUNS;
+	int b, r;
+
+	if (ac > 2 && !strcmp(av[1], "-r"))
+	{
+		runs = atoi(av[2]);
+		ac -= 2;
+		av += 2;
+	}
+
+	if (runs < 1 || runs > MAX_RUNS || (ac > 1 && av[1][0] == '-'))
+	{
+		fprintf(stderr, "usage: bench [-r runs] [name...]\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-16s %8s %12s %12s\n", "benchmark", "size", "ns/op", "allocs/op");
+
+	for (b = 0; benchmarks[b].name; ++b)
+	{
+		size_t ops = benchmarks[b].ops;
+
+		if (!selected(benchmarks[b].name, ac - 1, av + 1))
+			continue;
+
+		rand_state = SEED;
+		memset(&timer, 0, sizeof timer);
+		benchmarks[b].func(benchmarks[b].size, ops);
+
+		for (r = 0; r < runs; ++r)
+		{
+			rand_state = SEED;
+			memset(&timer, 0, sizeof timer);
+			benchmarks[b].func(benchmarks[b].size, ops);
+			ns[r] = timer.secs * 1e9 / ops;
+			per_op[r] = (double)timer.allocs / ops;
+		}
+
+		qsort(ns, runs, sizeof *ns, double_cmp);
+
+		if (benchmarks[b].size)
+			printf("%-16s %8lu %12.1f ", benchmarks[b].name, (unsigned long)benchmarks[b].size, ns[runs / 2]);
+		else
+			printf("%-16s %8s %12.1f ", benchmarks[b].name, "-", ns[runs / 2]);
+
+		if (COUNTING_ALLOCS)
+			printf("%12.2f\n", per_op[0]);
+		else
+			printf("%12s\n", "-");
+
+		fflush(stdout);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,1218 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<libslack(cache)> - object cache module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/cache.h>
+
+    typedef struct Cache Cache;
+
+    Cache *cache_create(size_t size);
+    void cache_release(Cache *cache);
+    void *cache_destroy(Cache **cache);
+    void *cache_alloc(Cache *cache);
+    int cache_free(Cache *cache, void *item);
+    size_t cache_size(const Cache *cache);
+    Cache *cache_class(size_t size);
+
+=head1 DESCRIPTION
+
+This module provides object caches: allocators for many objects of the same
+size that are allocated and deallocated over and over again (e.g. list
+iterators and string headers). Deallocated objects are kept on I<link(3)>
+free lists and handed out again by the next allocation, so after a warm up
+period, objects are recycled without calling I<malloc(3)> or I<free(3)>.
+
+Each thread has its own I<magazine> for each cache: a free list of up to
+C<32> objects, and a full spare free list of C<32> objects. Threads allocate
+from and deallocate to their own magazine without locking anything. Only
+when a thread's magazine runs out, or overflows, does it lock the cache to
+exchange a whole batch of C<32> objects with the cache's shared I<depot>.
+When the depot is empty, the cache grows by allocating a I<slab> of memory
+and carving it up into batches of objects. Each slab is twice as large as
+the last, up to C<1024> objects. Slabs are only deallocated when the cache
+is released. When a thread exits, the objects in its magazines are returned
+to the depot.
+
+The objects in a cache are aligned for any type. The first pointer-sized
+bytes of each object are used as the free list link while it is
+deallocated, and the second pointer-sized bytes are used as the link
+between batches of objects in the depot. Objects must not be used after they
+have been returned to the cache.
+
+Threads can have magazines for up to C<64> caches at a time (including the
+size class caches). Any further caches share a single magazine which is
+protected by a mutex. If the compiler doesn't support thread-local storage,
+all caches work that way.
+
+Size class caches of objects up to C<256> bytes (in multiples of C<16>
+bytes) are available with I<cache_class(3)>. They are created when they are
+first needed and last until the process exits. They can be shared by
+modules that need to allocate small objects of a fixed size.
+
+=over 4
+
+=cut
+
+*/
+
+#include "config.h"
+#include "std.h"
+
+#include "cache.h"
+#include "link.h"
+#include "mem.h"
+#include "err.h"
+
+typedef struct CacheBatch CacheBatch;
+typedef struct CacheMagazine CacheMagazine;
+typedef struct CacheSlab CacheSlab;
+
+/* Number of objects in each batch exchanged with the depot */
+
+#define CACHE_BATCH 32
+
+/* Maximum number of batches in each slab */
+
+#define CACHE_GROW_MAX 32
+
+/* Number of caches that each thread can have its own magazine for */
+
+#ifndef CACHE_SLOTS
+#define CACHE_SLOTS 64
+#endif
+
+/* Size classes */
+
+#define CACHE_CLASS_STEP 16
+#define CACHE_CLASS_MAX 256
+#define CACHE_CLASSES (CACHE_CLASS_MAX / CACHE_CLASS_STEP)
+
+/* Alignment of objects */
+
+#define CACHE_ALIGN sizeof(union { long l; double d; long double ld; void *p; void (*f)(void); })
+#define cache_align(size) (((size) + CACHE_ALIGN - 1) & ~(CACHE_ALIGN - 1))
+#define CACHE_HEADER cache_align(sizeof(CacheSlab))
+
+/*
+** Each thread has its own magazines when the compiler supports
+** thread-local storage.
+*/
+
+#if defined(__GNUC__) && !defined(NO_CACHE_MAGAZINES)
+#define CACHE_MAGAZINES
+#endif
+
+struct CacheBatch
+{
+	void *next;                   /* the second object in the batch (it's an slink_t list) */
+	CacheBatch *batch;            /* the next batch in the depot */
+};
+
+struct CacheMagazine
+{
+	unsigned long generation;     /* the generation of the cache that the objects belong to */
+	void *loaded;                 /* the free list to allocate from */
+	size_t count;                 /* number of objects in loaded */
+	void *spare;                  /* a full batch of objects, or null */
+};
+
+struct CacheSlab
+{
+	CacheSlab *next;              /* the previously allocated slab */
+	size_t objects;               /* number of objects in this slab */
+};
+
+struct Cache
+{
+	size_t size;                  /* size of each object (aligned) */
+	int slot;                     /* index of each thread's magazine for this cache, or -1 */
+	unsigned long generation;     /* distinguishes this cache from earlier caches in the same slot */
+	pthread_mutex_t lock;         /* mutex lock for the depot and slabs */
+	CacheBatch *full;             /* depot of full batches */
+	void *loose;                  /* depot of objects that don't make a full batch */
+	size_t loose_count;           /* number of objects in loose */
+	CacheSlab *slab;              /* the slabs that objects are carved from */
+	size_t grow;                  /* number of batches in the next slab */
+	pthread_mutex_t shared_lock;  /* mutex lock for the shared magazine */
+	CacheMagazine shared;         /* magazine for threads without their own */
+};
+
+#ifndef TEST
+
+static struct
+{
+	pthread_mutex_t lock;         /* mutex lock for the slots and generations */
+	Cache *slot[CACHE_SLOTS];     /* the caches that have magazines in each thread */
+	unsigned long generation;     /* the most recent cache generation */
+	pthread_mutex_t class_lock;   /* mutex lock for creating size class caches */
+	Cache *class[CACHE_CLASSES];  /* the size class caches */
+	pthread_once_t once;          /* for creating key */
+	pthread_key_t key;            /* for flushing magazines when threads exit */
+	int keyed;                    /* whether or not key was created */
+}
+g = { PTHREAD_MUTEX_INITIALIZER, { NULL }, 0, PTHREAD_MUTEX_INITIALIZER, { NULL }, PTHREAD_ONCE_INIT };
+
+#ifdef CACHE_MAGAZINES
+
+static __thread CacheMagazine cache_magazine[CACHE_SLOTS];
+static __thread int cache_thread_keyed;
+
+#endif
+
+/*
+
+=item C<Cache *cache_create(size_t size)>
+
+Creates a cache of objects that are C<size> bytes in size. It is the
+caller's responsibility to deallocate the new cache with
+I<cache_release(3)> or I<cache_destroy(3)>. On success, returns the new
+cache. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Cache *cache_create(size_t size)
+{
+	Cache *cache;
+	int err, slot;
+
+	if (!size || size > ((size_t)-1 - CACHE_HEADER) / (CACHE_BATCH * CACHE_GROW_MAX) - CACHE_ALIGN)
+		return set_errnull(EINVAL);
+
+	if (!(cache = mem_new(Cache)))
+		return NULL;
+
+	memset(cache, 0, sizeof(Cache));
+	cache->size = cache_align((size < sizeof(CacheBatch)) ? sizeof(CacheBatch) : size);
+	cache->grow = 1;
+	cache->slot = -1;
+
+	if ((err = pthread_mutex_init(&cache->lock, NULL)))
+	{
+		mem_release(cache);
+		return set_errnull(err);
+	}
+
+	if ((err = pthread_mutex_init(&cache->shared_lock, NULL)))
+	{
+		pthread_mutex_destroy(&cache->lock);
+		mem_release(cache);
+		return set_errnull(err);
+	}
+
+	if ((err = pthread_mutex_lock(&g.lock)))
+	{
+		cache_release(cache);
+		return set_errnull(err);
+	}
+
+	cache->generation = ++g.generation;
+
+#ifdef CACHE_MAGAZINES
+	for (slot = 0; slot < CACHE_SLOTS; ++slot)
+	{
+		if (!g.slot[slot])
+		{
+			g.slot[slot] = cache;
+			cache->slot = slot;
+			break;
+		}
+	}
+#endif
+
+	pthread_mutex_unlock(&g.lock);
+
+	return cache;
+}
+
+/*
+
+=item C<void cache_release(Cache *cache)>
+
+Releases (deallocates) C<cache> and all of the memory that its objects were
+allocated from, including objects that have not been returned to it.
+
+=cut
+
+*/
+
+void cache_release(Cache *cache)
+{
+	CacheSlab *slab;
+
+	if (!cache)
+		return;
+
+	if (cache->slot != -1 && !pthread_mutex_lock(&g.lock))
+	{
+		g.slot[cache->slot] = NULL;
+		pthread_mutex_unlock(&g.lock);
+	}
+
+	while ((slab = cache->slab))
+	{
+		cache->slab = slab->next;
+		mem_release(slab);
+	}
+
+	pthread_mutex_destroy(&cache->shared_lock);
+	pthread_mutex_destroy(&cache->lock);
+	mem_release(cache);
+}
+
+/*
+
+=item C<void *cache_destroy(Cache **cache)>
+
+Destroys (deallocates and sets to C<null>) C<*cache>. Returns C<null>.
+
+=cut
+
+*/
+
+void *cache_destroy(Cache **cache)
+{
+	if (cache && *cache)
+	{
+		cache_release(*cache);
+		*cache = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+C<static void cache_depot_batch(Cache *cache, void *batch)>
+
+Adds a full C<batch> of objects to C<cache>'s depot. C<cache> must be
+locked.
+
+*/
+
+static void cache_depot_batch(Cache *cache, void *batch)
+{
+	((CacheBatch *)batch)->batch = cache->full;
+	cache->full = batch;
+}
+
+/*
+
+C<static void cache_depot_loose(Cache *cache, void *item)>
+
+Adds the object C<item> to C<cache>'s depot. C<cache> must be locked.
+
+*/
+
+static void cache_depot_loose(Cache *cache, void *item)
+{
+	slink_free(&cache->loose, item);
+
+	if (++cache->loose_count == CACHE_BATCH)
+	{
+		cache_depot_batch(cache, cache->loose);
+		cache->loose = NULL;
+		cache->loose_count = 0;
+	}
+}
+
+/*
+
+C<static int cache_grow(Cache *cache)>
+
+Allocates a new slab for C<cache>, and adds its objects to the depot in
+batches. Each slab has twice as many batches as the last, up to
+C<CACHE_GROW_MAX>. C<cache> must be locked. On success, returns C<0>. On
+error, returns C<-1> with C<errno> set appropriately.
+
+*/
+
+static int cache_grow(Cache *cache)
+{
+	size_t batch_size = CACHE_BATCH * cache->size;
+	CacheSlab *slab;
+	char *objects;
+	size_t i;
+
+	if (!(slab = mem_create(CACHE_HEADER + cache->grow * batch_size, char)))
+		return -1;
+
+	slab->next = cache->slab;
+	slab->objects = cache->grow * CACHE_BATCH;
+	cache->slab = slab;
+	objects = (char *)slab + CACHE_HEADER;
+
+	for (i = 0; i < cache->grow; ++i)
+		cache_depot_batch(cache, slink_freelist_init(objects + i * batch_size, CACHE_BATCH, cache->size));
+
+	if (cache->grow < CACHE_GROW_MAX)
+		cache->grow <<= 1;
+
+	return 0;
+}
+
+/*
+
+C<static int cache_reload(Cache *cache, CacheMagazine *magazine)>
+
+Refills the empty C<magazine> with its spare batch, or with a batch of
+objects from C<cache>'s depot, growing the cache if the depot is empty. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+*/
+
+static int cache_reload(Cache *cache, CacheMagazine *magazine)
+{
+	int err;
+
+	if (magazine->spare)
+	{
+		magazine->loaded = magazine->spare;
+		magazine->count = CACHE_BATCH;
+		magazine->spare = NULL;
+
+		return 0;
+	}
+
+	if ((err = pthread_mutex_lock(&cache->lock)))
+		return set_errno(err);
+
+	if (!cache->full && !cache->loose && cache_grow(cache) == -1)
+	{
+		pthread_mutex_unlock(&cache->lock);
+		return -1;
+	}
+
+	if (cache->full)
+	{
+		magazine->loaded = cache->full;
+		magazine->count = CACHE_BATCH;
+		cache->full = cache->full->batch;
+	}
+	else
+	{
+		magazine->loaded = cache->loose;
+		magazine->count = cache->loose_count;
+		cache->loose = NULL;
+		cache->loose_count = 0;
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+
+	return 0;
+}
+
+/*
+
+C<static int cache_unload(Cache *cache, CacheMagazine *magazine)>
+
+Empties the full C<magazine> by making its objects the spare batch, after
+returning any existing spare batch to C<cache>'s depot. On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately.
+
+*/
+
+static int cache_unload(Cache *cache, CacheMagazine *magazine)
+{
+	int err;
+
+	if (magazine->spare)
+	{
+		if ((err = pthread_mutex_lock(&cache->lock)))
+			return set_errno(err);
+
+		cache_depot_batch(cache, magazine->spare);
+		pthread_mutex_unlock(&cache->lock);
+	}
+
+	magazine->spare = magazine->loaded;
+	magazine->loaded = NULL;
+	magazine->count = 0;
+
+	return 0;
+}
+
+#ifdef CACHE_MAGAZINES
+
+/*
+
+C<static void cache_thread_exit(void *arg)>
+
+Returns the objects in an exiting thread's magazines to the depots of the
+caches that they belong to (unless the caches have since been released).
+
+*/
+
+static void cache_thread_exit(void *arg)
+{
+	CacheMagazine *magazine = arg;
+	Cache *cache;
+	void *item;
+	int slot;
+
+	if (pthread_mutex_lock(&g.lock))
+		return;
+
+	for (slot = 0; slot < CACHE_SLOTS; ++slot, ++magazine)
+	{
+		if (!(cache = g.slot[slot]) || cache->generation != magazine->generation)
+			continue;
+
+		if (pthread_mutex_lock(&cache->lock))
+			continue;
+
+		if (magazine->spare)
+			cache_depot_batch(cache, magazine->spare);
+
+		while ((item = magazine->loaded))
+		{
+			magazine->loaded = slink_next(item);
+			cache_depot_loose(cache, item);
+		}
+
+		pthread_mutex_unlock(&cache->lock);
+		magazine->generation = 0;
+	}
+
+	pthread_mutex_unlock(&g.lock);
+}
+
+/*
+
+C<static void cache_thread_init(void)>
+
+Creates the key whose destructor flushes each thread's magazines when it
+exits.
+
+*/
+
+static void cache_thread_init(void)
+{
+	g.keyed = (pthread_key_create(&g.key, cache_thread_exit) == 0);
+}
+
+/*
+
+C<static CacheMagazine *cache_thread_magazine(Cache *cache)>
+
+Returns the calling thread's magazine for C<cache>. If the magazine belongs
+to an earlier cache that used the same slot, it is emptied first (the
+objects in it were deallocated along with that cache).
+
+*/
+
+static CacheMagazine *cache_thread_magazine(Cache *cache)
+{
+	CacheMagazine *magazine = cache_magazine + cache->slot;
+
+	if (magazine->generation != cache->generation)
+	{
+		if (!cache_thread_keyed)
+		{
+			pthread_once(&g.once, cache_thread_init);
+
+			if (g.keyed)
+				pthread_setspecific(g.key, cache_magazine);
+
+			cache_thread_keyed = 1;
+		}
+
+		magazine->generation = cache->generation;
+		magazine->loaded = NULL;
+		magazine->count = 0;
+		magazine->spare = NULL;
+	}
+
+	return magazine;
+}
+
+#endif
+
+/*
+
+=item C<void *cache_alloc(Cache *cache)>
+
+Allocates an object from C<cache>. The object is not initialised. It is the
+caller's responsibility to return the object to the cache with
+I<cache_free(3)>. On success, returns the object. On error, returns C<null>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+void *cache_alloc(Cache *cache)
+{
+	void *item;
+	int err;
+
+	if (!cache)
+		return set_errnull(EINVAL);
+
+#ifdef CACHE_MAGAZINES
+	if (cache->slot != -1)
+	{
+		CacheMagazine *magazine = cache_thread_magazine(cache);
+
+		if (!magazine->count && cache_reload(cache, magazine) == -1)
+			return NULL;
+
+		--magazine->count;
+
+		return slink_alloc(&magazine->loaded);
+	}
+#endif
+
+	if ((err = pthread_mutex_lock(&cache->shared_lock)))
+		return set_errnull(err);
+
+	item = NULL;
+
+	if (cache->shared.count || cache_reload(cache, &cache->shared) != -1)
+	{
+		--cache->shared.count;
+		item = slink_alloc(&cache->shared.loaded);
+	}
+
+	pthread_mutex_unlock(&cache->shared_lock);
+
+	return item;
+}
+
+/*
+
+=item C<int cache_free(Cache *cache, void *item)>
+
+Returns C<item> to C<cache> so that it can be allocated again. C<item> must
+have been allocated from C<cache> with I<cache_alloc(3)>. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int cache_free(Cache *cache, void *item)
+{
+	int err;
+
+	if (!cache || !item)
+		return set_errno(EINVAL);
+
+#ifdef CACHE_MAGAZINES
+	if (cache->slot != -1)
+	{
+		CacheMagazine *magazine = cache_thread_magazine(cache);
+
+		if (magazine->count == CACHE_BATCH && cache_unload(cache, magazine) == -1)
+			return -1;
+
+		slink_free(&magazine->loaded, item);
+		++magazine->count;
+
+		return 0;
+	}
+#endif
+
+	if ((err = pthread_mutex_lock(&cache->shared_lock)))
+		return set_errno(err);
+
+	if (cache->shared.count == CACHE_BATCH && cache_unload(cache, &cache->shared) == -1)
+	{
+		pthread_mutex_unlock(&cache->shared_lock);
+		return -1;
+	}
+
+	slink_free(&cache->shared.loaded, item);
+	++cache->shared.count;
+	pthread_mutex_unlock(&cache->shared_lock);
+
+	return 0;
+}
+
+/*
+
+=item C<size_t cache_size(const Cache *cache)>
+
+Returns the size of the objects in C<cache>. This is the size that it was
+created with, rounded up to a multiple of the alignment of objects (and
+large enough for two pointers). On error, returns C<0> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+size_t cache_size(const Cache *cache)
+{
+	if (!cache)
+	{
+		errno = EINVAL;
+		return 0;
+	}
+
+	return cache->size;
+}
+
+/*
+
+=item C<Cache *cache_class(size_t size)>
+
+Returns the shared size class cache for objects of C<size> bytes. C<size>
+must be no greater than C<256>. The size class caches are created when they
+are first needed, and must not be released. On success, returns the cache.
+On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Cache *cache_class(size_t size)
+{
+	Cache *cache;
+	size_t class;
+	int err;
+
+	if (!size || size > CACHE_CLASS_MAX)
+		return set_errnull(EINVAL);
+
+	class = (size - 1) / CACHE_CLASS_STEP;
+
+#ifdef __GNUC__
+	if ((cache = __atomic_load_n(g.class + class, __ATOMIC_ACQUIRE)))
+		return cache;
+#endif
+
+	if ((err = pthread_mutex_lock(&g.class_lock)))
+		return set_errnull(err);
+
+	if (!(cache = g.class[class]) && (cache = cache_create((class + 1) * CACHE_CLASS_STEP)))
+	{
+#ifdef __GNUC__
+		__atomic_store_n(g.class + class, cache, __ATOMIC_RELEASE);
+#else
+		g.class[class] = cache;
+#endif
+	}
+
+	pthread_mutex_unlock(&g.class_lock);
+
+	return cache;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments are C<null> or out of range.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Safe>
+
+=head1 EXAMPLES
+
+Recycling the nodes of a linked list:
+
+    #include <slack/std.h>
+    #include <slack/cache.h>
+
+    typedef struct Node Node;
+
+    struct Node
+    {
+        Node *next;
+        int value;
+    };
+
+    int main()
+    {
+        Cache *cache;
+        Node *list = NULL, *node;
+        int i, j;
+
+        if (!(cache = cache_create(sizeof(Node))))
+            return EXIT_FAILURE;
+
+        for (i = 0; i < 1000; ++i)
+        {
+            for (j = 0; j < 100; ++j)
+            {
+                if (!(node = cache_alloc(cache)))
+                    return EXIT_FAILURE;
+
+                node->value = j;
+                node->next = list;
+                list = node;
+            }
+
+            while ((node = list))
+            {
+                list = node->next;
+                cache_free(cache, node);
+            }
+        }
+
+        cache_destroy(&cache);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<link(3)>,
+I<mem(3)>
+
+=head1 AUTHOR
+
+20230330 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#include <time.h>
+
+#define TEST_THREADS 4
+#define TEST_ITEMS 1000
+#define TEST_ROUNDS 1000
+
+typedef struct TestThread TestThread;
+
+struct TestThread
+{
+	Cache *cache;                 /* the cache to allocate from, or null for malloc */
+	long id;                      /* thread number */
+	long items;                   /* number of objects to hold at once */
+	long rounds;                  /* number of times to allocate and deallocate them */
+	int errors;                   /* number of errors */
+};
+
+/* Returns the number of objects in the slabs of cache */
+
+static long slab_objects(Cache *cache)
+{
+	CacheSlab *slab;
+	long objects = 0;
+
+	for (slab = cache->slab; slab; slab = slab->next)
+		objects += slab->objects;
+
+	return objects;
+}
+
+/* Returns the number of objects in the depot of cache */
+
+static long depot_objects(Cache *cache)
+{
+	CacheBatch *batch;
+	long objects = cache->loose_count;
+
+	for (batch = cache->full; batch; batch = batch->batch)
+		objects += CACHE_BATCH;
+
+	return objects;
+}
+
+/* Returns whether or not item was carved from one of the slabs of cache */
+
+static int in_slab(Cache *cache, void *item)
+{
+	CacheSlab *slab;
+
+	for (slab = cache->slab; slab; slab = slab->next)
+	{
+		char *objects = (char *)slab + CACHE_HEADER;
+
+		if ((char *)item >= objects && (char *)item < objects + slab->objects * cache->size)
+			return ((char *)item - objects) % cache->size == 0;
+	}
+
+	return 0;
+}
+
+/*
+
+Allocates and deallocates test->items objects test->rounds times, in a
+different order each round, checking that no other thread writes to them in
+the meantime.
+
+*/
+
+static void *churn(void *arg)
+{
+	TestThread *test = arg;
+	long **items;
+	long i, j, round;
+
+	if (!(items = malloc(test->items * sizeof(long *))))
+	{
+		++test->errors;
+		return NULL;
+	}
+
+	for (round = 0; round < test->rounds; ++round)
+	{
+		for (i = 0; i < test->items; ++i)
+		{
+			if (!(items[i] = (test->cache) ? cache_alloc(test->cache) : malloc(sizeof(long) * 2)))
+			{
+				++test->errors;
+				test->items = i;
+				break;
+			}
+
+			items[i][0] = test->id;
+			items[i][1] = i;
+		}
+
+		for (i = 0; i < test->items; ++i)
+		{
+			j = (i * 7 + round) % test->items;
+
+			if (items[j][0] != test->id || items[j][1] != j)
+				++test->errors;
+		}
+
+		for (i = 0; i < test->items; ++i)
+		{
+			j = (round & 1) ? i : test->items - 1 - i;
+
+			if (test->cache)
+			{
+				if (cache_free(test->cache, items[j]) == -1)
+					++test->errors;
+			}
+			else
+				free(items[j]);
+		}
+	}
+
+	free(items);
+
+	return NULL;
+}
+
+/* Runs churn() in threads and returns the elapsed time in seconds */
+
+static double run(Cache *cache, int threads, long items, long rounds, int *errors)
+{
+	pthread_t id[TEST_THREADS];
+	TestThread test[TEST_THREADS];
+	struct timespec start[1], end[1];
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, start);
+
+	for (i = 0; i < threads; ++i)
+	{
+		test[i].cache = cache;
+		test[i].id = i;
+		test[i].items = items;
+		test[i].rounds = rounds;
+		test[i].errors = 0;
+		pthread_create(id + i, NULL, churn, test + i);
+	}
+
+	for (i = 0; i < threads; ++i)
+	{
+		pthread_join(id[i], NULL);
+		*errors += test[i].errors;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, end);
+
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+
+Compares the throughput of cache_alloc()/cache_free() with malloc()/free()
+for 16 byte objects, holding 1 and 1000 objects at a time, in 1 and 4
+threads.
+
+*/
+
+static void bench(void)
+{
+	static const long sizes[] = { 1, TEST_ITEMS };
+	Cache *cache;
+	int threads, errors = 0;
+	size_t i;
+
+	printf("%7s %7s %10s %10s (Mops/s, allocations and deallocations)\n", "threads", "held", "malloc", "cache");
+
+	for (threads = 1; threads <= TEST_THREADS; threads *= TEST_THREADS)
+	{
+		for (i = 0; i < sizeof sizes / sizeof *sizes; ++i)
+		{
+			long rounds = TEST_ROUNDS * 1000 / sizes[i];
+			double secs[2];
+
+			secs[0] = run(NULL, threads, sizes[i], rounds, &errors);
+			cache = cache_create(sizeof(long) * 2);
+			secs[1] = run(cache, threads, sizes[i], rounds, &errors);
+			cache_destroy(&cache);
+
+			printf("%7d %7ld %10.2f %10.2f\n", threads, sizes[i], 2 * threads * sizes[i] * rounds / secs[0] / 1e6, 2 * threads * sizes[i] * rounds / secs[1] / 1e6);
+		}
+	}
+
+	if (errors)
+		printf("%d errors\n", errors);
+
+	exit((errors) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static int ptr_cmp(const void *a, const void *b)
+{
+	const char *pa = *(char * const *)a, *pb = *(char * const *)b;
+
+	return (pa < pb) ? -1 : (pa > pb);
+}
+
+#define TEST_ACT(i, action) \
+	if (!(action)) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_INT_ACT(i, action) \
+	if ((action) == -1) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_EQ(i, action, value) \
+	if ((val = (long)(action)) != (long)(value)) \
+		++errors, printf("Test%d: %s failed (returned %ld, not %ld)\n", (i), (#action), val, (long)(value));
+
+#define TEST_ERR(i, action, err) \
+	if ((action) != -1 || errno != (err)) \
+		++errors, printf("Test%d: %s failed (errno %d, not %s)\n", (i), (#action), errno, (#err));
+
+#define TEST_ERRNULL(i, action, err) \
+	if ((action) || errno != (err)) \
+		++errors, printf("Test%d: %s failed (errno %d, not %s)\n", (i), (#action), errno, (#err));
+
+int main(int ac, char **av)
+{
+	Cache *cache, *other, *caches[CACHE_SLOTS + 2];
+	void *items[TEST_ITEMS], *item;
+	long i, val, slabbed;
+	int errors = 0, run_errors;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s [bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench();
+
+	printf("Testing: %s\n", "cache");
+
+	/* Test argument checking */
+
+	TEST_ERRNULL(1, cache_create(0), EINVAL)
+	TEST_ERRNULL(2, cache_alloc(NULL), EINVAL)
+	TEST_ERR(3, cache_free(NULL, items), EINVAL)
+	TEST_EQ(4, cache_size(NULL), 0)
+	TEST_ERRNULL(5, cache_class(0), EINVAL)
+	TEST_ERRNULL(6, cache_class(CACHE_CLASS_MAX + 1), EINVAL)
+
+	/* Test cache_create, cache_alloc, cache_free, cache_size */
+
+	TEST_ACT(7, cache = cache_create(1))
+	else
+	{
+		TEST_EQ(8, cache_size(cache), CACHE_ALIGN)
+		TEST_ERR(9, cache_free(cache, NULL), EINVAL)
+
+		for (i = 0; i < TEST_ITEMS; ++i)
+		{
+			TEST_ACT(10, items[i] = cache_alloc(cache))
+			else
+			{
+				if ((size_t)items[i] % CACHE_ALIGN)
+					++errors, printf("Test11: cache_alloc() returned %p (misaligned)\n", items[i]);
+
+				if (!in_slab(cache, items[i]))
+					++errors, printf("Test12: cache_alloc() returned %p (not in a slab)\n", items[i]);
+
+				memset(items[i], (int)i, CACHE_ALIGN);
+			}
+		}
+
+		qsort(items, TEST_ITEMS, sizeof *items, ptr_cmp);
+
+		for (i = 1; i < TEST_ITEMS; ++i)
+			if (items[i] == items[i - 1])
+				++errors, printf("Test13: cache_alloc() returned %p twice\n", items[i]);
+
+		/* The cache grows by doubling, so it holds less than twice what was needed */
+
+		slabbed = slab_objects(cache);
+		if (slabbed < TEST_ITEMS || slabbed >= 2 * TEST_ITEMS + CACHE_BATCH)
+			++errors, printf("Test14: slab_objects() returned %ld (expected %d..%d)\n", slabbed, TEST_ITEMS, 2 * TEST_ITEMS + CACHE_BATCH - 1);
+
+		for (i = 0; i < TEST_ITEMS; ++i)
+			TEST_INT_ACT(15, cache_free(cache, items[i]))
+
+		/* Deallocated objects are recycled without growing the cache */
+
+		for (i = 0; i < TEST_ITEMS; ++i)
+			TEST_ACT(16, items[i] = cache_alloc(cache))
+
+		TEST_EQ(17, slab_objects(cache), slabbed)
+
+		/* Everything else is in the depot, apart from what's in the thread's magazine */
+
+		TEST_EQ(18, depot_objects(cache) <= slabbed - TEST_ITEMS && depot_objects(cache) >= slabbed - TEST_ITEMS - 2 * CACHE_BATCH, 1)
+
+		for (i = 0; i < TEST_ITEMS; ++i)
+			TEST_INT_ACT(19, cache_free(cache, items[i]))
+
+		/* At most a loaded magazine and a spare batch stay with the thread */
+
+		TEST_EQ(20, depot_objects(cache) >= slabbed - 2 * CACHE_BATCH, 1)
+
+		cache_destroy(&cache);
+		TEST_EQ(21, cache, NULL)
+	}
+
+	/* Test cache_class */
+
+	TEST_ACT(22, cache = cache_class(1))
+	TEST_EQ(23, cache_class(CACHE_CLASS_STEP), cache)
+	TEST_ACT(24, other = cache_class(CACHE_CLASS_STEP + 1))
+	TEST_EQ(25, other != cache, 1)
+	TEST_EQ(26, cache_size(other), 2 * CACHE_CLASS_STEP)
+	TEST_EQ(27, cache_size(cache_class(CACHE_CLASS_MAX)), CACHE_CLASS_MAX)
+
+	TEST_ACT(28, item = cache_alloc(other))
+	else
+	{
+		TEST_EQ(29, in_slab(other, item), 1)
+		TEST_INT_ACT(30, cache_free(other, item))
+	}
+
+	/* Test that a cache that reuses a slot doesn't get the old cache's objects */
+
+	TEST_ACT(31, cache = cache_create(sizeof(long)))
+	else
+	{
+		int slot = cache->slot;
+
+		for (i = 0; i < 10; ++i)
+			TEST_ACT(32, items[i] = cache_alloc(cache))
+
+		for (i = 0; i < 10; ++i)
+			TEST_INT_ACT(32, cache_free(cache, items[i]))
+
+		cache_destroy(&cache);
+
+		TEST_ACT(33, cache = cache_create(sizeof(long)))
+		else
+		{
+			TEST_EQ(34, cache->slot, slot)
+			TEST_ACT(35, item = cache_alloc(cache))
+			else
+			{
+				TEST_EQ(35, in_slab(cache, item), 1)
+				TEST_INT_ACT(35, cache_free(cache, item))
+			}
+
+			cache_destroy(&cache);
+		}
+	}
+
+	/* Test caches without a slot (using the shared magazine) */
+
+	for (i = 0; i < CACHE_SLOTS + 2; ++i)
+		TEST_ACT(36, caches[i] = cache_create(sizeof(long)))
+
+	TEST_EQ(37, caches[CACHE_SLOTS + 1] && caches[CACHE_SLOTS + 1]->slot == -1, 1)
+
+	if ((cache = caches[CACHE_SLOTS + 1]))
+	{
+		for (i = 0; i < TEST_ITEMS; ++i)
+			TEST_ACT(38, items[i] = cache_alloc(cache))
+
+		for (i = 0; i < TEST_ITEMS; ++i)
+			TEST_INT_ACT(39, cache_free(cache, items[i]))
+
+		slabbed = slab_objects(cache);
+		TEST_EQ(40, depot_objects(cache) + cache->shared.count + ((cache->shared.spare) ? CACHE_BATCH : 0), slabbed)
+
+		run_errors = 0;
+		run(cache, TEST_THREADS, TEST_ITEMS, 100, &run_errors);
+		TEST_EQ(41, run_errors, 0)
+	}
+
+	for (i = 0; i < CACHE_SLOTS + 2; ++i)
+		cache_destroy(&caches[i]);
+
+	/* Test multiple threads, and that exiting threads return their objects */
+
+	TEST_ACT(42, cache = cache_create(sizeof(long) * 2))
+	else
+	{
+		run_errors = 0;
+		run(cache, TEST_THREADS, TEST_ITEMS, 100, &run_errors);
+		TEST_EQ(43, run_errors, 0)
+		TEST_EQ(44, depot_objects(cache), slab_objects(cache))
+		TEST_EQ(45, slab_objects(cache) < TEST_THREADS * (2 * TEST_ITEMS + CACHE_BATCH), 1)
+		cache_destroy(&cache);
+	}
+
+	if (errors)
+		printf("%d/45 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,1045 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<libslack(cmap)> - concurrent map module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/cmap.h>
+
+    typedef struct CMap CMap;
+
+    CMap *cmap_create(map_release_t *destroy);
+    CMap *cmap_create_sharded(size_t shards, map_release_t *destroy);
+    CMap *cmap_create_with_hash(map_hash_t *hash, map_release_t *destroy);
+    CMap *cmap_create_generic(map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
+    CMap *cmap_create_generic_sharded(size_t shards, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
+    void cmap_release(CMap *cmap);
+    void *cmap_destroy(CMap **cmap);
+    int cmap_add(CMap *cmap, const void *key, void *value);
+    int cmap_put(CMap *cmap, const void *key, void *value);
+    int cmap_insert(CMap *cmap, const void *key, void *value, int replace);
+    int cmap_remove(CMap *cmap, const void *key);
+    void *cmap_get(CMap *cmap, const void *key);
+    int cmap_lookup(CMap *cmap, const void *key, map_action_t *action, void *data);
+    void cmap_apply(CMap *cmap, map_action_t *action, void *data);
+    ssize_t cmap_size(CMap *cmap);
+
+=head1 DESCRIPTION
+
+This module provides maps that can be shared by many threads without a
+single lock becoming a point of contention. A I<CMap> divides its keys
+between a number of shards (C<64> by default). Each shard is an ordinary
+I<map(3)> with its own readers/writer lock, so threads only contend with
+each other when they use keys in the same shard, and readers of a shard
+don't exclude each other at all. The shard for a key is chosen from the high
+bits of the key's hash value (after multiplying it by a large odd
+constant), which are independent of the low bits that each shard uses to
+choose a slot. String keys are hashed with I<map_hash_string(3)>, so the
+distribution of keys between shards can't be predicted from outside the
+process.
+
+Operations on a single key are atomic. Operations that span the whole map
+(I<cmap_apply(3)> and I<cmap_size(3)>) lock one shard at a time, so they
+are not atomic with respect to concurrent updates of other shards.
+
+=over 4
+
+=cut
+
+*/
+
+#include "config.h"
+#include "std.h"
+
+#include "cmap.h"
+#include "mem.h"
+#include "err.h"
+#include "locker.h"
+
+typedef struct CMapShard CMapShard;
+
+struct CMapShard
+{
+	pthread_rwlock_t lock;        /* readers/writer lock for map */
+	Locker *locker;               /* locker for lock */
+	Map *map;                     /* the mappings in this shard */
+	char pad[64];                 /* keep other shards' locks off this cache line */
+};
+
+struct CMap
+{
+	size_t shards;                /* number of shards (a power of two) */
+	map_hash_t *hash;             /* hash function for choosing a shard */
+	CMapShard *shard;             /* array of shards */
+};
+
+#ifndef TEST
+
+/* Default and maximum number of shards */
+
+#define CMAP_SHARDS 64
+#define CMAP_SHARDS_MAX 65536
+
+/* Table size passed to hash functions (see map_create_with_hash(3)) */
+
+#define HASH_RANGE ((size_t)-1)
+
+/* Odd multiplier (2^n / phi) that moves all of a hash value's bits into its high bits */
+
+#if ULONG_MAX > 0xffffffffUL
+#define CMAP_SCRAMBLE 0x9e3779b97f4a7c15UL
+#else
+#define CMAP_SCRAMBLE 0x9e3779b9UL
+#endif
+
+/* The shard for a hash value (taken from its top 16 bits) */
+
+#define cmap_shard(cmap, h) ((cmap)->shard + ((((h) * CMAP_SCRAMBLE) >> (sizeof(size_t) * 8 - 16)) & ((cmap)->shards - 1)))
+
+/*
+
+C<static Map *cmap_map(const CMap *cmap, const void *key)>
+
+Returns the map in the shard of C<cmap> that C<key> belongs in. On error,
+returns C<null> with C<errno> set appropriately.
+
+*/
+
+static Map *cmap_map(const CMap *cmap, const void *key)
+{
+	if (!cmap || !key)
+		return set_errnull(EINVAL);
+
+	return cmap_shard(cmap, cmap->hash(HASH_RANGE, key))->map;
+}
+
+/*
+
+C<static CMap *cmap_create_shards(size_t shards, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
+
+Creates a I<CMap> with at least C<shards> shards. If C<hash> is C<null>, the
+keys are strings, and C<copy>, C<cmp> and C<key_destroy> are ignored. On
+success, returns the new map. On error, returns C<null> with C<errno> set
+appropriately.
+
+*/
+
+static CMap *cmap_create_shards(size_t shards, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
+{
+	CMap *cmap;
+	size_t i;
+	int err;
+
+	if (!shards || shards > CMAP_SHARDS_MAX)
+		return set_errnull(EINVAL);
+
+	if (!(cmap = mem_new(CMap)))
+		return NULL;
+
+	for (cmap->shards = 1; cmap->shards < shards; cmap->shards <<= 1)
+	{}
+
+	if (!(cmap->shard = mem_create(cmap->shards, CMapShard)))
+	{
+		mem_release(cmap);
+		return NULL;
+	}
+
+	cmap->hash = (hash) ? hash : map_hash_string;
+
+	for (i = 0; i < cmap->shards; ++i)
+	{
+		CMapShard *shard = cmap->shard + i;
+
+		if ((err = pthread_rwlock_init(&shard->lock, NULL)))
+		{
+			cmap->shards = i;
+			cmap_release(cmap);
+			return set_errnull(err);
+		}
+
+		shard->map = NULL;
+
+		if (!(shard->locker = locker_create_rwlock(&shard->lock)) ||
+			!(shard->map = (hash) ?
+				map_create_generic_with_locker(shard->locker, copy, cmp, hash, key_destroy, value_destroy) :
+				map_create_with_locker(shard->locker, value_destroy)))
+		{
+			cmap->shards = i + 1;
+			cmap_release(cmap);
+			return NULL;
+		}
+	}
+
+	return cmap;
+}
+
+/*
+
+=item C<CMap *cmap_create(map_release_t *destroy)>
+
+Creates a I<CMap> with string keys, C<64> shards and C<destroy> as its item
+destructor. It is the caller's responsibility to deallocate the new map
+with I<cmap_release(3)> or I<cmap_destroy(3)>. It is strongly recommended
+to use I<cmap_destroy(3)>, because it also sets the pointer variable to
+C<null>. On success, returns the new map. On error, returns C<null> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+CMap *cmap_create(map_release_t *destroy)
+{
+	return cmap_create_shards(CMAP_SHARDS, NULL, NULL, NULL, NULL, destroy);
+}
+
+/*
+
+=item C<CMap *cmap_create_sharded(size_t shards, map_release_t *destroy)>
+
+Equivalent to I<cmap_create(3)> except that the new map has C<shards>
+shards (rounded up to a power of two). More shards allow more threads to
+write to the map at the same time, at the cost of a small map per shard.
+C<shards> must not exceed C<65536>.
+
+=cut
+
+*/
+
+CMap *cmap_create_sharded(size_t shards, map_release_t *destroy)
+{
+	return cmap_create_shards(shards, NULL, NULL, NULL, NULL, destroy);
+}
+
+/*
+
+=item C<CMap *cmap_create_with_hash(map_hash_t *hash, map_release_t *destroy)>
+
+Equivalent to I<cmap_create(3)> except that C<hash> is used as the hash
+function (see I<map_create_with_hash(3)>). It is used both to choose a key's
+shard and to choose its slot within that shard.
+
+=cut
+
+*/
+
+CMap *cmap_create_with_hash(map_hash_t *hash, map_release_t *destroy)
+{
+	if (!hash)
+		return set_errnull(EINVAL);
+
+	return cmap_create_shards(CMAP_SHARDS, (map_copy_t *)mem_strdup, (map_cmp_t *)strcmp, hash, (map_release_t *)free, destroy);
+}
+
+/*
+
+=item C<CMap *cmap_create_generic(map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
+
+Creates a I<CMap> with arbitrary keys and C<64> shards. The arguments have
+the same meaning as for I<map_create_generic(3)>. It is the caller's
+responsibility to deallocate the new map with I<cmap_release(3)> or
+I<cmap_destroy(3)>. On success, returns the new map. On error, returns
+C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+CMap *cmap_create_generic(map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
+{
+	return cmap_create_generic_sharded(CMAP_SHARDS, copy, cmp, hash, key_destroy, value_destroy);
+}
+
+/*
+
+=item C<CMap *cmap_create_generic_sharded(size_t shards, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
+
+Equivalent to I<cmap_create_generic(3)> except that the new map has
+C<shards> shards (rounded up to a power of two). C<shards> must not exceed
+C<65536>.
+
+=cut
+
+*/
+
+CMap *cmap_create_generic_sharded(size_t shards, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
+{
+	if (!cmp || !hash)
+		return set_errnull(EINVAL);
+
+	return cmap_create_shards(shards, copy, cmp, hash, key_destroy, value_destroy);
+}
+
+/*
+
+=item C<void cmap_release(CMap *cmap)>
+
+Releases (deallocates) C<cmap>, destroying its items if necessary. No other
+thread may be using C<cmap>.
+
+=cut
+
+*/
+
+void cmap_release(CMap *cmap)
+{
+	size_t i;
+
+	if (!cmap)
+		return;
+
+	for (i = 0; i < cmap->shards; ++i)
+	{
+		CMapShard *shard = cmap->shard + i;
+
+		map_release(shard->map);
+		locker_release(shard->locker);
+		pthread_rwlock_destroy(&shard->lock);
+	}
+
+	mem_release(cmap->shard);
+	mem_release(cmap);
+}
+
+/*
+
+=item C<void *cmap_destroy(CMap **cmap)>
+
+Destroys (deallocates and sets to C<null>) C<*cmap>. Returns C<null>.
+B<Note:> maps shared by multiple threads must not be destroyed until after
+all threads have finished with it.
+
+=cut
+
+*/
+
+void *cmap_destroy(CMap **cmap)
+{
+	if (cmap && *cmap)
+	{
+		cmap_release(*cmap);
+		*cmap = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<int cmap_add(CMap *cmap, const void *key, void *value)>
+
+Adds the C<(key, value)> mapping to C<cmap>, if C<key> is not already
+present. Note that C<key> is copied but C<value> is not. On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int cmap_add(CMap *cmap, const void *key, void *value)
+{
+	return cmap_insert(cmap, key, value, 0);
+}
+
+/*
+
+=item C<int cmap_put(CMap *cmap, const void *key, void *value)>
+
+Adds the C<(key, value)> mapping to C<cmap>, replacing any existing
+C<(key, value)> mapping. If C<cmap> was created with a destroy function,
+then the value of any replaced mapping will be destroyed. Note that C<key>
+is copied but C<value> is not. On success, returns C<0>. On error, returns
+C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int cmap_put(CMap *cmap, const void *key, void *value)
+{
+	return cmap_insert(cmap, key, value, 1);
+}
+
+/*
+
+=item C<int cmap_insert(CMap *cmap, const void *key, void *value, int replace)>
+
+Adds the C<(key, value)> mapping to C<cmap>, replacing any existing
+C<(key, value)> mapping, if C<replace> is non-zero. If C<cmap> was created
+with a destroy function, then the value of any replaced mapping will be
+destroyed. Note that C<key> is copied but C<value> is not. On success,
+returns C<0>. On error, or if C<replace> is zero and C<key> already exists,
+returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int cmap_insert(CMap *cmap, const void *key, void *value, int replace)
+{
+	Map *map;
+
+	if (!(map = cmap_map(cmap, key)))
+		return -1;
+
+	return map_insert(map, key, value, replace);
+}
+
+/*
+
+=item C<int cmap_remove(CMap *cmap, const void *key)>
+
+Removes C<key>'s mapping from C<cmap>. If C<cmap> was created with a destroy
+function, then the value of the mapping will be destroyed. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int cmap_remove(CMap *cmap, const void *key)
+{
+	Map *map;
+
+	if (!(map = cmap_map(cmap, key)))
+		return -1;
+
+	return map_remove(map, key);
+}
+
+/*
+
+=item C<void *cmap_get(CMap *cmap, const void *key)>
+
+Returns the value associated with C<key> in C<cmap>. On error, returns
+C<null> with C<errno> set appropriately. B<Note:> if C<cmap> owns its items
+and another thread may replace or remove C<key>'s mapping, the value may be
+destroyed as soon as it is returned. Use I<cmap_lookup(3)> instead in that
+case.
+
+=cut
+
+*/
+
+void *cmap_get(CMap *cmap, const void *key)
+{
+	Map *map;
+
+	if (!(map = cmap_map(cmap, key)))
+		return NULL;
+
+	return map_get(map, key);
+}
+
+/*
+
+=item C<int cmap_lookup(CMap *cmap, const void *key, map_action_t *action, void *data)>
+
+Invokes C<action> for the value associated with C<key> in C<cmap>, while
+holding a read lock on C<key>'s shard, so that the value can't be replaced
+or removed (and destroyed) by another thread until C<action> returns. The
+arguments passed to C<action> are C<key>, the value and C<data>. C<action>
+must not modify C<cmap>. On success, returns C<0>. On error, or if C<key> is
+not present, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int cmap_lookup(CMap *cmap, const void *key, map_action_t *action, void *data)
+{
+	Map *map;
+	void *value;
+	int err;
+
+	if (!action)
+		return set_errno(EINVAL);
+
+	if (!(map = cmap_map(cmap, key)))
+		return -1;
+
+	if ((err = map_rdlock(map)))
+		return set_errno(err);
+
+	if ((value = map_get_unlocked(map, key)))
+		action((void *)key, value, data);
+	else
+		err = errno;
+
+	map_unlock(map);
+
+	return (err) ? set_errno(err) : 0;
+}
+
+/*
+
+=item C<void cmap_apply(CMap *cmap, map_action_t *action, void *data)>
+
+Invokes C<action> for each of C<cmap>'s items. The arguments passed to
+C<action> are the key, the item, and C<data>. Each shard is write-locked
+while C<action> is invoked for its items, so C<action> must not use
+C<cmap>. On error, sets C<errno> appropriately.
+
+=cut
+
+*/
+
+void cmap_apply(CMap *cmap, map_action_t *action, void *data)
+{
+	size_t i;
+
+	if (!cmap || !action)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	for (i = 0; i < cmap->shards; ++i)
+		map_apply(cmap->shard[i].map, action, data);
+}
+
+/*
+
+=item C<ssize_t cmap_size(CMap *cmap)>
+
+Returns the number of mappings in C<cmap>. If other threads are modifying
+C<cmap>, this is only an approximation. On error, returns C<-1> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t cmap_size(CMap *cmap)
+{
+	ssize_t size = 0, shard_size;
+	size_t i;
+
+	if (!cmap)
+		return set_errno(EINVAL);
+
+	for (i = 0; i < cmap->shards; ++i)
+	{
+		if ((shard_size = map_size(cmap->shard[i].map)) == -1)
+			return -1;
+
+		size += shard_size;
+	}
+
+	return size;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments are C<null> or out of range.
+
+=item C<ENOENT>
+
+When I<cmap_get(3)>, I<cmap_lookup(3)> or I<cmap_remove(3)> can't find the
+requested key.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Safe>
+
+=head1 EXAMPLES
+
+Cache the addresses of mail exchangers for many sending threads:
+
+    #include <slack/std.h>
+    #include <slack/cmap.h>
+
+    static void copy_address(void *key, void *value, void *data)
+    {
+        snprintf(data, 64, "%s", (char *)value);
+    }
+
+    int main()
+    {
+        CMap *mx;
+        char addr[64];
+
+        if (!(mx = cmap_create(free)))
+            return EXIT_FAILURE;
+
+        cmap_put(mx, "example.org", mem_strdup("192.0.2.25"));
+
+        // In any thread
+
+        if (cmap_lookup(mx, "example.org", copy_address, addr) == 0)
+            printf("%s\n", addr);
+
+        cmap_destroy(&mx);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<map(3)>,
+I<locker(3)>
+
+=head1 AUTHOR
+
+20230330 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#include <pthread.h>
+
+#define TEST_THREADS 8
+#define TEST_KEYS 10000
+
+typedef struct TestThread TestThread;
+
+struct TestThread
+{
+	CMap *cmap;
+	long id;
+	int errors;
+};
+
+static int destroyed = 0;
+
+static void destroy_counted(void *value)
+{
+	++destroyed;
+	free(value);
+}
+
+static void *direct_copy(const void *key)
+{
+	return (void *)key;
+}
+
+static int direct_cmp(const void *a, const void *b)
+{
+	return (a > b) - (a < b);
+}
+
+static size_t direct_hash(size_t size, const void *key)
+{
+	return (size_t)key % size;
+}
+
+static void copy_value(void *key, void *value, void *data)
+{
+	*(void **)data = value;
+}
+
+static void count_items(void *key, void *value, void *data)
+{
+	++*(long *)data;
+}
+
+/* Each thread adds, checks and then removes (half of) its own range of keys */
+
+static void *test_thread(void *arg)
+{
+	TestThread *test = arg;
+	long base = test->id * TEST_KEYS, i;
+
+	for (i = 1; i <= TEST_KEYS; ++i)
+		if (cmap_add(test->cmap, (void *)(base + i), (void *)(base + i)) == -1)
+			++test->errors;
+
+	for (i = 1; i <= TEST_KEYS; ++i)
+		if (cmap_get(test->cmap, (void *)(base + i)) != (void *)(base + i))
+			++test->errors;
+
+	for (i = 1; i <= TEST_KEYS; i += 2)
+		if (cmap_remove(test->cmap, (void *)(base + i)) == -1)
+			++test->errors;
+
+	return NULL;
+}
+
+static double wall(void)
+{
+	struct timespec ts[1];
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+#define BENCH_KEYS (1L << 20)
+#define BENCH_OPS 4000000L
+#define BENCH_THREADS 64
+
+typedef struct Bench Bench;
+
+struct Bench
+{
+	Map *map;                     /* the map, if benchmarking a Map */
+	CMap *cmap;                   /* the map, if benchmarking a CMap */
+	long ops;                     /* number of operations for each thread */
+	unsigned long seed;           /* random number generator state */
+};
+
+/* 90% lookups and 10% replacements of random keys */
+
+static void *bench_thread(void *arg)
+{
+	Bench *bench = arg;
+	unsigned long r = bench->seed;
+	long i;
+
+	for (i = 0; i < bench->ops; ++i)
+	{
+		void *key;
+
+		r ^= r << 13, r ^= r >> 7, r ^= r << 17;
+		key = (void *)(long)((r >> 8) % BENCH_KEYS + 1);
+
+		if (r % 10)
+			(bench->map) ? map_get(bench->map, key) : cmap_get(bench->cmap, key);
+		else
+			(bench->map) ? map_put(bench->map, key, key) : cmap_put(bench->cmap, key, key);
+	}
+
+	return NULL;
+}
+
+static double bench_run(Map *map, CMap *cmap, int threads)
+{
+	pthread_t id[BENCH_THREADS];
+	Bench bench[BENCH_THREADS];
+	double start;
+	int i;
+
+	for (i = 0; i < threads; ++i)
+	{
+		bench[i].map = map;
+		bench[i].cmap = cmap;
+		bench[i].ops = BENCH_OPS / threads;
+		bench[i].seed = 2463534242UL * (i + 1);
+	}
+
+	start = wall();
+
+	for (i = 0; i < threads; ++i)
+		pthread_create(id + i, NULL, bench_thread, bench + i);
+
+	for (i = 0; i < threads; ++i)
+		pthread_join(id[i], NULL);
+
+	return (BENCH_OPS / threads * threads) / (wall() - start) / 1e6;
+}
+
+/*
+
+Compares the throughput of a Map with a single readers/writer lock with
+CMaps with 16 and 64 shards, for 1 to 64 threads.
+
+*/
+
+static void bench(void)
+{
+	pthread_rwlock_t rwlock;
+	Locker *locker;
+	Map *map;
+	CMap *cmap16, *cmap64;
+	long i;
+	int threads;
+
+	pthread_rwlock_init(&rwlock, NULL);
+
+	if (!(locker = locker_create_rwlock(&rwlock)) ||
+		!(map = map_create_generic_with_locker(locker, direct_copy, direct_cmp, direct_hash, NULL, NULL)) ||
+		!(cmap16 = cmap_create_generic_sharded(16, direct_copy, direct_cmp, direct_hash, NULL, NULL)) ||
+		!(cmap64 = cmap_create_generic_sharded(64, direct_copy, direct_cmp, direct_hash, NULL, NULL)))
+	{
+		printf("Failed to create maps\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 1; i <= BENCH_KEYS; ++i)
+	{
+		map_add(map, (void *)i, (void *)i);
+		cmap_add(cmap16, (void *)i, (void *)i);
+		cmap_add(cmap64, (void *)i, (void *)i);
+	}
+
+	printf("%7s %10s %10s %10s (Mops/s, %ld keys, 90%% get, 10%% put)\n", "threads", "map", "cmap/16", "cmap/64", BENCH_KEYS);
+
+	for (threads = 1; threads <= BENCH_THREADS; threads <<= 1)
+	{
+		double map_rate = bench_run(map, NULL, threads);
+		double cmap16_rate = bench_run(NULL, cmap16, threads);
+		double cmap64_rate = bench_run(NULL, cmap64, threads);
+
+		printf("%7d %10.2f %10.2f %10.2f\n", threads, map_rate, cmap16_rate, cmap64_rate);
+	}
+
+	cmap_destroy(&cmap16);
+	cmap_destroy(&cmap64);
+	map_destroy(&map);
+	locker_destroy(&locker);
+	pthread_rwlock_destroy(&rwlock);
+
+	exit(EXIT_SUCCESS);
+}
+
+#define TEST_ACT(i, action) \
+	if (!(action)) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_INT_ACT(i, action) \
+	if ((action) == -1) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_EQ(i, action, value) \
+	if ((val = (action)) != (value)) \
+		++errors, printf("Test%d: %s failed (returned %ld, not %ld)\n", (i), (#action), (long)val, (long)(value));
+
+#define CHECK_ITEM(i, action, key, result) \
+	if (!(value = (char *)(action)) || strcmp(value, (result))) \
+		++errors, printf("Test%d: %s failed (mapping \"%s\" is \"%s\", not \"%s\")\n", (i), (#action), (key), value, (result));
+
+int main(int ac, char **av)
+{
+	CMap *cmap;
+	TestThread test[TEST_THREADS];
+	pthread_t id[TEST_THREADS];
+	char *value;
+	void *ptr;
+	long count, i, min, max;
+	ssize_t val;
+	int errors = 0;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s [bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench();
+
+	printf("Testing: %s\n", "cmap");
+
+	/* Test cmap_create, cmap_add, cmap_get, cmap_put, cmap_remove */
+
+	TEST_ACT(1, cmap = cmap_create(NULL))
+	else
+	{
+		TEST_INT_ACT(2, cmap_add(cmap, "abc", "abc"))
+		TEST_INT_ACT(3, cmap_add(cmap, "def", "def"))
+		TEST_INT_ACT(4, cmap_add(cmap, "ghi", "ghi"))
+		TEST_INT_ACT(5, cmap_add(cmap, "jkl", "jkl"))
+
+		CHECK_ITEM(6, cmap_get(cmap, "abc"), "abc", "abc")
+		CHECK_ITEM(7, cmap_get(cmap, "def"), "def", "def")
+		CHECK_ITEM(8, cmap_get(cmap, "ghi"), "ghi", "ghi")
+		CHECK_ITEM(9, cmap_get(cmap, "jkl"), "jkl", "jkl")
+
+		if ((value = cmap_get(cmap, "zzz")) || errno != ENOENT)
+			++errors, printf("Test10: cmap_get(\"zzz\") failed (%s, errno %d)\n", value, errno);
+
+		TEST_EQ(11, cmap_add(cmap, "abc", "ABC"), -1)
+		TEST_INT_ACT(12, cmap_put(cmap, "abc", "ABC"))
+		CHECK_ITEM(12, cmap_get(cmap, "abc"), "abc", "ABC")
+		TEST_EQ(13, cmap_size(cmap), 4)
+
+		TEST_INT_ACT(14, cmap_remove(cmap, "abc"))
+		if ((value = cmap_get(cmap, "abc")))
+			++errors, printf("Test15: cmap_get(\"abc\") after cmap_remove failed (%s)\n", value);
+		TEST_EQ(16, cmap_remove(cmap, "abc"), -1)
+		TEST_EQ(16, cmap_size(cmap), 3)
+
+		/* Test cmap_lookup, cmap_apply */
+
+		ptr = NULL;
+		if (cmap_lookup(cmap, "def", copy_value, &ptr) == -1 || !ptr || strcmp(ptr, "def"))
+			++errors, printf("Test17: cmap_lookup(\"def\") failed (%s)\n", (char *)ptr);
+
+		ptr = NULL;
+		if (cmap_lookup(cmap, "abc", copy_value, &ptr) != -1 || errno != ENOENT || ptr)
+			++errors, printf("Test18: cmap_lookup(\"abc\") failed (errno %d, not ENOENT)\n", errno);
+
+		count = 0;
+		cmap_apply(cmap, count_items, &count);
+		if (count != 3)
+			++errors, printf("Test19: cmap_apply() failed (%ld items, not 3)\n", count);
+
+		cmap_destroy(&cmap);
+		if (cmap)
+			++errors, printf("Test20: cmap_destroy(&cmap) failed (%p, not NULL)\n", (void *)cmap);
+	}
+
+	/* Test that owned items are destroyed when replaced, removed and released */
+
+	TEST_ACT(21, cmap = cmap_create_sharded(4, destroy_counted))
+	else
+	{
+		destroyed = 0;
+		TEST_INT_ACT(21, cmap_add(cmap, "abc", mem_strdup("abc")))
+		TEST_INT_ACT(21, cmap_add(cmap, "def", mem_strdup("def")))
+		TEST_INT_ACT(21, cmap_add(cmap, "ghi", mem_strdup("ghi")))
+		TEST_INT_ACT(22, cmap_put(cmap, "abc", mem_strdup("ABC")))
+		TEST_EQ(22, destroyed, 1)
+		TEST_INT_ACT(23, cmap_remove(cmap, "def"))
+		TEST_EQ(23, destroyed, 2)
+		cmap_destroy(&cmap);
+		TEST_EQ(24, destroyed, 4)
+	}
+
+	/* Test that keys are spread evenly over the shards */
+
+	TEST_ACT(25, cmap = cmap_create_generic(direct_copy, direct_cmp, direct_hash, NULL, NULL))
+	else
+	{
+		for (i = 1; i <= 64000; ++i)
+			TEST_INT_ACT(25, cmap_add(cmap, (void *)i, (void *)i))
+
+		TEST_EQ(26, cmap->shards, 64)
+		min = max = map_size(cmap->shard[0].map);
+
+		for (i = 1; i < cmap->shards; ++i)
+		{
+			long size = map_size(cmap->shard[i].map);
+
+			if (size < min)
+				min = size;
+			if (size > max)
+				max = size;
+		}
+
+		if (min < 900 || max > 1100)
+			++errors, printf("Test27: shard sizes failed (%ld..%ld, not near 1000)\n", min, max);
+
+		cmap_destroy(&cmap);
+	}
+
+	TEST_ACT(28, cmap = cmap_create(NULL))
+	else
+	{
+		static char keys[64000][8];
+
+		for (i = 0; i < 64000; ++i)
+		{
+			snprintf(keys[i], sizeof keys[i], "%ld", i);
+			TEST_INT_ACT(28, cmap_add(cmap, keys[i], keys[i]))
+		}
+
+		min = max = map_size(cmap->shard[0].map);
+
+		for (i = 1; i < cmap->shards; ++i)
+		{
+			long size = map_size(cmap->shard[i].map);
+
+			if (size < min)
+				min = size;
+			if (size > max)
+				max = size;
+		}
+
+		if (min < 850 || max > 1150)
+			++errors, printf("Test29: string shard sizes failed (%ld..%ld, not near 1000)\n", min, max);
+
+		cmap_destroy(&cmap);
+	}
+
+	/* Test sharding arguments */
+
+	TEST_ACT(30, cmap = cmap_create_generic_sharded(3, direct_copy, direct_cmp, direct_hash, NULL, NULL))
+	else
+	{
+		TEST_EQ(30, cmap->shards, 4)
+		cmap_destroy(&cmap);
+	}
+
+	if ((cmap = cmap_create_sharded(0, NULL)) || errno != EINVAL)
+		++errors, printf("Test31: cmap_create_sharded(0) failed (errno %d, not EINVAL)\n", errno);
+
+	if ((cmap = cmap_create_sharded(65537, NULL)) || errno != EINVAL)
+		++errors, printf("Test32: cmap_create_sharded(65537) failed (errno %d, not EINVAL)\n", errno);
+
+	if ((cmap = cmap_create_generic(direct_copy, direct_cmp, NULL, NULL, NULL)) || errno != EINVAL)
+		++errors, printf("Test33: cmap_create_generic(hash = NULL) failed (errno %d, not EINVAL)\n", errno);
+
+	/* Test concurrent use by multiple threads */
+
+	TEST_ACT(34, cmap = cmap_create_generic_sharded(16, direct_copy, direct_cmp, direct_hash, NULL, NULL))
+	else
+	{
+		for (i = 0; i < TEST_THREADS; ++i)
+		{
+			test[i].cmap = cmap;
+			test[i].id = i;
+			test[i].errors = 0;
+			pthread_create(id + i, NULL, test_thread, test + i);
+		}
+
+		for (i = 0; i < TEST_THREADS; ++i)
+		{
+			pthread_join(id[i], NULL);
+			if (test[i].errors)
+				++errors, printf("Test35: thread %ld failed (%d errors)\n", i, test[i].errors);
+		}
+
+		TEST_EQ(36, cmap_size(cmap), TEST_THREADS * TEST_KEYS / 2)
+
+		for (i = 1; i <= TEST_THREADS * TEST_KEYS; ++i)
+			if ((cmap_get(cmap, (void *)i) != NULL) != !(i & 1))
+				++errors, printf("Test37: cmap_get(%ld) after threads failed\n", i);
+
+		cmap_destroy(&cmap);
+	}
+
+	if (errors)
+		printf("%d/37 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
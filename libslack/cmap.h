@@ -0,0 +1,50 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+#ifndef LIBSLACK_CMAP_H
+#define LIBSLACK_CMAP_H
+
+#include <slack/hdr.h>
+#include <slack/map.h>
+
+typedef struct CMap CMap;
+
+_begin_decls
+CMap *cmap_create(map_release_t *destroy);
+CMap *cmap_create_sharded(size_t shards, map_release_t *destroy);
+CMap *cmap_create_with_hash(map_hash_t *hash, map_release_t *destroy);
+CMap *cmap_create_generic(map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
+CMap *cmap_create_generic_sharded(size_t shards, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
+void cmap_release(CMap *cmap);
+void *cmap_destroy(CMap **cmap);
+int cmap_add(CMap *cmap, const void *key, void *value);
+int cmap_put(CMap *cmap, const void *key, void *value);
+int cmap_insert(CMap *cmap, const void *key, void *value, int replace);
+int cmap_remove(CMap *cmap, const void *key);
+void *cmap_get(CMap *cmap, const void *key);
+int cmap_lookup(CMap *cmap, const void *key, map_action_t *action, void *data);
+void cmap_apply(CMap *cmap, map_action_t *action, void *data);
+ssize_t cmap_size(CMap *cmap);
+_end_decls
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,966 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<libslack(date)> - date module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/date.h>
+
+    #define DATE_SIZE 32
+    #define DATE_MSGID_SIZE 256
+
+    int date_clock(struct timespec *ts);
+    time_t date_time(void);
+    char *date_rfc5322(char *buf, size_t size, time_t t, int utc);
+    char *date_rfc5322_now(char *buf, size_t size, int utc);
+    char *date_msgid(char *buf, size_t size, const char *domain);
+
+=head1 DESCRIPTION
+
+This module provides a cheap source of the current time and functions for
+formatting the dates and message identifiers that are needed in internet
+message headers (RFC 5322). The formatting functions are intended for
+programs that generate many messages in quick succession. Rather than
+calling I<localtime(3)> and I<strftime(3)> for every message (which
+involves taking the timezone lock and possibly examining
+F</etc/localtime>), the local timezone offset is only determined once for
+each 15 minute period (all timezone transitions happen on a 15 minute
+boundary) and the formatted date is only recreated once per second.
+
+=over 4
+
+=cut
+
+*/
+
+#include "config.h"
+#include "std.h"
+
+#include <fcntl.h>
+
+#include "err.h"
+#include "date.h"
+
+#define DATE_ZONE_PERIOD 900
+
+#ifndef TEST
+
+static struct
+{
+	pthread_mutex_t lock;         /* Mutex lock for structure */
+	int zone_valid;               /* Whether or not zone_offset is known */
+	time_t zone_period;           /* Period for which zone_offset is valid */
+	long zone_offset;             /* Local timezone offset in seconds */
+	int date_valid[2];            /* Whether or not date[] is known */
+	time_t date_time[2];          /* Time (in seconds) that date[] is for */
+	size_t date_length[2];        /* Length of date[] */
+	char date[2][DATE_SIZE];      /* Cached local and UTC dates */
+	int msgid_seeded;             /* Whether or not msgid_pid/seed are known */
+	unsigned long msgid_pid;      /* Process id for message ids */
+	unsigned long msgid_seed;     /* Random per-process seed for message ids */
+	unsigned long msgid_counter;  /* Sequence number for message ids */
+}
+g =
+{
+	PTHREAD_MUTEX_INITIALIZER, /* lock */
+	0,                         /* zone_valid */
+	(time_t)0,                 /* zone_period */
+	0L,                        /* zone_offset */
+	{ 0, 0 },                  /* date_valid */
+	{ (time_t)0, (time_t)0 },  /* date_time */
+	{ 0, 0 },                  /* date_length */
+	{ "", "" },                /* date */
+	0,                         /* msgid_seeded */
+	0UL,                       /* msgid_pid */
+	0UL,                       /* msgid_seed */
+	0UL                        /* msgid_counter */
+};
+
+static const char * const day_names[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char * const month_names[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+#define ptry(action) { int err = (action); if (err) return set_errnull(err); }
+
+#ifdef __GNUC__
+#define date_atomic_load(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define date_atomic_store(var, val) __atomic_store_n(&(var), (val), __ATOMIC_RELEASE)
+#define date_atomic_fetch_add(var, val) __atomic_fetch_add(&(var), (val), __ATOMIC_RELAXED)
+#endif
+
+/*
+
+=item C<int date_clock(struct timespec *ts)>
+
+Stores the current time in C<ts>. Uses the coarse real time clock
+(C<CLOCK_REALTIME_COARSE>) where available because it is much cheaper to
+read and its resolution (a few milliseconds) is more than enough for
+message dates. Otherwise, C<CLOCK_REALTIME> is used. On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int date_clock(struct timespec *ts)
+{
+	if (!ts)
+		return set_errno(EINVAL);
+
+#ifdef CLOCK_REALTIME_COARSE
+	if (clock_gettime(CLOCK_REALTIME_COARSE, ts) == 0)
+		return 0;
+#endif
+
+	return clock_gettime(CLOCK_REALTIME, ts);
+}
+
+/*
+
+=item C<time_t date_time(void)>
+
+Returns the current time in seconds since the epoch using I<date_clock(3)>.
+Falls back to I<time(2)> if I<date_clock(3)> fails.
+
+=cut
+
+*/
+
+time_t date_time(void)
+{
+	struct timespec ts[1];
+
+	if (date_clock(ts) == -1)
+		return time(NULL);
+
+	return ts->tv_sec;
+}
+
+/*
+
+C<static long date_days_from_civil(long y, int m, int d)>
+
+Returns the number of days since the epoch of the proleptic Gregorian
+calendar date C<y>-C<m>-C<d> (where C<m> is from C<1> to C<12>).
+
+*/
+
+static long date_days_from_civil(long y, int m, int d)
+{
+	long era, yoe, doy, doe;
+
+	y -= m <= 2;
+	era = ((y >= 0) ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + ((m > 2) ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+/*
+
+C<static void date_civil_from_days(long z, long *y, int *m, int *d)>
+
+The inverse of I<date_days_from_civil()>. Stores the proleptic Gregorian
+calendar date that is C<z> days since the epoch in C<y>, C<m> and C<d>.
+
+*/
+
+static void date_civil_from_days(long z, long *y, int *m, int *d)
+{
+	long era, doe, yoe, doy, mp;
+
+	z += 719468;
+	era = ((z >= 0) ? z : z - 146096) / 146097;
+	doe = z - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	*d = (int)(doy - (153 * mp + 2) / 5 + 1);
+	*m = (int)((mp < 10) ? mp + 3 : mp - 9);
+	*y = yoe + era * 400 + (*m <= 2);
+}
+
+/*
+
+C<static long date_floor_div(long a, long b)>
+
+Returns C<a> divided by C<b>, rounded towards negative infinity.
+
+*/
+
+static long date_floor_div(long a, long b)
+{
+	return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+/*
+
+C<static int date_zone_offset_unlocked(time_t t, long *offset)>
+
+Stores the local timezone offset (in seconds east of UTC) at time C<t> in
+C<offset>. The offset is only determined using I<localtime_r(3)> when C<t>
+falls outside the 15 minute period for which the offset was last
+determined. Must be called with C<g.lock> locked. On success, returns C<0>.
+On error, returns C<-1>.
+
+*/
+
+static int date_zone_offset_unlocked(time_t t, long *offset)
+{
+	time_t period = (time_t)date_floor_div((long)t, DATE_ZONE_PERIOD);
+	struct tm tm[1];
+
+	if (!g.zone_valid || g.zone_period != period)
+	{
+		if (!localtime_r(&t, tm))
+			return -1;
+
+		g.zone_offset = date_days_from_civil(tm->tm_year + 1900L, tm->tm_mon + 1, tm->tm_mday) * 86400L + tm->tm_hour * 3600L + tm->tm_min * 60L + tm->tm_sec - (long)t;
+		g.zone_period = period;
+		g.zone_valid = 1;
+	}
+
+	*offset = g.zone_offset;
+
+	return 0;
+}
+
+/*
+
+C<static char *date_digits(char *buf, long n, int width)>
+
+Stores the non-negative number C<n> in C<buf> as exactly C<width> decimal
+digits (with leading zeroes) and returns a pointer to the byte after the
+last digit.
+
+*/
+
+static char *date_digits(char *buf, long n, int width)
+{
+	char *b = buf + width;
+
+	while (b > buf)
+		*--b = '0' + n % 10, n /= 10;
+
+	return buf + width;
+}
+
+/*
+
+C<static int date_format_unlocked(time_t t, int utc)>
+
+Formats the time C<t> (as UTC if C<utc> is non-zero, otherwise as local
+time) into C<g.date[utc]> unless it is already there. Must be called with
+C<g.lock> locked. On success, returns C<0>. On error, returns C<-1>.
+
+*/
+
+static int date_format_unlocked(time_t t, int utc)
+{
+	long offset = 0, secs, days, year, zone;
+	int month, day;
+	char *d;
+
+	if (g.date_valid[utc] && g.date_time[utc] == t)
+		return 0;
+
+	if (!utc && date_zone_offset_unlocked(t, &offset) == -1)
+		return -1;
+
+	secs = (long)t + offset;
+	days = date_floor_div(secs, 86400);
+	secs -= days * 86400;
+	date_civil_from_days(days, &year, &month, &day);
+	zone = (offset < 0) ? -offset : offset;
+
+	if (year < 0 || year > 9999)
+	{
+		g.date_valid[utc] = 0;
+		return set_errno(ERANGE);
+	}
+
+	d = g.date[utc];
+	memcpy(d, day_names[(int)(((days % 7) + 11) % 7)], 3), d += 3;
+	*d++ = ',', *d++ = ' ';
+	d = date_digits(d, day, 2), *d++ = ' ';
+	memcpy(d, month_names[month - 1], 3), d += 3, *d++ = ' ';
+	d = date_digits(d, year, 4), *d++ = ' ';
+	d = date_digits(d, secs / 3600, 2), *d++ = ':';
+	d = date_digits(d, (secs / 60) % 60, 2), *d++ = ':';
+	d = date_digits(d, secs % 60, 2), *d++ = ' ';
+	*d++ = (offset < 0) ? '-' : '+';
+	d = date_digits(d, zone / 3600, 2);
+	d = date_digits(d, (zone / 60) % 60, 2);
+	*d = '\0';
+
+	g.date_time[utc] = t;
+	g.date_length[utc] = d - g.date[utc];
+	g.date_valid[utc] = 1;
+
+	return 0;
+}
+
+/*
+
+=item C<char *date_rfc5322(char *buf, size_t size, time_t t, int utc)>
+
+Formats the time C<t> into C<buf> as an RFC 5322 date (e.g. C<"Thu, 30 Mar
+2023 12:00:00 +1100">) suitable for a C<Date:> header. If C<utc> is
+non-zero, the date is in UTC. Otherwise, it is in the local timezone. This
+is equivalent to calling I<strftime(3)> with the format C<"%a, %d %b %Y
+%H:%M:%S %z"> (in the C locale) on the result of I<gmtime(3)> or
+I<localtime(3)>, but it is much cheaper when called repeatedly. C<size> is
+the size of C<buf>, which should be at least C<DATE_SIZE> bytes. On
+success, returns C<buf>. On error, returns C<null> with C<errno> set
+appropriately.
+
+Note that the local timezone offset is cached for up to 15 minutes. If the
+C<TZ> environment variable is changed, the new timezone may not take effect
+immediately.
+
+=cut
+
+*/
+
+char *date_rfc5322(char *buf, size_t size, time_t t, int utc)
+{
+	int err;
+
+	if (!buf)
+		return set_errnull(EINVAL);
+
+	utc = (utc != 0);
+
+	ptry(pthread_mutex_lock(&g.lock))
+
+	if (date_format_unlocked(t, utc) == -1)
+	{
+		err = errno;
+		pthread_mutex_unlock(&g.lock);
+		return set_errnull(err);
+	}
+
+	if (g.date_length[utc] >= size)
+	{
+		pthread_mutex_unlock(&g.lock);
+		return set_errnull(ERANGE);
+	}
+
+	memcpy(buf, g.date[utc], g.date_length[utc] + 1);
+
+	ptry(pthread_mutex_unlock(&g.lock))
+
+	return buf;
+}
+
+/*
+
+=item C<char *date_rfc5322_now(char *buf, size_t size, int utc)>
+
+Equivalent to I<date_rfc5322(3)> with the current time as returned by
+I<date_time(3)>.
+
+=cut
+
+*/
+
+char *date_rfc5322_now(char *buf, size_t size, int utc)
+{
+	return date_rfc5322(buf, size, date_time(), utc);
+}
+
+/*
+
+C<static char *date_base36(char *buf, unsigned long n)>
+
+Stores C<n> in C<buf> in base 36 (lowercase) and returns a pointer to the
+nul byte at the end. C<buf> must have room for at least 14 bytes.
+
+*/
+
+static char *date_base36(char *buf, unsigned long n)
+{
+	static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+	char tmp[16], *t = tmp;
+
+	do
+	{
+		*t++ = digits[n % 36];
+		n /= 36;
+	}
+	while (n);
+
+	while (t > tmp)
+		*buf++ = *--t;
+
+	*buf = '\0';
+
+	return buf;
+}
+
+/*
+
+C<static void date_msgid_atfork_child(void)>
+
+Forgets the message id seed in a newly forked child process so that the
+child creates its own the next time it needs one.
+
+*/
+
+static void date_msgid_atfork_child(void)
+{
+	g.msgid_seeded = 0;
+	g.msgid_counter = 0;
+	pthread_mutex_init(&g.lock, NULL);
+}
+
+/*
+
+C<static int date_msgid_seed(void)>
+
+Determines the process id and a random seed for message ids, unless this
+has already been done in this process. This is the only time that
+I<date_msgid(3)> makes any system calls. The seed is read from
+F</dev/urandom>. If that isn't possible, it is derived from the time. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+*/
+
+static int date_msgid_seed(void)
+{
+	static int atfork_registered = 0;
+	struct timespec ts[1];
+	unsigned long seed = 0;
+	int fd, err;
+
+#ifdef date_atomic_load
+	if (date_atomic_load(g.msgid_seeded))
+		return 0;
+#endif
+
+	if ((err = pthread_mutex_lock(&g.lock)))
+		return set_errno(err);
+
+	if (!g.msgid_seeded)
+	{
+		if (!atfork_registered && pthread_atfork(NULL, NULL, date_msgid_atfork_child) == 0)
+			atfork_registered = 1;
+
+		if ((fd = open("/dev/urandom", O_RDONLY)) != -1)
+		{
+			if (read(fd, &seed, sizeof seed) != sizeof seed)
+				seed = 0;
+			close(fd);
+		}
+
+		if (!seed && date_clock(ts) == 0)
+			seed = (unsigned long)ts->tv_nsec * 2654435761UL ^ (unsigned long)ts->tv_sec;
+
+		g.msgid_pid = (unsigned long)getpid();
+		g.msgid_seed = seed;
+		g.msgid_counter = 0;
+#ifdef date_atomic_store
+		date_atomic_store(g.msgid_seeded, 1);
+#else
+		g.msgid_seeded = 1;
+#endif
+	}
+
+	if ((err = pthread_mutex_unlock(&g.lock)))
+		return set_errno(err);
+
+	return 0;
+}
+
+/*
+
+=item C<char *date_msgid(char *buf, size_t size, const char *domain)>
+
+Creates a new unique message identifier for the host C<domain> and stores
+it in C<buf> (including the enclosing angle brackets) suitable for a
+C<Message-ID:> header. The identifier consists of the current time, a
+per-process sequence number, the process id and a random per-process seed
+(each in base 36), followed by C<@> and C<domain>. The process id makes
+identifiers from concurrent processes on the same host distinct. The seed
+makes them distinct from those of earlier processes that had the same
+process id. C<size> is the size of C<buf>. Identifiers up to
+C<DATE_MSGID_SIZE> bytes long are supported. On success, returns C<buf>.
+On error, returns C<null> with C<errno> set appropriately.
+
+The process id and seed are only determined once per process (and again in
+a child process after I<fork(2)>), and the time comes from I<date_clock(3)>
+so, after the first call, no system calls are made. Where the compiler
+supports atomic operations, the sequence number is incremented without
+locking.
+
+=cut
+
+*/
+
+char *date_msgid(char *buf, size_t size, const char *domain)
+{
+	char local[80], *l;
+	unsigned long counter;
+	size_t local_length, domain_length;
+
+	if (!buf || !domain || !*domain)
+		return set_errnull(EINVAL);
+
+	if (date_msgid_seed() == -1)
+		return NULL;
+
+#ifdef date_atomic_fetch_add
+	counter = date_atomic_fetch_add(g.msgid_counter, 1UL);
+#else
+	ptry(pthread_mutex_lock(&g.lock))
+	counter = g.msgid_counter++;
+	ptry(pthread_mutex_unlock(&g.lock))
+#endif
+
+	l = date_base36(local, (unsigned long)date_time());
+	*l++ = '.';
+	l = date_base36(l, counter);
+	*l++ = '.';
+	l = date_base36(l, g.msgid_pid);
+	*l++ = '.';
+	l = date_base36(l, g.msgid_seed);
+
+	local_length = l - local;
+	domain_length = strlen(domain);
+
+	if (local_length + domain_length + 4 > size || local_length + domain_length + 4 > DATE_MSGID_SIZE)
+		return set_errnull(ERANGE);
+
+	buf[0] = '<';
+	memcpy(buf + 1, local, local_length);
+	buf[1 + local_length] = '@';
+	memcpy(buf + 2 + local_length, domain, domain_length);
+	memcpy(buf + 2 + local_length + domain_length, ">", 2);
+
+	return buf;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments are C<null> or invalid.
+
+=item C<ERANGE>
+
+When C<buf> is too small for the date or message identifier.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Safe>
+
+=head1 EXAMPLES
+
+Print the current date as it would appear in a C<Date:> header:
+
+    #include <slack/std.h>
+    #include <slack/date.h>
+
+    int main()
+    {
+        char buf[DATE_SIZE];
+
+        if (!date_rfc5322_now(buf, DATE_SIZE, 0))
+            return EXIT_FAILURE;
+
+        printf("Date: %s\n", buf);
+
+        return EXIT_SUCCESS;
+    }
+
+Print a unique message identifier:
+
+    #include <slack/std.h>
+    #include <slack/date.h>
+
+    int main()
+    {
+        char buf[DATE_MSGID_SIZE];
+
+        if (!date_msgid(buf, DATE_MSGID_SIZE, "example.org"))
+            return EXIT_FAILURE;
+
+        printf("Message-ID: %s\n", buf);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<clock_gettime(2)>,
+I<localtime(3)>,
+I<strftime(3)>,
+I<net(3)>
+
+=head1 AUTHOR
+
+20230330 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#include <sys/wait.h>
+
+static char *date_base36_test(char *buf, unsigned long n)
+{
+	static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+	char tmp[16], *t = tmp, *b = buf;
+
+	*b++ = '.';
+
+	do
+	{
+		*t++ = digits[n % 36];
+		n /= 36;
+	}
+	while (n);
+
+	while (t > tmp)
+		*b++ = *--t;
+
+	*b++ = '.';
+	*b = '\0';
+
+	return buf;
+}
+
+static int msgid_cmp(const void *a, const void *b)
+{
+	return strcmp((const char *)a, (const char *)b);
+}
+
+static double elapsed(clock_t start)
+{
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double wall(void)
+{
+	struct timespec ts[1];
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+static void *bench_msgid(void *arg)
+{
+	char buf[DATE_MSGID_SIZE];
+	int i, iterations = *(int *)arg;
+
+	for (i = 0; i < iterations; ++i)
+		date_msgid(buf, DATE_MSGID_SIZE, "example.org");
+
+	return NULL;
+}
+
+static void bench(void)
+{
+	const int iterations = 1000000;
+	char buf[DATE_MSGID_SIZE];
+	time_t t = time(NULL);
+	struct tm tm[1];
+	pthread_t thread[8];
+	clock_t start;
+	double secs;
+	int i, nthreads;
+
+	start = clock();
+	for (i = 0; i < iterations; ++i)
+	{
+		time_t now = time(NULL);
+		strftime(buf, DATE_SIZE, "%a, %d %b %Y %H:%M:%S %z", localtime_r(&now, tm));
+	}
+	secs = elapsed(start);
+	printf("%-40s %8.1f ns/op\n", "time+localtime_r+strftime", secs * 1e9 / iterations);
+
+	start = clock();
+	for (i = 0; i < iterations; ++i)
+		date_rfc5322_now(buf, DATE_SIZE, 0);
+	secs = elapsed(start);
+	printf("%-40s %8.1f ns/op\n", "date_rfc5322_now (local)", secs * 1e9 / iterations);
+
+	start = clock();
+	for (i = 0; i < iterations; ++i)
+		date_rfc5322(buf, DATE_SIZE, t + i, 0);
+	secs = elapsed(start);
+	printf("%-40s %8.1f ns/op\n", "date_rfc5322 (local, new second)", secs * 1e9 / iterations);
+
+	start = clock();
+	for (i = 0; i < iterations; ++i)
+		date_msgid(buf, DATE_MSGID_SIZE, "example.org");
+	secs = elapsed(start);
+	printf("%-40s %8.1f ns/op (%.0f ids/s)\n", "date_msgid", secs * 1e9 / iterations, iterations / secs);
+
+	for (nthreads = 2; nthreads <= 8; nthreads *= 2)
+	{
+		double begin = wall();
+
+		for (i = 0; i < nthreads; ++i)
+			pthread_create(&thread[i], NULL, bench_msgid, (void *)&iterations);
+
+		for (i = 0; i < nthreads; ++i)
+			pthread_join(thread[i], NULL);
+
+		secs = wall() - begin;
+		printf("date_msgid (%d threads)%*s %8.1f ns/op (%.0f ids/s)\n", nthreads, 17, "", secs * 1e9 / (iterations * nthreads), iterations * nthreads / secs);
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
+int main(int ac, char **av)
+{
+	const time_t times[] =
+	{
+		(time_t)0, (time_t)59, (time_t)86399, (time_t)951782400, (time_t)951868799,
+		(time_t)978307199, (time_t)1680134400, (time_t)1700000000, (time_t)2147483647,
+		(time_t)-1, (time_t)-86401, (time_t)-2208988800L
+	};
+	const int ntimes = sizeof times / sizeof times[0];
+	char expected[DATE_SIZE], buf[DATE_SIZE], buf2[DATE_MSGID_SIZE], msgids[1000][DATE_MSGID_SIZE], pidstr[32];
+	struct timespec ts[1];
+	int fds[2];
+	pid_t pid;
+	struct tm tm[1];
+	time_t t;
+	int errors = 0;
+	int i;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s [bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench();
+
+	printf("Testing: %s\n", "date");
+
+	/* Test date_clock and date_time */
+
+	if (date_clock(ts) == -1)
+		++errors, printf("Test1: date_clock() failed (%s)\n", strerror(errno));
+	else if (ts->tv_sec < time(NULL) - 1 || ts->tv_sec > time(NULL) + 1)
+		++errors, printf("Test1: date_clock() failed (%ld, not %ld)\n", (long)ts->tv_sec, (long)time(NULL));
+
+	if ((t = date_time()) < time(NULL) - 1 || t > time(NULL) + 1)
+		++errors, printf("Test2: date_time() failed (%ld, not %ld)\n", (long)t, (long)time(NULL));
+
+	/* Test date_rfc5322 (utc) against strftime */
+
+	for (i = 0; i < ntimes; ++i)
+	{
+		strftime(expected, DATE_SIZE, "%a, %d %b %Y %H:%M:%S %z", gmtime_r(&times[i], tm));
+
+		if (!date_rfc5322(buf, DATE_SIZE, times[i], 1))
+			++errors, printf("Test3: date_rfc5322(%ld, utc) failed (%s)\n", (long)times[i], strerror(errno));
+		else if (strcmp(buf, expected))
+			++errors, printf("Test3: date_rfc5322(%ld, utc) failed (\"%s\", not \"%s\")\n", (long)times[i], buf, expected);
+	}
+
+	for (t = 0; t < (time_t)4102444800L; t += 86400 * 13 + 3607)
+	{
+		strftime(expected, DATE_SIZE, "%a, %d %b %Y %H:%M:%S %z", gmtime_r(&t, tm));
+
+		if (!date_rfc5322(buf, DATE_SIZE, t, 1) || strcmp(buf, expected))
+		{
+			++errors, printf("Test4: date_rfc5322(%ld, utc) failed (\"%s\", not \"%s\")\n", (long)t, buf, expected);
+			break;
+		}
+	}
+
+	/* Test date_rfc5322 (local) against strftime across DST transitions */
+
+	setenv("TZ", "EST5EDT,M3.2.0,M11.1.0", 1);
+	tzset();
+
+	for (t = (time_t)1678600800L; t < (time_t)1678600800L + 86400; t += 599)
+	{
+		strftime(expected, DATE_SIZE, "%a, %d %b %Y %H:%M:%S %z", localtime_r(&t, tm));
+
+		if (!date_rfc5322(buf, DATE_SIZE, t, 0) || strcmp(buf, expected))
+		{
+			++errors, printf("Test5: date_rfc5322(%ld, local) failed (\"%s\", not \"%s\")\n", (long)t, buf, expected);
+			break;
+		}
+	}
+
+	for (t = (time_t)1699160400L; t < (time_t)1699160400L + 86400; t += 599)
+	{
+		strftime(expected, DATE_SIZE, "%a, %d %b %Y %H:%M:%S %z", localtime_r(&t, tm));
+
+		if (!date_rfc5322(buf, DATE_SIZE, t, 0) || strcmp(buf, expected))
+		{
+			++errors, printf("Test6: date_rfc5322(%ld, local) failed (\"%s\", not \"%s\")\n", (long)t, buf, expected);
+			break;
+		}
+	}
+
+	/* Test date_rfc5322 (local) with a timezone offset that isn't whole hours */
+
+	setenv("TZ", "<+0545>-5:45", 1);
+	tzset();
+
+	for (t = (time_t)1500000000L; t < (time_t)1500000000L + 86400 * 3; t += 1801)
+	{
+		strftime(expected, DATE_SIZE, "%a, %d %b %Y %H:%M:%S %z", localtime_r(&t, tm));
+
+		if (!date_rfc5322(buf, DATE_SIZE, t, 0) || strcmp(buf, expected))
+		{
+			++errors, printf("Test7: date_rfc5322(%ld, local) failed (\"%s\", not \"%s\")\n", (long)t, buf, expected);
+			break;
+		}
+	}
+
+	/* Test date_rfc5322 with a small buffer and bad arguments */
+
+	if (date_rfc5322(buf, 10, (time_t)0, 1) || errno != ERANGE)
+		++errors, printf("Test8: date_rfc5322(size=10) failed (errno %d, not ERANGE)\n", errno);
+
+	if (date_rfc5322(NULL, DATE_SIZE, (time_t)0, 1) || errno != EINVAL)
+		++errors, printf("Test9: date_rfc5322(NULL) failed (errno %d, not EINVAL)\n", errno);
+
+	/* Test date_rfc5322_now */
+
+	t = date_time();
+	strftime(expected, DATE_SIZE, "%a, %d %b %Y %H:%M:%S %z", localtime_r(&t, tm));
+
+	if (!date_rfc5322_now(buf, DATE_SIZE, 0))
+		++errors, printf("Test10: date_rfc5322_now() failed (%s)\n", strerror(errno));
+	else if (strcmp(buf, expected))
+	{
+		++t;
+		strftime(expected, DATE_SIZE, "%a, %d %b %Y %H:%M:%S %z", localtime_r(&t, tm));
+		if (strcmp(buf, expected))
+			++errors, printf("Test10: date_rfc5322_now() failed (\"%s\", not \"%s\")\n", buf, expected);
+	}
+
+	/* Test date_msgid */
+
+	for (i = 0; i < 1000; ++i)
+	{
+		if (!date_msgid(msgids[i], DATE_MSGID_SIZE, "example.org"))
+		{
+			++errors, printf("Test11: date_msgid() failed (%s)\n", strerror(errno));
+			break;
+		}
+
+		if (msgids[i][0] != '<' || strlen(msgids[i]) < 14 || strcmp(msgids[i] + strlen(msgids[i]) - 13, "@example.org>"))
+		{
+			++errors, printf("Test12: date_msgid() failed (\"%s\")\n", msgids[i]);
+			break;
+		}
+	}
+
+	if (i == 1000)
+	{
+		qsort(msgids, 1000, DATE_MSGID_SIZE, msgid_cmp);
+
+		for (i = 1; i < 1000; ++i)
+		{
+			if (!strcmp(msgids[i - 1], msgids[i]))
+			{
+				++errors, printf("Test13: date_msgid() failed (\"%s\" repeated)\n", msgids[i]);
+				break;
+			}
+		}
+	}
+
+	/* Test date_msgid in a child process (different pid and seed) */
+
+	if (pipe(fds) == -1)
+		++errors, printf("Test14: failed to perform test: pipe() failed\n");
+	else
+	{
+		switch (pid = fork())
+		{
+			case -1:
+				++errors, printf("Test14: failed to perform test: fork() failed\n");
+				break;
+
+			case 0:
+				date_msgid(buf2, DATE_MSGID_SIZE, "example.org");
+				write(fds[1], buf2, DATE_MSGID_SIZE);
+				_exit(EXIT_SUCCESS);
+
+			default:
+				if (read(fds[0], buf2, DATE_MSGID_SIZE) != DATE_MSGID_SIZE)
+					++errors, printf("Test14: failed to read child's message id\n");
+				else if (bsearch(buf2, msgids, 1000, DATE_MSGID_SIZE, msgid_cmp))
+					++errors, printf("Test14: date_msgid() in child failed (\"%s\" repeated)\n", buf2);
+				else if (!strstr(buf2, date_base36_test(pidstr, (unsigned long)pid)))
+					++errors, printf("Test14: date_msgid() in child failed (\"%s\" doesn't contain child's pid %s)\n", buf2, pidstr);
+				waitpid(pid, NULL, 0);
+				break;
+		}
+
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	if (date_msgid(buf, 10, "example.org") || errno != ERANGE)
+		++errors, printf("Test15: date_msgid(size=10) failed (errno %d, not ERANGE)\n", errno);
+
+	if (date_msgid(buf, DATE_SIZE, "") || errno != EINVAL)
+		++errors, printf("Test16: date_msgid(\"\") failed (errno %d, not EINVAL)\n", errno);
+
+	if (errors)
+		printf("%d/16 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,42 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+#ifndef LIBSLACK_DATE_H
+#define LIBSLACK_DATE_H
+
+#include <time.h>
+
+#include <slack/hdr.h>
+
+#define DATE_SIZE 32
+#define DATE_MSGID_SIZE 256
+
+_begin_decls
+int date_clock(struct timespec *ts);
+time_t date_time(void);
+char *date_rfc5322(char *buf, size_t size, time_t t, int utc);
+char *date_rfc5322_now(char *buf, size_t size, int utc);
+char *date_msgid(char *buf, size_t size, const char *domain);
+_end_decls
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -227,6 +227,68 @@ void vverbose(size_t level, const char *format, va_list args)
 
 /*
 
+C<int debug_format(char *buf, size_t size, size_t level, const char *format)>
+
+Builds the format for a debug message in C<buf> (of C<size> bytes): the
+program's name (with any C<%> doubled), C<"debug:">, the section and
+indent for C<level>, C<format> itself, and a newline. This lets the message
+be formatted once, straight into its destination. Returns C<0> on success,
+or C<-1> if the format doesn't fit.
+
+*/
+
+static int debug_format(char *buf, size_t size, size_t level, const char *format)
+{
+	const char *name = prog_name(), *end = buf + size - 1;
+	char section[16], *s = buf, *t = section + sizeof section;
+	size_t n;
+
+	if (level & 0xffffff00)
+	{
+		*--t = ']';
+		for (n = (level & 0xffffff00) >> 8; n; n /= 10)
+			*--t = '0' + n % 10;
+		*--t = '[';
+		*--t = ' ';
+	}
+
+	if (name)
+	{
+		for (; *name && s < end; *s++ = *name++)
+			if (*name == '%' && s + 1 < end)
+				*s++ = '%';
+
+		if (*name || s + 2 > end)
+			return -1;
+
+		*s++ = ':';
+		*s++ = ' ';
+	}
+
+	if (s + 6 + (section + sizeof section - t) + (level & 0xff) > end)
+		return -1;
+
+	memcpy(s, "debug:", 6);
+	s += 6;
+	memcpy(s, t, section + sizeof section - t);
+	s += section + sizeof section - t;
+	memset(s, ' ', level & 0xff);
+	s += level & 0xff;
+
+	for (; *format && s < end; *s++ = *format++)
+	{}
+
+	if (*format || s + 1 > end)
+		return -1;
+
+	*s++ = '\n';
+	*s = '\0';
+
+	return 0;
+}
+
+/*
+
 =item C<void debugf(size_t level, const char *format, ...)>
 
 Outputs a debug message to the program's debug message destination if
@@ -246,7 +308,9 @@ surrounded by square brackets. This is followed by as many spaces as the
 debug level. This indents debug messages according to their debug level.
 C<format> is a I<printf(3)>-like format string which processes any remaining
 arguments in the same way as I<printf(3)>. The message is followed by a
-newline.
+newline. If the program has a debug message trace (see
+I<prog_set_trace(3)>), the message is recorded there instead, and formatted
+later by I<trace_decode(3)>.
 
 =cut
 
@@ -292,6 +356,20 @@ void vdebugf(size_t level, const char *format, va_list args)
 	if (debug_level_match(level))
 	{
 		char mesg[MSG_SIZE], prefix[32] = "";
+		Trace *trace;
+
+		if ((trace = prog_trace()))
+		{
+			vtrace_out(trace, level, format, args);
+			return;
+		}
+
+		if (debug_format(mesg, MSG_SIZE, level, format) == 0)
+		{
+			vmsg_out(prog_dbg(), mesg, args);
+			return;
+		}
+
 		vsnprintf(mesg, MSG_SIZE, format, args);
 
 		if (level & 0xffffff00)
@@ -312,8 +390,10 @@ Outputs an error message to the program's error message destination. If the
 program's name has been supplied using I<prog_set_name(3)>, the message will
 be preceded by the name, a colon, and a space. C<format> is a
 I<printf(3)>-like format string which processes any remaining arguments in
-the same way as I<printf(3)>. The message is followed by a newline. Returns
--1.
+the same way as I<printf(3)>. The message is followed by a newline. Any
+debug messages still waiting to be written by an asynchronous I<Msg> (see
+I<msg_create_async(3)>) are written first, so that they appear before the
+error. Returns -1.
 
 =cut
 
@@ -343,7 +423,10 @@ as for I<vprintf(3)>.
 int verror(const char *format, va_list args)
 {
 	char mesg[MSG_SIZE];
+	int errno_saved = errno;
 	vsnprintf(mesg, MSG_SIZE, format, args);
+	msg_flush(prog_dbg());
+	errno = errno_saved;
 
 	if (prog_name())
 		msg_out(prog_err(), "%s: %s\n", prog_name(), mesg);
@@ -363,8 +446,11 @@ program's name was supplied using I<prog_set_name(3)>, the message will be
 preceded by the name, a colon, and a space. This is followed by the string
 C<"fatal: ">. C<format> is a I<printf(3)>-like format string which processes
 any remaining arguments in the same way as I<printf(3)>. The message is
-followed by a newline. B<Note:> Never use this in a library. Only an
-application can decide which errors are fatal.
+followed by a newline. Any debug messages still waiting to be written by an
+asynchronous I<Msg> (see I<msg_create_async(3)>), or in the program's debug
+message trace (see I<prog_set_trace(3)>), are written first, and the
+error message is written before exiting. B<Note:> Never use this in a
+library. Only an application can decide which errors are fatal.
 
 =cut
 
@@ -393,7 +479,10 @@ void vfatal(const char *format, va_list args)
 {
 	char mesg[MSG_SIZE];
 	vsnprintf(mesg, MSG_SIZE, format, args);
+	trace_flush(prog_trace());
+	msg_flush(prog_dbg());
 	error("fatal: %s", mesg);
+	msg_flush(prog_err());
 	exit(EXIT_FAILURE);
 }
 
@@ -406,9 +495,10 @@ calls I<abort(3)>. If the program's name was supplied using
 I<prog_set_name(3)>, the message will be preceded by the name, a colon, and
 a space. This is followed by the string C<"dump: ">. C<format> is a
 I<printf(3)>-like format string which processes any remaining arguments in
-the same way as I<printf(3)>. The message is followed by a newline. B<Note:>
-Never use this in a library. Only an application can decide which errors are
-fatal.
+the same way as I<printf(3)>. The message is followed by a newline. As with
+I<fatal(3)>, waiting asynchronous debug and error messages are written
+before aborting. B<Note:> Never use this in a library. Only an application
+can decide which errors are fatal.
 
 =cut
 
@@ -437,7 +527,10 @@ void vdump(const char *format, va_list args)
 {
 	char mesg[MSG_SIZE];
 	vsnprintf(mesg, MSG_SIZE, format, args);
+	trace_flush(prog_trace());
+	msg_flush(prog_dbg());
 	error("dump: %s", mesg);
+	msg_flush(prog_err());
 	abort();
 }
 
@@ -450,7 +543,8 @@ message destination. If the program's name has been supplied using
 I<prog_set_name(3)>, the message will be preceded by the name, a colon, and
 a space. C<format> is a I<printf(3)>-like format string which processes any
 remaining arguments in the same way as I<printf(3)>. The message is followed
-by a newline. Note that this only works when the program's alert message
+by a newline. As with I<error(3)>, waiting asynchronous debug messages are
+written first. Note that this only works when the program's alert message
 destination is a simple syslog destination. If the alert message destination
 is anything else (including a multiplexing message destination containing
 syslog destinations), C<priority> is ignored.
@@ -483,8 +577,11 @@ void valert(int priority, const char *format, va_list args)
 	Msg *alert;
 	char mesg[MSG_SIZE];
 	int err;
+	int errno_saved = errno;
 
 	vsnprintf(mesg, MSG_SIZE, format, args);
+	msg_flush(prog_dbg());
+	errno = errno_saved;
 
 	alert = prog_alert();
 
@@ -853,6 +950,7 @@ Send a range of messages to default locations:
 I<libslack(3)>,
 I<msg(3)>,
 I<prog(3)>,
+I<trace(3)>,
 I<printf(3)>
 
 =head1 AUTHOR
@@ -928,6 +1026,7 @@ int main(int ac, char **av)
 	const char * const err = "err.err";
 	const char * const dbg = "err.dbg";
 	const char * const alertfile = "err.alert";
+	const char * const ordered = "err.ordered";
 	const char * const core = "core";
 	const char * const core2 = "err.core"; /* OpenBSD */
 	char buf[BUFSIZ];
@@ -1365,8 +1464,30 @@ int main(int ac, char **av)
 	else if (errno != EINVAL)
 		++errors, printf("Test19: set_errnullf(EINVAL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
+	/* Test that error(), errorsys() and alert() write waiting asynchronous debug messages first */
+
+	prog_set_debug_level(1);
+	prog_set_dbg(msg_create_async(msg_create_file(ordered), 0));
+	prog_err_file(ordered);
+	prog_alert_file(ordered);
+
+	debugf(1, "debugmsg1");
+	debugf(1, "debugmsg2");
+	error("errormsg1");
+	debugf(1, "debugmsg3");
+	errno = EINVAL;
+	errorsys("errormsg2");
+	debugf(1, "debugmsg4");
+	alert(LOG_INFO, "alertmsg");
+
+	prog_err_none();
+	prog_dbg_none();
+	prog_alert_none();
+	snprintf(buf, BUFSIZ, "debug: debugmsg1\ndebug: debugmsg2\nerrormsg1\ndebug: debugmsg3\nerrormsg2: %s\ndebug: debugmsg4\nalertmsg\n", strerror(EINVAL));
+	errors += verify(20, ordered, buf);
+
 	if (errors)
-		printf("%d/19 tests failed\n", errors);
+		printf("%d/20 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
@@ -30,8 +30,15 @@ I<libslack(fio)> - fifo and file control module and some I/O
     #include <slack/std.h>
     #include <slack/fio.h>
 
+    typedef struct LineReader LineReader;
+
     char *fgetline(char *line, size_t size, FILE *stream);
     char *fgetline_unlocked(char *line, size_t size, FILE *stream);
+    LineReader *linereader_create(int fd, size_t size);
+    LineReader *linereader_create_buffer(char *buf, size_t size);
+    void linereader_release(LineReader *reader);
+    void *linereader_destroy(LineReader **reader);
+    ssize_t linereader_getline(LineReader *reader, char **line);
     int read_timeout(int fd, long sec, long usec);
     int write_timeout(int fd, long sec, long usec);
     int rw_timeout(int fd, long sec, long usec);
@@ -55,6 +62,12 @@ no matter what line endings are used; timeouts for read/write operations
 without signals; exclusively opening a fifo for reading; and some random
 shorthand functions for manipulating file flags and locks.
 
+Lines can be read from I<stdio> streams with I<fgetline(3)>, which reads
+them a byte at a time. A I<LineReader> reads the same lines from a file
+descriptor in large blocks instead (or from memory), finds line endings with
+I<memchr(3)>, and returns each line in place, without copying it. This is
+many times faster for large inputs.
+
 =over 4
 
 =cut
@@ -79,8 +92,22 @@ shorthand functions for manipulating file flags and locks.
 #include <sys/stat.h>
 
 #include "err.h"
+#include "mem.h"
 #include "fio.h"
 
+struct LineReader
+{
+	int fd;                       /* the file descriptor to read from, or -1 for a buffer */
+	char *buf;                    /* the buffer */
+	size_t size;                  /* the size of the buffer */
+	size_t max;                   /* maximum length of a line (or part of one) */
+	char *start;                  /* the start of the next line */
+	char *end;                    /* the end of the data in the buffer */
+	char *cr;                     /* the next "\r" at or after start, or null */
+	char *cr_end;                 /* the end of the search for cr */
+	int eof;                      /* whether or not the end of input has been read */
+};
+
 #ifndef TEST
 
 void (flockfile)(FILE *stream); /* Missing from old glibc headers */
@@ -179,6 +206,294 @@ char *fgetline_unlocked(char *line, size_t size, FILE *stream)
 
 /*
 
+=item C<LineReader *linereader_create(int fd, size_t size)>
+
+Creates a line reader that reads from the file descriptor, C<fd>, in blocks
+into a buffer of C<size> bytes. Lines are returned by
+I<linereader_getline(3)> in the same way as I<fgetline(3)> with a buffer of
+C<size> bytes would return them (i.e. lines longer than C<size - 1> bytes
+are returned in pieces), except that they are not copied. C<size> must be at
+least C<2>, but it should be much larger for efficiency (e.g. C<65536>).
+C<fd> is not closed when the line reader is released. It is the caller's
+responsibility to deallocate the new line reader with
+I<linereader_release(3)> or I<linereader_destroy(3)>. On success, returns
+the new line reader. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+LineReader *linereader_create(int fd, size_t size)
+{
+	LineReader *reader;
+
+	if (fd < 0 || size < 2)
+		return set_errnull(EINVAL);
+
+	if (!(reader = mem_new(LineReader)))
+		return NULL;
+
+	if (!(reader->buf = mem_create(size, char)))
+	{
+		mem_release(reader);
+		return NULL;
+	}
+
+	reader->fd = fd;
+	reader->size = size;
+	reader->max = size - 1;
+	reader->start = reader->end = reader->cr_end = reader->buf;
+	reader->cr = NULL;
+	reader->eof = 0;
+
+	return reader;
+}
+
+/*
+
+=item C<LineReader *linereader_create_buffer(char *buf, size_t size)>
+
+Creates a line reader that returns the lines in the C<size> bytes of memory
+pointed to by C<buf> (e.g. a file mapped with I<mmap(2)>). There is no limit
+on the length of lines. C<buf> must remain valid until the line reader is
+released, and it must be writable, because line endings that aren't C<"\n">
+are replaced with C<"\n"> as their lines are returned. If C<buf> is a
+private mapping of a file, only the pages that contain such line endings are
+copied. It is the caller's responsibility to deallocate the new line reader
+with I<linereader_release(3)> or I<linereader_destroy(3)>. On success,
+returns the new line reader. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+LineReader *linereader_create_buffer(char *buf, size_t size)
+{
+	LineReader *reader;
+
+	if (!buf)
+		return set_errnull(EINVAL);
+
+	if (!(reader = mem_new(LineReader)))
+		return NULL;
+
+	reader->fd = -1;
+	reader->buf = buf;
+	reader->size = size;
+	reader->max = (size_t)-1;
+	reader->start = reader->cr_end = buf;
+	reader->end = buf + size;
+	reader->cr = NULL;
+	reader->eof = 1;
+
+	return reader;
+}
+
+/*
+
+=item C<void linereader_release(LineReader *reader)>
+
+Releases (deallocates) C<reader>. Lines that it returned are no longer
+valid.
+
+=cut
+
+*/
+
+void linereader_release(LineReader *reader)
+{
+	if (!reader)
+		return;
+
+	if (reader->fd != -1)
+		mem_release(reader->buf);
+
+	mem_release(reader);
+}
+
+/*
+
+=item C<void *linereader_destroy(LineReader **reader)>
+
+Destroys (deallocates and sets to C<null>) C<*reader>. Returns C<null>.
+
+=cut
+
+*/
+
+void *linereader_destroy(LineReader **reader)
+{
+	if (reader && *reader)
+	{
+		linereader_release(*reader);
+		*reader = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+C<static char *linereader_find(LineReader *reader, char *limit)>
+
+Returns the first C<"\n"> or C<"\r"> byte in C<reader>'s buffer between the
+start of the next line and C<limit>, or C<null> if there isn't one. Each
+search uses I<memchr(3)>, which is vectorised on most systems. The position
+of the next C<"\r"> is remembered, so that input without any only costs one
+extra search per block, rather than one per line.
+
+*/
+
+static char *linereader_find(LineReader *reader, char *limit)
+{
+	char *start = reader->start;
+	char *nl, *from;
+
+	if (!reader->cr || reader->cr < start)
+	{
+		from = (reader->cr_end > start) ? reader->cr_end : start;
+		reader->cr = (from < reader->end) ? memchr(from, '\r', reader->end - from) : NULL;
+		reader->cr_end = (reader->cr) ? reader->cr + 1 : reader->end;
+	}
+
+	nl = memchr(start, '\n', limit - start);
+
+	if (reader->cr && reader->cr < limit && (!nl || reader->cr < nl))
+		return reader->cr;
+
+	return nl;
+}
+
+/*
+
+C<static int linereader_fill(LineReader *reader)>
+
+Moves the unread part of C<reader>'s buffer to the start of the buffer, and
+reads as much more as will fit (or as much as is available). On success,
+returns C<0>. On error, returns C<-1> with C<errno> set by I<read(2)>.
+
+*/
+
+static int linereader_fill(LineReader *reader)
+{
+	size_t shift = reader->start - reader->buf;
+	ssize_t bytes;
+
+	if (shift)
+	{
+		memmove(reader->buf, reader->start, reader->end - reader->start);
+
+		if (reader->cr_end < reader->start)
+			reader->cr_end = reader->start;
+
+		if (reader->cr && reader->cr < reader->start)
+			reader->cr = NULL;
+
+		if (reader->cr)
+			reader->cr -= shift;
+
+		reader->cr_end -= shift;
+		reader->start -= shift;
+		reader->end -= shift;
+	}
+
+	while ((bytes = read(reader->fd, reader->end, reader->buf + reader->size - reader->end)) == -1)
+		if (errno != EINTR)
+			return -1;
+
+	if (bytes == 0)
+		reader->eof = 1;
+
+	reader->end += bytes;
+
+	return 0;
+}
+
+/*
+
+=item C<ssize_t linereader_getline(LineReader *reader, char **line)>
+
+Sets C<*line> to point to the next line from C<reader> without copying it.
+Line endings are recognised and returned exactly as I<fgetline(3)> does:
+UNIX (C<"\n">), DOS/Windows (C<"\r\n">) and old Macintosh (C<"\r">) line
+endings (even different line endings in the same input) are all returned as
+a single C<"\n"> byte at the end of the line. The last line has no C<"\n">
+if the input doesn't end with a line ending. Note that the line is not
+C<nul>-terminated. It is valid until the next call to
+I<linereader_getline(3)> or I<linereader_release(3)>, and it may be
+modified in place. On success, returns the length of the line (including
+its C<"\n">). At the end of input, returns C<0>. On error, returns C<-1>
+with C<errno> set appropriately.
+
+    LineReader *reader = linereader_create(STDIN_FILENO, 65536);
+    char *line;
+    ssize_t len;
+
+    while ((len = linereader_getline(reader, &line)) > 0)
+        fwrite(line, 1, len, stdout);
+
+    linereader_release(reader);
+
+=cut
+
+*/
+
+ssize_t linereader_getline(LineReader *reader, char **line)
+{
+	char *start, *limit, *p;
+	size_t avail;
+
+	if (!reader || !line)
+		return set_errno(EINVAL);
+
+	for (;;)
+	{
+		start = reader->start;
+		avail = reader->end - start;
+		limit = start + ((avail < reader->max) ? avail : reader->max);
+
+		/* A "\r" at the end of the buffer might be the start of "\r\n" */
+
+		if ((p = linereader_find(reader, limit)) && (*p == '\n' || p + 1 < reader->end || reader->eof))
+		{
+			if (*p == '\r')
+			{
+				reader->start = (p + 1 < reader->end && p[1] == '\n') ? p + 2 : p + 1;
+				*p = '\n';
+			}
+			else
+				reader->start = p + 1;
+
+			*line = start;
+
+			return p + 1 - start;
+		}
+
+		if (!p && avail >= reader->max)
+		{
+			reader->start = limit;
+			*line = start;
+
+			return limit - start;
+		}
+
+		if (!p && reader->eof)
+		{
+			reader->start = reader->end;
+			*line = start;
+
+			return avail;
+		}
+
+		if (linereader_fill(reader) == -1)
+			return -1;
+	}
+}
+
+/*
+
 =item C<int read_timeout(int fd, long sec, long usec)>
 
 Performs a I<select(2)> on a single file descriptor, C<fd>, for reading and
@@ -977,8 +1292,172 @@ I<mkfifo(2)>
 
 #ifdef TEST
 
+#include <time.h>
+#include <sys/mman.h>
+
 #include <slack/fio.h>
 
+/*
+
+Writes contents to path, then reads it back with fgetline() using a buffer
+of size bytes, and with a line reader over a file descriptor with the same
+size (and over a copy in memory when size is large enough that fgetline()
+doesn't split any lines). Returns the number of differences.
+
+*/
+
+static int compare_lines(const char *path, const char *contents, size_t length, size_t size)
+{
+	LineReader *reader[2] = { NULL, NULL };
+	char *expected, *copy, *line;
+	FILE *file;
+	ssize_t len;
+	int fd, i, differences = 0;
+
+	if (!(file = fopen(path, "wb")) || fwrite(contents, 1, length, file) != length || fclose(file))
+		return 1;
+
+	if (!(expected = malloc(size)) || !(copy = malloc(length + 1)))
+		return 1;
+
+	memcpy(copy, contents, length);
+
+	if (!(file = fopen(path, "rb")) || (fd = open(path, O_RDONLY)) == -1)
+		return 1;
+
+	reader[0] = linereader_create(fd, size);
+	if (size > length + 1)
+		reader[1] = linereader_create_buffer(copy, length);
+
+	for (;;)
+	{
+		char *ret = fgetline(expected, size, file);
+
+		for (i = 0; i < 2; ++i)
+		{
+			if (!reader[i])
+				continue;
+
+			len = linereader_getline(reader[i], &line);
+
+			if (!ret && len != 0)
+				++differences;
+			else if (ret && (len != strlen(expected) || memcmp(line, expected, len)))
+				++differences;
+		}
+
+		if (!ret)
+			break;
+	}
+
+	linereader_destroy(&reader[0]);
+	linereader_destroy(&reader[1]);
+	close(fd);
+	fclose(file);
+	unlink(path);
+	free(expected);
+	free(copy);
+
+	return differences;
+}
+
+#define BENCH_SIZE (64 * 1024 * 1024)
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec end[1];
+
+	clock_gettime(CLOCK_MONOTONIC, end);
+
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+
+Compares the speed of fgetline() with a line reader over a file descriptor
+and over a private mapping of the file, for 64MiB of lines of 0 to 99 bytes
+with UNIX and DOS line endings.
+
+*/
+
+static void bench(const char *path)
+{
+	static const char * const endings[] = { "\n", "\r\n" };
+	char line[BUFSIZ], *buf, *text;
+	LineReader *reader;
+	struct timespec start[1];
+	double secs[3];
+	size_t bytes[3];
+	ssize_t len;
+	size_t i, n;
+	FILE *file;
+	int fd;
+
+	printf("%-6s %10s %10s %10s (GB/s, %d MiB)\n", "ending", "fgetline", "fd", "mmap", BENCH_SIZE >> 20);
+
+	for (i = 0; i < sizeof endings / sizeof *endings; ++i)
+	{
+		if (!(file = fopen(path, "wb")))
+			exit(EXIT_FAILURE);
+
+		srand(1);
+
+		for (n = 0; n < BENCH_SIZE; )
+		{
+			size_t length = rand() % 100;
+
+			memset(line, 'x', length);
+			strcpy(line + length, endings[i]);
+			fputs(line, file);
+			n += length + strlen(endings[i]);
+		}
+
+		fclose(file);
+
+		/* fgetline() (which copies each line into line) */
+
+		if (!(file = fopen(path, "rb")))
+			exit(EXIT_FAILURE);
+
+		clock_gettime(CLOCK_MONOTONIC, start);
+		for (bytes[0] = 0; fgetline(line, BUFSIZ, file); bytes[0] += strlen(line))
+			;
+		secs[0] = elapsed(start);
+		fclose(file);
+
+		/* A line reader over a file descriptor */
+
+		if ((fd = open(path, O_RDONLY)) == -1 || !(reader = linereader_create(fd, 65536)))
+			exit(EXIT_FAILURE);
+
+		clock_gettime(CLOCK_MONOTONIC, start);
+		for (bytes[1] = 0; (len = linereader_getline(reader, &text)) > 0; bytes[1] += len)
+			;
+		secs[1] = elapsed(start);
+		linereader_destroy(&reader);
+
+		/* A line reader over a private mapping */
+
+		clock_gettime(CLOCK_MONOTONIC, start);
+		if ((buf = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED || !(reader = linereader_create_buffer(buf, n)))
+			exit(EXIT_FAILURE);
+		for (bytes[2] = 0; (len = linereader_getline(reader, &text)) > 0; bytes[2] += len)
+			;
+		secs[2] = elapsed(start);
+		linereader_destroy(&reader);
+		munmap(buf, n);
+		close(fd);
+		unlink(path);
+
+		if (bytes[1] != bytes[0] || bytes[2] != bytes[0])
+			printf("bytes differ: %lu %lu %lu\n", (unsigned long)bytes[0], (unsigned long)bytes[1], (unsigned long)bytes[2]);
+
+		printf("%-6s %10.2f %10.2f %10.2f\n", (i) ? "\\r\\n" : "\\n", n / secs[0] / 1e9, n / secs[1] / 1e9, n / secs[2] / 1e9);
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
 int main(int ac, char **av)
 {
 	const char * const fifoname = "./fio.fifo";
@@ -992,10 +1471,13 @@ int main(int ac, char **av)
 
 	if (ac == 2 && !strcmp(av[1], "help"))
 	{
-		printf("usage: %s\n", *av);
+		printf("usage: %s [bench]\n", *av);
 		return EXIT_SUCCESS;
 	}
 
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench(filename);
+
 	printf("Testing: %s\n", "fio");
 
 	umask(0);
@@ -1080,6 +1562,84 @@ int main(int ac, char **av)
 	TEST_FGETLINE(18, line, 3, "abc\r", "ab", "c\n", (char *)NULL)
 	TEST_FGETLINE(19, NULL, 0, "abc\r", (char *)NULL, (char *)NULL, (char *)NULL)
 
+	/* Test linereader_getline() against fgetline() */
+
+	{
+		static const char * const contents[] =
+		{
+			"abc\ndef\r\nghi\r", "abc\rdef\nghi\r\n", "abc\r\ndef\rghi\n", "abc\ndef\rghi",
+			"", "abc", "abc\n", "abc\r\n", "abc\r", "\r\r\n\n\r", "ab\r\ncd\r\r\n"
+		};
+		static const size_t sizes[] = { 2, 3, 4, 5, BUFSIZ };
+		char random[200];
+		size_t c, s;
+		int differences;
+
+		for (c = 0; c < sizeof contents / sizeof *contents; ++c)
+			for (s = 0; s < sizeof sizes / sizeof *sizes; ++s)
+				if ((differences = compare_lines(filename, contents[c], strlen(contents[c]), sizes[s])))
+					++errors, printf("Test37: linereader_getline() differed from fgetline() %d times (contents %d, size %d)\n", differences, (int)c, (int)sizes[s]);
+
+		/* Random mixtures of line endings, split across blocks everywhere */
+
+		srand(37);
+
+		for (differences = 0, c = 0; c < 1000; ++c)
+		{
+			size_t length = rand() % sizeof random;
+
+			for (s = 0; s < length; ++s)
+				random[s] = "ab\r\n"[rand() % 4];
+
+			differences += compare_lines(filename, random, length, 2 + rand() % 16);
+			differences += compare_lines(filename, random, length, BUFSIZ);
+		}
+
+		if (differences)
+			++errors, printf("Test38: linereader_getline() differed from fgetline() %d times for random input\n", differences);
+	}
+
+	{
+		LineReader *reader;
+		char *text;
+
+		if (linereader_create(-1, BUFSIZ) || errno != EINVAL)
+			++errors, printf("Test39: linereader_create(-1, BUFSIZ) failed (errno %d, not EINVAL)\n", errno);
+
+		if (linereader_create(STDIN_FILENO, 1) || errno != EINVAL)
+			++errors, printf("Test40: linereader_create(STDIN_FILENO, 1) failed (errno %d, not EINVAL)\n", errno);
+
+		if (linereader_create_buffer(NULL, 0) || errno != EINVAL)
+			++errors, printf("Test41: linereader_create_buffer(NULL, 0) failed (errno %d, not EINVAL)\n", errno);
+
+		if (linereader_getline(NULL, &text) != -1 || errno != EINVAL)
+			++errors, printf("Test42: linereader_getline(NULL) failed (errno %d, not EINVAL)\n", errno);
+
+		if (!(reader = linereader_create_buffer(line, 0)))
+			++errors, printf("Test43: linereader_create_buffer(line, 0) failed (%s)\n", strerror(errno));
+		else
+		{
+			if (linereader_getline(reader, &text) != 0)
+				++errors, printf("Test44: linereader_getline() failed to return 0 for empty input\n");
+
+			linereader_destroy(&reader);
+			if (reader)
+				++errors, printf("Test45: linereader_destroy() failed to set reader to null\n");
+		}
+
+		/* Read errors are reported */
+
+		if (!(reader = linereader_create(STDOUT_FILENO + 1000, BUFSIZ)))
+			++errors, printf("Test46: linereader_create(bad fd) failed (%s)\n", strerror(errno));
+		else
+		{
+			if (linereader_getline(reader, &text) != -1 || errno != EBADF)
+				++errors, printf("Test47: linereader_getline(bad fd) failed (errno %d, not EBADF)\n", errno);
+
+			linereader_release(reader);
+		}
+	}
+
 	/* Test read_timeout() and write_timeout() */
 
 	if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, S_IRUSR | S_IWUSR)) == -1)
@@ -1130,7 +1690,7 @@ int main(int ac, char **av)
 	TEST_ERR(36, nap(0, -1))
 
 	if (errors)
-		printf("%d/36 tests failed\n", errors);
+		printf("%d/47 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
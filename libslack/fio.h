@@ -27,9 +27,16 @@
 
 #include <slack/hdr.h>
 
+typedef struct LineReader LineReader;
+
 _begin_decls
 char *fgetline(char *line, size_t size, FILE *stream);
 char *fgetline_unlocked(char *line, size_t size, FILE *stream);
+LineReader *linereader_create(int fd, size_t size);
+LineReader *linereader_create_buffer(char *buf, size_t size);
+void linereader_release(LineReader *reader);
+void *linereader_destroy(LineReader **reader);
+ssize_t linereader_getline(LineReader *reader, char **line);
 int read_timeout(int fd, long sec, long usec);
 int write_timeout(int fd, long sec, long usec);
 int rw_timeout(int fd, long sec, long usec);
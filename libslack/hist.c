@@ -0,0 +1,1375 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<libslack(hist)> - high dynamic range (latency) histogram module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/hist.h>
+
+    typedef struct Hist Hist;
+
+    Hist *hist_create(unsigned long long highest, int digits);
+    void hist_release(Hist *hist);
+    void *hist_destroy(Hist **hist);
+    int hist_record(Hist *hist, unsigned long long value);
+    int hist_record_n(Hist *hist, unsigned long long value, unsigned long long count);
+    int hist_add(Hist *hist, const Hist *src);
+    void hist_reset(Hist *hist);
+    unsigned long long hist_count(const Hist *hist);
+    unsigned long long hist_min(const Hist *hist);
+    unsigned long long hist_max(const Hist *hist);
+    double hist_mean(const Hist *hist);
+    unsigned long long hist_percentile(const Hist *hist, double percentile);
+    ssize_t hist_encode(const Hist *hist, void *buf, size_t size);
+    Hist *hist_decode(const void *buf, size_t size);
+
+=head1 DESCRIPTION
+
+This module provides high dynamic range histograms, in the manner of Gil
+Tene's I<HdrHistogram>. They count values (e.g. latencies in nanoseconds)
+from C<0> up to some highest value, to a fixed number of significant
+decimal digits. For example, with 3 digits, values up to 1000 are counted
+exactly, values up to a million are counted to the nearest 1000 or better,
+and so on. So the 50th, 99th or 99.9th percentile can be found to within
+0.1%, no matter how many values were recorded, and recording a value takes
+the same (small) constant time no matter how large it is.
+
+Histograms with the same number of digits can be added together quickly,
+so each thread can record into its own histogram, and the histograms can
+be added up later (or several threads can record into one histogram).
+Histograms can also be encoded in a compact binary form (from a few bytes
+to a few KB, depending on how widely the values vary) that can be saved or
+sent elsewhere, and decoded later.
+
+Each power of two up to C<highest> has its own set of counters, one for
+each of the smallest power of two that is at least C<10^digits> (e.g. 1024
+counters for 3 digits), plus twice that for the lowest values. Counters are
+8 bytes, so a histogram for up to an hour in nanoseconds, to 3 digits,
+takes about 270KB.
+
+=over 4
+
+=cut
+
+*/
+
+#include "config.h"
+#include "std.h"
+
+#include "hist.h"
+#include "mem.h"
+#include "err.h"
+
+struct Hist
+{
+	unsigned long long highest; /* the highest value that can be recorded */
+	int digits;           /* the number of significant decimal digits */
+	int half_magnitude;   /* log2(half_count) */
+	unsigned long long half_count; /* half the number of counters per power of two */
+	unsigned long long mask; /* values below this are counted exactly */
+	size_t length;        /* the number of counters */
+	unsigned long long *counts; /* the counters */
+	unsigned long long total; /* the number of values recorded */
+	unsigned long long min; /* the lowest value recorded (or ULLONG_MAX) */
+	unsigned long long max; /* the highest value recorded */
+	pthread_mutex_t lock; /* guards everything when atomics aren't available */
+};
+
+#ifndef TEST
+
+#ifdef __GNUC__
+
+#define hist_atomic_load(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define hist_atomic_store(var, val) __atomic_store_n(&(var), (val), __ATOMIC_RELAXED)
+#define hist_atomic_add(var, val) __atomic_add_fetch(&(var), (val), __ATOMIC_RELAXED)
+#define hist_atomic_swap(var, old, val) __atomic_compare_exchange_n(&(var), &(old), (val), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#define hist_enter(hist)
+#define hist_leave(hist)
+#define hist_log2(value) (63 - __builtin_clzll(value))
+
+#else
+
+#define hist_atomic_load(var) (var)
+#define hist_atomic_store(var, val) ((var) = (val))
+#define hist_atomic_add(var, val) ((var) += (val))
+#define hist_atomic_swap(var, old, val) ((var) = (val), 1)
+#define hist_enter(hist) pthread_mutex_lock(&((Hist *)(hist))->lock)
+#define hist_leave(hist) pthread_mutex_unlock(&((Hist *)(hist))->lock)
+#define hist_log2(value) hist_log2_slow(value)
+
+static int hist_log2_slow(unsigned long long value)
+{
+	int bits;
+
+	for (bits = -1; value; value >>= 1)
+		++bits;
+
+	return bits;
+}
+
+#endif
+
+/* Varints in the encoded form are at most this many bytes */
+
+#define HIST_VARINT 10
+#define HIST_VERSION 1
+
+/*
+
+C<size_t hist_index(const Hist *hist, unsigned long long value)>
+
+Returns the index of the counter for C<value>. Values below C<hist->mask>
+(i.e. with fewer than C<half_magnitude + 1> bits) have their own counters.
+After that, each power of two has C<half_count> counters, each for the
+values that share the same C<half_magnitude + 1> most significant bits.
+
+*/
+
+static size_t hist_index(const Hist *hist, unsigned long long value)
+{
+	int bucket = hist_log2(value | hist->mask) - hist->half_magnitude;
+
+	return ((size_t)(bucket + 1) << hist->half_magnitude) + (size_t)((value >> bucket) - hist->half_count);
+}
+
+/*
+
+C<unsigned long long hist_lowest(const Hist *hist, size_t index, unsigned long long *size)>
+
+Returns the lowest value counted by the counter at C<index>. If C<size> is
+not C<null>, the number of values counted by the counter is stored there.
+
+*/
+
+static unsigned long long hist_lowest(const Hist *hist, size_t index, unsigned long long *size)
+{
+	int bucket = (int)(index >> hist->half_magnitude) - 1;
+	unsigned long long sub = (index & (hist->half_count - 1)) + hist->half_count;
+
+	if (bucket < 0)
+	{
+		sub -= hist->half_count;
+		bucket = 0;
+	}
+
+	if (size)
+		*size = 1ULL << bucket;
+
+	return sub << bucket;
+}
+
+/*
+
+C<unsigned long long hist_highest(const Hist *hist, size_t index)>
+
+Returns the highest value counted by the counter at C<index>.
+
+*/
+
+static unsigned long long hist_highest(const Hist *hist, size_t index)
+{
+	unsigned long long size, lowest = hist_lowest(hist, index, &size);
+
+	return lowest + (size - 1);
+}
+
+/*
+
+=item C<Hist *hist_create(unsigned long long highest, int digits)>
+
+Creates a histogram that counts values from C<0> to C<highest> to C<digits>
+significant decimal digits. C<highest> must be at least C<2>, and
+C<digits> must be from C<1> to C<5>. It is the caller's responsibility to
+deallocate the new histogram with I<hist_release(3)> or
+I<hist_destroy(3)>. It is strongly recommended to use I<hist_destroy(3)>,
+because it also sets the pointer variable to C<null>. On success, returns
+the new histogram. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+Hist *hist_create(unsigned long long highest, int digits)
+{
+	unsigned long long resolution, count, untrackable;
+	int magnitude, buckets, i;
+	Hist *hist;
+
+	if (highest < 2 || digits < 1 || digits > 5)
+		return set_errnull(EINVAL);
+
+	/* Counters per power of two, for 1 in 10^digits resolution */
+
+	for (resolution = 2, i = 0; i < digits; ++i)
+		resolution *= 10;
+
+	for (magnitude = 0, count = 1; count < resolution; count <<= 1)
+		++magnitude;
+
+	/* Powers of two needed to reach highest */
+
+	for (buckets = 1, untrackable = count; untrackable <= highest; ++buckets)
+	{
+		if (untrackable > ULLONG_MAX / 2)
+		{
+			++buckets;
+			break;
+		}
+
+		untrackable <<= 1;
+	}
+
+	if (!(hist = mem_new(Hist)))
+		return NULL;
+
+	memset(hist, 0, sizeof(Hist));
+	hist->highest = highest;
+	hist->digits = digits;
+	hist->half_magnitude = magnitude - 1;
+	hist->half_count = count >> 1;
+	hist->mask = count - 1;
+	hist->length = (size_t)(buckets + 1) * hist->half_count;
+	hist->min = ULLONG_MAX;
+
+	if (!(hist->counts = mem_create(hist->length, unsigned long long)))
+	{
+		mem_release(hist);
+		return NULL;
+	}
+
+	memset(hist->counts, 0, hist->length * sizeof(unsigned long long));
+	pthread_mutex_init(&hist->lock, NULL);
+
+	return hist;
+}
+
+/*
+
+=item C<void hist_release(Hist *hist)>
+
+Releases (deallocates) C<hist>.
+
+=cut
+
+*/
+
+void hist_release(Hist *hist)
+{
+	if (!hist)
+		return;
+
+	pthread_mutex_destroy(&hist->lock);
+	mem_release(hist->counts);
+	mem_release(hist);
+}
+
+/*
+
+=item C<void *hist_destroy(Hist **hist)>
+
+Destroys (deallocates and sets to C<null>) C<*hist>. Returns C<null>.
+
+=cut
+
+*/
+
+void *hist_destroy(Hist **hist)
+{
+	if (hist && *hist)
+	{
+		hist_release(*hist);
+		*hist = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<int hist_record(Hist *hist, unsigned long long value)>
+
+Records C<value> in C<hist>. On success, returns C<0>. On error, returns
+C<-1> with C<errno> set appropriately (C<ERANGE> when C<value> is higher
+than the highest value that C<hist> can record).
+
+=cut
+
+*/
+
+int hist_record(Hist *hist, unsigned long long value)
+{
+	return hist_record_n(hist, value, 1);
+}
+
+/*
+
+=item C<int hist_record_n(Hist *hist, unsigned long long value, unsigned long long count)>
+
+Records C<value> in C<hist> C<count> times. On success, returns C<0>. On
+error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int hist_record_n(Hist *hist, unsigned long long value, unsigned long long count)
+{
+	unsigned long long old;
+
+	if (!hist)
+		return set_errno(EINVAL);
+
+	if (value > hist->highest)
+		return set_errno(ERANGE);
+
+	hist_enter(hist);
+	hist_atomic_add(hist->counts[hist_index(hist, value)], count);
+	hist_atomic_add(hist->total, count);
+
+	for (old = hist_atomic_load(hist->min); value < old; )
+		if (hist_atomic_swap(hist->min, old, value))
+			break;
+
+	for (old = hist_atomic_load(hist->max); value > old; )
+		if (hist_atomic_swap(hist->max, old, value))
+			break;
+
+	hist_leave(hist);
+
+	return 0;
+}
+
+/*
+
+=item C<int hist_add(Hist *hist, const Hist *src)>
+
+Adds the values recorded in C<src> to C<hist>. This is quick when C<hist>
+and C<src> have the same number of digits. Otherwise, each of C<src>'s
+counters is recorded in C<hist> as the middle of the values that it
+counts. On success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately (C<ERANGE> when C<src> contains values higher than C<hist>
+can record, in which case C<hist> is unchanged).
+
+=cut
+
+*/
+
+int hist_add(Hist *hist, const Hist *src)
+{
+	unsigned long long count, size, value, min, max;
+	size_t i, length;
+
+	if (!hist || !src || hist == src)
+		return set_errno(EINVAL);
+
+	if (!hist_count(src))
+		return 0;
+
+	min = hist_min(src);
+
+	if ((max = hist_max(src)) > hist->highest)
+		return set_errno(ERANGE);
+
+	length = hist_index(src, max) + 1;
+
+	for (i = 0; i < length; ++i)
+	{
+		if (!(count = hist_atomic_load(src->counts[i])))
+			continue;
+
+		if (hist->digits == src->digits)
+		{
+			hist_enter(hist);
+			hist_atomic_add(hist->counts[i], count);
+			hist_atomic_add(hist->total, count);
+			hist_leave(hist);
+		}
+		else
+		{
+			value = hist_lowest(src, i, &size) + size / 2;
+			hist_record_n(hist, (value < min) ? min : (value > max) ? max : value, count);
+		}
+	}
+
+	/* Keep the exact extremes (recording them zero times) */
+
+	hist_record_n(hist, min, 0);
+	hist_record_n(hist, max, 0);
+
+	return 0;
+}
+
+/*
+
+=item C<void hist_reset(Hist *hist)>
+
+Forgets all values recorded in C<hist>. This should not be called while
+other threads are recording in C<hist>.
+
+=cut
+
+*/
+
+void hist_reset(Hist *hist)
+{
+	if (!hist)
+		return;
+
+	hist_enter(hist);
+	memset(hist->counts, 0, hist->length * sizeof(unsigned long long));
+	hist_atomic_store(hist->total, 0);
+	hist_atomic_store(hist->min, ULLONG_MAX);
+	hist_atomic_store(hist->max, 0);
+	hist_leave(hist);
+}
+
+/*
+
+=item C<unsigned long long hist_count(const Hist *hist)>
+
+Returns the number of values recorded in C<hist>. On error, returns C<0>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+unsigned long long hist_count(const Hist *hist)
+{
+	if (!hist)
+	{
+		set_errno(EINVAL);
+		return 0;
+	}
+
+	return hist_atomic_load(hist->total);
+}
+
+/*
+
+=item C<unsigned long long hist_min(const Hist *hist)>
+
+Returns the lowest value recorded in C<hist> (exactly), or C<0> if none
+have been recorded. On error, returns C<0> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+unsigned long long hist_min(const Hist *hist)
+{
+	unsigned long long min;
+
+	if (!hist)
+	{
+		set_errno(EINVAL);
+		return 0;
+	}
+
+	min = hist_atomic_load(hist->min);
+
+	return (min == ULLONG_MAX) ? 0 : min;
+}
+
+/*
+
+=item C<unsigned long long hist_max(const Hist *hist)>
+
+Returns the highest value recorded in C<hist> (exactly), or C<0> if none
+have been recorded. On error, returns C<0> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+unsigned long long hist_max(const Hist *hist)
+{
+	if (!hist)
+	{
+		set_errno(EINVAL);
+		return 0;
+	}
+
+	return hist_atomic_load(hist->max);
+}
+
+/*
+
+=item C<double hist_mean(const Hist *hist)>
+
+Returns the mean of the values recorded in C<hist> (to C<hist>'s
+precision), or C<0.0> if none have been recorded. On error, returns C<0.0>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+double hist_mean(const Hist *hist)
+{
+	unsigned long long total, count, size, lowest;
+	double sum = 0.0;
+	size_t i, length;
+
+	if (!hist)
+	{
+		set_errno(EINVAL);
+		return 0.0;
+	}
+
+	if (!(total = hist_count(hist)))
+		return 0.0;
+
+	length = hist_index(hist, hist_max(hist)) + 1;
+
+	for (i = 0; i < length; ++i)
+	{
+		if ((count = hist_atomic_load(hist->counts[i])))
+		{
+			lowest = hist_lowest(hist, i, &size);
+			sum += (double)(lowest + size / 2) * count;
+		}
+	}
+
+	return sum / total;
+}
+
+/*
+
+=item C<unsigned long long hist_percentile(const Hist *hist, double percentile)>
+
+Returns the value that C<percentile> percent of the values recorded in
+C<hist> are less than or equal to (to C<hist>'s precision, but never lower
+than the lowest value recorded or higher than the highest). C<percentile>
+must be from C<0.0> to C<100.0>. For example, C<hist_percentile(hist,
+99.9)> returns the 99.9th percentile. This is the nearest-rank percentile,
+as in HdrHistogram: the value at rank C<ceil(percentile / 100 * count)> (at
+least C<1>), so a percentile is never lower than the values it must cover
+(e.g. the 94th percentile of 10 values is the 10th value, not the 9th).
+Returns C<0> if no values have been
+recorded. On error, returns C<0> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+unsigned long long hist_percentile(const Hist *hist, double percentile)
+{
+	unsigned long long total, target, seen, value, min, max;
+	double rank;
+	size_t i, length;
+
+	if (!hist || percentile < 0.0 || percentile > 100.0)
+	{
+		set_errno(EINVAL);
+		return 0;
+	}
+
+	if (!(total = hist_count(hist)))
+		return 0;
+
+	min = hist_min(hist);
+	max = hist_max(hist);
+
+	/* The nearest rank (rounding up, but not for floating point noise) */
+
+	rank = percentile / 100.0 * total;
+	target = (unsigned long long)rank;
+
+	if (rank - target > rank * 1e-12)
+		++target;
+
+	if (target == 0)
+		target = 1;
+
+	length = hist_index(hist, max) + 1;
+	value = max;
+
+	for (seen = 0, i = 0; i < length; ++i)
+	{
+		if ((seen += hist_atomic_load(hist->counts[i])) >= target)
+		{
+			value = hist_highest(hist, i);
+			break;
+		}
+	}
+
+	return (value < min) ? min : (value > max) ? max : value;
+}
+
+/*
+
+C<size_t hist_put(unsigned char *buf, size_t size, size_t pos, unsigned long long value)>
+
+Stores C<value> as a varint (7 bits per byte, least significant first) at
+C<buf[pos]>, if it fits in C<size> bytes. Returns the position after it.
+
+*/
+
+static size_t hist_put(unsigned char *buf, size_t size, size_t pos, unsigned long long value)
+{
+	do
+	{
+		if (pos < size)
+			buf[pos] = (value & 0x7f) | ((value > 0x7f) ? 0x80 : 0);
+
+		++pos;
+	}
+	while (value >>= 7);
+
+	return pos;
+}
+
+/*
+
+C<int hist_get(const unsigned char *buf, size_t size, size_t *pos, unsigned long long *value)>
+
+Retrieves a varint from C<buf[*pos]> into C<*value>, and advances C<*pos>.
+On success, returns C<0>. On error (i.e. the varint is truncated or too
+long), returns C<-1>.
+
+*/
+
+static int hist_get(const unsigned char *buf, size_t size, size_t *pos, unsigned long long *value)
+{
+	int shift;
+
+	for (*value = 0, shift = 0; *pos < size && shift < 7 * HIST_VARINT; shift += 7)
+	{
+		*value |= (unsigned long long)(buf[*pos] & 0x7f) << shift;
+
+		if (!(buf[(*pos)++] & 0x80))
+			return 0;
+	}
+
+	return -1;
+}
+
+/*
+
+=item C<ssize_t hist_encode(const Hist *hist, void *buf, size_t size)>
+
+Encodes C<hist> in C<buf> (which is C<size> bytes long) in a compact binary
+form that can be decoded by I<hist_decode(3)> on any host. It consists of
+a version, the number of digits, the highest value, the lowest and highest
+values recorded, and then the counters, run-length encoded (i.e. each
+non-zero counter, and each run of zero counters, is a single varint).
+Returns the number of bytes needed to encode C<hist>. If that is more than
+C<size>, the encoding was truncated (but no more than C<size> bytes were
+written), and it should be encoded again in a larger buffer. So
+C<hist_encode(hist, NULL, 0)> returns the size of buffer needed. On error,
+returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t hist_encode(const Hist *hist, void *buf, size_t size)
+{
+	unsigned long long count, zeroes;
+	size_t i, length, pos;
+
+	if (!hist || (!buf && size))
+		return set_errno(EINVAL);
+
+	length = (hist_count(hist)) ? hist_index(hist, hist_max(hist)) + 1 : 0;
+
+	pos = hist_put(buf, size, 0, HIST_VERSION);
+	pos = hist_put(buf, size, pos, hist->digits);
+	pos = hist_put(buf, size, pos, hist->highest);
+	pos = hist_put(buf, size, pos, hist_min(hist));
+	pos = hist_put(buf, size, pos, hist_max(hist));
+
+	/* Counters are even (count * 2), runs of zeroes are odd (run * 2 - 1) */
+
+	for (zeroes = 0, i = 0; i < length; ++i)
+	{
+		if (!(count = hist_atomic_load(hist->counts[i])))
+		{
+			++zeroes;
+			continue;
+		}
+
+		if (zeroes)
+			pos = hist_put(buf, size, pos, zeroes * 2 - 1), zeroes = 0;
+
+		pos = hist_put(buf, size, pos, count * 2);
+	}
+
+	return pos;
+}
+
+/*
+
+=item C<Hist *hist_decode(const void *buf, size_t size)>
+
+Creates a histogram from the C<size> bytes in C<buf> that were encoded by
+I<hist_encode(3)>. It is the caller's responsibility to deallocate the new
+histogram with I<hist_release(3)> or I<hist_destroy(3)>. On success,
+returns the new histogram. On error, returns C<null> with C<errno> set
+appropriately (C<EINVAL> when C<buf> is truncated or corrupt).
+
+=cut
+
+*/
+
+Hist *hist_decode(const void *buf, size_t size)
+{
+	unsigned long long version, digits, highest, min, max, value;
+	size_t pos = 0, i = 0;
+	Hist *hist;
+
+	if (!buf)
+		return set_errnull(EINVAL);
+
+	if (hist_get(buf, size, &pos, &version) == -1 || version != HIST_VERSION ||
+		hist_get(buf, size, &pos, &digits) == -1 ||
+		hist_get(buf, size, &pos, &highest) == -1 ||
+		hist_get(buf, size, &pos, &min) == -1 ||
+		hist_get(buf, size, &pos, &max) == -1)
+		return set_errnull(EINVAL);
+
+	if (digits > 5 || max > highest)
+		return set_errnull(EINVAL);
+
+	if (!(hist = hist_create(highest, (int)digits)))
+		return NULL;
+
+	while (pos < size)
+	{
+		if (hist_get(buf, size, &pos, &value) == -1)
+			break;
+
+		if (value & 1)
+			i += (value + 1) / 2;
+		else if (i < hist->length)
+		{
+			hist->counts[i++] = value / 2;
+			hist->total += value / 2;
+		}
+		else
+			break;
+	}
+
+	if (pos < size || i > hist->length || (hist->total && (min > max || hist_index(hist, max) != i - 1)))
+	{
+		hist_release(hist);
+		return set_errnull(EINVAL);
+	}
+
+	if (hist->total)
+		hist->min = min, hist->max = max;
+
+	return hist;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+An argument was invalid, or a histogram being decoded was truncated or
+corrupt.
+
+=item C<ERANGE>
+
+A value was higher than the highest value that the histogram can record.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Safe>
+
+Any number of threads may record values in the same histogram at the same
+time. Each value is recorded atomically, but the count, extremes,
+percentiles and encoded form of a histogram that is being recorded in at
+the same time might not include the values being recorded at the time.
+For the lowest overhead, each thread can record in its own histogram, and
+they can be added together with I<hist_add(3)> later.
+
+=head1 EXAMPLE
+
+Time something many times, and report the percentiles:
+
+    #include <slack/std.h>
+    #include <slack/hist.h>
+    #include <time.h>
+
+    static unsigned long long now(void)
+    {
+        struct timespec ts[1];
+
+        clock_gettime(CLOCK_MONOTONIC, ts);
+
+        return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+    }
+
+    int main(int ac, char **av)
+    {
+        Hist *hist;
+        int i;
+
+        // Up to a minute in nanoseconds, to 3 significant digits
+
+        if (!(hist = hist_create(60 * 1000000000ULL, 3)))
+            return EXIT_FAILURE;
+
+        for (i = 0; i < 100000; ++i)
+        {
+            unsigned long long start = now();
+            getpid();
+            hist_record(hist, now() - start);
+        }
+
+        printf("min %llu p50 %llu p99 %llu p99.9 %llu max %llu (ns)\n",
+            hist_min(hist),
+            hist_percentile(hist, 50.0),
+            hist_percentile(hist, 99.0),
+            hist_percentile(hist, 99.9),
+            hist_max(hist));
+
+        hist_destroy(&hist);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<HdrHistogram (https://hdrhistogram.github.io/HdrHistogram/)>
+
+=head1 AUTHOR
+
+20230330 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#include <time.h>
+
+#define THREADS 4
+#define THREAD_VALUES 100000
+#define VALUES 200000
+
+static Hist *shared;
+
+static void *recorder(void *arg)
+{
+	Hist *own = arg;
+	int i;
+
+	for (i = 0; i < THREAD_VALUES; ++i)
+		hist_record((own) ? own : shared, i);
+
+	return NULL;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The nearest rank of a percentile of n values (as hist_percentile() finds it) */
+
+static int nearest_rank(double percentile, int n)
+{
+	double rank = percentile / 100.0 * n;
+	int target = (int)rank;
+
+	if (rank - target > rank * 1e-12)
+		++target;
+
+	return (target) ? target : 1;
+}
+
+/* A fixed pseudo-random sequence, so that failures can be reproduced */
+
+static unsigned long long rnd(void)
+{
+	static unsigned long long state = 88172645463325252ULL;
+
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+
+	return state;
+}
+
+/* Values spread over several orders of magnitude, like latencies */
+
+static unsigned long long latency(void)
+{
+	return 1000 + rnd() % (1ULL << (10 + rnd() % 20));
+}
+
+static double wall(void)
+{
+	struct timespec ts[1];
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+#define BENCH_VALUES 10000000
+#define BENCH_QUERIES 10000
+
+/*
+
+Times hist_record() (by one thread, and by several threads recording in
+the same histogram), hist_percentile(), and hist_encode().
+
+*/
+
+static void bench(void)
+{
+	static unsigned long long values[1024];
+	pthread_t thread[THREADS];
+	double start, secs[4];
+	unsigned long long sum = 0;
+	ssize_t size;
+	Hist *hist;
+	int i;
+
+	if (!(hist = hist_create(3600 * 1000000000ULL, 3)))
+	{
+		printf("Failed to create histogram\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < 1024; ++i)
+		values[i] = latency();
+
+	start = wall();
+	for (i = 0; i < BENCH_VALUES; ++i)
+		hist_record(hist, values[i & 1023]);
+	secs[0] = wall() - start;
+
+	shared = hist;
+	start = wall();
+	for (i = 0; i < THREADS; ++i)
+		pthread_create(&thread[i], NULL, recorder, NULL);
+	for (i = 0; i < THREADS; ++i)
+		pthread_join(thread[i], NULL);
+	secs[1] = wall() - start;
+
+	start = wall();
+	for (i = 0; i < BENCH_QUERIES; ++i)
+		sum += hist_percentile(hist, 99.9);
+	secs[2] = wall() - start;
+
+	start = wall();
+	for (i = 0; i < BENCH_QUERIES; ++i)
+		size = hist_encode(hist, NULL, 0);
+	secs[3] = wall() - start;
+
+	printf("%10s %10s %10s %10s (ns/op)\n", "record", "shared", "percentile", "encode");
+	printf("%10.1f %10.1f %10.1f %10.1f\n",
+		secs[0] * 1e9 / BENCH_VALUES,
+		secs[1] * 1e9 / (THREADS * THREAD_VALUES),
+		secs[2] * 1e9 / BENCH_QUERIES,
+		secs[3] * 1e9 / BENCH_QUERIES);
+	printf("p99.9 %llu, encoded size %d bytes\n", sum / BENCH_QUERIES, (int)size);
+
+	hist_destroy(&hist);
+
+	exit(EXIT_SUCCESS);
+}
+
+int main(int ac, char **av)
+{
+	static unsigned long long values[VALUES];
+	static const double percentiles[] = { 0.0, 1.0, 25.0, 50.0, 90.0, 99.0, 99.9, 99.99, 100.0 };
+	static unsigned char buf[262144];
+	pthread_t thread[THREADS];
+	Hist *hist, *other, *copy, *threads[THREADS];
+	unsigned long long value, exact;
+	ssize_t size;
+	double mean;
+	int errors = 0;
+	int i, j;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s [bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench();
+
+	printf("Testing: %s\n", "hist");
+
+	/* Test invalid arguments */
+
+	if (hist_create(1, 3) || errno != EINVAL)
+		++errors, printf("Test1: hist_create(1, 3) failed\n");
+
+	if (hist_create(1000, 0) || errno != EINVAL)
+		++errors, printf("Test2: hist_create(1000, 0) failed\n");
+
+	if (hist_create(1000, 6) || errno != EINVAL)
+		++errors, printf("Test3: hist_create(1000, 6) failed\n");
+
+	if (!(hist = hist_create(1000000, 3)))
+	{
+		printf("Test4: hist_create(1000000, 3) failed (%s)\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	/* Test an empty histogram */
+
+	if (hist_count(hist) || hist_min(hist) || hist_max(hist) || hist_mean(hist) != 0.0 || hist_percentile(hist, 50.0))
+		++errors, printf("Test5: empty histogram failed (count %llu min %llu max %llu)\n", hist_count(hist), hist_min(hist), hist_max(hist));
+
+	/* Test values that are counted exactly */
+
+	for (value = 0; value < 2048; ++value)
+		hist_record(hist, value);
+
+	if (hist_count(hist) != 2048 || hist_min(hist) != 0 || hist_max(hist) != 2047)
+		++errors, printf("Test6: exact values failed (count %llu min %llu max %llu)\n", hist_count(hist), hist_min(hist), hist_max(hist));
+
+	if ((value = hist_percentile(hist, 50.0)) != 1023)
+		++errors, printf("Test7: hist_percentile(50) failed (%llu, not 1023)\n", value);
+
+	if ((value = hist_percentile(hist, 99.0)) != 2027)
+		++errors, printf("Test8: hist_percentile(99) failed (%llu, not 2027)\n", value);
+
+	if ((mean = hist_mean(hist)) != 1023.5)
+		++errors, printf("Test9: hist_mean() failed (%g, not 1023.5)\n", mean);
+
+	/* Test values out of range */
+
+	if (hist_record(hist, 1000001) != -1 || errno != ERANGE || hist_count(hist) != 2048)
+		++errors, printf("Test10: hist_record(1000001) failed\n");
+
+	if (hist_record(hist, 1000000) != 0 || hist_max(hist) != 1000000 || hist_percentile(hist, 100.0) != 1000000)
+		++errors, printf("Test11: hist_record(1000000) failed\n");
+
+	/* Test hist_record_n() and hist_reset() */
+
+	hist_reset(hist);
+
+	if (hist_count(hist) || hist_min(hist) || hist_max(hist))
+		++errors, printf("Test12: hist_reset() failed\n");
+
+	hist_record_n(hist, 10, 99);
+	hist_record_n(hist, 500000, 1);
+
+	if (hist_count(hist) != 100 || hist_percentile(hist, 99.0) != 10 || hist_percentile(hist, 99.5) != 500000)
+		++errors, printf("Test13: hist_record_n() failed (p99 %llu p99.5 %llu)\n", hist_percentile(hist, 99.0), hist_percentile(hist, 99.5));
+
+	hist_destroy(&hist);
+
+	if (hist)
+		++errors, printf("Test14: hist_destroy() failed\n");
+
+	/* Test precision against the exact percentiles */
+
+	for (j = 1; j <= 5; ++j)
+	{
+		unsigned long long sorted[VALUES / 10];
+		int n = VALUES / 10;
+
+		if (!(hist = hist_create(1ULL << 40, j)))
+		{
+			++errors, printf("Test15: hist_create(2^40, %d) failed\n", j);
+			continue;
+		}
+
+		for (i = 0; i < n; ++i)
+			hist_record(hist, sorted[i] = latency());
+
+		qsort(sorted, n, sizeof *sorted, cmp);
+
+		for (i = 0; i < sizeof percentiles / sizeof *percentiles; ++i)
+		{
+			int rank = nearest_rank(percentiles[i], n);
+			unsigned long long tolerance = 1;
+			int k;
+
+			for (k = 0; k < j; ++k)
+				tolerance *= 10;
+
+			exact = sorted[(rank) ? rank - 1 : 0];
+			value = hist_percentile(hist, percentiles[i]);
+
+			if (value < exact || value - exact > exact / tolerance)
+				++errors, printf("Test15: %d digits: hist_percentile(%g) failed (%llu, exact %llu)\n", j, percentiles[i], value, exact);
+		}
+
+		if (hist_min(hist) != sorted[0] || hist_max(hist) != sorted[n - 1])
+			++errors, printf("Test16: %d digits: min/max failed\n", j);
+
+		hist_destroy(&hist);
+	}
+
+	/* Test adding histograms with the same digits */
+
+	hist = hist_create(1ULL << 40, 3);
+	other = hist_create(1ULL << 40, 3);
+	copy = hist_create(1ULL << 40, 3);
+
+	if (!hist || !other || !copy)
+	{
+		printf("Test17: hist_create() failed (%s)\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < VALUES; ++i)
+	{
+		values[i] = latency();
+		hist_record((i & 1) ? hist : other, values[i]);
+		hist_record(copy, values[i]);
+	}
+
+	if (hist_add(hist, other) != 0 || hist_count(hist) != VALUES)
+		++errors, printf("Test17: hist_add() failed (count %llu)\n", hist_count(hist));
+
+	for (i = 0; i < sizeof percentiles / sizeof *percentiles; ++i)
+		if (hist_percentile(hist, percentiles[i]) != hist_percentile(copy, percentiles[i]))
+			++errors, printf("Test18: hist_add() failed (p%g %llu, not %llu)\n", percentiles[i], hist_percentile(hist, percentiles[i]), hist_percentile(copy, percentiles[i]));
+
+	if (hist_min(hist) != hist_min(copy) || hist_max(hist) != hist_max(copy) || hist_mean(hist) != hist_mean(copy))
+		++errors, printf("Test19: hist_add() failed (min/max/mean)\n");
+
+	/* Test encoding and decoding */
+
+	if ((size = hist_encode(hist, NULL, 0)) <= 0 || size > sizeof buf)
+		++errors, printf("Test20: hist_encode(NULL) failed (%d)\n", (int)size);
+	else if (hist_encode(hist, buf, 10) != size)
+		++errors, printf("Test21: hist_encode(10) failed\n");
+	else if (hist_encode(hist, buf, sizeof buf) != size)
+		++errors, printf("Test22: hist_encode() failed\n");
+	else if (!(hist_destroy(&other), other = hist_decode(buf, size)))
+		++errors, printf("Test23: hist_decode() failed (%s)\n", strerror(errno));
+	else
+	{
+		if (hist_count(other) != hist_count(hist) || hist_min(other) != hist_min(hist) || hist_max(other) != hist_max(hist) || hist_mean(other) != hist_mean(hist))
+			++errors, printf("Test24: hist_decode() failed (count %llu min %llu max %llu)\n", hist_count(other), hist_min(other), hist_max(other));
+
+		for (i = 0; i < sizeof percentiles / sizeof *percentiles; ++i)
+			if (hist_percentile(other, percentiles[i]) != hist_percentile(hist, percentiles[i]))
+				++errors, printf("Test25: hist_decode() failed (p%g)\n", percentiles[i]);
+
+		if (hist_decode(buf, size - 1) || errno != EINVAL)
+			++errors, printf("Test26: hist_decode() failed to detect a truncated histogram\n");
+
+		buf[size - 1] |= 0x80;
+
+		if (hist_decode(buf, size) || errno != EINVAL)
+			++errors, printf("Test27: hist_decode() failed to detect a corrupt histogram\n");
+
+		if (hist_decode("\x02\x03\x0a\x00\x00", 5) || errno != EINVAL)
+			++errors, printf("Test28: hist_decode() failed to detect the wrong version\n");
+	}
+
+	hist_destroy(&other);
+
+	/* An empty histogram encodes in a few bytes */
+
+	if (!(other = hist_create(1000, 2)) || (size = hist_encode(other, buf, sizeof buf)) != 6)
+		++errors, printf("Test29: hist_encode(empty) failed (%d)\n", (int)size);
+
+	hist_destroy(&other);
+
+	if (!(other = hist_decode(buf, 6)) || hist_count(other))
+		++errors, printf("Test30: hist_decode(empty) failed\n");
+
+	hist_destroy(&other);
+
+	/* Test adding histograms with different digits */
+
+	other = hist_create(1ULL << 40, 2);
+	hist_reset(copy);
+
+	for (i = 0; i < VALUES; ++i)
+		hist_record(copy, values[i]);
+
+	if (hist_add(other, copy) != 0 || hist_count(other) != VALUES || hist_min(other) != hist_min(copy) || hist_max(other) != hist_max(copy))
+		++errors, printf("Test31: hist_add(different digits) failed\n");
+
+	for (i = 1; i < sizeof percentiles / sizeof *percentiles - 1; ++i)
+	{
+		exact = hist_percentile(copy, percentiles[i]);
+		value = hist_percentile(other, percentiles[i]);
+
+		if (value < exact - exact / 100 || value > exact + exact / 50)
+			++errors, printf("Test32: hist_add(different digits) failed (p%g %llu, not about %llu)\n", percentiles[i], value, exact);
+	}
+
+	hist_destroy(&other);
+
+	/* Test adding a histogram with values that are too high */
+
+	other = hist_create(1000, 3);
+	hist_record(other, 7);
+
+	if (hist_add(other, copy) != -1 || errno != ERANGE || hist_count(other) != 1 || hist_max(other) != 7)
+		++errors, printf("Test33: hist_add(too high) failed\n");
+
+	hist_destroy(&other);
+	hist_destroy(&copy);
+	hist_destroy(&hist);
+
+	/* Test the full range */
+
+	if (!(hist = hist_create(ULLONG_MAX, 3)))
+		++errors, printf("Test34: hist_create(ULLONG_MAX) failed\n");
+	else
+	{
+		hist_record(hist, ULLONG_MAX);
+		hist_record(hist, ULLONG_MAX / 3);
+		hist_record(hist, 0);
+
+		if (hist_percentile(hist, 100.0) != ULLONG_MAX || hist_percentile(hist, 0.0) != 0)
+			++errors, printf("Test35: hist_percentile(full range) failed\n");
+
+		value = hist_percentile(hist, 50.0);
+
+		if (value < ULLONG_MAX / 3 || value - ULLONG_MAX / 3 > ULLONG_MAX / 3 / 1000)
+			++errors, printf("Test36: hist_percentile(full range) failed (%llu)\n", value);
+
+		if ((size = hist_encode(hist, buf, sizeof buf)) > sizeof buf || !(other = hist_decode(buf, size)) || hist_max(other) != ULLONG_MAX)
+			++errors, printf("Test37: hist_encode(full range) failed\n");
+
+		hist_destroy(&other);
+		hist_destroy(&hist);
+	}
+
+	/* Test threads recording in one histogram, and in their own */
+
+	if (!(shared = hist_create(THREAD_VALUES, 3)))
+		++errors, printf("Test38: hist_create() failed\n");
+	else
+	{
+		for (i = 0; i < THREADS; ++i)
+			pthread_create(&thread[i], NULL, recorder, NULL);
+
+		for (i = 0; i < THREADS; ++i)
+			pthread_join(thread[i], NULL);
+
+		if (hist_count(shared) != THREADS * THREAD_VALUES || hist_max(shared) != THREAD_VALUES - 1)
+			++errors, printf("Test38: shared histogram failed (count %llu)\n", hist_count(shared));
+
+		hist = hist_create(THREAD_VALUES, 3);
+
+		for (i = 0; i < THREADS; ++i)
+		{
+			threads[i] = hist_create(THREAD_VALUES, 3);
+			pthread_create(&thread[i], NULL, recorder, threads[i]);
+		}
+
+		for (i = 0; i < THREADS; ++i)
+		{
+			pthread_join(thread[i], NULL);
+			hist_add(hist, threads[i]);
+			hist_destroy(&threads[i]);
+		}
+
+		if (hist_count(hist) != hist_count(shared) || hist_percentile(hist, 99.0) != hist_percentile(shared, 99.0))
+			++errors, printf("Test39: added histograms failed (count %llu)\n", hist_count(hist));
+
+		hist_destroy(&hist);
+		hist_destroy(&shared);
+	}
+
+	/* Test errors */
+
+	if (hist_record(NULL, 1) != -1 || errno != EINVAL)
+		++errors, printf("Test40: hist_record(NULL) failed\n");
+
+	if (hist_count(NULL) || errno != EINVAL)
+		++errors, printf("Test41: hist_count(NULL) failed\n");
+
+	if ((hist = hist_create(1000, 3)))
+	{
+		if (hist_percentile(hist, 100.1) || errno != EINVAL || hist_percentile(hist, -1.0) || errno != EINVAL)
+			++errors, printf("Test42: hist_percentile(out of range) failed\n");
+
+		if (hist_add(hist, hist) != -1 || errno != EINVAL || hist_add(hist, NULL) != -1 || errno != EINVAL)
+			++errors, printf("Test43: hist_add(invalid) failed\n");
+
+		if (hist_encode(hist, NULL, 10) != -1 || errno != EINVAL)
+			++errors, printf("Test44: hist_encode(NULL, 10) failed\n");
+
+		hist_destroy(&hist);
+	}
+
+	if (hist_decode(NULL, 10) || errno != EINVAL)
+		++errors, printf("Test45: hist_decode(NULL) failed\n");
+
+	/* Test that percentiles use the nearest rank (rounding up, not to nearest) */
+
+	if ((hist = hist_create(1000, 3)))
+	{
+		for (i = 1; i <= 10; ++i)
+			hist_record(hist, i);
+
+		if ((value = hist_percentile(hist, 94.0)) != 10 || (value = hist_percentile(hist, 90.0)) != 9 || (value = hist_percentile(hist, 0.0)) != 1)
+			++errors, printf("Test46: hist_percentile() of 10 values failed (%llu)\n", value);
+
+		for (i = 11; i <= 1000; ++i)
+			hist_record(hist, i);
+
+		if ((value = hist_percentile(hist, 99.94)) != 1000 || (value = hist_percentile(hist, 99.9)) != 999 || (value = hist_percentile(hist, 50.0)) != 500)
+			++errors, printf("Test46: hist_percentile() of 1000 values failed (%llu)\n", value);
+
+		hist_destroy(&hist);
+	}
+
+	if (errors)
+		printf("%d/46 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,50 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+#ifndef LIBSLACK_HIST_H
+#define LIBSLACK_HIST_H
+
+#include <sys/types.h>
+
+#include <slack/hdr.h>
+
+typedef struct Hist Hist;
+
+_begin_decls
+Hist *hist_create(unsigned long long highest, int digits);
+void hist_release(Hist *hist);
+void *hist_destroy(Hist **hist);
+int hist_record(Hist *hist, unsigned long long value);
+int hist_record_n(Hist *hist, unsigned long long value, unsigned long long count);
+int hist_add(Hist *hist, const Hist *src);
+void hist_reset(Hist *hist);
+unsigned long long hist_count(const Hist *hist);
+unsigned long long hist_min(const Hist *hist);
+unsigned long long hist_max(const Hist *hist);
+double hist_mean(const Hist *hist);
+unsigned long long hist_percentile(const Hist *hist, double percentile);
+ssize_t hist_encode(const Hist *hist, void *buf, size_t size);
+Hist *hist_decode(const void *buf, size_t size);
+_end_decls
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -110,6 +110,7 @@ This examples sorts and prints an array of strings.
 
 =head1 SEE ALSO
 
+I<psort(3)>,
 I<qsort(3)>
 
 =head1 AUTHOR
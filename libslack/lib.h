@@ -24,10 +24,14 @@
 
 #include <slack/std.h>
 #include <slack/agent.h>
+#include <slack/cache.h>
+#include <slack/cmap.h>
 #include <slack/coproc.h>
 #include <slack/daemon.h>
+#include <slack/date.h>
 #include <slack/err.h>
 #include <slack/fio.h>
+#include <slack/hist.h>
 #include <slack/hsort.h>
 #include <slack/lim.h>
 #include <slack/link.h>
@@ -40,6 +44,8 @@
 #include <slack/prog.h>
 #include <slack/prop.h>
 #include <slack/pseudo.h>
+#include <slack/psort.h>
+#include <slack/queue.h>
 #include <slack/sig.h>
 #include <slack/str.h>
 
@@ -48,6 +54,8 @@
 #endif
 
 #ifndef HAVE_VSSCANF
+#include <slack/tpool.h>
+#include <slack/trace.h>
 #include <slack/vsscanf.h>
 #endif
 
@@ -47,6 +47,7 @@ I<libslack(list)> - list module
     List *list_make_with_locker(Locker *locker, list_release_t *destroy, ...);
     List *list_vmake_with_locker(Locker *locker, list_release_t *destroy, va_list args);
     List *list_copy_with_locker(Locker *locker, const List *src, list_copy_t *copy);
+    List *list_create_in(Pool *pool, list_release_t *destroy);
     int list_rdlock(const List *list);
     int list_wrlock(const List *list);
     int list_unlock(const List *list);
@@ -132,6 +133,14 @@ I<libslack(list)> - list module
     List *list_grep_unlocked(List *list, list_query_t *grep, void *data);
     List *list_grep_with_locker(Locker *locker, List *list, list_query_t *grep, void *data);
     List *list_grep_with_locker_unlocked(Locker *locker, List *list, list_query_t *grep, void *data);
+    List *list_sort_parallel(List *list, ThreadPool *pool, list_cmp_t *cmp);
+    List *list_sort_parallel_unlocked(List *list, ThreadPool *pool, list_cmp_t *cmp);
+    void list_apply_parallel(List *list, ThreadPool *pool, list_action_t *action, void *data);
+    void list_apply_parallel_unlocked(List *list, ThreadPool *pool, list_action_t *action, void *data);
+    List *list_map_parallel(List *list, ThreadPool *pool, list_release_t *destroy, list_map_t *map, void *data);
+    List *list_map_parallel_unlocked(List *list, ThreadPool *pool, list_release_t *destroy, list_map_t *map, void *data);
+    List *list_grep_parallel(List *list, ThreadPool *pool, list_query_t *grep, void *data);
+    List *list_grep_parallel_unlocked(List *list, ThreadPool *pool, list_query_t *grep, void *data);
     ssize_t list_query(List *list, ssize_t *index, list_query_t *query, void *data);
     ssize_t list_query_unlocked(List *list, ssize_t *index, list_query_t *query, void *data);
     Lister *lister_create(List *list);
@@ -163,6 +172,18 @@ insert items owned by one list into a list that doesn't own its own items
 unless you know that the source list (and all of the shared items) will
 outlive the destination list.
 
+The items of a I<List> are kept in a single vector, with room to spare at
+both ends. Inserting or removing an item moves whichever is shorter of the
+items before it and the items after it, so adding and removing items at
+either end (e.g. with I<list_push(3)>, I<list_pop(3)>, I<list_unshift(3)>
+and I<list_shift(3)>) takes amortised constant time, and a I<List> can be
+used as a double-ended queue. Indexing an item still takes constant time.
+
+The functions whose names contain C<_parallel> sort, apply, map or grep
+long lists using the threads of a I<ThreadPool> (see I<tpool(3)>). Their
+results are in the same order as those of the sequential functions, no
+matter how many threads do the work.
+
 =over 4
 
 =cut
@@ -175,8 +196,12 @@ outlive the destination list.
 #include "list.h"
 #include "mem.h"
 #include "err.h"
-#include "hsort.h"
+#include "psort.h"
+#include "tpool.h"
 #include "locker.h"
+#include "cache.h"
+
+typedef struct ListTask ListTask;
 
 #define xor(a, b) (!(a) ^ !(b))
 #define iff(a, b) !xor(a, b)
@@ -186,10 +211,12 @@ struct List
 {
 	size_t size;             /* number of item slots allocated */
 	size_t length;           /* number of items used */
-	void **list;             /* vector of items (void *) */
+	size_t head;             /* number of unused slots before the first item */
+	void **list;             /* vector of items (void *), starting at the first item */
 	list_release_t *destroy; /* item destructor, if any */
 	Lister *lister;          /* built-in iterator */
 	Locker *locker;          /* locking strategy for this object */
+	Pool *pool;              /* pool the list lives in, if any */
 };
 
 struct Lister
@@ -198,84 +225,219 @@ struct Lister
 	ssize_t index;           /* the index of the current item */
 };
 
+struct ListTask
+{
+	List *list;              /* the list being processed in parallel */
+	void *data;              /* the callback's data */
+	list_action_t *action;   /* the action (list_apply_parallel()) */
+	list_map_t *map;         /* the map function (list_map_parallel()) */
+	list_query_t *grep;      /* the grep function (list_grep_parallel()) */
+	list_cmp_t *cmp;         /* the comparison function (list_sort_parallel()) */
+	char *keep;              /* whether each item is kept (list_grep_parallel()) */
+	void **src;              /* the runs to merge (list_sort_parallel()) */
+	void **out;              /* the map results or merged runs */
+	size_t run;              /* length of each sorted run */
+	size_t parts;            /* number of pieces each pair of runs is merged in */
+};
+
 #ifndef TEST
 
+/* Listers are recycled by a size class object cache */
+
+#define lister_alloc() ((Lister *)cache_alloc(cache_class(sizeof(Lister))))
+#define lister_free(lister) cache_free(cache_class(sizeof(Lister)), (lister))
+
 /* Minimum list length: must be a power of 2 */
 
 static const size_t MIN_LIST_SIZE = 4;
 
+/* Shortest run, and most runs, that list_sort_parallel() sorts separately */
+
+#define LIST_PARALLEL_RUN 4096
+#define LIST_PARALLEL_RUNS 64
+
+/* Number of merge pieces per thread in each round of list_sort_parallel() */
+
+#define LIST_PARALLEL_PIECES 4
+
+/*
+
+C<int resize(List *list, size_t size)>
+
+Reallocates C<list>'s vector to hold C<size> items, keeping the items at the
+same offset from its start. Lists in a pool get their new memory from the
+pool. On success, returns C<0>. On error, returns C<-1>.
+
+*/
+
+static int resize(List *list, size_t size)
+{
+	void **base = (list->list) ? list->list - list->head : NULL;
+
+	if (list->pool)
+	{
+		if (!(base = pool_resize(list->pool, base, list->size * sizeof(void *), size * sizeof(void *))))
+			return -1;
+	}
+	else if (!mem_resize(&base, size))
+		return -1;
+
+	list->list = base + list->head;
+	list->size = size;
+
+	return 0;
+}
+
+/*
+
+C<void slide(List *list, size_t head)>
+
+Moves C<list>'s items so that they start C<head> slots into its vector.
+
+*/
+
+static void slide(List *list, size_t head)
+{
+	void **base = list->list - list->head;
+
+	memmove(base + head, list->list, list->length * sizeof(*list->list));
+	list->list = base + head;
+	list->head = head;
+}
+
 /*
 
 C<int grow(List *list, size_t items)>
 
-Allocates enough memory to add C<item> extra items to C<list> if necessary.
-On success, returns C<0>. On error, returns C<-1>.
+Makes room for C<items> extra items after the end of C<list>. Space left at
+the start of the vector by removals is reused when that leaves the vector no
+more than half full. Otherwise, the vector is doubled in size until the
+items fit (and at least once, if the items fit only after moving them to the
+start, so that moving them again is far away). On success, returns C<0>. On
+error, returns C<-1>.
 
 */
 
 static int grow(List *list, size_t items)
 {
-	int grown = 0;
+	size_t size;
 
-	while (list->length + items > list->size)
-	{
-		if (list->size)
-			list->size <<= 1;
-		else
-			list->size = MIN_LIST_SIZE;
+	if (list->head + list->length + items <= list->size)
+		return 0;
 
-		grown = 1;
+	if (list->head && (list->length + items) * 2 <= list->size)
+	{
+		slide(list, 0);
+		return 0;
 	}
 
-	if (grown)
-		return mem_resize(&list->list, list->size) ? 0 : -1;
+	for (size = (list->size) ? list->size : MIN_LIST_SIZE; list->length + items > size; size <<= 1)
+	{}
+
+	if (size == list->size)
+		size <<= 1;
+
+	if (resize(list, size) == -1)
+		return -1;
+
+	if (list->head)
+		slide(list, 0);
 
 	return 0;
 }
 
 /*
 
-C<int shrink(List *list, size_t items)>
+C<int grow_front(List *list, size_t items)>
 
-Allocates less memory for removing C<items> items from C<list> if necessary.
-On success, returns C<0>. On error, returns C<-1>.
+Makes room for C<items> extra items before the start of C<list>. When there
+isn't enough room, the vector is doubled in size until it is no more than
+half full, and the items are moved to the middle of it, so that a sequence
+of insertions at the start takes amortised constant time. On success,
+returns C<0>. On error, returns C<-1>.
 
 */
 
-static int shrink(List *list, size_t items)
+static int grow_front(List *list, size_t items)
 {
-	int shrunk = 0;
+	size_t size;
 
-	while (list->length - items < list->size >> 1)
-	{
-		if (list->size == MIN_LIST_SIZE)
-			break;
+	if (list->head >= items)
+		return 0;
 
-		list->size >>= 1;
-		shrunk = 1;
-	}
+	for (size = (list->size) ? list->size : MIN_LIST_SIZE; (list->length + items) * 2 > size; size <<= 1)
+	{}
+
+	if (size != list->size && resize(list, size) == -1)
+		return -1;
 
-	if (shrunk)
-		return mem_resize(&list->list, list->size) ? 0 : -1;
+	slide(list, (list->size - list->length) / 2);
 
 	return 0;
 }
 
 /*
 
+C<void shrink(List *list)>
+
+Allocates less memory for C<list> if it is less than a quarter full, halving
+its vector until it is at least half full. The gap between these limits
+stops a list that is used as a queue from repeatedly shrinking and growing.
+Shrinking is only an optimisation, so if the memory can't be reallocated,
+the list keeps its current vector.
+
+*/
+
+static void shrink(List *list)
+{
+	size_t size = list->size;
+
+	if (list->pool || list->length >= size >> 2)
+		return;
+
+	while (list->length < size >> 1 && size > MIN_LIST_SIZE)
+		size >>= 1;
+
+	if (size == list->size)
+		return;
+
+	if (list->head)
+		slide(list, 0);
+
+	resize(list, size);
+}
+
+/*
+
 C<int expand(List *list, ssize_t index, size_t range)>
 
-Slides C<list>'s items, starting at C<index>, C<range> slots to the right to
-make room for more. On success, returns C<0>. On error, returns C<-1>.
+Opens a gap of C<range> slots at C<index> in C<list> to make room for more
+items. Whichever is shorter of the items before C<index> (which move left)
+and the items from C<index> onwards (which move right) is moved, so adding
+to either end of a list takes amortised constant time. On success, returns
+C<0>. On error, returns C<-1>.
 
 */
 
 static int expand(List *list, ssize_t index, size_t range)
 {
-	if (grow(list, range) == -1)
-		return -1;
+	if ((size_t)index < list->length - index)
+	{
+		if (grow_front(list, range) == -1)
+			return -1;
+
+		memmove(list->list - range, list->list, index * sizeof(*list->list));
+		list->list -= range;
+		list->head -= range;
+	}
+	else
+	{
+		if (grow(list, range) == -1)
+			return -1;
+
+		memmove(list->list + index + range, list->list + index, (list->length - index) * sizeof(*list->list));
+	}
 
-	memmove(list->list + index + range, list->list + index, (list->length - index) * sizeof(*list->list));
 	list->length += range;
 
 	return 0;
@@ -285,20 +447,26 @@ static int expand(List *list, ssize_t index, size_t range)
 
 C<int contract(List *list, ssize_t index, size_t range)>
 
-Slides C<list>'s items, starting at C<index> + C<range>, C<range> slots to
-the left to close a gap starting at C<index>. On success, returns C<0>. On
-error, returns C<-1>.
+Closes a gap of C<range> slots starting at C<index> in C<list>. Whichever is
+shorter of the items before C<index> (which move right) and the items after
+the gap (which move left) is moved, so removing from either end of a list
+takes constant time. On success, returns C<0>. On error, returns C<-1>.
 
 */
 
 static int contract(List *list, ssize_t index, size_t range)
 {
-	memmove(list->list + index, list->list + index + range, (list->length - index - range) * sizeof(*list->list));
-
-	if (shrink(list, range) == -1)
-		return -1;
+	if ((size_t)index < list->length - index - range)
+	{
+		memmove(list->list + range, list->list, index * sizeof(*list->list));
+		list->list += range;
+		list->head += range;
+	}
+	else
+		memmove(list->list + index, list->list + index + range, (list->length - index - range) * sizeof(*list->list));
 
 	list->length -= range;
+	shrink(list);
 
 	return 0;
 }
@@ -440,11 +608,12 @@ List *list_create_with_locker(Locker *locker, list_release_t *destroy)
 	if (!(list = mem_new(List))) /* XXX decouple */
 		return NULL;
 
-	list->size = list->length = 0;
+	list->size = list->length = list->head = 0;
 	list->list = NULL;
 	list->destroy = destroy;
 	list->lister = NULL;
 	list->locker = locker;
+	list->pool = NULL;
 
 	return list;
 }
@@ -529,6 +698,46 @@ List *list_copy_with_locker(Locker *locker, const List *src, list_copy_t *copy)
 
 /*
 
+=item C<List *list_create_in(Pool *pool, list_release_t *destroy)>
+
+Equivalent to I<list_create(3)> except that the new list, and any memory it
+needs as it grows, are allocated from C<pool> (preferably one created with
+I<pool_create_growable(3)>). Such lists can still be passed to
+I<list_release(3)> or I<list_destroy(3)>, which destroy their items with
+C<destroy> as usual, but their own memory is only reclaimed when C<pool> is
+cleared or released, at which point the list must no longer be used. When
+the items are also allocated from C<pool> (e.g. with I<str_create_in(3)>),
+C<destroy> can be C<null>, and the whole list can be freed with a single
+I<pool_clear(3)>. Lists created from a pool list (e.g. by I<list_copy(3)>)
+are allocated normally, not from the pool. On success, returns the new
+list. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *list_create_in(Pool *pool, list_release_t *destroy)
+{
+	List *list;
+
+	if (!pool)
+		return set_errnull(EINVAL);
+
+	if (!(list = pool_new(pool, List)))
+		return NULL;
+
+	list->size = list->length = list->head = 0;
+	list->list = NULL;
+	list->destroy = destroy;
+	list->lister = NULL;
+	list->locker = NULL;
+	list->pool = pool;
+
+	return list;
+}
+
+/*
+
 =item C<int list_rdlock(const List *list)>
 
 Claims a read lock on C<list> (if C<list> was created with a I<Locker>).
@@ -594,8 +803,9 @@ int (list_unlock)(const List *list)
 
 =item C<void list_release(List *list)>
 
-Releases (deallocates) C<list>, destroying its items if necessary. On error,
-sets C<errno> appropriately.
+Releases (deallocates) C<list>, destroying its items if necessary. The
+memory of lists created with I<list_create_in(3)> is left for their pool to
+reclaim. On error, sets C<errno> appropriately.
 
 =cut
 
@@ -609,10 +819,12 @@ void list_release(List *list)
 	if (list->list)
 	{
 		killitems(list, 0, list->length);
-		mem_release(list->list);
+		if (!list->pool)
+			mem_release(list->list - list->head);
 	}
 
-	mem_release(list);
+	if (!list->pool)
+		mem_release(list);
 }
 
 /*
@@ -2184,10 +2396,14 @@ List *list_splice_with_locker_unlocked(Locker *locker, List *list, ssize_t index
 
 =item C<List *list_sort(List *list, list_cmp_t *cmp)>
 
-Sorts the items in C<list>, using the item comparison function C<cmp>, and
-I<qsort(3)> for lists of fewer than 10000 items, and I<hsort(3)> for larger
-lists. On success, returns C<list>. On error, returns C<null> with C<errno>
-set appropriately.
+Sorts the items in C<list>, using the item comparison function C<cmp> and
+I<psort_ptr(3)>, a pattern-defeating quicksort. As with I<qsort(3)>, C<cmp>
+is passed pointers to the items. This is not a stable sort: items that
+C<cmp> considers equal can end up in any order relative to each other
+(glibc's I<qsort(3)>, which this used to call, usually kept them in their
+original order). If that matters, make C<cmp> compare something that
+distinguishes them. On success, returns C<list>. On error, returns C<null>
+with C<errno> set appropriately.
 
 =cut
 
@@ -2230,7 +2446,7 @@ List *list_sort_unlocked(List *list, list_cmp_t *cmp)
 	if (!list->list || !list->length)
 		return set_errnull(EINVAL);
 
-	((list->length >= 10000) ? hsort : qsort)(list->list, list->length, sizeof list->list[0], cmp);
+	psort_ptr(list->list, list->length, cmp);
 
 	return list;
 }
@@ -2558,127 +2774,185 @@ List *list_grep_with_locker_unlocked(Locker *locker, List *list, list_query_t *g
 
 /*
 
-=item C<ssize_t list_query(List *list, ssize_t *index, list_query_t *query, void *data)>
-
-Invokes C<query> on each item in C<list>, starting at C<*index>, until
-C<query> returns a non-zero value. The arguments passed to C<query> are the
-item, C<index>, and C<data>. Returns the index of the item that satisfied
-C<query>, or C<-1> when C<query> is not satisfied by any remaining items.
-The value pointed to by C<index> is set to the return value. On error, sets
-C<errno> appropriately.
+C<void apply_task(size_t start, size_t end, void *data)>
 
-=cut
+Invokes the action of the I<ListTask> C<data> for the items from C<start> to
+C<end - 1>.
 
 */
 
-ssize_t list_query(List *list, ssize_t *index, list_query_t *query, void *data)
+static void apply_task(size_t start, size_t end, void *data)
 {
-	ssize_t ret;
-	int err;
+	ListTask *task = data;
+	size_t i;
 
-	if (!list || !index || !query)
-		return set_errno(EINVAL);
+	for (; start < end; ++start)
+	{
+		i = start;
+		task->action(task->list->list[start], &i, task->data);
+	}
+}
 
-	if ((err = list_rdlock(list)))
-		return set_errno(err);
+/*
 
-	ret = list_query_unlocked(list, index, query, data);
+C<void map_task(size_t start, size_t end, void *data)>
 
-	if ((err = list_unlock(list)))
-		return set_errno(err);
+Stores the results of the map function of the I<ListTask> C<data> for the
+items from C<start> to C<end - 1> at the same positions in its output.
 
-	return ret;
+*/
+
+static void map_task(size_t start, size_t end, void *data)
+{
+	ListTask *task = data;
+	size_t i;
+
+	for (; start < end; ++start)
+	{
+		i = start;
+		task->out[start] = task->map(task->list->list[start], &i, task->data);
+	}
 }
 
 /*
 
-=item C<ssize_t list_query_unlocked(List *list, ssize_t *index, list_query_t *query, void *data)>
-
-Equivalent to I<list_query(3)> except that C<list> is not read-locked.
+C<void grep_task(size_t start, size_t end, void *data)>
 
-=cut
+Records whether the grep function of the I<ListTask> C<data> keeps each of
+the items from C<start> to C<end - 1>.
 
 */
 
-ssize_t list_query_unlocked(List *list, ssize_t *index, list_query_t *query, void *data)
+static void grep_task(size_t start, size_t end, void *data)
 {
+	ListTask *task = data;
 	size_t i;
 
-	if (!list || !index || !query)
-		return set_errno(EINVAL);
-
-	if (*index >= list->length)
-		return set_errno(EINVAL);
-
-	for (i = *index; i < list->length; ++i)
+	for (; start < end; ++start)
 	{
-		if (query(list->list[i], (size_t *)index, data))
-			return *index = i;
+		i = start;
+		task->keep[start] = (task->grep(task->list->list[start], &i, task->data) != 0);
 	}
-
-	return *index = -1;
 }
 
 /*
 
-=item C<Lister *lister_create(List *list)>
-
-Creates an iterator for C<list>. It is the caller's responsibility to
-deallocate the iterator with I<lister_release(3)> or I<lister_destroy(3)>.
-It is strongly recommended to use I<lister_destroy(3)>, because it also sets
-the pointer variable to C<null>. The iterator keeps C<list> write-locked
-until it is released with I<lister_release(3)> or I<lister_destroy(3)>. Note
-that the iterator itself is not locked so it must not be shared between
-threads. On success, returns the iterator. On error, returns C<null> with
-C<errno> set appropriately.
+C<void sort_task(size_t start, size_t end, void *data)>
 
-=cut
+Sorts the runs numbered C<start> to C<end - 1> of the I<ListTask> C<data>.
 
 */
 
-Lister *lister_create(List *list)
+static void sort_task(size_t start, size_t end, void *data)
 {
-	return lister_create_wrlocked(list);
+	ListTask *task = data;
+	size_t length = task->list->length, offset;
+
+	for (; start < end; ++start)
+	{
+		offset = start * task->run;
+		psort_ptr(task->src + offset, (length - offset < task->run) ? length - offset : task->run, task->cmp);
+	}
 }
 
 /*
 
-=item C<Lister *lister_create_rdlocked(List *list)>
-
-Equivalent to I<lister_create(3)> except that C<list> is read-locked rather
-than write-locked. Use this in preference to I<lister_create(3)> when no
-calls to I<lister_remove(3)> will be made during the iteration.
+C<size_t corank(void **a, size_t alen, void **b, size_t blen, size_t k, list_cmp_t *cmp)>
 
-=cut
+Returns how many of the first C<k> items of the merge of the sorted runs
+C<a> and C<b> come from C<a>. Equal items are taken from C<a> first, so the
+merge is stable.
 
 */
 
-Lister *lister_create_rdlocked(List *list)
+static size_t corank(void **a, size_t alen, void **b, size_t blen, size_t k, list_cmp_t *cmp)
 {
-	int err;
+	size_t lo = (k > blen) ? k - blen : 0;
+	size_t hi = (k < alen) ? k : alen;
+	size_t mid;
 
-	if (!list)
-		return set_errnull(EINVAL);
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
 
-	if ((err = list_rdlock(list)))
-		return set_errnull(err);
+		if (cmp(a + mid, b + k - mid - 1) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	return lister_create_unlocked(list);
+	return lo;
 }
 
 /*
 
-=item C<Lister *lister_create_wrlocked(List *list)>
+C<void merge_task(size_t start, size_t end, void *data)>
 
-Equivalent to I<lister_create(3)> except that this function name makes the
-fact that C<list> is write-locked explicit.
+Merges the pieces numbered C<start> to C<end - 1> of the pairs of adjacent
+runs of the I<ListTask> C<data>. Piece C<p> is part C<p % parts> of the
+merge of pair C<p / parts>. The pieces are found by binary search (see
+I<corank()>), so they can be merged independently.
+
+*/
+
+static void merge_task(size_t start, size_t end, void *data)
+{
+	ListTask *task = data;
+	size_t length = task->list->length;
+	size_t offset, part, alen, blen, k, i, iend, j, jend;
+	void **a, **b, **out;
+
+	for (; start < end; ++start)
+	{
+		offset = start / task->parts * 2 * task->run;
+		part = start % task->parts;
+		a = task->src + offset;
+		alen = (length - offset < task->run) ? length - offset : task->run;
+		b = a + alen;
+		blen = (length - offset - alen < task->run) ? length - offset - alen : task->run;
+
+		k = (alen + blen) * part / task->parts;
+		i = corank(a, alen, b, blen, k, task->cmp);
+		j = k - i;
+		k = (alen + blen) * (part + 1) / task->parts;
+		iend = corank(a, alen, b, blen, k, task->cmp);
+		jend = k - iend;
+		out = task->out + offset + i + j;
+
+		while (i < iend && j < jend)
+			*out++ = (task->cmp(b + j, a + i) < 0) ? b[j++] : a[i++];
+
+		while (i < iend)
+			*out++ = a[i++];
+
+		while (j < jend)
+			*out++ = b[j++];
+	}
+}
+
+/*
+
+=item C<List *list_sort_parallel(List *list, ThreadPool *pool, list_cmp_t *cmp)>
+
+Equivalent to I<list_sort(3)> except that the threads in C<pool> sort
+C<list> together (see I<tpool(3)>). Long lists are divided into runs
+(at most C<64> of them), and the runs are sorted with I<psort_ptr(3)> at the
+same time. Then pairs of adjacent runs are merged, in parallel pieces, until
+a single run remains. The runs only depend on the length of C<list>, and
+the merges are stable, so the result is the same no matter how many
+threads C<pool> has, even when some items are equal. If C<pool> is C<null>,
+the calling thread does all of the work. Short lists are sorted by
+I<list_sort(3)>. On success, returns C<list>. On error, returns C<null>
+with C<errno> set appropriately. On error, the items are left in an
+unspecified order.
 
 =cut
 
 */
 
-Lister *lister_create_wrlocked(List *list)
+List *list_sort_parallel(List *list, ThreadPool *pool, list_cmp_t *cmp)
 {
+	List *ret;
 	int err;
 
 	if (!list)
@@ -2687,78 +2961,530 @@ Lister *lister_create_wrlocked(List *list)
 	if ((err = list_wrlock(list)))
 		return set_errnull(err);
 
-	return lister_create_unlocked(list);
+	ret = list_sort_parallel_unlocked(list, pool, cmp);
+
+	if ((err = list_unlock(list)))
+		return set_errnull(err);
+
+	return ret;
 }
 
 /*
 
-=item C<Lister *lister_create_unlocked(const List *list)>
+=item C<List *list_sort_parallel_unlocked(List *list, ThreadPool *pool, list_cmp_t *cmp)>
 
-Equivalent to I<lister_create(3)> except that C<list> is not write-locked.
+Equivalent to I<list_sort_parallel(3)> except that C<list> is not
+write-locked.
 
 =cut
 
 */
 
-Lister *lister_create_unlocked(const List *list)
+List *list_sort_parallel_unlocked(List *list, ThreadPool *pool, list_cmp_t *cmp)
 {
-	Lister *lister;
+	ListTask task;
+	size_t pairs, threads = tpool_threads(pool);
+	void **tmp;
+	int ret = 0;
 
-	if (!list)
+	if (!list || !cmp)
 		return set_errnull(EINVAL);
 
-	if (!(lister = mem_new(Lister))) /* XXX decouple */
+	if (!list->list || !list->length)
+		return set_errnull(EINVAL);
+
+	if ((task.run = (list->length + LIST_PARALLEL_RUNS - 1) / LIST_PARALLEL_RUNS) < LIST_PARALLEL_RUN)
+		task.run = LIST_PARALLEL_RUN;
+
+	if (task.run >= list->length)
+		return list_sort_unlocked(list, cmp);
+
+	if (!(tmp = mem_create(list->length, void *)))
 		return NULL;
 
-	lister->list = (List *)list;
-	lister->index = -1;
+	task.list = list;
+	task.cmp = cmp;
+	task.src = list->list;
+	task.out = tmp;
 
-	return lister;
+	if ((ret = tpool_run(pool, (list->length + task.run - 1) / task.run, 1, sort_task, &task)) == 0)
+	{
+		for (; task.run < list->length; task.run <<= 1)
+		{
+			void **src = task.src;
+
+			pairs = (list->length + 2 * task.run - 1) / (2 * task.run);
+			task.parts = (threads * LIST_PARALLEL_PIECES + pairs - 1) / pairs;
+
+			if ((ret = tpool_run(pool, pairs * task.parts, 1, merge_task, &task)) == -1)
+				break;
+
+			task.src = task.out;
+			task.out = src;
+		}
+	}
+
+	if (task.src != list->list)
+		memcpy(list->list, task.src, list->length * sizeof(*list->list));
+
+	mem_release(tmp);
+
+	return (ret == -1) ? NULL : list;
 }
 
 /*
 
-=item C<void lister_release(Lister *lister)>
+=item C<void list_apply_parallel(List *list, ThreadPool *pool, list_action_t *action, void *data)>
 
-Releases (deallocates) C<lister> and unlocks the associated list.
+Equivalent to I<list_apply(3)> except that the threads in C<pool> invoke
+C<action> for chunks of C<list>'s items at the same time (see I<tpool(3)>),
+so C<action> must be thread-safe. The items are not processed in any
+particular order. The index passed to C<action> points to a copy of the
+item's position, so changing it has no effect. If C<pool> is C<null>, the
+calling thread does all of the work. C<list> is write-locked. On error, sets
+C<errno> appropriately.
 
 =cut
 
 */
 
-void lister_release(Lister *lister)
+void list_apply_parallel(List *list, ThreadPool *pool, list_action_t *action, void *data)
 {
 	int err;
 
-	if (!lister)
+	if (!list || !action)
+	{
+		set_errno(EINVAL);
 		return;
+	}
 
-	if ((err = list_unlock(lister->list)))
+	if ((err = list_wrlock(list)))
 	{
 		set_errno(err);
 		return;
 	}
 
-	mem_release(lister);
+	list_apply_parallel_unlocked(list, pool, action, data);
+
+	if ((err = list_unlock(list)))
+		set_errno(err);
 }
 
 /*
 
-=item C<void lister_release_unlocked(Lister *lister)>
+=item C<void list_apply_parallel_unlocked(List *list, ThreadPool *pool, list_action_t *action, void *data)>
 
-Equivalent to I<lister_release(3)> except that the associated list is not
-unlocked.
+Equivalent to I<list_apply_parallel(3)> except that C<list> is not
+write-locked.
 
 =cut
 
 */
 
-void lister_release_unlocked(Lister *lister)
+void list_apply_parallel_unlocked(List *list, ThreadPool *pool, list_action_t *action, void *data)
 {
-	if (!lister)
-		return;
+	ListTask task;
 
-	mem_release(lister);
+	if (!list || !action)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	task.list = list;
+	task.action = action;
+	task.data = data;
+	tpool_run(pool, list->length, 0, apply_task, &task);
+}
+
+/*
+
+=item C<List *list_map_parallel(List *list, ThreadPool *pool, list_release_t *destroy, list_map_t *map, void *data)>
+
+Equivalent to I<list_map(3)> except that the threads in C<pool> invoke
+C<map> for chunks of C<list>'s items at the same time (see I<tpool(3)>), so
+C<map> must be thread-safe. Each return value is stored at its item's
+position in the new list, so the new list is in the same order as C<list>,
+no matter how many threads C<pool> has. The index passed to C<map> points
+to a copy of the item's position, so changing it has no effect. If C<pool>
+is C<null>, the calling thread does all of the work. On success, returns
+the new list. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *list_map_parallel(List *list, ThreadPool *pool, list_release_t *destroy, list_map_t *map, void *data)
+{
+	List *mapping;
+	int err;
+
+	if (!list || !map)
+		return set_errnull(EINVAL);
+
+	if ((err = list_rdlock(list)))
+		return set_errnull(err);
+
+	mapping = list_map_parallel_unlocked(list, pool, destroy, map, data);
+
+	if ((err = list_unlock(list)))
+	{
+		list_release(mapping);
+		return set_errnull(err);
+	}
+
+	return mapping;
+}
+
+/*
+
+=item C<List *list_map_parallel_unlocked(List *list, ThreadPool *pool, list_release_t *destroy, list_map_t *map, void *data)>
+
+Equivalent to I<list_map_parallel(3)> except that C<list> is not
+read-locked.
+
+=cut
+
+*/
+
+List *list_map_parallel_unlocked(List *list, ThreadPool *pool, list_release_t *destroy, list_map_t *map, void *data)
+{
+	ListTask task;
+	List *mapping;
+
+	if (!list || !map)
+		return set_errnull(EINVAL);
+
+	if (!(mapping = list_create(destroy)))
+		return NULL;
+
+	if (grow(mapping, list->length) == -1)
+	{
+		list_release(mapping);
+		return NULL;
+	}
+
+	task.list = list;
+	task.map = map;
+	task.data = data;
+	task.out = mapping->list;
+
+	if (tpool_run(pool, list->length, 0, map_task, &task) == -1)
+	{
+		list_release(mapping);
+		return NULL;
+	}
+
+	mapping->length = list->length;
+
+	return mapping;
+}
+
+/*
+
+=item C<List *list_grep_parallel(List *list, ThreadPool *pool, list_query_t *grep, void *data)>
+
+Equivalent to I<list_grep(3)> except that the threads in C<pool> invoke
+C<grep> for chunks of C<list>'s items at the same time (see I<tpool(3)>),
+so C<grep> must be thread-safe. The decision for each item is recorded at
+its position, and then the chosen items are appended in order, so the new
+list is in the same order as C<list>, no matter how many threads C<pool>
+has. The index passed to C<grep> points to a copy of the item's position,
+so changing it has no effect. If C<pool> is C<null>, the calling thread does
+all of the work. On success, returns the new list. On error, returns
+C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *list_grep_parallel(List *list, ThreadPool *pool, list_query_t *grep, void *data)
+{
+	List *grepping;
+	int err;
+
+	if (!list || !grep)
+		return set_errnull(EINVAL);
+
+	if ((err = list_rdlock(list)))
+		return set_errnull(err);
+
+	grepping = list_grep_parallel_unlocked(list, pool, grep, data);
+
+	if ((err = list_unlock(list)))
+	{
+		list_release(grepping);
+		return set_errnull(err);
+	}
+
+	return grepping;
+}
+
+/*
+
+=item C<List *list_grep_parallel_unlocked(List *list, ThreadPool *pool, list_query_t *grep, void *data)>
+
+Equivalent to I<list_grep_parallel(3)> except that C<list> is not
+read-locked.
+
+=cut
+
+*/
+
+List *list_grep_parallel_unlocked(List *list, ThreadPool *pool, list_query_t *grep, void *data)
+{
+	ListTask task;
+	List *grepping;
+	size_t i, length;
+
+	if (!list || !grep)
+		return set_errnull(EINVAL);
+
+	if (!(grepping = list_create(NULL)))
+		return NULL;
+
+	if (!list->length)
+		return grepping;
+
+	if (!(task.keep = mem_create(list->length, char)))
+	{
+		list_release(grepping);
+		return NULL;
+	}
+
+	task.list = list;
+	task.grep = grep;
+	task.data = data;
+
+	if (tpool_run(pool, list->length, 0, grep_task, &task) == -1)
+	{
+		mem_release(task.keep);
+		list_release(grepping);
+		return NULL;
+	}
+
+	for (length = i = 0; i < list->length; ++i)
+		length += task.keep[i];
+
+	if (grow(grepping, length) == -1)
+	{
+		mem_release(task.keep);
+		list_release(grepping);
+		return NULL;
+	}
+
+	for (i = 0; i < list->length; ++i)
+		if (task.keep[i])
+			grepping->list[grepping->length++] = list->list[i];
+
+	mem_release(task.keep);
+
+	return grepping;
+}
+
+/*
+
+=item C<ssize_t list_query(List *list, ssize_t *index, list_query_t *query, void *data)>
+
+Invokes C<query> on each item in C<list>, starting at C<*index>, until
+C<query> returns a non-zero value. The arguments passed to C<query> are the
+item, C<index>, and C<data>. Returns the index of the item that satisfied
+C<query>, or C<-1> when C<query> is not satisfied by any remaining items.
+The value pointed to by C<index> is set to the return value. On error, sets
+C<errno> appropriately.
+
+=cut
+
+*/
+
+ssize_t list_query(List *list, ssize_t *index, list_query_t *query, void *data)
+{
+	ssize_t ret;
+	int err;
+
+	if (!list || !index || !query)
+		return set_errno(EINVAL);
+
+	if ((err = list_rdlock(list)))
+		return set_errno(err);
+
+	ret = list_query_unlocked(list, index, query, data);
+
+	if ((err = list_unlock(list)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<ssize_t list_query_unlocked(List *list, ssize_t *index, list_query_t *query, void *data)>
+
+Equivalent to I<list_query(3)> except that C<list> is not read-locked.
+
+=cut
+
+*/
+
+ssize_t list_query_unlocked(List *list, ssize_t *index, list_query_t *query, void *data)
+{
+	size_t i;
+
+	if (!list || !index || !query)
+		return set_errno(EINVAL);
+
+	if (*index >= list->length)
+		return set_errno(EINVAL);
+
+	for (i = *index; i < list->length; ++i)
+	{
+		if (query(list->list[i], (size_t *)index, data))
+			return *index = i;
+	}
+
+	return *index = -1;
+}
+
+/*
+
+=item C<Lister *lister_create(List *list)>
+
+Creates an iterator for C<list>. It is the caller's responsibility to
+deallocate the iterator with I<lister_release(3)> or I<lister_destroy(3)>.
+It is strongly recommended to use I<lister_destroy(3)>, because it also sets
+the pointer variable to C<null>. The iterator keeps C<list> write-locked
+until it is released with I<lister_release(3)> or I<lister_destroy(3)>. Note
+that the iterator itself is not locked so it must not be shared between
+threads. On success, returns the iterator. On error, returns C<null> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+Lister *lister_create(List *list)
+{
+	return lister_create_wrlocked(list);
+}
+
+/*
+
+=item C<Lister *lister_create_rdlocked(List *list)>
+
+Equivalent to I<lister_create(3)> except that C<list> is read-locked rather
+than write-locked. Use this in preference to I<lister_create(3)> when no
+calls to I<lister_remove(3)> will be made during the iteration.
+
+=cut
+
+*/
+
+Lister *lister_create_rdlocked(List *list)
+{
+	int err;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_rdlock(list)))
+		return set_errnull(err);
+
+	return lister_create_unlocked(list);
+}
+
+/*
+
+=item C<Lister *lister_create_wrlocked(List *list)>
+
+Equivalent to I<lister_create(3)> except that this function name makes the
+fact that C<list> is write-locked explicit.
+
+=cut
+
+*/
+
+Lister *lister_create_wrlocked(List *list)
+{
+	int err;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errnull(err);
+
+	return lister_create_unlocked(list);
+}
+
+/*
+
+=item C<Lister *lister_create_unlocked(const List *list)>
+
+Equivalent to I<lister_create(3)> except that C<list> is not write-locked.
+
+=cut
+
+*/
+
+Lister *lister_create_unlocked(const List *list)
+{
+	Lister *lister;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if (!(lister = lister_alloc()))
+		return NULL;
+
+	lister->list = (List *)list;
+	lister->index = -1;
+
+	return lister;
+}
+
+/*
+
+=item C<void lister_release(Lister *lister)>
+
+Releases (deallocates) C<lister> and unlocks the associated list.
+
+=cut
+
+*/
+
+void lister_release(Lister *lister)
+{
+	int err;
+
+	if (!lister)
+		return;
+
+	if ((err = list_unlock(lister->list)))
+	{
+		set_errno(err);
+		return;
+	}
+
+	lister_free(lister);
+}
+
+/*
+
+=item C<void lister_release_unlocked(Lister *lister)>
+
+Equivalent to I<lister_release(3)> except that the associated list is not
+unlocked.
+
+=cut
+
+*/
+
+void lister_release_unlocked(Lister *lister)
+{
+	if (!lister)
+		return;
+
+	lister_free(lister);
 }
 
 /*
@@ -3529,9 +4255,10 @@ strategy should be decoupled from this code.
 I<libslack(3)>,
 I<map(3)>,
 I<mem(3)>,
-I<hsort(3)>,
+I<psort(3)>,
 I<qsort(3)>,
-I<locker(3)>
+I<locker(3)>,
+I<tpool(3)>
 
 =head1 AUTHOR
 
@@ -3780,6 +4507,107 @@ void mt_test(int test, Locker *locker)
 	}
 }
 
+static int int_cmp(const void *a, const void *b)
+{
+	int x = (int)(long)*(void * const *)a, y = (int)(long)*(void * const *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Compares int items by all but their low 8 bits, so that many items are equal */
+
+static int key_cmp(const void *a, const void *b)
+{
+	int x = (int)(long)*(void * const *)a >> 8, y = (int)(long)*(void * const *)b >> 8;
+
+	return (x > y) - (x < y);
+}
+
+static void *twice(void *item, size_t *index, void *data)
+{
+	return (void *)((long)item * 2);
+}
+
+static int thirds(void *item, size_t *index, void *data)
+{
+	return (long)item % 3 == 0;
+}
+
+static void mark(void *item, size_t *index, void *data)
+{
+	((unsigned char *)data)[*index] += ((long)item == (long)*index * 7919 % 100000) ? 1 : 2;
+}
+
+static double wall(void)
+{
+	struct timespec ts[1];
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+#define BENCH_OPS 1000000
+
+/*
+
+Times queue-style workloads: appending to the end and shifting from the
+start of a list that holds a steady number of items; unshifting then
+shifting (a stack at the start); and indexing a list after it has been used
+as a queue.
+
+*/
+
+static void bench(void)
+{
+	List *list;
+	double start, secs[3];
+	unsigned long r = 88172645463325252UL;
+	long n, i, sum = 0;
+
+	printf("%9s %10s %10s %10s (ns/op)\n", "length", "queue", "front", "index");
+
+	for (n = 1000; n <= 1000000; n *= 10)
+	{
+		if (!(list = list_create(NULL)))
+		{
+			printf("Failed to create list\n");
+			exit(EXIT_FAILURE);
+		}
+
+		for (i = 0; i < n; ++i)
+			list_append_int(list, (int)i);
+
+		start = wall();
+		for (i = 0; i < BENCH_OPS; ++i)
+		{
+			list_append_int(list, (int)i);
+			sum += list_shift_int(list);
+		}
+		secs[0] = wall() - start;
+
+		start = wall();
+		for (i = 0; i < BENCH_OPS / 2; ++i)
+			list_unshift_int(list, (int)i);
+		for (i = 0; i < BENCH_OPS / 2; ++i)
+			sum += list_shift_int(list);
+		secs[1] = wall() - start;
+
+		start = wall();
+		for (i = 0; i < BENCH_OPS; ++i)
+		{
+			r ^= r << 13, r ^= r >> 7, r ^= r << 17;
+			sum += list_item_int(list, (ssize_t)(r % (unsigned long)n));
+		}
+		secs[2] = wall() - start;
+
+		printf("%9ld %10.1f %10.1f %10.1f\n", n, secs[0] * 1e9 / BENCH_OPS, secs[1] * 1e9 / BENCH_OPS, secs[2] * 1e9 / BENCH_OPS);
+		list_destroy(&list);
+	}
+
+	exit((sum == -1) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
 #define TEST_ACT(i, action) \
 	if (!(action)) \
 		++errors, printf("Test%d: %s failed\n", (i), (#action));
@@ -3810,10 +4638,13 @@ int main(int ac, char **av)
 
 	if (ac == 2 && !strcmp(av[1], "help"))
 	{
-		printf("usage: %s [debug]\n", *av);
+		printf("usage: %s [debug|bench]\n", *av);
 		return EXIT_SUCCESS;
 	}
 
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench();
+
 	printf("Testing: %s\n", "list");
 
 	/* Test list_make, list_length, list_item */
@@ -4523,8 +5354,352 @@ int main(int ac, char **av)
 	if (sizeof(int) > sizeof(void *))
 		++errors, printf("Test176: assumption failed: sizeof(int) > sizeof(void *): int lists are limited to %d bytes\n", (int)sizeof(void *));
 
+	/* Test list_create_in() */
+
+	{
+		Pool *pool;
+
+		TEST_ACT(177, !list_create_in(NULL, NULL))
+		TEST_ACT(178, pool = pool_create_growable(64))
+		if (pool)
+		{
+			TEST_ACT(179, a = list_create_in(pool, NULL))
+			if (a)
+			{
+				for (i = 0; i < 1000; ++i)
+					if (!list_append_int(a, i))
+						break;
+				CHECK_LENGTH(180, list_append_int(), a, 1000)
+				for (i = 0; i < 1000; ++i)
+					if (list_item_int(a, i) != i)
+						break;
+				TEST_EQ(181, i, 1000)
+				TEST_ACT(182, list_remove_range(a, 0, 990))
+				CHECK_LENGTH(182, list_remove_range(), a, 10)
+				CHECK_INT_ITEM(182, list_remove_range(), a, 0, 990)
+				list_release(a);
+			}
+
+			TEST_ACT(183, a = list_create_in(pool, free))
+			if (a)
+			{
+				TEST_ACT(183, list_append(a, mem_strdup("abc")))
+				CHECK_ITEM(183, list_append(), a, 0, "abc")
+				list_destroy(&a);
+			}
+
+			pool_destroy(&pool);
+		}
+	}
+
+
+	/* Test the deque behaviour of lists (items are added and removed at both ends without moving the others) */
+
+	TEST_ACT(184, a = list_create(NULL))
+	else
+	{
+		static int model[20000];
+		unsigned long r = 2463534242UL;
+		int length = 0, longest = 0, step, j;
+
+		for (step = 0; step < 20000; ++step)
+		{
+			int op, at;
+
+			r ^= r << 13, r ^= r >> 17, r ^= r << 5;
+			op = (int)(r % 7);
+			at = (length) ? (int)((r >> 8) % (unsigned long)length) : 0;
+
+			/* Alternate between phases of growth and shrinkage */
+
+			if ((step / 2500) % 2 == 0 && op >= 3 && (r & 0x300))
+				op -= 3;
+
+			if (length > 5000 && op < 3)
+				op += 3;
+
+			switch (op)
+			{
+				case 0:
+					if (!list_append_int(a, step))
+						++errors, printf("Test184: list_append_int() failed\n");
+					model[length++] = step;
+					break;
+
+				case 1:
+					if (!list_unshift_int(a, step))
+						++errors, printf("Test184: list_unshift_int() failed\n");
+					memmove(model + 1, model, length++ * sizeof(int));
+					model[0] = step;
+					break;
+
+				case 2:
+					if (!list_insert_int(a, at, step))
+						++errors, printf("Test184: list_insert_int(%d) failed\n", at);
+					memmove(model + at + 1, model + at, (length++ - at) * sizeof(int));
+					model[at] = step;
+					break;
+
+				case 3:
+					if (!length)
+						break;
+					if ((val = list_shift_int(a)) != model[0])
+						++errors, printf("Test184: list_shift_int() failed (%d, not %d)\n", val, model[0]);
+					memmove(model, model + 1, --length * sizeof(int));
+					break;
+
+				case 4:
+					if (!length)
+						break;
+					if ((val = list_pop_int(a)) != model[length - 1])
+						++errors, printf("Test184: list_pop_int() failed (%d, not %d)\n", val, model[length - 1]);
+					--length;
+					break;
+
+				case 5:
+					if (!length)
+						break;
+					if (!list_remove(a, at))
+						++errors, printf("Test184: list_remove(%d) failed\n", at);
+					memmove(model + at, model + at + 1, (--length - at) * sizeof(int));
+					break;
+
+				case 6:
+					if (length < 10)
+						break;
+					if (!list_remove_range(a, at / 2, 3))
+						++errors, printf("Test184: list_remove_range(%d, 3) failed\n", at / 2);
+					memmove(model + at / 2, model + at / 2 + 3, (length - at / 2 - 3) * sizeof(int));
+					length -= 3;
+					break;
+			}
+
+			if (list_length(a) != length)
+			{
+				++errors, printf("Test184: step %d failed (length %d, not %d)\n", step, (int)list_length(a), length);
+				break;
+			}
+
+			for (j = 0; j < length; ++j)
+				if (list_item_int(a, j) != model[j])
+					break;
+
+			if (j < length)
+			{
+				++errors, printf("Test184: step %d failed (item %d is %d, not %d)\n", step, j, list_item_int(a, j), model[j]);
+				break;
+			}
+
+			if (length > longest)
+				longest = length;
+		}
+
+		if (longest < 1000)
+			++errors, printf("Test184: failed (list never grew beyond %d items)\n", longest);
+
+		list_destroy(&a);
+	}
+
+	TEST_ACT(185, a = list_create(NULL))
+	else
+	{
+		int shifted = 0;
+
+		for (i = 0; i < 1000; ++i)
+			list_append_int(a, i);
+
+		for (i = 1000; i < 100000; ++i)
+		{
+			list_append_int(a, i);
+			if ((val = list_shift_int(a)) != shifted++)
+			{
+				++errors, printf("Test185: list_shift_int() failed (%d, not %d)\n", val, shifted - 1);
+				break;
+			}
+
+			if (a->size > 4096) /* white box */
+			{
+				++errors, printf("Test185: queue of 1000 items failed (%d slots allocated)\n", (int)a->size);
+				break;
+			}
+		}
+
+		CHECK_LENGTH(186, list_shift_int(), a, 1000)
+		CHECK_INT_ITEM(186, list_shift_int(), a, 0, 99000)
+		CHECK_INT_ITEM(186, list_shift_int(), a, 999, 99999)
+		list_destroy(&a);
+	}
+
+	TEST_ACT(187, a = list_create(NULL))
+	else
+	{
+		for (i = 0; i < 100000; ++i)
+			list_unshift_int(a, i);
+
+		for (i = 99999; i >= 0; --i)
+			if ((val = list_shift_int(a)) != i)
+			{
+				++errors, printf("Test187: list_shift_int() failed (%d, not %d)\n", val, i);
+				break;
+			}
+
+		CHECK_LENGTH(187, list_shift_int(), a, 0)
+
+		for (i = 0; i < 1000; ++i)
+			list_prepend_int(a, (i * 7919) % 1000);
+		TEST_ACT(188, list_sort(a, int_cmp))
+		for (i = 0; i < 1000; ++i)
+			if (list_item_int(a, i) != i)
+			{
+				++errors, printf("Test188: list_sort() after list_prepend_int() failed (item %d is %d)\n", i, list_item_int(a, i));
+				break;
+			}
+
+		list_destroy(&a);
+	}
+
+	/* Test list_sort_parallel, list_apply_parallel, list_map_parallel, list_grep_parallel */
+
+	TEST_ACT(189, a = list_create(NULL))
+	else
+	{
+		static unsigned char marks[100000];
+		ThreadPool *pool[4];
+		List *sorted[4];
+		size_t j;
+		int p;
+
+		pool[0] = NULL;
+		pool[1] = tpool_create(1);
+		pool[2] = tpool_create(3);
+		pool[3] = tpool_create(4);
+
+		for (i = 0; i < 100000; ++i)
+			list_append_int(a, i * 7919 % 100000);
+
+		for (p = 0; p < 4; ++p)
+		{
+			TEST_ACT(189, b = list_map_parallel(a, pool[p], NULL, twice, NULL))
+			else
+			{
+				TEST_ACT(189, c = list_map(a, NULL, twice, NULL))
+				else
+				{
+					CHECK_LENGTH(189, list_map_parallel(), b, 100000)
+					else if (memcmp(b->list, c->list, 100000 * sizeof(void *)))
+						++errors, printf("Test189: list_map_parallel(pool %d) failed (differs from list_map())\n", p);
+					list_destroy(&c);
+				}
+
+				list_destroy(&b);
+			}
+
+			TEST_ACT(190, b = list_grep_parallel(a, pool[p], thirds, NULL))
+			else
+			{
+				TEST_ACT(190, c = list_grep(a, thirds, NULL))
+				else
+				{
+					CHECK_LENGTH(190, list_grep_parallel(), b, 33334)
+					else if (memcmp(b->list, c->list, 33334 * sizeof(void *)))
+						++errors, printf("Test190: list_grep_parallel(pool %d) failed (differs from list_grep())\n", p);
+					list_destroy(&c);
+				}
+
+				list_destroy(&b);
+			}
+
+			memset(marks, 0, sizeof marks);
+			list_apply_parallel(a, pool[p], mark, marks);
+			for (j = 0; j < 100000; ++j)
+				if (marks[j] != 1)
+				{
+					++errors, printf("Test191: list_apply_parallel(pool %d) failed (index %d marked %d)\n", p, (int)j, marks[j]);
+					break;
+				}
+
+			TEST_ACT(192, sorted[p] = list_copy(a, NULL))
+			else
+			{
+				TEST_ACT(192, list_sort_parallel(sorted[p], pool[p], key_cmp))
+				for (j = 1; j < 100000; ++j)
+					if (key_cmp(sorted[p]->list + j - 1, sorted[p]->list + j) > 0)
+					{
+						++errors, printf("Test192: list_sort_parallel(pool %d) failed (item %d is out of order)\n", p, (int)j);
+						break;
+					}
+
+				if (p && sorted[0] && memcmp(sorted[p]->list, sorted[0]->list, 100000 * sizeof(void *)))
+					++errors, printf("Test193: list_sort_parallel(pool %d) failed (differs from pool 0)\n", p);
+			}
+		}
+
+		for (p = 0; p < 4; ++p)
+		{
+			list_destroy(&sorted[p]);
+			tpool_destroy(&pool[p]);
+		}
+
+		pool[0] = tpool_create(4);
+
+		TEST_ACT(194, b = list_create(NULL))
+		else
+		{
+			TEST_ACT(194, c = list_map_parallel(b, pool[0], NULL, twice, NULL))
+			else CHECK_LENGTH(194, list_map_parallel(), c, 0)
+			list_destroy(&c);
+			TEST_ACT(194, c = list_grep_parallel(b, pool[0], thirds, NULL))
+			else CHECK_LENGTH(194, list_grep_parallel(), c, 0)
+			list_destroy(&c);
+			TEST_ACT(195, !list_sort_parallel(b, pool[0], int_cmp) && errno == EINVAL)
+
+			for (i = 0; i < 1000; ++i)
+				list_append_int(b, (i * 7919) % 1000);
+
+			TEST_ACT(196, list_sort_parallel(b, pool[0], int_cmp))
+			for (i = 0; i < 1000; ++i)
+				if (list_item_int(b, i) != i)
+				{
+					++errors, printf("Test196: list_sort_parallel() failed (item %d is %d)\n", i, list_item_int(b, i));
+					break;
+				}
+
+			list_destroy(&b);
+		}
+
+		tpool_destroy(&pool[0]);
+		list_destroy(&a);
+	}
+
+	/* Test list_sort with many equal items (every item is kept, in key order) */
+
+	TEST_ACT(197, a = list_create(NULL))
+	else
+	{
+		for (i = 0; i < 10000; ++i)
+			list_append_int(a, (i * 7919) % 10000);
+
+		TEST_ACT(197, list_sort(a, key_cmp))
+		for (i = 1; i < 10000; ++i)
+			if (key_cmp(a->list + i - 1, a->list + i) > 0)
+			{
+				++errors, printf("Test197: list_sort() with equal keys failed (item %d is out of order)\n", i);
+				break;
+			}
+
+		TEST_ACT(197, list_sort(a, int_cmp))
+		for (i = 0; i < 10000; ++i)
+			if (list_item_int(a, i) != i)
+			{
+				++errors, printf("Test197: list_sort() with equal keys failed (item %d is missing)\n", i);
+				break;
+			}
+
+		list_destroy(&a);
+	}
+
 	if (errors)
-		printf("%d/176 tests failed\n", errors);
+		printf("%d/197 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
@@ -28,6 +28,8 @@
 
 #include <slack/hdr.h>
 #include <slack/locker.h>
+#include <slack/mem.h>
+#include <slack/tpool.h>
 
 typedef struct List List;
 typedef struct Lister Lister;
@@ -47,6 +49,7 @@ List *list_create_with_locker(Locker *locker, list_release_t *destroy);
 List *list_make_with_locker(Locker *locker, list_release_t *destroy, ...);
 List *list_vmake_with_locker(Locker *locker, list_release_t *destroy, va_list args);
 List *list_copy_with_locker(Locker *locker, const List *src, list_copy_t *copy);
+List *list_create_in(Pool *pool, list_release_t *destroy);
 int list_rdlock(const List *list);
 int list_wrlock(const List *list);
 int list_unlock(const List *list);
@@ -132,6 +135,14 @@ List *list_grep(List *list, list_query_t *grep, void *data);
 List *list_grep_unlocked(List *list, list_query_t *grep, void *data);
 List *list_grep_with_locker(Locker *locker, List *list, list_query_t *grep, void *data);
 List *list_grep_with_locker_unlocked(Locker *locker, List *list, list_query_t *grep, void *data);
+List *list_sort_parallel(List *list, ThreadPool *pool, list_cmp_t *cmp);
+List *list_sort_parallel_unlocked(List *list, ThreadPool *pool, list_cmp_t *cmp);
+void list_apply_parallel(List *list, ThreadPool *pool, list_action_t *action, void *data);
+void list_apply_parallel_unlocked(List *list, ThreadPool *pool, list_action_t *action, void *data);
+List *list_map_parallel(List *list, ThreadPool *pool, list_release_t *destroy, list_map_t *map, void *data);
+List *list_map_parallel_unlocked(List *list, ThreadPool *pool, list_release_t *destroy, list_map_t *map, void *data);
+List *list_grep_parallel(List *list, ThreadPool *pool, list_query_t *grep, void *data);
+List *list_grep_parallel_unlocked(List *list, ThreadPool *pool, list_query_t *grep, void *data);
 ssize_t list_query(List *list, ssize_t *index, list_query_t *query, void *data);
 ssize_t list_query_unlocked(List *list, ssize_t *index, list_query_t *query, void *data);
 Lister *lister_create(List *list);
@@ -152,7 +152,7 @@ SLACK_TARGET := $(SLACK_SRCDIR)/lib$(SLACK_NAME).a
 SLACK_INSTALL := $(SLACK_ID).a
 SLACK_INSTALL_LINK := lib$(SLACK_NAME).a
 SLACK_CONFIG := $(SLACK_SRCDIR)/lib$(SLACK_NAME)-config
-SLACK_MODULES := agent coproc daemon err fio $(GETOPT) hsort lim link list locker map mem msg net prog prop pseudo sig $(SNPRINTF) str $(VSSCANF)
+SLACK_MODULES := agent cache cmap coproc daemon date err fio $(GETOPT) hist hsort lim link list locker map mem msg net prog prop pseudo psort queue sig $(SNPRINTF) str tpool trace $(VSSCANF)
 SLACK_HEADERS := std lib hdr socks
 SLACK_LIB_PODS := libslack
 SLACK_APP_PODS := libslack-config
@@ -181,6 +181,7 @@ SLACK_SWIGFILE := $(SLACK_SRCDIR)/slack.swig
 
 SLACK_TESTDIR := $(SLACK_SRCDIR)/test
 SLACK_TESTS := $(patsubst %, $(SLACK_TESTDIR)/%, $(SLACK_MODULES))
+SLACK_BENCH := $(SLACK_TESTDIR)/bench
 
 SLACK_INCLINK := $(SLACK_SRCDIR)/$(SLACK_NAME)
 
@@ -199,6 +200,7 @@ endif
 ALL_TARGETS += slack
 READY_TARGETS += ready-slack
 TEST_TARGETS += test-slack
+BENCH_TARGETS += bench-slack
 ifeq ($(SLACK_MAIN), 1)
 MAN_TARGETS += man-slack
 HTML_TARGETS += html-slack
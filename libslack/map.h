@@ -100,6 +100,7 @@ void map_apply_wrlocked(Map *map, map_action_t *action, void *data);
 void map_apply_unlocked(Map *map, map_action_t *action, void *data);
 ssize_t map_size(Map *map);
 ssize_t map_size_unlocked(const Map *map);
+size_t map_hash_string(size_t size, const void *key);
 _end_decls
 
 #endif
@@ -31,6 +31,29 @@ I<libslack(mem)> - memory module
     #include <slack/mem.h>
 
     typedef struct Pool Pool;
+    typedef struct PoolMark PoolMark;
+
+    struct PoolMark
+    {
+        void *chunk;
+        size_t used;
+    };
+
+    typedef struct MemStats MemStats;
+
+    struct MemStats
+    {
+        const char *file;
+        int line;
+        unsigned long allocs;
+        unsigned long frees;
+        size_t bytes;
+        size_t live;
+        unsigned long blocks;
+        size_t peak;
+    };
+
+    typedef void mem_track_report_t(const MemStats *stats, void *data);
 
     #define null NULL
     #define nul '\0'
@@ -45,6 +68,14 @@ I<libslack(mem)> - memory module
     void mem_release_secure(void *mem);
     void *mem_destroy_secure(void **mem);
     char *mem_strdup(const char *str);
+    void *mem_track_alloc(size_t size, const char *file, int line);
+    void *mem_track_resize(void **mem, size_t size, const char *file, int line);
+    void mem_track_free(void *mem);
+    char *mem_track_strdup(const char *str, const char *file, int line);
+    int mem_track_report(mem_track_report_t *report, void *data);
+    int mem_track_totals(MemStats *totals);
+    void mem_track_print(const MemStats *stats, void *stream);
+    void mem_track_reset(void);
     #define mem_create2d(type, x, y)
     #define mem_create3d(type, x, y, z)
     #define mem_create4d(type, x, y, z, a)
@@ -62,14 +93,23 @@ I<libslack(mem)> - memory module
     Pool *pool_create_with_locker(Locker *locker, size_t size);
     void pool_release(Pool *pool);
     void *pool_destroy(Pool **pool);
+    Pool *pool_create_growable(size_t size);
+    Pool *pool_create_growable_with_locker(Locker *locker, size_t size);
     Pool *pool_create_secure(size_t size);
     Pool *pool_create_secure_with_locker(Locker *locker, size_t size);
+    Pool *pool_create_secure_growable(size_t size);
+    Pool *pool_create_secure_growable_with_locker(Locker *locker, size_t size);
     void pool_release_secure(Pool *pool);
     void *pool_destroy_secure(Pool **pool);
     void pool_clear_secure(Pool *pool);
     #define pool_new(pool, type)
     #define pool_newsz(pool, size, type)
     void *pool_alloc(Pool *pool, size_t size);
+    void *pool_alloc_aligned(Pool *pool, size_t size, size_t alignment);
+    void *pool_alloc_thread(Pool *pool, size_t size);
+    void *pool_resize(Pool *pool, void *addr, size_t oldsize, size_t size);
+    int pool_mark(Pool *pool, PoolMark *mark);
+    int pool_rewind(Pool *pool, const PoolMark *mark);
     void pool_clear(Pool *pool);
 
 =head1 DESCRIPTION
@@ -77,7 +117,10 @@ I<libslack(mem)> - memory module
 This module is mostly just an interface to I<malloc(3)>, I<realloc(3)> and
 I<free(3)> that tries to ensure that pointers that don't point to anything
 get set to C<null>. It also provides dynamically allocated multi-dimensional
-arrays, memory pools and secure memory for the more adventurous.
+arrays, memory pools (fixed-size or growable regions) and secure memory for
+the more adventurous. When compiled with C<MEM_TRACK> defined, it also
+counts allocations, bytes and peak usage per call site (see
+I<mem_track_alloc(3)>).
 
 =over 4
 
@@ -97,14 +140,84 @@ arrays, memory pools and secure memory for the more adventurous.
 
 struct Pool
 {
-	size_t size;    /* number of bytes in the pool */
-	size_t used;    /* number of bytes allocated from the pool */
-	char *pool;     /* address of the pool */
-	Locker *locker; /* locking strategy for the pool */
+	size_t size;              /* number of bytes in the pool (or current chunk) */
+	size_t used;              /* number of bytes allocated from the pool (or chunk) */
+	char *pool;               /* address of the pool (or current chunk) */
+	Locker *locker;           /* locking strategy for the pool */
+	int growable;             /* whether to chain more memory when the pool is full */
+	int secure;               /* whether the memory is locked into RAM */
+	unsigned long generation; /* changes whenever memory is given back */
+};
+
+/* Growable pools are a chain of chunks, each preceded by this header */
+
+typedef struct PoolChunk PoolChunk;
+
+struct PoolChunk
+{
+	PoolChunk *next; /* the previously filled chunk */
+	size_t size;     /* number of bytes in the chunk (after the header) */
 };
 
+/* Alignment of memory allocated from growable pools */
+
+#define POOL_ALIGN sizeof(union { long l; double d; long double ld; void *p; void (*f)(void); })
+#define pool_align(size) (((size) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+#define POOL_HEADER pool_align(sizeof(PoolChunk))
+#define pool_chunk(pool) ((PoolChunk *)((pool)->pool - POOL_HEADER))
+
+/*
+** Each thread allocates from its own slab of a shared pool with
+** pool_alloc_thread() when the compiler supports thread-local storage.
+*/
+
+#if defined(__GNUC__) && !defined(NO_POOL_THREAD_SLABS)
+#define POOL_THREAD_SLABS
+#endif
+
+#ifndef POOL_SLAB_SIZE
+#define POOL_SLAB_SIZE 4096
+#endif
+
 #ifndef TEST
 
+#ifdef POOL_THREAD_SLABS
+
+typedef struct PoolSlab PoolSlab;
+
+struct PoolSlab
+{
+	const Pool *pool;         /* the pool the slab was carved from */
+	unsigned long generation; /* the pool's generation at the time */
+	char *next;               /* the next unused byte in the slab */
+	char *end;                /* the end of the slab */
+};
+
+static __thread PoolSlab pool_slab[1];
+
+#endif
+
+/*
+
+C<unsigned long pool_generation(void)>
+
+Returns a new generation number for a pool. They are unique across pools so
+that a thread's slab can't be mistaken for one carved from another pool that
+happens to reuse the same address.
+
+*/
+
+static unsigned long pool_generation(void)
+{
+	static unsigned long generation = 0;
+
+#ifdef __GNUC__
+	return __atomic_add_fetch(&generation, 1, __ATOMIC_RELAXED);
+#else
+	return ++generation;
+#endif
+}
+
 /*
 
 =item C< #define null NULL>
@@ -217,7 +330,11 @@ void *(mem_destroy)(void **mem)
 {
 	if (mem && *mem)
 	{
+#ifdef MEM_TRACK
+		mem_track_free(*mem);
+#else
 		free(*mem);
+#endif
 		*mem = NULL;
 	}
 
@@ -408,7 +525,7 @@ standard. On error, returns C<null> with C<errno> set appropriately.
 
 */
 
-char *mem_strdup(const char *str)
+char *(mem_strdup)(const char *str)
 {
 	size_t size;
 	char *copy;
@@ -422,259 +539,954 @@ char *mem_strdup(const char *str)
 	return memcpy(copy, str, size);
 }
 
-/*
-
-=item C< #define mem_create2d(i, j, type)>
-
-Alias for allocating a 2-dimensional array. See I<mem_create_space(3)>.
-
-=item C< #define mem_create3d(i, j, k, type)>
-
-Alias for allocating a 3-dimensional array. See I<mem_create_space(3)>.
-
-=item C< #define mem_create4d(i, j, k, l, type)>
+/* Allocation tracking (see mem_track_alloc() below) */
 
-Alias for allocating a 4-dimensional array. See I<mem_create_space(3)>.
+typedef struct MemBlock MemBlock;
 
-=item C<void *mem_create_space(size_t size, ...)>
+struct MemBlock
+{
+	void *mem;   /* the address of a live tracked block (null if unused) */
+	size_t size; /* the number of bytes requested */
+	size_t site; /* the index of the call site that allocated it */
+};
 
-Allocates a multi-dimensional array of elements of size C<size> and sets the
-memory to C<nul> bytes. The remaining arguments specify the sizes of each
-dimension. The last argument must be zero. There is an arbitrary limit of 32
-dimensions. The memory returned is set to C<nul> bytes. The memory returned
-needs to be cast or assigned into the appropriate pointer type. You can then
-set and access elements exactly like a real multi-dimensional C array.
-Finally, it must be deallocated with I<mem_destroy_space(3)> or
-I<mem_release_space(3)> or I<mem_destroy(3)> or I<mem_release(3)> or
-I<free(3)>. It is strongly recommended to use I<mem_destroy_space(3)> or
-I<mem_destroy(3)>, because they also set the pointer variable to C<null>.
+#define MEM_TRACK_MIN_SLOTS 64
 
-Note: You must not use I<memset(3)> on all of the returned memory because
-the start of this memory contains pointers into the remainder. The exact
-amount of this overhead depends on the number and size of dimensions. The
-memory is allocated with I<calloc(3)> to reduce the need to I<memset(3)> the
-elements, but if you need to know where the elements begin, use
-I<mem_space_start(3)>.
+static struct
+{
+	pthread_mutex_t lock;   /* guards everything below */
+	MemStats *site;         /* call sites, in order of first use */
+	size_t sites;           /* number of call sites */
+	size_t site_size;       /* allocated length of site */
+	size_t *site_index;     /* hash of call sites (1 + index into site, 0 if unused) */
+	size_t site_index_size; /* number of slots in site_index (a power of 2) */
+	MemBlock *block;        /* hash of live tracked blocks by address */
+	size_t blocks;          /* number of live tracked blocks */
+	size_t block_size;      /* number of slots in block (a power of 2) */
+	MemStats total;         /* totals over all call sites */
+}
+mem_track = { PTHREAD_MUTEX_INITIALIZER };
 
-The memory returned looks like (e.g.):
+#define mem_track_hash_site(file, line) (((size_t)(file) >> 3) * 31 + (size_t)(line))
+#define mem_track_hash_block(mem) (((size_t)(mem) >> 4) * (size_t)2654435761UL)
 
-  char ***a = mem_create3d(2, 2, 3, char);
+/*
 
-                                          +-------------------------+
-                                  +-------|-------------------+     |
-  a                       +-------|-------|-------------+     |     |
-  |               +-------|-------|-------|-------+     |     |     |
-  v               |       |       |       |       V     V     V     V
- +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
- | a[0]  | a[1]  |a[0][0]|a[0][1]|a[1][0]|a[1][1]| | | | | | | | | | | | |
- +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-  |       |       ^               ^               a a a a a a a a a a a a
-  +-------|-------+               |               0 0 0 0 0 0 1 1 1 1 1 1
-          +-----------------------+               0 0 0 1 1 1 0 0 0 1 1 1
-                                                  0 1 2 0 1 2 0 1 2 0 1 2
+C<static size_t mem_track_site(const char *file, int line)>
 
-=cut
+Returns the index of the call site, C<file> and C<line>, creating it if
+necessary. On error, returns C<(size_t)-1> with C<errno> set appropriately.
+Must be called with the lock held.
 
 */
 
-#ifndef MEM_MAX_DIM
-#define MEM_MAX_DIM 32
-#endif
-
-void *mem_create_space(size_t size, ...)
+static size_t mem_track_site(const char *file, int line)
 {
-	size_t dim[MEM_MAX_DIM], d, i, j;
-	size_t lengths[MEM_MAX_DIM];
-	size_t starts[MEM_MAX_DIM];
-	size_t sizes[MEM_MAX_DIM];
-	char *space;
-	size_t arg, length;
-	va_list args;
-
-	va_start(args, size);
-	for (d = 0; d < MEM_MAX_DIM && (arg = va_arg(args, size_t)); ++d)
-		dim[d] = arg;
-	va_end(args);
+	size_t mask = mem_track.site_index_size - 1;
+	size_t i, s;
 
-	for (length = i = 0; i < d; ++i)
+	if (mem_track.site_index_size)
 	{
-		starts[i] = length;
-		lengths[i] = sizes[i] = (i == d - 1) ? size : sizeof(void *);
-		for (j = 0; j <= i; ++j)
-			lengths[i] *= dim[j];
-		length += lengths[i];
+		for (i = mem_track_hash_site(file, line) & mask; (s = mem_track.site_index[i]); i = (i + 1) & mask)
+			if (mem_track.site[s - 1].file == file && mem_track.site[s - 1].line == line)
+				return s - 1;
 	}
 
-	if (!(space = calloc(length, 1)))
-		return NULL;
+	if (mem_track.sites == mem_track.site_size)
+	{
+		size_t size = (mem_track.site_size) ? mem_track.site_size * 2 : MEM_TRACK_MIN_SLOTS;
+		MemStats *site;
 
-	for (i = 0; i < d - 1; ++i)
+		if (!(site = realloc(mem_track.site, size * sizeof *site)))
+			return (size_t)set_errno(ENOMEM);
+
+		mem_track.site = site;
+		mem_track.site_size = size;
+	}
+
+	if ((mem_track.sites + 1) * 2 > mem_track.site_index_size)
 	{
-		size_t num = dim[i];
+		size_t size = (mem_track.site_index_size) ? mem_track.site_index_size * 2 : MEM_TRACK_MIN_SLOTS;
+		size_t *site_index;
 
-		for (j = 0; j < i; ++j)
-			num *= dim[j];
+		if (!(site_index = calloc(size, sizeof *site_index)))
+			return (size_t)set_errno(ENOMEM);
 
-		for (j = 0; j < num; ++j)
-			*(char **)(space + starts[i] + j * sizes[i]) = space + starts[i + 1] + j * dim[i + 1] * sizes[i + 1];
+		free(mem_track.site_index);
+		mem_track.site_index = site_index;
+		mem_track.site_index_size = size;
+		mask = size - 1;
+
+		for (s = 0; s < mem_track.sites; ++s)
+		{
+			for (i = mem_track_hash_site(mem_track.site[s].file, mem_track.site[s].line) & mask; site_index[i]; i = (i + 1) & mask)
+				;
+
+			site_index[i] = s + 1;
+		}
 	}
 
-	return space;
-}
+	for (i = mem_track_hash_site(file, line) & mask; mem_track.site_index[i]; i = (i + 1) & mask)
+		;
 
-/*
+	s = mem_track.sites++;
+	memset(&mem_track.site[s], 0, sizeof mem_track.site[s]);
+	mem_track.site[s].file = file;
+	mem_track.site[s].line = line;
+	mem_track.site_index[i] = s + 1;
 
-=item C<size_t mem_space_start(size_t size, ...)>
+	return s;
+}
 
-Calculates the amount of overhead required for a dynamically allocated
-multi-dimensional array created by a call to I<mem_create_space(3)> with the
-same arguments. If you need to reset all elements in such an array to C<nul>
-bytes:
+/*
 
-    int ****space = mem_create_space(sizeof(int), 2, 3, 4, 5, 0);
-    size_t start = mem_space_start(sizeof(int), 2, 3, 4, 5, 0);
-    memset((char *)space + start, '\0', sizeof(int) * 2 * 3 * 4 * 5);
+C<static int mem_track_reserve(void)>
 
-=cut
+Makes sure that there is room in the block hash for one more block. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately. Must be called with the lock held.
 
 */
 
-size_t mem_space_start(size_t size, ...)
+static int mem_track_reserve(void)
 {
-	size_t dim[MEM_MAX_DIM], d, i, j;
-	size_t lengths[MEM_MAX_DIM];
-	size_t arg, length;
-	va_list args;
+	MemBlock *block, *old = mem_track.block;
+	size_t size, mask, i, j;
 
-	va_start(args, size);
-	for (d = 0; d < MEM_MAX_DIM && (arg = va_arg(args, size_t)); ++d)
-		dim[d] = arg;
-	va_end(args);
+	if ((mem_track.blocks + 1) * 2 <= mem_track.block_size)
+		return 0;
 
-	for (length = i = 0; i < d; ++i)
+	size = (mem_track.block_size) ? mem_track.block_size * 2 : MEM_TRACK_MIN_SLOTS;
+	mask = size - 1;
+
+	if (!(block = calloc(size, sizeof *block)))
+		return set_errno(ENOMEM);
+
+	for (j = 0; j < mem_track.block_size; ++j)
 	{
-		lengths[i] = (i == d - 1) ? size : sizeof(void *);
-		for (j = 0; j <= i; ++j)
-			lengths[i] *= dim[j];
-		length += lengths[i];
+		if (!old[j].mem)
+			continue;
+
+		for (i = mem_track_hash_block(old[j].mem) & mask; block[i].mem; i = (i + 1) & mask)
+			;
+
+		block[i] = old[j];
 	}
 
-	return length - lengths[d - 1];
+	free(old);
+	mem_track.block = block;
+	mem_track.block_size = size;
+
+	return 0;
 }
 
 /*
 
-=item C< #define mem_release2d(space)>
+C<static MemBlock *mem_track_find(const void *mem)>
 
-Alias for releasing (deallocating) a dynamically allocated 2-dimensional
-array. See I<mem_release_space(3)>.
+Returns the slot of the tracked block at C<mem>, or C<null> if it isn't
+tracked. Must be called with the lock held.
 
-=item C< #define mem_release3d(space)>
+*/
 
-Alias for releasing (deallocating) a dynamically allocated 3-dimensional
-array. See I<mem_release_space(3)>.
+static MemBlock *mem_track_find(const void *mem)
+{
+	size_t mask = mem_track.block_size - 1;
+	size_t i;
 
-=item C< #define mem_release4d(space)>
+	if (!mem_track.block_size)
+		return NULL;
 
-Alias for releasing (deallocating) a dynamically allocated 4-dimensional
-array. See I<mem_release_space(3)>.
+	for (i = mem_track_hash_block(mem) & mask; mem_track.block[i].mem; i = (i + 1) & mask)
+		if (mem_track.block[i].mem == mem)
+			return &mem_track.block[i];
 
-=item C< #define mem_release_space(space)>
+	return NULL;
+}
 
-Releases (deallocates) a multi-dimensional array, C<space>, allocated with
-I<mem_create_space>. Same as I<free(3)>. Only to be used in destructor
-functions. In other cases, use I<mem_destroy_space(3)> or I<mem_destroy>
-which also set C<space> to C<null>.
+/*
 
-=item C< #define mem_destroy2d(space)>
+C<static void mem_track_forget(MemBlock *block)>
 
-Alias for destroying (deallocating and setting to C<null>) a
-2-dimensional array. See I<mem_destroy_space(3)>.
+Counts the tracked block in C<block> as released, and removes it from the
+block hash, shifting any later blocks in its probe sequence back into the
+gap. Must be called with the lock held.
 
-=item C< #define mem_destroy3d(space)>
+*/
 
-Alias for destroying (deallocating and setting to C<null>) a
-3-dimensional array. See I<mem_destroy_space(3)>.
+static void mem_track_forget(MemBlock *block)
+{
+	MemStats *site = &mem_track.site[block->site];
+	size_t mask = mem_track.block_size - 1;
+	size_t gap = block - mem_track.block;
+	size_t i, home;
+
+	++site->frees;
+	site->live -= block->size;
+	--site->blocks;
+	++mem_track.total.frees;
+	mem_track.total.live -= block->size;
+	--mem_track.total.blocks;
+
+	for (i = (gap + 1) & mask; mem_track.block[i].mem; i = (i + 1) & mask)
+	{
+		home = mem_track_hash_block(mem_track.block[i].mem) & mask;
 
-=item C< #define mem_destroy4d(space)>
+		if (((i - home) & mask) >= ((i - gap) & mask))
+		{
+			mem_track.block[gap] = mem_track.block[i];
+			gap = i;
+		}
+	}
 
-Alias for destroying (deallocating and setting to C<null>) a
-4-dimensional array. See I<mem_destroy_space(3)>.
+	mem_track.block[gap].mem = NULL;
+	--mem_track.blocks;
+}
 
-=item C< #define mem_destroy_space(mem)>
+/*
 
-Destroys (deallocates and sets to C<null>) the multi-dimensional array
-pointed to by C<space>.
+C<static void mem_track_remember(void *mem, size_t size, size_t site)>
 
-=cut
+Adds the block at C<mem> of C<size> bytes to the block hash, and counts it
+against C<site>. If the address is already tracked (because it was released
+without being tracked), the old block is counted as released first. Must be
+called with the lock held, after I<mem_track_reserve()>.
 
 */
 
+static void mem_track_remember(void *mem, size_t size, size_t site)
+{
+	MemStats *stats = &mem_track.site[site];
+	MemBlock *block;
+	size_t mask, i;
+
+	if ((block = mem_track_find(mem)))
+		mem_track_forget(block);
+
+	mask = mem_track.block_size - 1;
+	for (i = mem_track_hash_block(mem) & mask; mem_track.block[i].mem; i = (i + 1) & mask)
+		;
+
+	mem_track.block[i].mem = mem;
+	mem_track.block[i].size = size;
+	mem_track.block[i].site = site;
+	++mem_track.blocks;
+
+	++stats->allocs;
+	stats->bytes += size;
+	stats->live += size;
+	++stats->blocks;
+	if (stats->live > stats->peak)
+		stats->peak = stats->live;
+
+	++mem_track.total.allocs;
+	mem_track.total.bytes += size;
+	mem_track.total.live += size;
+	++mem_track.total.blocks;
+	if (mem_track.total.live > mem_track.total.peak)
+		mem_track.total.peak = mem_track.total.live;
+}
+
 /*
 
-=item C<Pool *pool_create(size_t size)>
+=item C<void *mem_track_alloc(size_t size, const char *file, int line)>
 
-Creates a memory pool of size C<size> from which smaller chunks of memory
-may be subsequently allocated (with I<pool_alloc(3)>) without resorting to
-the use of I<malloc(3)>. Useful when you have many small objects to
-allocate, but I<malloc(3)> is slowing your program down too much. It is the
-caller's responsibility to deallocate the new pool with I<pool_release(3)>
-or I<pool_destroy(3)>. It is strongly recommended to use I<pool_destroy(3)>,
-because it also sets the pointer variable to C<null>. On success, returns
-the pool. On error, returns C<null>.
+Allocates C<size> bytes (with I<malloc(3)>) and records the allocation
+against the call site given by C<file> and C<line>. It is the caller's
+responsibility to deallocate the memory with I<mem_track_free(3)>. On
+success, returns the address of the allocated memory. On error, returns
+C<null> with C<errno> set appropriately.
 
-The size of a pool can't be changed after it is created, and the individual
-chunks of memory allocated from within a pool can't be separately
-deallocated. The entire pool can be emptied with I<pool_clear(3)>.
+When I<libslack> and the application are compiled with C<MEM_TRACK> defined
+(e.g. C<make CPPFLAGS=-DMEM_TRACK>), I<mem_new(3)>, I<mem_create(3)>,
+I<mem_resize(3)>, I<mem_release(3)>, I<mem_destroy(3)> and I<mem_strdup(3)>
+call the I<mem_track> functions with their caller's C<__FILE__> and
+C<__LINE__>, so that I<mem_track_report(3)> can show where the heap usage
+(and churn) comes from. Otherwise, they are plain I<malloc(3)>,
+I<realloc(3)> and I<free(3)> as usual, and tracking costs nothing.
+
+Tracking is keyed by address, so tracked memory may be passed to code that
+was compiled without C<MEM_TRACK> and vice versa. Memory that isn't tracked
+is ignored when it is released. Tracked memory that is released with plain
+I<free(3)> is still counted as live until its address is reused.
 
 =cut
 
 */
 
-Pool *pool_create(size_t size)
+void *mem_track_alloc(size_t size, const char *file, int line)
 {
-	return pool_create_with_locker(NULL, size);
+	size_t site;
+	void *mem;
+
+	if (!file)
+		return set_errnull(EINVAL);
+
+	pthread_mutex_lock(&mem_track.lock);
+
+	if ((site = mem_track_site(file, line)) == (size_t)-1 || mem_track_reserve() == -1 || !(mem = malloc(size)))
+	{
+		pthread_mutex_unlock(&mem_track.lock);
+		return set_errnull(ENOMEM);
+	}
+
+	mem_track_remember(mem, size, site);
+	pthread_mutex_unlock(&mem_track.lock);
+
+	return mem;
 }
 
 /*
 
-=item C<Pool *pool_create_with_locker(Locker *locker, size_t size)>
+=item C<void *mem_track_resize(void **mem, size_t size, const char *file, int line)>
 
-Equivalent to I<pool_create(3)> except that multiple threads accessing the
-new pool will be synchronised by C<locker>.
+Equivalent to I<mem_resize_fn(3)> except that the resize is recorded against
+the call site given by C<file> and C<line>. A resize counts as releasing the
+old block and allocating the new one (at this call site). This is what
+I<mem_resize(3)> calls when compiled with C<MEM_TRACK> defined.
 
 =cut
 
 */
 
-Pool *pool_create_with_locker(Locker *locker, size_t size)
+void *mem_track_resize(void **mem, size_t size, const char *file, int line)
 {
-	Pool *pool = mem_create(1, Pool);
+	MemBlock *block;
+	size_t site;
+	void *ptr;
 
-	if (!pool)
-		return NULL;
+	if (!mem || !file)
+		return set_errnull(EINVAL);
 
-	if (!(pool->pool = malloc(size)))
+	if (!size)
 	{
-		mem_release(pool);
-		return NULL;
+		mem_track_free(*mem);
+		return *mem = NULL;
 	}
 
-	pool->size = size;
-	pool->used = 0;
-	pool->locker = locker;
+	pthread_mutex_lock(&mem_track.lock);
 
-	return pool;
+	if ((site = mem_track_site(file, line)) == (size_t)-1 || mem_track_reserve() == -1 || !(ptr = (*mem) ? realloc(*mem, size) : malloc(size)))
+	{
+		pthread_mutex_unlock(&mem_track.lock);
+		return set_errnull(ENOMEM);
+	}
+
+	if (*mem && (block = mem_track_find(*mem)))
+		mem_track_forget(block);
+
+	mem_track_remember(ptr, size, site);
+	pthread_mutex_unlock(&mem_track.lock);
+
+	return *mem = ptr;
 }
 
 /*
 
-C<int pool_lock(Pool *pool)>
+=item C<void mem_track_free(void *mem)>
 
-Claims a write lock on C<pool>. On success, returns C<0>. On error, returns
-an error code.
+Releases (deallocates) C<mem> with I<free(3)>, and counts it as released
+against the call site that allocated it (if it is tracked). This is what
+I<mem_release(3)> and I<mem_destroy(3)> call when compiled with
+C<MEM_TRACK> defined.
 
-C<int pool_unlock(Pool *pool)>
+=cut
+
+*/
+
+void mem_track_free(void *mem)
+{
+	MemBlock *block;
+
+	if (!mem)
+		return;
+
+	pthread_mutex_lock(&mem_track.lock);
+
+	if ((block = mem_track_find(mem)))
+		mem_track_forget(block);
+
+	pthread_mutex_unlock(&mem_track.lock);
+
+	free(mem);
+}
+
+/*
+
+=item C<char *mem_track_strdup(const char *str, const char *file, int line)>
+
+Equivalent to I<mem_strdup(3)> except that the allocation is recorded
+against the call site given by C<file> and C<line>. This is what
+I<mem_strdup(3)> calls when compiled with C<MEM_TRACK> defined.
+
+=cut
+
+*/
+
+char *mem_track_strdup(const char *str, const char *file, int line)
+{
+	size_t size;
+	char *copy;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	if (!(copy = mem_track_alloc(size = strlen(str) + 1, file, line)))
+		return NULL;
+
+	return memcpy(copy, str, size);
+}
+
+/*
+
+C<static int mem_track_cmp(const void *a, const void *b)>
+
+Orders call sites by the number of bytes they allocated (most first), then
+by the number of allocations, then by file and line.
+
+*/
+
+static int mem_track_cmp(const void *a, const void *b)
+{
+	const MemStats *x = a;
+	const MemStats *y = b;
+	int cmp;
+
+	if (x->bytes != y->bytes)
+		return (x->bytes < y->bytes) ? 1 : -1;
+
+	if (x->allocs != y->allocs)
+		return (x->allocs < y->allocs) ? 1 : -1;
+
+	if ((cmp = strcmp(x->file, y->file)))
+		return cmp;
+
+	return x->line - y->line;
+}
+
+/*
+
+=item C<int mem_track_report(mem_track_report_t *report, void *data)>
+
+Calls C<report> with the statistics for each call site that has used
+tracked memory (since the last I<mem_track_reset(3)>, or that still has
+live blocks), in order of the number of bytes allocated there (most
+first), passing C<data> as its second argument. The C<MemStats> structure
+contains the call site's C<file> and C<line>, the number of C<allocs> and
+C<frees>, the total number of C<bytes> allocated, the number of C<live>
+bytes and C<blocks> (allocated and not yet released), and the C<peak>
+number of live bytes. The statistics are a snapshot, so C<report> may
+allocate memory. Pass I<mem_track_print(3)> as C<report> to print them. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+Calling this in an I<atexit(3)> function, after freeing everything,
+shows any leaks as call sites with live blocks.
+
+=cut
+
+*/
+
+int mem_track_report(mem_track_report_t *report, void *data)
+{
+	MemStats *site;
+	size_t sites, i;
+
+	if (!report)
+		return set_errno(EINVAL);
+
+	pthread_mutex_lock(&mem_track.lock);
+
+	if (!(site = malloc((mem_track.sites + 1) * sizeof *site)))
+	{
+		pthread_mutex_unlock(&mem_track.lock);
+		return set_errno(ENOMEM);
+	}
+
+	for (sites = i = 0; i < mem_track.sites; ++i)
+		if (mem_track.site[i].allocs || mem_track.site[i].frees || mem_track.site[i].blocks)
+			site[sites++] = mem_track.site[i];
+
+	pthread_mutex_unlock(&mem_track.lock);
+
+	qsort(site, sites, sizeof *site, mem_track_cmp);
+
+	for (i = 0; i < sites; ++i)
+		report(&site[i], data);
+
+	free(site);
+
+	return 0;
+}
+
+/*
+
+=item C<int mem_track_totals(MemStats *totals)>
+
+Stores the statistics for all tracked memory in C<totals>. Its C<file> is
+C<null> and its C<peak> is the most tracked memory that was live at once.
+On success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int mem_track_totals(MemStats *totals)
+{
+	if (!totals)
+		return set_errno(EINVAL);
+
+	pthread_mutex_lock(&mem_track.lock);
+	*totals = mem_track.total;
+	pthread_mutex_unlock(&mem_track.lock);
+
+	return 0;
+}
+
+/*
+
+=item C<void mem_track_print(const MemStats *stats, void *stream)>
+
+A I<mem_track_report_t> function that prints C<stats> as a single line of
+C<key=value> pairs to C<stream> (a C<FILE *>), or to C<stderr> if C<stream>
+is C<null>. E.g. C<mem_track_report(mem_track_print, stderr)>.
+
+=cut
+
+*/
+
+void mem_track_print(const MemStats *stats, void *stream)
+{
+	if (!stats)
+		return;
+
+	fprintf((stream) ? (FILE *)stream : stderr, "site=%s:%d allocs=%lu frees=%lu bytes=%lu live=%lu blocks=%lu peak=%lu\n",
+		(stats->file) ? stats->file : "total", stats->line,
+		stats->allocs, stats->frees,
+		(unsigned long)stats->bytes, (unsigned long)stats->live,
+		stats->blocks, (unsigned long)stats->peak
+	);
+}
+
+/*
+
+=item C<void mem_track_reset(void)>
+
+Starts counting afresh: Sets the number of allocations, releases and bytes
+allocated to zero, and the peak to the current live usage, for every call
+site and for the totals. Live blocks are still tracked. This makes it
+possible to measure the heap churn of one part of a program (e.g. sending a
+single message) by resetting before it and reporting after it.
+
+=cut
+
+*/
+
+void mem_track_reset(void)
+{
+	size_t i;
+
+	pthread_mutex_lock(&mem_track.lock);
+
+	for (i = 0; i < mem_track.sites; ++i)
+	{
+		mem_track.site[i].allocs = mem_track.site[i].frees = 0;
+		mem_track.site[i].bytes = 0;
+		mem_track.site[i].peak = mem_track.site[i].live;
+	}
+
+	mem_track.total.allocs = mem_track.total.frees = 0;
+	mem_track.total.bytes = 0;
+	mem_track.total.peak = mem_track.total.live;
+
+	pthread_mutex_unlock(&mem_track.lock);
+}
+
+/*
+
+=item C< #define mem_create2d(i, j, type)>
+
+Alias for allocating a 2-dimensional array. See I<mem_create_space(3)>.
+
+=item C< #define mem_create3d(i, j, k, type)>
+
+Alias for allocating a 3-dimensional array. See I<mem_create_space(3)>.
+
+=item C< #define mem_create4d(i, j, k, l, type)>
+
+Alias for allocating a 4-dimensional array. See I<mem_create_space(3)>.
+
+=item C<void *mem_create_space(size_t size, ...)>
+
+Allocates a multi-dimensional array of elements of size C<size> and sets the
+memory to C<nul> bytes. The remaining arguments specify the sizes of each
+dimension. The last argument must be zero. There is an arbitrary limit of 32
+dimensions. The memory returned is set to C<nul> bytes. The memory returned
+needs to be cast or assigned into the appropriate pointer type. You can then
+set and access elements exactly like a real multi-dimensional C array.
+Finally, it must be deallocated with I<mem_destroy_space(3)> or
+I<mem_release_space(3)> or I<mem_destroy(3)> or I<mem_release(3)> or
+I<free(3)>. It is strongly recommended to use I<mem_destroy_space(3)> or
+I<mem_destroy(3)>, because they also set the pointer variable to C<null>.
+
+Note: You must not use I<memset(3)> on all of the returned memory because
+the start of this memory contains pointers into the remainder. The exact
+amount of this overhead depends on the number and size of dimensions. The
+memory is allocated with I<calloc(3)> to reduce the need to I<memset(3)> the
+elements, but if you need to know where the elements begin, use
+I<mem_space_start(3)>.
+
+The memory returned looks like (e.g.):
+
+  char ***a = mem_create3d(2, 2, 3, char);
+
+                                          +-------------------------+
+                                  +-------|-------------------+     |
+  a                       +-------|-------|-------------+     |     |
+  |               +-------|-------|-------|-------+     |     |     |
+  v               |       |       |       |       V     V     V     V
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ | a[0]  | a[1]  |a[0][0]|a[0][1]|a[1][0]|a[1][1]| | | | | | | | | | | | |
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  |       |       ^               ^               a a a a a a a a a a a a
+  +-------|-------+               |               0 0 0 0 0 0 1 1 1 1 1 1
+          +-----------------------+               0 0 0 1 1 1 0 0 0 1 1 1
+                                                  0 1 2 0 1 2 0 1 2 0 1 2
+
+=cut
+
+*/
+
+#ifndef MEM_MAX_DIM
+#define MEM_MAX_DIM 32
+#endif
+
+void *mem_create_space(size_t size, ...)
+{
+	size_t dim[MEM_MAX_DIM], d, i, j;
+	size_t lengths[MEM_MAX_DIM];
+	size_t starts[MEM_MAX_DIM];
+	size_t sizes[MEM_MAX_DIM];
+	char *space;
+	size_t arg, length;
+	va_list args;
+
+	va_start(args, size);
+	for (d = 0; d < MEM_MAX_DIM && (arg = va_arg(args, size_t)); ++d)
+		dim[d] = arg;
+	va_end(args);
+
+	for (length = i = 0; i < d; ++i)
+	{
+		starts[i] = length;
+		lengths[i] = sizes[i] = (i == d - 1) ? size : sizeof(void *);
+		for (j = 0; j <= i; ++j)
+			lengths[i] *= dim[j];
+		length += lengths[i];
+	}
+
+	if (!(space = calloc(length, 1)))
+		return NULL;
+
+	for (i = 0; i < d - 1; ++i)
+	{
+		size_t num = dim[i];
+
+		for (j = 0; j < i; ++j)
+			num *= dim[j];
+
+		for (j = 0; j < num; ++j)
+			*(char **)(space + starts[i] + j * sizes[i]) = space + starts[i + 1] + j * dim[i + 1] * sizes[i + 1];
+	}
+
+	return space;
+}
+
+/*
+
+=item C<size_t mem_space_start(size_t size, ...)>
+
+Calculates the amount of overhead required for a dynamically allocated
+multi-dimensional array created by a call to I<mem_create_space(3)> with the
+same arguments. If you need to reset all elements in such an array to C<nul>
+bytes:
+
+    int ****space = mem_create_space(sizeof(int), 2, 3, 4, 5, 0);
+    size_t start = mem_space_start(sizeof(int), 2, 3, 4, 5, 0);
+    memset((char *)space + start, '\0', sizeof(int) * 2 * 3 * 4 * 5);
+
+=cut
+
+*/
+
+size_t mem_space_start(size_t size, ...)
+{
+	size_t dim[MEM_MAX_DIM], d, i, j;
+	size_t lengths[MEM_MAX_DIM];
+	size_t arg, length;
+	va_list args;
+
+	va_start(args, size);
+	for (d = 0; d < MEM_MAX_DIM && (arg = va_arg(args, size_t)); ++d)
+		dim[d] = arg;
+	va_end(args);
+
+	for (length = i = 0; i < d; ++i)
+	{
+		lengths[i] = (i == d - 1) ? size : sizeof(void *);
+		for (j = 0; j <= i; ++j)
+			lengths[i] *= dim[j];
+		length += lengths[i];
+	}
+
+	return length - lengths[d - 1];
+}
+
+/*
+
+=item C< #define mem_release2d(space)>
+
+Alias for releasing (deallocating) a dynamically allocated 2-dimensional
+array. See I<mem_release_space(3)>.
+
+=item C< #define mem_release3d(space)>
+
+Alias for releasing (deallocating) a dynamically allocated 3-dimensional
+array. See I<mem_release_space(3)>.
+
+=item C< #define mem_release4d(space)>
+
+Alias for releasing (deallocating) a dynamically allocated 4-dimensional
+array. See I<mem_release_space(3)>.
+
+=item C< #define mem_release_space(space)>
+
+Releases (deallocates) a multi-dimensional array, C<space>, allocated with
+I<mem_create_space>. Same as I<free(3)>. Only to be used in destructor
+functions. In other cases, use I<mem_destroy_space(3)> or I<mem_destroy>
+which also set C<space> to C<null>.
+
+=item C< #define mem_destroy2d(space)>
+
+Alias for destroying (deallocating and setting to C<null>) a
+2-dimensional array. See I<mem_destroy_space(3)>.
+
+=item C< #define mem_destroy3d(space)>
+
+Alias for destroying (deallocating and setting to C<null>) a
+3-dimensional array. See I<mem_destroy_space(3)>.
+
+=item C< #define mem_destroy4d(space)>
+
+Alias for destroying (deallocating and setting to C<null>) a
+4-dimensional array. See I<mem_destroy_space(3)>.
+
+=item C< #define mem_destroy_space(mem)>
+
+Destroys (deallocates and sets to C<null>) the multi-dimensional array
+pointed to by C<space>.
+
+=cut
+
+*/
+
+/*
+
+=item C<Pool *pool_create(size_t size)>
+
+Creates a memory pool of size C<size> from which smaller chunks of memory
+may be subsequently allocated (with I<pool_alloc(3)>) without resorting to
+the use of I<malloc(3)>. Useful when you have many small objects to
+allocate, but I<malloc(3)> is slowing your program down too much. It is the
+caller's responsibility to deallocate the new pool with I<pool_release(3)>
+or I<pool_destroy(3)>. It is strongly recommended to use I<pool_destroy(3)>,
+because it also sets the pointer variable to C<null>. On success, returns
+the pool. On error, returns C<null>.
+
+The size of a pool can't be changed after it is created (see
+I<pool_create_growable(3)> for pools that can), and the individual chunks
+of memory allocated from within a pool can't be separately deallocated. The
+entire pool can be emptied with I<pool_clear(3)>, or emptied back to an
+earlier point with I<pool_rewind(3)>.
+
+=cut
+
+*/
+
+Pool *pool_create(size_t size)
+{
+	return pool_create_with_locker(NULL, size);
+}
+
+/*
+
+=item C<Pool *pool_create_with_locker(Locker *locker, size_t size)>
+
+Equivalent to I<pool_create(3)> except that multiple threads accessing the
+new pool will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+Pool *pool_create_with_locker(Locker *locker, size_t size)
+{
+	Pool *pool = mem_create(1, Pool);
+
+	if (!pool)
+		return NULL;
+
+	if (!(pool->pool = malloc(size)))
+	{
+		mem_release(pool);
+		return NULL;
+	}
+
+	pool->size = size;
+	pool->used = 0;
+	pool->locker = locker;
+	pool->growable = 0;
+	pool->secure = 0;
+	pool->generation = pool_generation();
+
+	return pool;
+}
+
+/*
+
+C<PoolChunk *pool_chunk_create(size_t size, int secure)>
+
+Allocates a chunk with room for C<size> bytes for a growable pool. If
+C<secure> is non-zero, the chunk is locked into RAM. On success, returns the
+chunk. On error, returns C<null> with C<errno> set appropriately.
+
+C<void pool_chunk_release(PoolChunk *chunk, int secure)>
+
+Deallocates C<chunk>. If C<secure> is non-zero, it is cleared and unlocked
+first.
+
+C<void pool_release_chunks(PoolChunk *chunk, int secure)>
+
+Deallocates C<chunk> and every chunk chained after it.
+
+*/
+
+static PoolChunk *pool_chunk_create(size_t size, int secure)
+{
+	PoolChunk *chunk = (secure) ? mem_create_secure(POOL_HEADER + size) : malloc(POOL_HEADER + size);
+
+	if (!chunk)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->size = size;
+
+	return chunk;
+}
+
+static void pool_chunk_release(PoolChunk *chunk, int secure)
+{
+	if (secure)
+		mem_release_secure(chunk);
+	else
+		free(chunk);
+}
+
+static void pool_release_chunks(PoolChunk *chunk, int secure)
+{
+	while (chunk)
+	{
+		PoolChunk *next = chunk->next;
+		pool_chunk_release(chunk, secure);
+		chunk = next;
+	}
+}
+
+/*
+
+C<Pool *pool_create_chained(Locker *locker, size_t size, int secure)>
+
+Creates a growable pool whose first chunk has room for C<size> bytes. If
+C<secure> is non-zero, all of its chunks are locked into RAM.
+
+*/
+
+static Pool *pool_create_chained(Locker *locker, size_t size, int secure)
+{
+	Pool *pool = mem_create(1, Pool);
+	PoolChunk *chunk;
+
+	if (!pool)
+		return NULL;
+
+	size = pool_align((size) ? size : 1);
+
+	if (!(chunk = pool_chunk_create(size, secure)))
+	{
+		mem_release(pool);
+		return NULL;
+	}
+
+	pool->pool = (char *)chunk + POOL_HEADER;
+	pool->size = size;
+	pool->used = 0;
+	pool->locker = locker;
+	pool->growable = 1;
+	pool->secure = secure;
+	pool->generation = pool_generation();
+
+	return pool;
+}
+
+/*
+
+=item C<Pool *pool_create_growable(size_t size)>
+
+Creates a memory pool just like I<pool_create(3)> except that, when the pool
+doesn't have enough unused memory for an allocation, another chunk of memory
+(at least twice as large as the last) is allocated and chained onto the
+pool, rather than failing with C<ENOSPC>. C<size> is the size of the first
+chunk. All memory allocated from a growable pool is suitably aligned for any
+type. I<pool_clear(3)> deallocates every chunk except the most recent (and
+largest) one, so a pool that is cleared and reused (e.g. once per message or
+request) soon stops needing I<malloc(3)> at all. It is the caller's
+responsibility to deallocate the new pool with I<pool_release(3)> or
+I<pool_destroy(3)>. On success, returns the pool. On error, returns C<null>.
+
+=cut
+
+*/
+
+Pool *pool_create_growable(size_t size)
+{
+	return pool_create_growable_with_locker(NULL, size);
+}
+
+/*
+
+=item C<Pool *pool_create_growable_with_locker(Locker *locker, size_t size)>
+
+Equivalent to I<pool_create_growable(3)> except that multiple threads
+accessing the new pool will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+Pool *pool_create_growable_with_locker(Locker *locker, size_t size)
+{
+	return pool_create_chained(locker, size, 0);
+}
+
+/*
+
+C<int pool_lock(Pool *pool)>
+
+Claims a write lock on C<pool>. On success, returns C<0>. On error, returns
+an error code.
+
+C<int pool_unlock(Pool *pool)>
 
 Unlocks a write lock on C<pool>. On success, returns C<0>. On error, returns
 an error code.
@@ -710,7 +1522,10 @@ void pool_release(Pool *pool)
 	}
 
 	locker = pool->locker;
-	mem_release(pool->pool);
+	if (pool->growable)
+		pool_release_chunks(pool_chunk(pool), pool->secure);
+	else
+		mem_release(pool->pool);
 	mem_release(pool);
 
 	if ((err = locker_unlock(locker)))
@@ -795,6 +1610,9 @@ Pool *pool_create_secure_with_locker(Locker *locker, size_t size)
 	pool->size = size;
 	pool->used = 0;
 	pool->locker = locker;
+	pool->growable = 0;
+	pool->secure = 1;
+	pool->generation = pool_generation();
 
 	return pool;
 #else
@@ -805,13 +1623,52 @@ Pool *pool_create_secure_with_locker(Locker *locker, size_t size)
 
 /*
 
+=item C<Pool *pool_create_secure_growable(size_t size)>
+
+Creates a growable memory pool just like I<pool_create_growable(3)> except
+that every chunk of the pool is locked into RAM as for
+I<pool_create_secure(3)>, and is cleared before it is deallocated (including
+the chunks deallocated by I<pool_clear(3)>). Memory given back by
+I<pool_rewind(3)> is also cleared. It is the caller's responsibility to
+deallocate the new pool with I<pool_release_secure(3)> or
+I<pool_destroy_secure(3)>. On success, returns the pool. On error, returns
+C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Pool *pool_create_secure_growable(size_t size)
+{
+	return pool_create_secure_growable_with_locker(NULL, size);
+}
+
+/*
+
+=item C<Pool *pool_create_secure_growable_with_locker(Locker *locker, size_t size)>
+
+Equivalent to I<pool_create_secure_growable(3)> except that multiple threads
+accessing the new pool will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+Pool *pool_create_secure_growable_with_locker(Locker *locker, size_t size)
+{
+	return pool_create_chained(locker, size, 1);
+}
+
+/*
+
 =item C<void pool_release_secure(Pool *pool)>
 
 Sets the contents of the memory pool to C<0xff> bytes, then to C<0xaa>
 bytes, then to C<0x55> bytes, then to C<nul> bytes, then unlocks and
 releases (deallocates) C<pool>. Only to be used on pools returned by
-I<pool_create_secure(3)>. Only to be used in destructor functions. In other
-cases, use I<pool_destroy_secure(3)> which also sets C<pool> to C<null>.
+I<pool_create_secure(3)> or I<pool_create_secure_growable(3)>. Only to be
+used in destructor functions. In other cases, use I<pool_destroy_secure(3)>
+which also sets C<pool> to C<null>.
 
 =cut
 
@@ -833,7 +1690,10 @@ void pool_release_secure(Pool *pool)
 	}
 
 	locker = pool->locker;
-	mem_release_secure(pool->pool);
+	if (pool->growable)
+		pool_release_chunks(pool_chunk(pool), 1);
+	else
+		mem_release_secure(pool->pool);
 	mem_release(pool);
 
 	if ((err = locker_unlock(locker)))
@@ -859,112 +1719,442 @@ void *pool_destroy_secure(Pool **pool)
 {
 	if (pool && *pool)
 	{
-		pool_release_secure(*pool);
-		*pool = NULL;
+		pool_release_secure(*pool);
+		*pool = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+C<void pool_wipe(char *addr, size_t size)>
+
+Sets C<size> bytes at C<addr> to C<0xff> bytes, then C<0xaa> bytes, then
+C<0x55> bytes, then C<nul> bytes.
+
+*/
+
+static void pool_wipe(char *addr, size_t size)
+{
+	memset(addr, 0xff, size);
+	memset(addr, 0xaa, size);
+	memset(addr, 0x55, size);
+	memset(addr, 0x00, size);
+}
+
+/*
+
+=item C<void pool_clear_secure(Pool *pool)>
+
+Fills the secure C<pool> with C<0xff> bytes, then C<0xaa> bytes, then
+C<0x55> bytes, then C<nul> bytes, and deallocates all of the chunks of
+secure memory previously allocated from C<pool> so that it can be reused.
+Does not use I<free(3)> except to release the extra memory chained onto a
+growable pool (which is cleared first).
+
+=cut
+
+*/
+
+static void pool_clear_unlocked(Pool *pool);
+
+void pool_clear_secure(Pool *pool)
+{
+	int err;
+
+	if (!pool)
+		return;
+
+	if ((err = pool_lock(pool)))
+	{
+		set_errno(err);
+		return;
+	}
+
+	pool_clear_unlocked(pool);
+	pool_wipe(pool->pool, pool->size);
+
+	if ((err = pool_unlock(pool)))
+		set_errno(err);
+}
+
+/*
+
+=item C< #define pool_new(pool, type)>
+
+Allocates enough memory from C<pool> to store an object of type C<type>. On
+success, returns the address of the allocated memory. On error, returns
+C<null> with C<errno> set appropriately.
+
+=item C< #define pool_newsz(pool, size, type)>
+
+Allocates enough memory from C<pool> to store C<size> objects of type
+C<type>. On success, returns the address of the allocated memory. On error,
+returns C<null> with C<errno> set appropriately.
+
+=item C<void *pool_alloc(Pool *pool, size_t size)>
+
+Allocates a chunk of memory of C<size> bytes from C<pool>. Does not use
+I<malloc(3)>. The pointer returned must not be passed to I<free(3)> or
+I<realloc(3)>. Only the entire pool can be deallocated with
+I<pool_release(3)> or I<pool_destroy(3)>. All of the chunks can be
+deallocated in one go with I<pool_clear(3)> without deallocating the pool
+itself.
+
+On success, returns the pointer to the allocated pool memory. On error,
+returns C<null> with C<errno> set appropriately (i.e. C<EINVAL> if C<pool>
+is C<null>, C<ENOSPC> if C<pool> is not growable and does not have enough
+unused memory to allocate C<size> bytes).
+
+Memory allocated from a growable pool is suitably aligned for any type.
+Otherwise, it is the caller's responsibility to ensure the correct alignment
+if necessary by allocating the right numbers of bytes (or by using
+I<pool_alloc_aligned(3)>). The easiest way to do ensure is to use separate
+pools for each specific data type that requires specific alignment.
+
+=cut
+
+*/
+
+/*
+
+C<int pool_chain(Pool *pool, size_t size)>
+
+Chains a new chunk, with room for at least C<size> bytes, onto the growable
+C<pool> and makes it the current chunk. On success, returns C<0>. On error,
+returns C<-1> with C<errno> set appropriately.
+
+C<void *pool_alloc_unlocked(Pool *pool, size_t size, size_t alignment)>
+
+Allocates C<size> bytes from C<pool>, aligned on a multiple of C<alignment>
+(which must be a power of 2), without locking C<pool>.
+
+*/
+
+#define pool_pad(addr, alignment) ((size_t)(-(unsigned long)(addr)) & ((alignment) - 1))
+#define pool_default_alignment(pool) (((pool)->growable) ? POOL_ALIGN : 1)
+
+static int pool_chain(Pool *pool, size_t size)
+{
+	PoolChunk *chunk;
+	size_t chunk_size;
+
+	for (chunk_size = pool->size << 1; chunk_size < size; chunk_size <<= 1)
+	{}
+
+	if (!(chunk = pool_chunk_create(chunk_size, pool->secure)))
+		return -1;
+
+	chunk->next = pool_chunk(pool);
+	pool->pool = (char *)chunk + POOL_HEADER;
+	pool->size = chunk_size;
+	pool->used = 0;
+
+	return 0;
+}
+
+static void *pool_alloc_unlocked(Pool *pool, size_t size, size_t alignment)
+{
+	void *addr;
+	size_t pad;
+
+	if (pool->growable)
+		size = pool_align(size);
+
+	pad = pool_pad(pool->pool + pool->used, alignment);
+
+	if (pool->used + pad + size > pool->size)
+	{
+		if (!pool->growable)
+			return set_errnull(ENOSPC);
+
+		if (pool_chain(pool, size + alignment) == -1)
+			return NULL;
+
+		pad = pool_pad(pool->pool, alignment);
+	}
+
+	addr = pool->pool + pool->used + pad;
+	pool->used += pad + size;
+
+	return addr;
+}
+
+void *pool_alloc(Pool *pool, size_t size)
+{
+	void *addr;
+	int err;
+
+	if (!pool)
+		return set_errnull(EINVAL);
+
+	if ((err = pool_lock(pool)))
+		return set_errnull(err);
+
+	addr = pool_alloc_unlocked(pool, size, pool_default_alignment(pool));
+
+	if ((err = pool_unlock(pool)))
+		return set_errnull(err);
+
+	return addr;
+}
+
+/*
+
+=item C<void *pool_alloc_aligned(Pool *pool, size_t size, size_t alignment)>
+
+Equivalent to I<pool_alloc(3)> except that the address returned is a
+multiple of C<alignment>, which must be a power of 2. This works with any
+pool, not just growable ones, and can be used for alignments stricter than
+that of any type (e.g. cache lines or pages). On error, returns C<null> with
+C<errno> set appropriately (i.e. C<EINVAL> if C<pool> is C<null> or
+C<alignment> is not a power of 2, C<ENOSPC> if C<pool> is not growable and
+does not have enough unused memory).
+
+=cut
+
+*/
+
+void *pool_alloc_aligned(Pool *pool, size_t size, size_t alignment)
+{
+	void *addr;
+	int err;
+
+	if (!pool || !alignment || (alignment & (alignment - 1)))
+		return set_errnull(EINVAL);
+
+	if ((err = pool_lock(pool)))
+		return set_errnull(err);
+
+	addr = pool_alloc_unlocked(pool, size, alignment);
+
+	if ((err = pool_unlock(pool)))
+		return set_errnull(err);
+
+	return addr;
+}
+
+/*
+
+=item C<void *pool_alloc_thread(Pool *pool, size_t size)>
+
+Equivalent to I<pool_alloc(3)> (with the memory suitably aligned for any
+type) except that it is intended for pools that are shared by multiple
+threads. Each thread carves a slab of memory out of C<pool> (locking it)
+and then satisfies its subsequent allocations from that slab without
+locking anything. A thread only locks C<pool> again when its slab is
+exhausted, when it switches to allocating from another pool, or after
+C<pool> has been cleared or rewound. Large allocations are passed straight
+to the pool. The cost is that up to a slab of memory per thread can be
+left unused in C<pool>. Memory allocated by I<pool_alloc_thread(3)> must not
+be passed to I<pool_resize(3)>. Without compiler support for thread-local
+storage, this is the same as I<pool_alloc(3)> on an aligned address.
+
+=cut
+
+*/
+
+void *pool_alloc_thread(Pool *pool, size_t size)
+{
+#ifdef POOL_THREAD_SLABS
+	PoolSlab *slab = pool_slab;
+	char *addr;
+	int err;
+
+	if (!pool)
+		return set_errnull(EINVAL);
+
+	size = pool_align(size);
+
+	/* The fast path: the rest of this thread's current slab */
+
+	if (slab->pool == pool && slab->generation == pool->generation && (size_t)(slab->end - slab->next) >= size)
+	{
+		addr = slab->next;
+		slab->next += size;
+
+		return addr;
+	}
+
+	if (size > POOL_SLAB_SIZE / 4)
+		return pool_alloc_aligned(pool, size, POOL_ALIGN);
+
+	if ((err = pool_lock(pool)))
+		return set_errnull(err);
+
+	if ((addr = pool_alloc_unlocked(pool, POOL_SLAB_SIZE, POOL_ALIGN)))
+	{
+		slab->pool = pool;
+		slab->generation = pool->generation;
+		slab->next = addr + size;
+		slab->end = addr + POOL_SLAB_SIZE;
 	}
+	else if (errno == ENOSPC)
+		addr = pool_alloc_unlocked(pool, size, POOL_ALIGN);
 
-	return NULL;
+	if ((err = pool_unlock(pool)))
+		return set_errnull(err);
+
+	return addr;
+#else
+	return pool_alloc_aligned(pool, size, POOL_ALIGN);
+#endif
 }
 
 /*
 
-=item C<void pool_clear_secure(Pool *pool)>
+=item C<void *pool_resize(Pool *pool, void *addr, size_t oldsize, size_t size)>
 
-Fills the secure C<pool> with C<0xff> bytes, then C<0xaa> bytes, then
-C<0x55> bytes, then C<nul> bytes, and deallocates all of the chunks of
-secure memory previously allocated from C<pool> so that it can be reused.
-Does not use I<free(3)>.
+Resizes the chunk of memory at C<addr>, of C<oldsize> bytes, that was
+previously allocated from C<pool>, so that it is C<size> bytes long. If
+C<addr> is the most recent allocation from C<pool>, and there is room, it
+is resized in place. Otherwise, a new chunk is allocated and the contents of
+the old one are copied into it. The old chunk is not reclaimed until the
+pool is cleared. If C<addr> is C<null>, this is equivalent to
+I<pool_alloc(3)>. This makes it cheap to build up strings and vectors in a
+growable pool. On success, returns the address of the resized memory (which
+might differ from C<addr>). On error, returns C<null> with C<errno> set
+appropriately, and C<addr> remains valid.
 
 =cut
 
 */
 
-static void pool_clear_unlocked(Pool *pool);
-
-void pool_clear_secure(Pool *pool)
+void *pool_resize(Pool *pool, void *addr, size_t oldsize, size_t size)
 {
+	size_t old_used, new_used;
+	void *new_addr;
 	int err;
 
 	if (!pool)
-		return;
+		return set_errnull(EINVAL);
 
 	if ((err = pool_lock(pool)))
+		return set_errnull(err);
+
+	old_used = (pool->growable) ? pool_align(oldsize) : oldsize;
+	new_used = (pool->growable) ? pool_align(size) : size;
+
+	if (addr && (char *)addr + old_used == pool->pool + pool->used && pool->used - old_used + new_used <= pool->size)
 	{
-		set_errno(err);
-		return;
+		pool->used = pool->used - old_used + new_used;
+		new_addr = addr;
 	}
-
-	pool_clear_unlocked(pool);
-	memset(pool->pool, 0xff, pool->size);
-	memset(pool->pool, 0xaa, pool->size);
-	memset(pool->pool, 0x55, pool->size);
-	memset(pool->pool, 0x00, pool->size);
+	else if ((new_addr = pool_alloc_unlocked(pool, size, pool_default_alignment(pool))) && addr)
+		memcpy(new_addr, addr, (oldsize < size) ? oldsize : size);
 
 	if ((err = pool_unlock(pool)))
-		set_errno(err);
+		return set_errnull(err);
+
+	return new_addr;
 }
 
 /*
 
-=item C< #define pool_new(pool, type)>
+=item C<int pool_mark(Pool *pool, PoolMark *mark)>
 
-Allocates enough memory from C<pool> to store an object of type C<type>. On
-success, returns the address of the allocated memory. On error, returns
-C<null> with C<errno> set appropriately.
+Records the current extent of C<pool> in C<mark> so that everything that is
+allocated from C<pool> after this point can later be deallocated in one go
+with I<pool_rewind(3)>, while keeping everything that was allocated before
+it. Marks can be nested (i.e. a pool can be rewound to an inner mark, and
+then to an outer one). A mark is invalidated by I<pool_clear(3)> and by
+rewinding to an earlier mark. On success, returns C<0>. On error, returns
+C<-1> with C<errno> set appropriately.
 
-=item C< #define pool_newsz(pool, size, type)>
+=cut
 
-Allocates enough memory from C<pool> to store C<size> objects of type
-C<type>. On success, returns the address of the allocated memory. On error,
-returns C<null> with C<errno> set appropriately.
+*/
 
-=item C<void *pool_alloc(Pool *pool, size_t size)>
+int pool_mark(Pool *pool, PoolMark *mark)
+{
+	int err;
 
-Allocates a chunk of memory of C<size> bytes from C<pool>. Does not use
-I<malloc(3)>. The pointer returned must not be passed to I<free(3)> or
-I<realloc(3)>. Only the entire pool can be deallocated with
-I<pool_release(3)> or I<pool_destroy(3)>. All of the chunks can be
-deallocated in one go with I<pool_clear(3)> without deallocating the pool
-itself.
+	if (!pool || !mark)
+		return set_errno(EINVAL);
 
-On success, returns the pointer to the allocated pool memory. On error,
-returns C<null> with C<errno> set appropriately (i.e. C<EINVAL> if C<pool>
-is C<null>, C<ENOSPC> if C<pool> does not have enough unused memory to
-allocate C<size> bytes).
+	if ((err = pool_lock(pool)))
+		return set_errno(err);
+
+	mark->chunk = pool->pool;
+	mark->used = pool->used;
+
+	if ((err = pool_unlock(pool)))
+		return set_errno(err);
+
+	return 0;
+}
+
+/*
+
+=item C<int pool_rewind(Pool *pool, const PoolMark *mark)>
 
-It is the caller's responsibility to ensure the correct alignment if
-necessary by allocating the right numbers of bytes. The easiest way to do
-ensure is to use separate pools for each specific data type that requires
-specific alignment.
+Deallocates all of the memory allocated from C<pool> since C<mark> was
+recorded with I<pool_mark(3)>. Any chunks chained onto a growable pool since
+then are released. In secure pools, the memory given back is cleared. Does
+not use I<free(3)> except to release chained chunks. On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately (i.e.
+C<EINVAL> if C<pool> or C<mark> is C<null>, or if C<mark> is no longer
+valid).
 
 =cut
 
 */
 
-void *pool_alloc(Pool *pool, size_t size)
+int pool_rewind(Pool *pool, const PoolMark *mark)
 {
-	void *addr;
+	PoolChunk *chunk = NULL;
+	size_t used;
 	int err;
 
-	if (!pool)
-		return set_errnull(EINVAL);
+	if (!pool || !mark)
+		return set_errno(EINVAL);
 
 	if ((err = pool_lock(pool)))
-		return set_errnull(err);
+		return set_errno(err);
+
+	/* Find the chunk that was current when the mark was made */
+
+	if (pool->growable)
+		for (chunk = pool_chunk(pool); chunk && (char *)chunk + POOL_HEADER != mark->chunk; chunk = chunk->next)
+		{}
+
+	if ((pool->growable) ? (!chunk || mark->used > chunk->size) : (mark->chunk != pool->pool))
+	{
+		pool_unlock(pool);
+		return set_errno(EINVAL);
+	}
+
+	used = (mark->chunk == pool->pool) ? pool->used : chunk->size;
 
-	if (pool->used + size > pool->size)
+	if (mark->used > used)
 	{
 		pool_unlock(pool);
-		return set_errnull(ENOSPC);
+		return set_errno(EINVAL);
 	}
 
-	addr = pool->pool + pool->used;
-	pool->used += size;
+	/* Release the chunks chained since then */
+
+	while (pool->growable && pool_chunk(pool) != chunk)
+	{
+		PoolChunk *next = pool_chunk(pool)->next;
+		pool_chunk_release(pool_chunk(pool), pool->secure);
+		pool->pool = (char *)next + POOL_HEADER;
+	}
+
+	if (pool->secure)
+		pool_wipe(pool->pool + mark->used, used - mark->used);
+
+	if (pool->growable)
+		pool->size = chunk->size;
+
+	pool->used = mark->used;
+	pool->generation = pool_generation();
 
 	if ((err = pool_unlock(pool)))
-		return set_errnull(err);
+		return set_errno(err);
 
-	return addr;
+	return 0;
 }
 
 /*
@@ -972,7 +2162,8 @@ void *pool_alloc(Pool *pool, size_t size)
 =item C<void pool_clear(Pool *pool)>
 
 Deallocates all of the chunks of memory previously allocated from C<pool> so
-that it can be reused. Does not use I<free(3)>.
+that it can be reused. Does not use I<free(3)> except to release the extra
+memory chained onto a growable pool (the most recent chunk is kept).
 
 =cut
 
@@ -991,7 +2182,14 @@ static void pool_clear_with_locker(Pool *pool, int lock_pool)
 		return;
 	}
 
+	if (pool->growable)
+	{
+		pool_release_chunks(pool_chunk(pool)->next, pool->secure);
+		pool_chunk(pool)->next = NULL;
+	}
+
 	pool->used = 0;
+	pool->generation = pool_generation();
 
 	if (lock_pool && (err = pool_unlock(pool)))
 		set_errno(err);
@@ -1023,13 +2221,15 @@ When arguments are invalid.
 
 =item C<ENOSPC>
 
-When there is insufficient available space in a pool for I<pool_alloc(3)> to
-satisfy a request.
+When there is insufficient available space in a pool that isn't growable for
+I<pool_alloc(3)>, I<pool_alloc_aligned(3)>, I<pool_alloc_thread(3)> or
+I<pool_resize(3)> to satisfy a request.
 
 =item C<ENOSYS>
 
-Returned by I<mem_create_secure(3)> and I<pool_create_secure(3)> when
-I<mlock(2)> is not supported (e.g. I<Mac OS X>).
+Returned by I<mem_create_secure(3)>, I<pool_create_secure(3)> and
+I<pool_create_secure_growable(3)> when I<mlock(2)> is not supported (e.g.
+I<Mac OS X>).
 
 =back
 
@@ -1037,7 +2237,8 @@ I<mlock(2)> is not supported (e.g. I<Mac OS X>).
 
 I<MT-Safe> (mem)
 
-I<MT-Disciplined> (pool) man I<locker(3)> for details.
+I<MT-Disciplined> (pool) man I<locker(3)> for details. I<pool_alloc_thread(3)>
+only uses the pool's locker when the calling thread needs a new slab.
 
 =head1 EXAMPLES
 
@@ -1080,6 +2281,31 @@ A pool of a million integers:
         pool_destroy(&pool);
     }
 
+A growable region for each request, with a checkpoint:
+
+    Pool *region;
+    PoolMark mark;
+
+    if (!(region = pool_create_growable(64 * 1024)))
+        exit(EXIT_FAILURE);
+
+    while (next_request())
+    {
+        Request *req = pool_new(region, Request);
+        parse_request(region, req);
+        pool_mark(region, &mark);
+
+        if (!try_fast_response(region, req))
+        {
+            pool_rewind(region, &mark); // Discard the failed attempt
+            slow_response(region, req);
+        }
+
+        pool_clear(region); // Keeps the largest chunk for next time
+    }
+
+    pool_destroy(&region);
+
 Secure memory:
 
     char *secure_passwd = mem_create_secure(32);
@@ -1132,6 +2358,153 @@ I<locker(3)>
 #include <sys/stat.h>
 #include <slack/net.h>
 
+static void *thread_allocator(void *arg)
+{
+	Pool *pool = arg;
+	long *addrs[2000];
+	int i;
+
+	for (i = 0; i < 2000; ++i)
+	{
+		if (!(addrs[i] = pool_alloc_thread(pool, (i % 8 + 1) * sizeof(long))))
+			return (void *)1;
+
+		if ((unsigned long)addrs[i] % POOL_ALIGN)
+			return (void *)1;
+
+		*addrs[i] = (long)pthread_self() + i;
+	}
+
+	for (i = 0; i < 2000; ++i)
+		if (*addrs[i] != (long)pthread_self() + i)
+			return (void *)1;
+
+	return NULL;
+}
+
+static double wall(void)
+{
+	struct timespec ts[1];
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+typedef struct TrackReport TrackReport;
+
+struct TrackReport
+{
+	int sites;
+	MemStats stats[8];
+};
+
+static void track_collect(const MemStats *stats, void *data)
+{
+	TrackReport *report = data;
+
+	if (stats->file && !strcmp(stats->file, "track.c") && report->sites < 8)
+		report->stats[report->sites++] = *stats;
+}
+
+#define BENCH_ALLOCS 1000000
+#define BENCH_THREADS 4
+
+static Pool *bench_pool;
+static void *bench_addrs[BENCH_THREADS][BENCH_ALLOCS / BENCH_THREADS];
+
+static void *bench_thread(void *arg)
+{
+	void **addrs = bench_addrs[(long)arg >> 2];
+	int how = (long)arg & 3;
+	int i;
+
+	for (i = 0; i < BENCH_ALLOCS / BENCH_THREADS; ++i)
+	{
+		size_t size = 16 + (i & 7) * 8;
+
+		switch (how)
+		{
+			case 0: addrs[i] = malloc(size); break;
+			case 1: addrs[i] = pool_alloc(bench_pool, size); break;
+			case 2: addrs[i] = pool_alloc_thread(bench_pool, size); break;
+		}
+	}
+
+	if (how == 0)
+		for (i = 0; i < BENCH_ALLOCS / BENCH_THREADS; ++i)
+			free(addrs[i]);
+
+	return NULL;
+}
+
+static void bench(void)
+{
+	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	const char * const names[] = { "malloc+free", "pool_alloc (locked)", "pool_alloc_thread (locked)" };
+	Locker *locker = locker_create_mutex(&mutex);
+	pthread_t thread[BENCH_THREADS];
+	void **addrs = bench_addrs[0];
+	double start, secs;
+	int i, how;
+
+	/* Single-threaded: allocate a message's worth of objects, then free them all */
+
+	start = wall();
+	for (i = 0; i < BENCH_ALLOCS / BENCH_THREADS; ++i)
+		addrs[i] = malloc(16 + (i & 7) * 8);
+	for (i = 0; i < BENCH_ALLOCS / BENCH_THREADS; ++i)
+		free(addrs[i]);
+	secs = wall() - start;
+	printf("%-40s %8.1f ns/alloc\n", "malloc+free", secs * 1e9 / (BENCH_ALLOCS / BENCH_THREADS));
+
+	bench_pool = pool_create(BENCH_ALLOCS / BENCH_THREADS * 80);
+	start = wall();
+	for (i = 0; i < BENCH_ALLOCS / BENCH_THREADS; ++i)
+		addrs[i] = pool_alloc(bench_pool, 16 + (i & 7) * 8);
+	pool_clear(bench_pool);
+	secs = wall() - start;
+	printf("%-40s %8.1f ns/alloc\n", "pool_alloc (fixed)", secs * 1e9 / (BENCH_ALLOCS / BENCH_THREADS));
+	pool_destroy(&bench_pool);
+
+	bench_pool = pool_create_growable(4096);
+	start = wall();
+	for (i = 0; i < BENCH_ALLOCS / BENCH_THREADS; ++i)
+		addrs[i] = pool_alloc(bench_pool, 16 + (i & 7) * 8);
+	pool_clear(bench_pool);
+	secs = wall() - start;
+	printf("%-40s %8.1f ns/alloc\n", "pool_alloc (growable, cold)", secs * 1e9 / (BENCH_ALLOCS / BENCH_THREADS));
+	start = wall();
+	for (i = 0; i < BENCH_ALLOCS / BENCH_THREADS; ++i)
+		addrs[i] = pool_alloc(bench_pool, 16 + (i & 7) * 8);
+	pool_clear(bench_pool);
+	secs = wall() - start;
+	printf("%-40s %8.1f ns/alloc\n", "pool_alloc (growable, reused)", secs * 1e9 / (BENCH_ALLOCS / BENCH_THREADS));
+	pool_destroy(&bench_pool);
+
+	/* Multi-threaded: every thread allocating from one shared pool */
+
+	for (how = 0; how < 3; ++how)
+	{
+		bench_pool = pool_create_growable_with_locker(locker, 1024 * 1024);
+		start = wall();
+
+		for (i = 0; i < BENCH_THREADS; ++i)
+			pthread_create(&thread[i], NULL, bench_thread, (void *)(long)(i << 2 | how));
+
+		for (i = 0; i < BENCH_THREADS; ++i)
+			pthread_join(thread[i], NULL);
+
+		pool_clear(bench_pool);
+		secs = wall() - start;
+		printf("%-31s (%d threads) %8.1f ns/alloc (%.1fM allocs/s)\n", names[how], BENCH_THREADS, secs * 1e9 / BENCH_ALLOCS, BENCH_ALLOCS / secs / 1e6);
+		pool_destroy(&bench_pool);
+	}
+
+	locker_destroy(&locker);
+	exit(EXIT_SUCCESS);
+}
+
 int main(int ac, char **av)
 {
 	int *mem1 = NULL;
@@ -1155,10 +2528,13 @@ int main(int ac, char **av)
 
 	if (ac == 2 && !strcmp(av[1], "help"))
 	{
-		printf("usage: %s [pool]\n", *av);
+		printf("usage: %s [pool|bench]\n", *av);
 		return EXIT_SUCCESS;
 	}
 
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench();
+
 	printf("Testing: %s\n", "mem");
 
 	/* Test create, resize and destroy */
@@ -1666,8 +3042,272 @@ int main(int ac, char **av)
 	if (!mem_resize(&str, UINT_MAX) && errno != ENOMEM)
 		++errors, printf("Test67: assumption failed: realloc failed but errno == \"%s\" (not \"%s\")\n", strerror(errno), strerror(ENOMEM));
 
+	/* Test growable pools and pool_resize() */
+
+	if (!(pool = pool_create_growable(16)))
+		++errors, printf("Test68: pool_create_growable(16) failed: %s\n", strerror(errno));
+	else
+	{
+		char *addrs[1000], *a, *b;
+
+		for (i = 0; i < 1000; ++i)
+		{
+			if (!(addrs[i] = pool_alloc(pool, 1 + i % 24)))
+			{
+				++errors, printf("Test69: pool_alloc(growable, %d) failed: %s\n", 1 + i % 24, strerror(errno));
+				break;
+			}
+
+			if ((unsigned long)addrs[i] % POOL_ALIGN)
+				++errors, printf("Test69: pool_alloc(growable, %d) failed: %p is not aligned\n", 1 + i % 24, (void *)addrs[i]);
+
+			memset(addrs[i], i & 0xff, 1 + i % 24);
+		}
+
+		for (j = 0; j < i; ++j)
+			if (addrs[j][j % 24] != (char)(j & 0xff))
+				++errors, printf("Test70: growable pool memory %d was overwritten\n", j);
+
+		pool_clear(pool);
+		if (pool->used || pool_chunk(pool)->next || pool->size <= 16)
+			++errors, printf("Test71: pool_clear(growable) failed (used %d, next %p, size %d)\n", (int)pool->used, (void *)pool_chunk(pool)->next, (int)pool->size);
+
+		a = pool_alloc(pool, 8);
+		if (!a || pool_resize(pool, a, 8, 100) != a)
+			++errors, printf("Test72: pool_resize(last) failed to resize in place\n");
+
+		b = pool_alloc(pool, 8);
+		if (a && b)
+		{
+			strcpy(a, "abcdefg");
+			if (!(b = pool_resize(pool, a, 8, 64)) || b == a || strcmp(b, "abcdefg"))
+				++errors, printf("Test73: pool_resize(not last) failed\n");
+		}
+
+		pool_destroy(&pool);
+	}
+
+	if (pool_resize(NULL, NULL, 0, 1) != NULL || errno != EINVAL)
+		++errors, printf("Test74: pool_resize(NULL) failed (errno %d, not %d)\n", errno, EINVAL);
+
+	if ((pool = pool_create(16)))
+	{
+		char *a = pool_alloc(pool, 8);
+
+		if (pool_resize(pool, a, 8, 16) != a)
+			++errors, printf("Test75: pool_resize(fixed, last) failed to resize in place\n");
+
+		if (pool_resize(pool, a, 16, 17) != NULL || errno != ENOSPC)
+			++errors, printf("Test76: pool_resize(fixed, too big) failed (errno %d, not %d)\n", errno, ENOSPC);
+
+		pool_destroy(&pool);
+	}
+
+	/* Test pool_alloc_aligned() */
+
+	if ((pool = pool_create(1024)))
+	{
+		char *a;
+
+		pool_alloc(pool, 1);
+		if (!(a = pool_alloc_aligned(pool, 10, 64)) || (unsigned long)a % 64)
+			++errors, printf("Test77: pool_alloc_aligned(fixed, 10, 64) failed (%p)\n", (void *)a);
+
+		if (pool_alloc_aligned(pool, 10, 48) != NULL || errno != EINVAL)
+			++errors, printf("Test78: pool_alloc_aligned(fixed, 10, 48) failed (errno %d, not %d)\n", errno, EINVAL);
+
+		pool_destroy(&pool);
+	}
+
+	/* Test pool_mark() and pool_rewind() */
+
+	if ((pool = pool_create_growable(64)))
+	{
+		PoolMark mark[1], inner[1];
+		char *first, *again;
+		PoolChunk *chunk;
+
+		pool_alloc(pool, 10);
+		if (pool_mark(pool, mark) == -1)
+			++errors, printf("Test79: pool_mark() failed: %s\n", strerror(errno));
+
+		chunk = pool_chunk(pool);
+		first = pool_alloc(pool, 10);
+		for (i = 0; i < 100; ++i)
+			pool_alloc(pool, 100);
+
+		pool_mark(pool, inner);
+		pool_alloc(pool, 1000);
+
+		if (pool_rewind(pool, inner) == -1 || pool->pool != inner->chunk || pool->used != inner->used)
+			++errors, printf("Test80: pool_rewind(inner) failed\n");
+
+		if (pool_rewind(pool, mark) == -1 || pool_chunk(pool) != chunk || pool->size != 64)
+			++errors, printf("Test81: pool_rewind(mark) failed (chunk %p, not %p, size %d)\n", (void *)pool_chunk(pool), (void *)chunk, (int)pool->size);
+
+		if ((again = pool_alloc(pool, 10)) != first)
+			++errors, printf("Test82: pool_alloc() after pool_rewind() failed (%p, not %p)\n", (void *)again, (void *)first);
+
+		if (pool_rewind(pool, inner) != -1 || errno != EINVAL)
+			++errors, printf("Test83: pool_rewind(invalid) failed (errno %d, not %d)\n", errno, EINVAL);
+
+		pool_destroy(&pool);
+	}
+
+	/* Test pool_alloc_thread() */
+
+	{
+		static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+		Locker *locker = locker_create_mutex(&mutex);
+		pthread_t thread[4];
+
+		if (!(pool = pool_create_growable_with_locker(locker, 1024)))
+			++errors, printf("Test84: pool_create_growable_with_locker() failed: %s\n", strerror(errno));
+		else
+		{
+			for (i = 0; i < 4; ++i)
+				pthread_create(&thread[i], NULL, thread_allocator, pool);
+
+			for (i = 0; i < 4; ++i)
+			{
+				void *failed;
+
+				pthread_join(thread[i], &failed);
+				if (failed)
+					++errors, printf("Test84: pool_alloc_thread() in thread %d failed\n", i);
+			}
+
+			pool_clear(pool);
+			if (!pool_alloc_thread(pool, 8) || pool->used != POOL_SLAB_SIZE)
+				++errors, printf("Test85: pool_alloc_thread() after pool_clear() failed (used %d, not %d)\n", (int)pool->used, POOL_SLAB_SIZE);
+
+			pool_destroy(&pool);
+		}
+
+		locker_destroy(&locker);
+	}
+
+	/* Test secure growable pools */
+
+	if (!no_secure_mem)
+	{
+		if (!(pool = pool_create_secure_growable(32)))
+			++errors, printf("Test86: pool_create_secure_growable(32) failed: %s\n", strerror(errno));
+		else
+		{
+			PoolMark mark[1];
+			char *secret;
+
+			for (i = 0; i < 100; ++i)
+				if (!pool_alloc(pool, 32))
+					++errors, printf("Test86: pool_alloc(secure growable, 32) failed: %s\n", strerror(errno));
+
+			pool_mark(pool, mark);
+			if ((secret = pool_alloc(pool, 16)))
+			{
+				strcpy(secret, "0123456789abcde");
+				pool_rewind(pool, mark);
+				for (i = 0; i < 16; ++i)
+					if (secret[i])
+						break;
+				if (i != 16)
+					++errors, printf("Test87: pool_rewind(secure) failed: memory not cleared\n");
+			}
+
+			pool_destroy_secure(&pool);
+		}
+	}
+
+	/* Test allocation tracking */
+
+	{
+		MemStats before, after;
+		TrackReport report;
+		char *a[3], *b, *copy;
+
+		mem_track_totals(&before);
+
+		for (i = 0; i < 3; ++i)
+			if (!(a[i] = mem_track_alloc(100, "track.c", 10)))
+				++errors, printf("Test88: mem_track_alloc(100) failed: %s\n", strerror(errno));
+
+		if (!(b = mem_track_alloc(1000, "track.c", 20)))
+			++errors, printf("Test88: mem_track_alloc(1000) failed: %s\n", strerror(errno));
+
+		mem_track_totals(&after);
+		if (after.allocs - before.allocs != 4 || after.live - before.live != 1300 || after.blocks - before.blocks != 4)
+			++errors, printf("Test89: mem_track_totals() failed (allocs %lu live %lu blocks %lu, not 4 1300 4)\n", after.allocs - before.allocs, (unsigned long)(after.live - before.live), after.blocks - before.blocks);
+
+		if (!mem_track_resize((void **)&a[0], 500, "track.c", 30))
+			++errors, printf("Test90: mem_track_resize() failed: %s\n", strerror(errno));
+
+		mem_track_free(a[1]);
+		mem_track_free(malloc(10)); /* untracked */
+
+		memset(&report, 0, sizeof report);
+		mem_track_report(track_collect, &report);
+
+		if (report.sites != 3)
+			++errors, printf("Test91: mem_track_report() failed (%d sites, not 3)\n", report.sites);
+		else
+		{
+			if (report.stats[0].line != 20 || report.stats[0].bytes != 1000 || report.stats[0].live != 1000 || report.stats[0].blocks != 1)
+				++errors, printf("Test92: mem_track_report() failed (line %d bytes %lu live %lu, not 20 1000 1000)\n", report.stats[0].line, (unsigned long)report.stats[0].bytes, (unsigned long)report.stats[0].live);
+
+			if (report.stats[1].line != 30 || report.stats[1].allocs != 1 || report.stats[1].live != 500 || report.stats[1].frees != 0)
+				++errors, printf("Test93: mem_track_report() failed (line %d allocs %lu live %lu frees %lu, not 30 1 500 0)\n", report.stats[1].line, report.stats[1].allocs, (unsigned long)report.stats[1].live, report.stats[1].frees);
+
+			if (report.stats[2].line != 10 || report.stats[2].allocs != 3 || report.stats[2].frees != 2 || report.stats[2].live != 100 || report.stats[2].peak != 300)
+				++errors, printf("Test94: mem_track_report() failed (line %d allocs %lu frees %lu live %lu peak %lu, not 10 3 2 100 300)\n", report.stats[2].line, report.stats[2].allocs, report.stats[2].frees, (unsigned long)report.stats[2].live, (unsigned long)report.stats[2].peak);
+		}
+
+		mem_track_reset();
+		mem_track_free(b);
+
+		if (!(copy = mem_track_strdup("abc", "track.c", 40)) || strcmp(copy, "abc"))
+			++errors, printf("Test95: mem_track_strdup() failed\n");
+
+		memset(&report, 0, sizeof report);
+		mem_track_report(track_collect, &report);
+
+		for (i = 0; i < report.sites; ++i)
+			if (report.stats[i].line == 20 && (report.stats[i].allocs != 0 || report.stats[i].frees != 1 || report.stats[i].peak != 1000 || report.stats[i].live != 0))
+				++errors, printf("Test96: mem_track_reset() failed (allocs %lu frees %lu peak %lu live %lu, not 0 1 1000 0)\n", report.stats[i].allocs, report.stats[i].frees, (unsigned long)report.stats[i].peak, (unsigned long)report.stats[i].live);
+
+		mem_track_free(copy);
+		mem_track_free(a[0]);
+		mem_track_free(a[2]);
+
+		mem_track_totals(&after);
+		if (after.live != before.live || after.blocks != before.blocks)
+			++errors, printf("Test97: mem_track_free() failed (live %lu blocks %lu, not %lu %lu)\n", (unsigned long)after.live, after.blocks, (unsigned long)before.live, before.blocks);
+
+		if (mem_track_alloc(1, NULL, 0) || errno != EINVAL || mem_track_report(NULL, NULL) != -1 || mem_track_totals(NULL) != -1)
+			++errors, printf("Test98: mem_track argument checks failed\n");
+
+		/* Lots of blocks and sites to exercise growth and deletion */
+
+		{
+			static char *many[5000];
+
+			for (i = 0; i < 5000; ++i)
+				if (!(many[i] = mem_track_alloc(i % 7 + 1, "track-many.c", i % 100)))
+					break;
+
+			for (i = 0; i < 5000; i += 2)
+				mem_track_free(many[i]);
+
+			for (i = 1; i < 5000; i += 2)
+				mem_track_free(many[i]);
+
+			mem_track_totals(&after);
+			if (after.live != before.live || after.blocks != before.blocks)
+				++errors, printf("Test99: mem_track_free(many) failed (live %lu blocks %lu, not %lu %lu)\n", (unsigned long)after.live, after.blocks, (unsigned long)before.live, before.blocks);
+		}
+	}
+
 	if (errors)
-		printf("%d/67 tests failed\n", errors);
+		printf("%d/99 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
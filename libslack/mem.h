@@ -36,13 +36,46 @@
 #endif
 
 typedef struct Pool Pool;
+typedef struct PoolMark PoolMark;
+
+struct PoolMark
+{
+	void *chunk; /* the pool's current chunk when the mark was made */
+	size_t used; /* the number of bytes used in that chunk */
+};
+
+typedef struct MemStats MemStats;
+
+struct MemStats
+{
+	const char *file;     /* the call site's source file (null for the totals) */
+	int line;             /* the call site's line number */
+	unsigned long allocs; /* the number of allocations (and resizes) */
+	unsigned long frees;  /* the number of releases (and resizes) */
+	size_t bytes;         /* the number of bytes allocated */
+	size_t live;          /* the number of bytes allocated and not yet released */
+	unsigned long blocks; /* the number of blocks allocated and not yet released */
+	size_t peak;          /* the largest number of live bytes */
+};
+
+typedef void mem_track_report_t(const MemStats *stats, void *data);
 
 _begin_decls
+#ifdef MEM_TRACK
+#define mem_new(type) mem_track_alloc(sizeof(type), __FILE__, __LINE__)
+#define mem_create(size, type) mem_track_alloc((size) * sizeof(type), __FILE__, __LINE__)
+#define mem_resize(mem, size) mem_track_resize((void **)(mem), (size) * sizeof(**(mem)), __FILE__, __LINE__)
+#else
 #define mem_new(type) malloc(sizeof(type))
 #define mem_create(size, type) malloc((size) * sizeof(type))
 #define mem_resize(mem, size) mem_resize_fn((void **)(mem), (size) * sizeof(**(mem)))
+#endif
 void *mem_resize_fn(void **mem, size_t size);
+#ifdef MEM_TRACK
+#define mem_release(mem) mem_track_free(mem)
+#else
 #define mem_release(mem) free(mem)
+#endif
 void *mem_destroy(void **mem);
 #define mem_destroy(mem) (mem_destroy)((void **)(mem))
 void *mem_create_secure(size_t size);
@@ -50,6 +83,17 @@ void mem_release_secure(void *mem);
 void *mem_destroy_secure(void **mem);
 #define mem_destroy_secure(mem) (mem_destroy_secure)((void **)(mem))
 char *mem_strdup(const char *str);
+#ifdef MEM_TRACK
+#define mem_strdup(str) mem_track_strdup((str), __FILE__, __LINE__)
+#endif
+void *mem_track_alloc(size_t size, const char *file, int line);
+void *mem_track_resize(void **mem, size_t size, const char *file, int line);
+void mem_track_free(void *mem);
+char *mem_track_strdup(const char *str, const char *file, int line);
+int mem_track_report(mem_track_report_t *report, void *data);
+int mem_track_totals(MemStats *totals);
+void mem_track_print(const MemStats *stats, void *stream);
+void mem_track_reset(void);
 #define mem_create2d(i, j, type) ((type **)mem_create_space(sizeof(type), (i), (j), 0))
 #define mem_create3d(i, j, k, type) ((type ***)mem_create_space(sizeof(type), (i), (j), (k), 0))
 #define mem_create4d(i, j, k, l, type) ((type ****)mem_create_space(sizeof(type), (i), (j), (k), (l), 0))
@@ -67,14 +111,23 @@ Pool *pool_create(size_t size);
 Pool *pool_create_with_locker(Locker *locker, size_t size);
 void pool_release(Pool *pool);
 void *pool_destroy(Pool **pool);
+Pool *pool_create_growable(size_t size);
+Pool *pool_create_growable_with_locker(Locker *locker, size_t size);
 Pool *pool_create_secure(size_t size);
 Pool *pool_create_secure_with_locker(Locker *locker, size_t size);
+Pool *pool_create_secure_growable(size_t size);
+Pool *pool_create_secure_growable_with_locker(Locker *locker, size_t size);
 void pool_release_secure(Pool *pool);
 void *pool_destroy_secure(Pool **pool);
 void pool_clear_secure(Pool *pool);
 #define pool_new(pool, type) pool_alloc((pool), sizeof(type))
 #define pool_newsz(pool, size, type) pool_alloc((pool), (size) * sizeof(type))
 void *pool_alloc(Pool *pool, size_t size);
+void *pool_alloc_aligned(Pool *pool, size_t size, size_t alignment);
+void *pool_alloc_thread(Pool *pool, size_t size);
+void *pool_resize(Pool *pool, void *addr, size_t oldsize, size_t size);
+int pool_mark(Pool *pool, PoolMark *mark);
+int pool_rewind(Pool *pool, const PoolMark *mark);
 void pool_clear(Pool *pool);
 _end_decls
 
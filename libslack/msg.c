@@ -66,6 +66,10 @@ I<libslack(msg)> - message module
     int msg_add_plex_unlocked(Msg *mesg, Msg *item);
     Msg *msg_create_filter(msg_filter_t *filter, Msg *mesg);
     Msg *msg_create_filter_with_locker(Locker *locker, msg_filter_t *filter, Msg *mesg);
+    Msg *msg_create_async(Msg *mesg, size_t size);
+    Msg *msg_create_async_with_locker(Locker *locker, Msg *mesg, size_t size);
+    int msg_flush(Msg *mesg);
+    size_t msg_async_dropped(Msg *mesg);
     const char *msg_set_timestamp_format(const char *format);
     int msg_set_timestamp_format_locker(Locker *locker);
     int syslog_lookup_facility(const char *facility);
@@ -79,7 +83,9 @@ I<libslack(msg)> - message module
 This module provides general messaging functions. Message channels can be
 created that send messages to a file descriptor, a file, I<syslog> or a
 client defined message handler or that multiplexes messages to any
-combination of the above. Messages sent to files are timestamped using (by
+combination of the above. Messages can also be handed to a flusher thread
+that sends them to any of the above, so that sending a message costs no
+more than copying it. Messages sent to files are timestamped using (by
 default) the I<strftime(3)> format: C<"%Y%m%d %H:%M:%S">.
 
 It also provides functions for parsing I<syslog> targets, converting between
@@ -108,6 +114,7 @@ priority names and codes.
 #include <time.h>
 
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "msg.h"
 #include "mem.h"
@@ -123,12 +130,15 @@ typedef struct MsgFileData MsgFileData;
 typedef struct MsgSyslogData MsgSyslogData;
 typedef struct MsgFilterData MsgFilterData;
 typedef struct MsgPlexData MsgPlexData;
+typedef struct MsgAsyncData MsgAsyncData;
+typedef struct MsgRing MsgRing;
 
 #define MSG_FD 1
 #define MSG_FILE 2
 #define MSG_SYSLOG 3
 #define MSG_PLEX 4
 #define MSG_FILTER 5
+#define MSG_ASYNC 6
 
 struct Msg
 {
@@ -163,6 +173,47 @@ struct MsgFilterData
 	Msg *mesg;            /* destination Msg */
 };
 
+#define MSG_ASYNC_LINE 64
+#define MSG_ASYNC_IOV 256
+#define MSG_ASYNC_MIN (MSG_SIZE * 2)
+#define MSG_ASYNC_MAX ((size_t)1 << (sizeof(size_t) * 8 - 2))
+#define MSG_ASYNC_SKIP ((size_t)-1)
+#define MSG_ASYNC_NAP 10000000 /* ns the flusher waits between batches */
+#define MSG_ASYNC_NAPS 100     /* idle naps before it waits to be woken */
+#define MSG_ASYNC_NAPPING 1
+#define MSG_ASYNC_ASLEEP 2
+#define msg_record_size(len) ((sizeof(size_t) + (len) + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1))
+
+struct MsgRing
+{
+	MsgRing *next;                     /* next ring in the list */
+	MsgAsyncData *data;                /* the asynchronous Msg's data */
+	char *buf;                         /* records: length, then message */
+	size_t mask;                       /* size of buf - 1 */
+	int orphaned;                      /* the thread has exited */
+	char pad1[MSG_ASYNC_LINE];         /* keep tail in its own cache line */
+	size_t tail;                       /* written by the thread */
+	size_t last;                       /* size of the thread's previous record */
+	char pad2[MSG_ASYNC_LINE];         /* keep head in its own cache line */
+	size_t head;                       /* written by the flusher */
+};
+
+struct MsgAsyncData
+{
+	Msg *mesg;                  /* destination Msg */
+	size_t size;                /* size of each thread's ring */
+	pthread_key_t key;          /* each thread's ring */
+	pthread_mutex_t lock;       /* guards rings, sleeping and stopping */
+	pthread_cond_t wake;        /* wakes the flusher */
+	pthread_mutex_t flush_lock; /* one thread writes messages at a time */
+	pthread_t flusher;          /* the flusher thread */
+	MsgRing *rings;             /* all threads' rings */
+	int sleeping;               /* the flusher is napping or asleep */
+	int stopping;               /* the flusher should exit */
+	size_t dropped;             /* messages dropped (rings full) */
+	MsgAsyncData *next;         /* next asynchronous Msg (for exit) */
+};
+
 typedef struct syslog_map_t syslog_map_t;
 
 struct syslog_map_t
@@ -226,13 +277,64 @@ static const syslog_map_t syslog_priority_map[] =
 static const char *timestamp_format = "%Y%m%d %H:%M:%S ";
 static Locker *timestamp_format_locker = NULL;
 
+#ifdef __GNUC__
+
+#define msg_atomic_load(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define msg_atomic_load_relaxed(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define msg_atomic_store(var, val) __atomic_store_n(&(var), (val), __ATOMIC_RELEASE)
+#define msg_atomic_inc(var) __atomic_add_fetch(&(var), 1, __ATOMIC_RELAXED)
+#define msg_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define msg_enter()
+#define msg_leave()
+
+/* A thread that publishes a message then checks sleeping, and the flusher sets sleeping then checks for messages */
+
+#define msg_async_sleeping(data) (msg_atomic_fence(), msg_atomic_load_relaxed((data)->sleeping))
+
+#else
+
+#define msg_atomic_load(var) (var)
+#define msg_atomic_load_relaxed(var) (var)
+#define msg_atomic_store(var, val) ((var) = (val))
+#define msg_atomic_inc(var) (msg_enter(), ++(var), msg_leave())
+#define msg_atomic_fence()
+#define msg_enter() pthread_mutex_lock(&g.atomic)
+#define msg_leave() pthread_mutex_unlock(&g.atomic)
+#define msg_async_sleeping(data) MSG_ASYNC_ASLEEP
+
+#endif
+
+static struct
+{
+	pthread_once_t once;  /* registers msg_async_exit() */
+	pthread_mutex_t lock; /* guards list */
+	MsgAsyncData *list;   /* all asynchronous Msg objects */
+#ifndef __GNUC__
+	pthread_mutex_t atomic; /* stands in for atomic operations */
+#endif
+}
+g =
+{
+	PTHREAD_ONCE_INIT,
+	PTHREAD_MUTEX_INITIALIZER,
+	NULL
+#ifndef __GNUC__
+	, PTHREAD_MUTEX_INITIALIZER
+#endif
+};
+
+/* Asynchronous messages are formatted straight into a ring (see vmsg_out_unlocked()) */
+
+static void msg_out_async(void *data, const void *mesg, size_t mesglen);
+static void msg_vout_async(MsgAsyncData *data, const char *format, va_list args);
+
 /*
 
 =item C<Msg *msg_create(int type, msg_out_t *out, void *data, msg_release_t *destroy)>
 
 Creates a I<Msg> object initialised with C<type>, C<out>, C<data> and
 C<destroy>. Client-defined message handlers must specify a C<type> greater
-than C<5>. It is the caller's responsibility to deallocate the new I<Msg>
+than C<6>. It is the caller's responsibility to deallocate the new I<Msg>
 with I<msg_release(3)> or I<msg_destroy>. It is strongly recommended to use
 I<msg_destroy(3)>, because it also sets the pointer variable to C<null>. On
 success, returns the new I<Msg> object. On error, returns C<null>.
@@ -471,7 +573,9 @@ void vmsg_out_unlocked(Msg *dst, const char *format, va_list args)
 	if (!dst)
 		return;
 
-	if (dst->out)
+	if (dst->out == msg_out_async)
+		msg_vout_async(dst->data, format, args);
+	else if (dst->out)
 	{
 		char mesg[MSG_SIZE];
 		vsnprintf(mesg, MSG_SIZE, format, args);
@@ -1402,6 +1506,783 @@ Msg *msg_create_filter_with_locker(Locker *locker, msg_filter_t *filter, Msg *me
 
 /*
 
+C<void msg_ring_orphan(void *ring)>
+
+Marks a thread's ring as orphaned when the thread exits. The flusher
+deallocates it once it has written its remaining messages.
+
+*/
+
+static void msg_ring_orphan(void *ring)
+{
+	msg_atomic_store(((MsgRing *)ring)->orphaned, 1);
+}
+
+/*
+
+C<MsgRing *msg_ring_create(MsgAsyncData *data)>
+
+Creates the calling thread's ring for the asynchronous I<Msg> data, C<data>.
+On success, returns the ring. On error, returns C<null> with C<errno> set
+appropriately.
+
+*/
+
+static MsgRing *msg_ring_create(MsgAsyncData *data)
+{
+	MsgRing *ring;
+	int err;
+
+	if (!(ring = mem_new(MsgRing)))
+		return NULL;
+
+	memset(ring, 0, sizeof(MsgRing));
+	ring->data = data;
+	ring->mask = data->size - 1;
+
+	if (!(ring->buf = mem_create(data->size, char)))
+	{
+		mem_release(ring);
+		return NULL;
+	}
+
+	if ((err = pthread_setspecific(data->key, ring)))
+	{
+		mem_release(ring->buf);
+		mem_release(ring);
+		return set_errnull(err);
+	}
+
+	pthread_mutex_lock(&data->lock);
+	ring->next = data->rings;
+	data->rings = ring;
+	pthread_mutex_unlock(&data->lock);
+
+	return ring;
+}
+
+/*
+
+C<MsgRing *msg_async_ring(MsgAsyncData *data)>
+
+Returns the calling thread's ring for the asynchronous I<Msg> data, C<data>,
+creating it if necessary. On error, counts a dropped message and returns
+C<null>.
+
+*/
+
+static MsgRing *msg_async_ring(MsgAsyncData *data)
+{
+	MsgRing *ring;
+
+	if (!(ring = pthread_getspecific(data->key)) && !(ring = msg_ring_create(data)))
+		msg_atomic_inc(data->dropped);
+
+	return ring;
+}
+
+/*
+
+C<void msg_async_wake(MsgAsyncData *data, size_t used)>
+
+Wakes the flusher if it's asleep, or if it's napping and C<used> (the number
+of bytes used in the calling thread's ring) is more than half the ring.
+
+*/
+
+static void msg_async_wake(MsgAsyncData *data, size_t used)
+{
+	int sleeping;
+
+	if ((sleeping = msg_async_sleeping(data)) && (sleeping == MSG_ASYNC_ASLEEP || used > data->size / 2))
+	{
+		pthread_mutex_lock(&data->lock);
+		pthread_cond_signal(&data->wake);
+		pthread_mutex_unlock(&data->lock);
+	}
+}
+
+/*
+
+C<void msg_out_async(void *data, const void *mesg, size_t mesglen)>
+
+Copies a message into the calling thread's ring, for the flusher to write
+later, and wakes the flusher if necessary. If the ring is full, the message
+is dropped and counted. C<data> is the asynchronous I<Msg> data. C<mesg> is
+the message. C<mesglen> is its length.
+
+*/
+
+static void msg_out_async(void *data, const void *mesg, size_t mesglen)
+{
+	MsgAsyncData *async_data = data;
+	MsgRing *ring;
+	size_t need, tail, pos, skip, used;
+
+	if (!async_data || !mesg || !(ring = msg_async_ring(async_data)))
+		return;
+
+	/* Records don't wrap around. If there's no room at the end, skip it. */
+
+	need = msg_record_size(mesglen);
+
+	msg_enter();
+	tail = ring->tail;
+	pos = tail & ring->mask;
+	skip = (need > async_data->size - pos) ? async_data->size - pos : 0;
+
+	ring->last = need;
+
+	if ((used = tail - msg_atomic_load(ring->head) + skip + need) > async_data->size)
+	{
+		msg_leave();
+		msg_atomic_inc(async_data->dropped);
+		return;
+	}
+
+	if (skip)
+	{
+		*(size_t *)(ring->buf + pos) = MSG_ASYNC_SKIP;
+		tail += skip;
+		pos = 0;
+	}
+
+	*(size_t *)(ring->buf + pos) = mesglen;
+	memcpy(ring->buf + pos + sizeof(size_t), mesg, mesglen);
+	msg_atomic_store(ring->tail, tail + need);
+	msg_leave();
+
+	msg_async_wake(async_data, used);
+}
+
+/*
+
+C<void msg_vout_async(MsgAsyncData *data, const char *format, va_list args)>
+
+Formats a message straight into the calling thread's ring, rather than
+formatting it on the stack and then copying it. If the ring doesn't have
+room for a message as long as the thread's previous one, the message is
+dropped and counted without being formatted at all. If the message doesn't
+fit in the free space after the ring's last record (or there is no room
+there even for the record's length), but there is more free space at the
+start of the ring, it is formatted on the stack and passed to
+I<msg_out_async()>, which can skip to the start of the ring.
+
+*/
+
+static void msg_vout_async(MsgAsyncData *data, const char *format, va_list args)
+{
+	char mesg[MSG_SIZE];
+	MsgRing *ring;
+	size_t tail, pos, room, used;
+	va_list args_copy;
+	int len = -1;
+
+	if (!data || !format || !(ring = msg_async_ring(data)))
+		return;
+
+	msg_enter();
+	tail = ring->tail;
+	pos = tail & ring->mask;
+	used = tail - msg_atomic_load(ring->head);
+
+	if (used + ring->last > data->size)
+	{
+		msg_leave();
+		msg_atomic_inc(data->dropped);
+		return;
+	}
+
+	/* The room for the message: in the ring, after the end, and at most MSG_SIZE */
+
+	room = data->size - used;
+
+	if (room > data->size - pos)
+		room = data->size - pos;
+
+	va_copy(args_copy, args);
+
+	if (room > sizeof(size_t))
+	{
+		if ((room -= sizeof(size_t)) > MSG_SIZE)
+			room = MSG_SIZE;
+
+		if ((len = vsnprintf(ring->buf + pos + sizeof(size_t), room, format, args)) < 0)
+			len = 0;
+	}
+
+	if (len != -1 && ((size_t)len < room || room == MSG_SIZE))
+	{
+		if ((size_t)len >= MSG_SIZE)
+			len = MSG_SIZE - 1;
+
+		*(size_t *)(ring->buf + pos) = len;
+		ring->last = msg_record_size(len);
+		used += ring->last;
+		msg_atomic_store(ring->tail, tail + ring->last);
+		msg_leave();
+		va_end(args_copy);
+		msg_async_wake(data, used);
+		return;
+	}
+
+	/* It might fit at the start of the ring, if there's more room there */
+
+	msg_leave();
+
+	if (data->size - used <= data->size - pos)
+	{
+		va_end(args_copy);
+		if (len != -1)
+			ring->last = msg_record_size(len);
+		msg_atomic_inc(data->dropped);
+		return;
+	}
+
+	vsnprintf(mesg, MSG_SIZE, format, args_copy);
+	va_end(args_copy);
+	ring->last = msg_record_size(strlen(mesg));
+	msg_out_async(data, mesg, strlen(mesg));
+}
+
+/*
+
+C<void msg_writev(int fd, struct iovec *iov, int iovcnt)>
+
+Writes all of C<iov> to C<fd> with as few calls to I<writev(2)> as
+possible. Gives up on error.
+
+*/
+
+static void msg_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t bytes;
+
+	while (iovcnt)
+	{
+		if ((bytes = writev(fd, iov, iovcnt)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return;
+		}
+
+		for (; iovcnt && (size_t)bytes >= iov->iov_len; ++iov, --iovcnt)
+			bytes -= iov->iov_len;
+
+		if (iovcnt)
+		{
+			iov->iov_base = (char *)iov->iov_base + bytes;
+			iov->iov_len -= bytes;
+		}
+	}
+}
+
+/*
+
+C<size_t msg_async_drain(MsgAsyncData *data)>
+
+Writes the messages in all of the threads' rings to the destination I<Msg>.
+When the destination is a file descriptor, up to C<MSG_ASYNC_IOV> messages
+are written with each call to I<writev(2)>. The rings of threads that have
+exited are deallocated once they are empty. C<data>'s C<flush_lock> must be
+locked. Returns the number of messages written.
+
+*/
+
+static size_t msg_async_drain(MsgAsyncData *data)
+{
+	struct iovec iov[MSG_ASYNC_IOV];
+	Msg *dst = data->mesg;
+	int fd = (dst->out == msg_out_fd) ? *(MsgFDData *)dst->data : -1;
+	MsgRing *ring, **link;
+	size_t written = 0;
+
+	pthread_mutex_lock(&data->lock);
+	ring = data->rings;
+	pthread_mutex_unlock(&data->lock);
+
+	/* New rings are only ever added to the front of the list */
+
+	for (; ring; ring = ring->next)
+	{
+		size_t head = ring->head, tail;
+
+		msg_enter();
+		tail = msg_atomic_load(ring->tail);
+		msg_leave();
+
+		while (head != tail)
+		{
+			int iovcnt = 0;
+
+			for (; head != tail && iovcnt < MSG_ASYNC_IOV; ++written)
+			{
+				char *record = ring->buf + (head & ring->mask);
+				size_t len = *(size_t *)record;
+
+				if (len == MSG_ASYNC_SKIP)
+				{
+					head += data->size - (head & ring->mask);
+					--written;
+					continue;
+				}
+
+				if (fd != -1)
+				{
+					iov[iovcnt].iov_base = record + sizeof(size_t);
+					iov[iovcnt++].iov_len = len;
+				}
+				else if (dst->out)
+					dst->out(dst->data, record + sizeof(size_t), len);
+
+				head += msg_record_size(len);
+			}
+
+			if (iovcnt)
+				msg_writev(fd, iov, iovcnt);
+
+			msg_enter();
+			msg_atomic_store(ring->head, head);
+			msg_leave();
+		}
+	}
+
+	pthread_mutex_lock(&data->lock);
+
+	for (link = &data->rings; (ring = *link); )
+	{
+		if (msg_atomic_load(ring->orphaned) && msg_atomic_load(ring->tail) == ring->head)
+		{
+			*link = ring->next;
+			mem_release(ring->buf);
+			mem_release(ring);
+		}
+		else
+			link = &ring->next;
+	}
+
+	pthread_mutex_unlock(&data->lock);
+
+	return written;
+}
+
+/*
+
+C<int msg_async_pending(MsgAsyncData *data)>
+
+Returns whether or not there are any messages in C<data>'s rings. C<data>'s
+C<lock> must be locked.
+
+*/
+
+static int msg_async_pending(MsgAsyncData *data)
+{
+	MsgRing *ring;
+	int pending = 0;
+
+	msg_enter();
+
+	for (ring = data->rings; ring && !pending; ring = ring->next)
+		pending = (msg_atomic_load(ring->tail) != msg_atomic_load(ring->head));
+
+	msg_leave();
+
+	return pending;
+}
+
+/*
+
+C<void *msg_async_flusher(void *arg)>
+
+The flusher thread for the asynchronous I<Msg> data, C<arg>. Writes messages
+whenever there are any. When there aren't, it naps for C<MSG_ASYNC_NAP>
+nanoseconds so that messages are written in batches without the sending
+threads needing to wake it up. After C<MSG_ASYNC_NAPS> naps without any
+messages, it waits to be woken up instead.
+
+*/
+
+static void *msg_async_flusher(void *arg)
+{
+	MsgAsyncData *data = arg;
+	struct timespec deadline[1];
+	size_t written;
+	int naps = 0;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&data->flush_lock);
+		written = msg_async_drain(data);
+		pthread_mutex_unlock(&data->flush_lock);
+
+		pthread_mutex_lock(&data->lock);
+
+		if (data->stopping)
+		{
+			pthread_mutex_unlock(&data->lock);
+			break;
+		}
+
+		/* Check again after saying so, in case a thread missed it (see msg_out_async()) */
+
+		if (written)
+			naps = 0;
+		else
+		{
+			int sleeping = (++naps > MSG_ASYNC_NAPS) ? MSG_ASYNC_ASLEEP : MSG_ASYNC_NAPPING;
+
+			msg_atomic_store(data->sleeping, sleeping);
+			msg_atomic_fence();
+
+			if (!msg_async_pending(data))
+			{
+				clock_gettime(CLOCK_REALTIME, deadline);
+
+				if (sleeping == MSG_ASYNC_ASLEEP)
+					++deadline->tv_sec;
+				else if ((deadline->tv_nsec += MSG_ASYNC_NAP) >= 1000000000)
+					++deadline->tv_sec, deadline->tv_nsec -= 1000000000;
+
+				pthread_cond_timedwait(&data->wake, &data->lock, deadline);
+			}
+
+			msg_atomic_store(data->sleeping, 0);
+		}
+
+		pthread_mutex_unlock(&data->lock);
+	}
+
+	pthread_mutex_lock(&data->flush_lock);
+	msg_async_drain(data);
+	pthread_mutex_unlock(&data->flush_lock);
+
+	return NULL;
+}
+
+/*
+
+C<void msg_async_exit(void)>
+
+Writes the messages of all asynchronous I<Msg> objects when the process
+calls I<exit(3)> (e.g. via I<fatal(3)>), so that they aren't lost.
+
+*/
+
+static void msg_async_exit(void)
+{
+	MsgAsyncData *data;
+
+	pthread_mutex_lock(&g.lock);
+
+	for (data = g.list; data; data = data->next)
+	{
+		pthread_mutex_lock(&data->flush_lock);
+		msg_async_drain(data);
+		pthread_mutex_unlock(&data->flush_lock);
+	}
+
+	pthread_mutex_unlock(&g.lock);
+}
+
+/*
+
+C<void msg_async_init(void)>
+
+Arranges for I<msg_async_exit()> to be called at exit.
+
+*/
+
+static void msg_async_init(void)
+{
+	atexit(msg_async_exit);
+}
+
+/*
+
+C<MsgAsyncData *msg_asyncdata_create(Msg *mesg, size_t size)>
+
+Creates the internal data needed by a I<Msg> object that sends messages to
+another I<Msg> object, I<mesg>, from a flusher thread, and starts the
+flusher thread. Each thread's ring will be C<size> bytes. On success,
+returns the data. On error, returns C<null> with C<errno> set
+appropriately.
+
+*/
+
+static MsgAsyncData *msg_asyncdata_create(Msg *mesg, size_t size)
+{
+	MsgAsyncData *data;
+	sigset_t all, mask;
+	size_t ring_size;
+	int err;
+
+	if (!mesg || size > MSG_ASYNC_MAX)
+		return set_errnull(EINVAL);
+
+	for (ring_size = MSG_ASYNC_MIN; ring_size < size; ring_size <<= 1)
+		;
+
+	if (!(data = mem_new(MsgAsyncData)))
+		return NULL;
+
+	memset(data, 0, sizeof(MsgAsyncData));
+	data->mesg = mesg;
+	data->size = ring_size;
+
+	if ((err = pthread_key_create(&data->key, msg_ring_orphan)))
+	{
+		mem_release(data);
+		return set_errnull(err);
+	}
+
+	pthread_mutex_init(&data->lock, NULL);
+	pthread_mutex_init(&data->flush_lock, NULL);
+	pthread_cond_init(&data->wake, NULL);
+
+	/* The flusher shouldn't handle the program's signals */
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &mask);
+	err = pthread_create(&data->flusher, NULL, msg_async_flusher, data);
+	pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+	if (err)
+	{
+		pthread_cond_destroy(&data->wake);
+		pthread_mutex_destroy(&data->flush_lock);
+		pthread_mutex_destroy(&data->lock);
+		pthread_key_delete(data->key);
+		mem_release(data);
+		return set_errnull(err);
+	}
+
+	pthread_once(&g.once, msg_async_init);
+	pthread_mutex_lock(&g.lock);
+	data->next = g.list;
+	g.list = data;
+	pthread_mutex_unlock(&g.lock);
+
+	return data;
+}
+
+/*
+
+C<void msg_asyncdata_release(MsgAsyncData *data)>
+
+Stops the flusher thread (after it writes any remaining messages), and
+releases (deallocates) the internal data needed by a I<Msg> object that
+sends messages to another I<Msg> object from a flusher thread.
+
+*/
+
+static void msg_asyncdata_release(MsgAsyncData *data)
+{
+	MsgAsyncData **link;
+	MsgRing *ring;
+
+	if (!data)
+		return;
+
+	pthread_mutex_lock(&g.lock);
+
+	for (link = &g.list; *link; link = &(*link)->next)
+	{
+		if (*link == data)
+		{
+			*link = data->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&g.lock);
+
+	pthread_mutex_lock(&data->lock);
+	data->stopping = 1;
+	pthread_cond_signal(&data->wake);
+	pthread_mutex_unlock(&data->lock);
+	pthread_join(data->flusher, NULL);
+
+	pthread_key_delete(data->key);
+
+	while ((ring = data->rings))
+	{
+		data->rings = ring->next;
+		mem_release(ring->buf);
+		mem_release(ring);
+	}
+
+	pthread_cond_destroy(&data->wake);
+	pthread_mutex_destroy(&data->flush_lock);
+	pthread_mutex_destroy(&data->lock);
+	msg_release(data->mesg);
+	mem_release(data);
+}
+
+/*
+
+=item C<Msg *msg_create_async(Msg *mesg, size_t size)>
+
+Creates a I<Msg> object that sends messages to C<mesg> asynchronously.
+Sending a message just formats it straight into a ring buffer belonging to
+the calling thread, without locking anything or making any system calls. A
+flusher thread writes the messages in every thread's ring to C<mesg>. If
+C<mesg> sends messages to a file descriptor (i.e. it was created by
+I<msg_create_fd(3)>, I<msg_create_stderr(3)> or I<msg_create_stdout(3)>),
+many messages are written with each call to I<writev(2)>. Each thread's
+ring holds C<size> bytes (rounded up to a power of two, and at least twice
+C<MSG_SIZE>). The flusher writes messages in batches, within about ten
+milliseconds of them being sent. If a thread's ring is full, its messages
+are dropped (and counted) rather than waiting for the flusher, and they are
+not formatted at all. Sending still costs about as much as one call to
+I<vsnprintf(3)>, so it is cheaper than a synchronous I<Msg> by the cost of
+the system call, not by orders of magnitude. Messages from each thread stay
+in order, but messages from different threads can be interleaved
+differently than they were sent. C<mesg> is owned by the new I<Msg>, and is
+released along with it. Any remaining messages are written when the new
+I<Msg> is released, when I<msg_flush(3)> is called, and when the process
+calls I<exit(3)>. I<error(3)>, I<alert(3)> and their variants flush the
+program's debug message destination before writing, and I<fatal(3)> and
+I<dump(3)> also flush the program's error message destination, so debug
+messages never appear after the errors that followed them. Do not create asynchronous I<Msg> objects before
+I<daemon_init(3)>, because the flusher thread does not survive I<fork(2)>.
+It is the caller's responsibility to deallocate the new I<Msg> with
+I<msg_release(3)> or I<msg_destroy(3)>. It is strongly recommended to use
+I<msg_destroy(3)>, because it also sets the pointer variable to C<null>. On
+success, returns the new I<Msg> object. On error, returns C<null> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+Msg *msg_create_async(Msg *mesg, size_t size)
+{
+	return msg_create_async_with_locker(NULL, mesg, size);
+}
+
+/*
+
+=item C<Msg *msg_create_async_with_locker(Locker *locker, Msg *mesg, size_t size)>
+
+Equivalent to I<msg_create_async(3)> except that multiple threads accessing
+the new I<Msg> will be synchronised by C<locker>. This is never necessary
+just for sending messages.
+
+=cut
+
+*/
+
+Msg *msg_create_async_with_locker(Locker *locker, Msg *mesg, size_t size)
+{
+	MsgAsyncData *data;
+	Msg *newmesg;
+
+	if (!(data = msg_asyncdata_create(mesg, size)))
+		return NULL;
+
+	if (!(newmesg = msg_create_with_locker(locker, MSG_ASYNC, msg_out_async, data, (msg_release_t *)msg_asyncdata_release)))
+	{
+		data->mesg = NULL;
+		msg_asyncdata_release(data);
+		return NULL;
+	}
+
+	return newmesg;
+}
+
+/*
+
+C<void msg_flush_unlocked(Msg *mesg)>
+
+Writes any messages waiting in C<mesg>, if it's asynchronous, or in any
+asynchronous I<Msg> objects that it multiplexes or filters messages to.
+
+*/
+
+static void msg_flush_unlocked(Msg *mesg)
+{
+	if (mesg->out == msg_out_async)
+	{
+		MsgAsyncData *data = mesg->data;
+
+		pthread_mutex_lock(&data->flush_lock);
+		msg_async_drain(data);
+		pthread_mutex_unlock(&data->flush_lock);
+		msg_flush_unlocked(data->mesg);
+	}
+	else if (mesg->out == msg_out_plex)
+	{
+		MsgPlexData *data = mesg->data;
+		size_t i;
+
+		for (i = 0; i < data->length; ++i)
+			if (data->list[i])
+				msg_flush_unlocked(data->list[i]);
+	}
+	else if (mesg->out == msg_out_filter)
+		msg_flush_unlocked(((MsgFilterData *)mesg->data)->mesg);
+}
+
+/*
+
+=item C<int msg_flush(Msg *mesg)>
+
+Writes any messages that are waiting to be written by C<mesg> (if it was
+created by I<msg_create_async(3)>), or by any asynchronous I<Msg> objects
+that C<mesg> sends messages to. Returns when they have been written. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int msg_flush(Msg *mesg)
+{
+	int err;
+
+	if (!mesg)
+		return set_errno(EINVAL);
+
+	if ((err = msg_rdlock(mesg)))
+		return set_errno(err);
+
+	msg_flush_unlocked(mesg);
+
+	if ((err = msg_unlock(mesg)))
+		return set_errno(err);
+
+	return 0;
+}
+
+/*
+
+=item C<size_t msg_async_dropped(Msg *mesg)>
+
+Returns the number of messages that have been dropped by C<mesg> (which
+must have been created by I<msg_create_async(3)>) because the sending
+thread's ring was full. On error, returns C<0> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+size_t msg_async_dropped(Msg *mesg)
+{
+	if (!mesg || mesg->out != msg_out_async)
+	{
+		errno = EINVAL;
+		return 0;
+	}
+
+	return msg_atomic_load(((MsgAsyncData *)mesg->data)->dropped);
+}
+
+/*
+
 =item C<const char *msg_set_timestamp_format(const char *format)>
 
 Sets the I<strftime(3)> format string used when sending messages to a file.
@@ -1707,6 +2588,8 @@ I<locker(3)>
 
 #ifdef TEST
 
+#include "prog.h"
+
 static int verify(int test, const char *name, const char *mesg)
 {
 	char buf[MSG_SIZE];
@@ -1747,6 +2630,125 @@ static int prefix_filter(void **mesgp, const void *mesg, size_t mesglen)
 	return asprintf((char **)mesgp, "[%d] %.*s", 12345, (int)mesglen, (char *)mesg);
 }
 
+#define ASYNC_THREADS 4
+#define ASYNC_MESSAGES 2000
+
+static Msg *async_msg;
+
+static void *async_sender(void *arg)
+{
+	int i;
+
+	for (i = 0; i < ASYNC_MESSAGES; ++i)
+		msg_out(async_msg, "%d %d\n", (int)(long)arg, i);
+
+	return NULL;
+}
+
+/* A destination that blocks until the test lets it go */
+
+static pthread_mutex_t stall_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int stalled = 0;
+static size_t stall_delivered = 0;
+static size_t stall_mangled = 0;
+
+/* If data points to a length, messages of any other length are counted as mangled */
+
+static void stall_out(void *data, const void *mesg, size_t mesglen)
+{
+	stalled = 1;
+	pthread_mutex_lock(&stall_lock);
+	++stall_delivered;
+	if (data && mesglen != *(size_t *)data)
+		++stall_mangled;
+	pthread_mutex_unlock(&stall_lock);
+}
+
+static double wall(void)
+{
+	struct timespec ts[1];
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+#define BENCH_MESSAGES 1000000
+
+/*
+
+Times sending short messages to /dev/null directly (one write(2) each) and
+via an asynchronous Msg whose ring is big enough to hold them all (so the
+time is just formatting into the calling thread's ring). The flushed time
+also includes releasing the asynchronous Msg, which waits for the flusher
+to write everything. The full time is for messages sent while the flusher
+is stuck, so the ring is full and they are dropped without being
+formatted. The debug time is for debug() with an asynchronous debug
+destination, which formats the message once more to add its prefix.
+
+*/
+
+static void bench(void)
+{
+	Msg *mesg, *stall;
+	double start, secs[5];
+	size_t dropped;
+	int fd, i;
+
+	if ((fd = open("/dev/null", O_WRONLY)) == -1)
+	{
+		printf("Failed to open /dev/null\n");
+		exit(EXIT_FAILURE);
+	}
+
+	mesg = msg_create_fd(fd);
+	start = wall();
+	for (i = 0; i < BENCH_MESSAGES; ++i)
+		msg_out(mesg, "bench message %d\n", i);
+	secs[0] = wall() - start;
+	msg_release(mesg);
+
+	mesg = msg_create_async(msg_create_fd(fd), (size_t)BENCH_MESSAGES * 32);
+	start = wall();
+	for (i = 0; i < BENCH_MESSAGES; ++i)
+		msg_out(mesg, "bench message %d\n", i);
+	secs[1] = wall() - start;
+	dropped = msg_async_dropped(mesg);
+	msg_release(mesg);
+	secs[2] = wall() - start;
+
+	stall = msg_create(7, stall_out, NULL, NULL);
+	mesg = msg_create_async(stall, 0);
+	pthread_mutex_lock(&stall_lock);
+	stalled = 0;
+	msg_out(mesg, "stall the flusher\n");
+	while (!stalled)
+		usleep(1000);
+	for (i = 0; i < BENCH_MESSAGES && msg_async_dropped(mesg) == 0; ++i)
+		msg_out(mesg, "bench message %d\n", i);
+	start = wall();
+	for (i = 0; i < BENCH_MESSAGES; ++i)
+		msg_out(mesg, "bench message %d\n", i);
+	secs[3] = wall() - start;
+	pthread_mutex_unlock(&stall_lock);
+	msg_release(mesg);
+
+	prog_set_dbg(msg_create_async(msg_create_fd(fd), (size_t)BENCH_MESSAGES * 64));
+	prog_set_debug_level(1);
+	start = wall();
+	for (i = 0; i < BENCH_MESSAGES; ++i)
+		debug((1, "bench message %d", i))
+	secs[4] = wall() - start;
+	prog_set_debug_level(0);
+	prog_dbg_stderr();
+	close(fd);
+
+	printf("%10s %10s %10s %10s %10s\n", "sync", "async", "flushed", "full", "debug");
+	printf("%10.1f %10.1f %10.1f %10.1f %10.1f (ns/message, %lu dropped)\n", secs[0] * 1e9 / BENCH_MESSAGES, secs[1] * 1e9 / BENCH_MESSAGES, secs[2] * 1e9 / BENCH_MESSAGES, secs[3] * 1e9 / BENCH_MESSAGES, secs[4] * 1e9 / BENCH_MESSAGES, (unsigned long)dropped);
+
+	exit(EXIT_SUCCESS);
+}
+
 int main(int ac, char **av)
 {
 	const char *msg_file_name = "./msg.file";
@@ -1770,10 +2772,13 @@ int main(int ac, char **av)
 
 	if (ac == 2 && !strcmp(av[1], "help"))
 	{
-		printf("usage: %s\n", *av);
+		printf("usage: %s [bench]\n", *av);
 		return EXIT_SUCCESS;
 	}
 
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench();
+
 	printf("Testing: %s\n", "msg");
 
 	++tests;
@@ -1870,6 +2875,161 @@ int main(int ac, char **av)
 	if (syslog_parse("gibberish", NULL, NULL) != -1)
 		++errors, printf("Test%d: syslog_parse(\"gibberish\") failed\n", tests);
 
+	/* Test msg_create_async: several threads, each thread's messages in order */
+
+	{
+		const char *msg_async_name = "./msg.async";
+		pthread_t thread[ASYNC_THREADS];
+		int next[ASYNC_THREADS];
+		char line[64];
+		FILE *in;
+		int fd, lines = 0, ok = 1, t, n;
+
+		++tests;
+		if ((fd = open(msg_async_name, O_WRONLY | O_CREAT | O_TRUNC, 0640)) == -1)
+			++errors, printf("Test%d: failed to create %s (%s)\n", tests, msg_async_name, strerror(errno));
+		else if (!(async_msg = msg_create_async(msg_create_fd(fd), 1 << 16)))
+			++errors, printf("Test%d: msg_create_async() failed (%s)\n", tests, strerror(errno));
+		else
+		{
+			for (t = 0; t < ASYNC_THREADS; ++t)
+				next[t] = 0, pthread_create(&thread[t], NULL, async_sender, (void *)(long)t);
+
+			for (t = 0; t < ASYNC_THREADS; ++t)
+				pthread_join(thread[t], NULL);
+
+			++tests;
+			if (msg_async_dropped(async_msg) != 0)
+				++errors, printf("Test%d: msg_async_dropped() failed (%lu, not 0)\n", tests, (unsigned long)msg_async_dropped(async_msg));
+
+			msg_destroy(&async_msg);
+			close(fd);
+
+			if ((in = fopen(msg_async_name, "r")))
+			{
+				while (fgets(line, sizeof line, in))
+				{
+					++lines;
+
+					if (sscanf(line, "%d %d", &t, &n) != 2 || t < 0 || t >= ASYNC_THREADS || n != next[t]++)
+						ok = 0;
+				}
+
+				fclose(in);
+			}
+
+			++tests;
+			if (!ok || lines != ASYNC_THREADS * ASYNC_MESSAGES)
+				++errors, printf("Test%d: msg_create_async() failed (%d lines, not %d, in order: %s)\n", tests, lines, ASYNC_THREADS * ASYNC_MESSAGES, ok ? "yes" : "no");
+		}
+
+		unlink(msg_async_name);
+	}
+
+	/* Test msg_flush: messages are written by the time it returns, even via a plex */
+
+	{
+		const char *msg_async_name = "./msg.async";
+		const char *flushed = "flushed message\n";
+		Msg *plex;
+		int fd;
+
+		if ((fd = open(msg_async_name, O_WRONLY | O_CREAT | O_TRUNC, 0640)) != -1)
+		{
+			plex = msg_create_plex(msg_create_async(msg_create_fd(fd), 0), msg_create_async(msg_create_fd(fd), 0));
+			msg_out(plex, "%s", flushed);
+
+			++tests;
+			if (msg_flush(plex) == -1)
+				++errors, printf("Test%d: msg_flush() failed (%s)\n", tests, strerror(errno));
+
+			errors += verify(++tests, msg_async_name, flushed);
+			msg_destroy(&plex);
+			close(fd);
+		}
+		else
+			++errors, printf("Test%d: failed to create %s (%s)\n", ++tests, msg_async_name, strerror(errno));
+	}
+
+	/* Test msg_async_dropped: a full ring drops (and counts) messages rather than waiting */
+
+	{
+		Msg *stall = msg_create(7, stall_out, NULL, NULL);
+		Msg *mesg = msg_create_async(stall, 0);
+		size_t dropped;
+		int sent = 0;
+
+		pthread_mutex_lock(&stall_lock);
+		msg_out(mesg, "stall the flusher\n");
+		++sent;
+
+		while (!stalled)
+			usleep(1000);
+
+		for (i = 0; i < 10000; ++i, ++sent)
+			msg_out(mesg, "%100d\n", i);
+
+		dropped = msg_async_dropped(mesg);
+		pthread_mutex_unlock(&stall_lock);
+		msg_destroy(&mesg);
+
+		++tests;
+		if (dropped == 0 || stall_delivered + dropped != (size_t)sent)
+			++errors, printf("Test%d: msg_async_dropped() failed (dropped %lu, delivered %lu, sent %d)\n", tests, (unsigned long)dropped, (unsigned long)stall_delivered, sent);
+	}
+
+	/* Test a ring filled exactly (by a multiplexing Msg) and then formatted into directly */
+
+	{
+		static size_t length = 56; /* 64 byte records, so the ring fills exactly */
+		Msg *stall = msg_create(7, stall_out, &length, NULL);
+		Msg *mesg = msg_create_async(stall, 0);
+		Msg *plex = msg_create_plex(mesg, NULL);
+		size_t dropped;
+		int sent = 0;
+
+		pthread_mutex_lock(&stall_lock);
+		stalled = 0;
+		stall_delivered = 0;
+		msg_out(plex, "%55d\n", sent++);
+
+		while (!stalled)
+			usleep(1000);
+
+		while (msg_async_dropped(mesg) == 0)
+			msg_out(plex, "%55d\n", sent++);
+
+		for (i = 0; i < 100; ++i, ++sent)
+			msg_out(mesg, "%55d\n", sent);
+
+		dropped = msg_async_dropped(mesg);
+		pthread_mutex_unlock(&stall_lock);
+		msg_destroy(&plex);
+
+		++tests;
+		if (dropped != 101 || stall_delivered + dropped != (size_t)sent || stall_mangled)
+			++errors, printf("Test%d: msg_out() to a full ring failed (dropped %lu, delivered %lu, mangled %lu, sent %d)\n", tests, (unsigned long)dropped, (unsigned long)stall_delivered, (unsigned long)stall_mangled, sent);
+	}
+
+	++tests;
+	if (msg_create_async(NULL, 0) != NULL || errno != EINVAL)
+		++errors, printf("Test%d: msg_create_async(NULL) failed\n", tests);
+
+	++tests;
+	if (msg_flush(NULL) != -1 || errno != EINVAL)
+		++errors, printf("Test%d: msg_flush(NULL) failed\n", tests);
+
+	{
+		Msg *sync = msg_create_fd(STDOUT_FILENO);
+
+		++tests;
+		errno = 0;
+		if (msg_async_dropped(sync) != 0 || errno != EINVAL)
+			++errors, printf("Test%d: msg_async_dropped(sync) failed\n", tests);
+
+		msg_release(sync);
+	}
+
 	if (errors)
 		printf("%d/%d tests failed\n%s\n    %s", errors, tests, note, mesg);
 	else
@@ -70,6 +70,10 @@ int msg_add_plex(Msg *mesg, Msg *item);
 int msg_add_plex_unlocked(Msg *mesg, Msg *item);
 Msg *msg_create_filter(msg_filter_t *filter, Msg *mesg);
 Msg *msg_create_filter_with_locker(Locker *locker, msg_filter_t *filter, Msg *mesg);
+Msg *msg_create_async(Msg *mesg, size_t size);
+Msg *msg_create_async_with_locker(Locker *locker, Msg *mesg, size_t size);
+int msg_flush(Msg *mesg);
+size_t msg_async_dropped(Msg *mesg);
 const char *msg_set_timestamp_format(const char *format);
 int msg_set_timestamp_format_locker(Locker *locker);
 int syslog_lookup_facility(const char *facility);
@@ -119,6 +119,7 @@ I<libslack(net)> - network module
     ssize_t vunpack(void *buf, size_t size, const char *format, va_list args);
     ssize_t net_read(int sockfd, long timeout, char *buf, size_t count);
     ssize_t net_write(int sockfd, long timeout, const char *buf, size_t count);
+    ssize_t net_writev(int sockfd, long timeout, const struct iovec *iov, int iovcnt);
     ssize_t net_expect(int sockfd, long timeout, const char *format, ...);
     ssize_t net_vexpect(int sockfd, long timeout, const char *format, va_list args);
     ssize_t net_send(int sockfd, long timeout, const char *format, ...);
@@ -3764,6 +3765,75 @@ ssize_t net_write(int sockfd, long timeout, const char *buf, size_t count)
 
 /*
 
+=item C<ssize_t net_writev(int sockfd, long timeout, const struct iovec *iov, int iovcnt)>
+
+Equivalent to I<net_write(3)> except that the data is gathered from the
+C<iovcnt> buffers described by C<iov> (see I<writev(2)>). Repeatedly calls
+I<writev(2)> until all of the data has been written, or until it times out
+(after C<timeout> seconds). The data is written without first being copied
+into a single buffer. C<iov> is not modified. On success, returns the
+number of bytes written. On error, returns C<-1>.
+
+=cut
+
+*/
+
+#ifndef NET_IOV_MAX
+#define NET_IOV_MAX 16
+#endif
+
+ssize_t net_writev(int sockfd, long timeout, const struct iovec *iov, int iovcnt)
+{
+	struct iovec vec[NET_IOV_MAX];
+	size_t offset = 0, total = 0;
+	ssize_t bytes;
+	int i, n;
+
+	if (!iov || iovcnt < 0)
+		return set_errno(EINVAL);
+
+	while (iovcnt && iov->iov_len == offset)
+		++iov, --iovcnt, offset = 0;
+
+	while (iovcnt)
+	{
+		for (n = 0; n < iovcnt && n < NET_IOV_MAX; ++n)
+		{
+			vec[n].iov_base = (char *)iov[n].iov_base + ((n) ? 0 : offset);
+			vec[n].iov_len = iov[n].iov_len - ((n) ? 0 : offset);
+		}
+
+		if (write_timeout(sockfd, timeout, 0) == -1)
+			return -1;
+
+		if ((bytes = writev(sockfd, vec, n)) <= 0)
+			return bytes;
+
+		total += bytes;
+
+		for (i = 0; bytes; ++i)
+		{
+			size_t left = vec[i].iov_len;
+
+			if ((size_t)bytes < left)
+			{
+				offset += bytes;
+				break;
+			}
+
+			bytes -= left;
+			++iov, --iovcnt, offset = 0;
+		}
+
+		while (iovcnt && iov->iov_len == offset)
+			++iov, --iovcnt, offset = 0;
+	}
+
+	return total;
+}
+
+/*
+
 =item C<ssize_t net_expect(int sockfd, long timeout, const char *format, ...)>
 
 Expects and confirms a formatted text message from a remote connection on
@@ -3831,8 +3901,14 @@ ssize_t net_vexpect(int sockfd, long timeout, const char *format, va_list args)
 
 Sends a formatted string (see I<printf(3)>) to a remote connection on the
 socket, C<sockfd>. C<timeout> is the number of seconds to wait before timing
-out. On success, returns the number of bytes written. On error, returns
-C<-1> with C<errno> set appropriately.
+out. There is no limit on the length of the formatted string. If C<format>
+contains nothing but literal text and plain C<%s> conversions (e.g. C<"RCPT
+TO: %s\r\n">), the literal text and the string arguments are written
+directly with I<writev(2)> without being copied at all. Otherwise, strings
+up to C<MSG_SIZE> bytes long (C<8192> by default) are formatted into a
+buffer on the stack and anything longer is formatted into a buffer
+allocated on the heap. On success, returns the number of bytes written. On
+error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
@@ -3852,6 +3928,43 @@ ssize_t net_send(int sockfd, long timeout, const char *format, ...)
 
 /*
 
+C<static int net_send_plain(const char *format)>
+
+If C<format> contains nothing but literal text, C<%%> and plain C<%s>
+conversions, and it can be written with at most C<NET_IOV_MAX> buffers,
+returns the number of buffers needed. Otherwise, returns C<-1>.
+
+*/
+
+static int net_send_plain(const char *format)
+{
+	const char *f;
+	int iovcnt = 0, literal = 0;
+
+	for (f = format; *f; ++f)
+	{
+		if (*f != '%')
+		{
+			iovcnt += !literal;
+			literal = 1;
+			continue;
+		}
+
+		if (f[1] == 's')
+			++iovcnt, literal = 0;
+		else if (f[1] == '%')
+			++iovcnt, literal = 1;
+		else
+			return -1;
+
+		++f;
+	}
+
+	return (iovcnt <= NET_IOV_MAX) ? iovcnt : -1;
+}
+
+/*
+
 =item C<ssize_t net_vsend(int sockfd, long timeout, const char *format, va_list args)>
 
 Equivalent to I<net_send(3)> with the variable argument list specified
@@ -3861,16 +3974,79 @@ directly as for I<vprintf(3)>.
 
 */
 
+#ifndef va_copy
+#define va_copy(dst, src) __va_copy((dst), (src))
+#endif
+
 ssize_t net_vsend(int sockfd, long timeout, const char *format, va_list args)
 {
-	char buf[MSG_SIZE + 1];
+	struct iovec iov[NET_IOV_MAX];
+	char buf[MSG_SIZE + 1], *heap;
+	const char *f, *literal;
 	ssize_t bytes;
+	va_list args_copy;
+	int iovcnt;
 
-	bytes = vsnprintf(buf, MSG_SIZE + 1, format, args);
-	if (bytes == -1 || bytes > MSG_SIZE)
-		return set_errno(ENOSPC);
+	if (!format)
+		return set_errno(EINVAL);
+
+	/* Write literal text and %s arguments in place */
+
+	if ((iovcnt = net_send_plain(format)) != -1)
+	{
+		for (iovcnt = 0, literal = f = format; *f; ++f)
+		{
+			if (*f != '%')
+				continue;
+
+			if (f > literal)
+				iov[iovcnt].iov_base = (void *)literal, iov[iovcnt++].iov_len = f - literal;
+
+			if (*++f == 's')
+			{
+				const char *arg = va_arg(args, const char *);
+
+				if (!arg)
+					arg = "(null)";
+
+				iov[iovcnt].iov_base = (void *)arg, iov[iovcnt++].iov_len = strlen(arg);
+				literal = f + 1;
+			}
+			else /* %% */
+				literal = f;
+		}
+
+		if (f > literal)
+			iov[iovcnt].iov_base = (void *)literal, iov[iovcnt++].iov_len = f - literal;
 
-	return net_write(sockfd, timeout, buf, bytes);
+		return net_writev(sockfd, timeout, iov, iovcnt);
+	}
+
+	/* Format short messages on the stack and long ones on the heap */
+
+	va_copy(args_copy, args);
+	bytes = vsnprintf(buf, MSG_SIZE + 1, format, args_copy);
+	va_end(args_copy);
+
+	if (bytes == -1)
+		return set_errno(EINVAL);
+
+	if (bytes <= MSG_SIZE)
+		return net_write(sockfd, timeout, buf, bytes);
+
+	if (!(heap = mem_create(bytes + 1, char)))
+		return -1;
+
+	if (vsnprintf(heap, bytes + 1, format, args) != bytes)
+	{
+		mem_release(heap);
+		return set_errno(EINVAL);
+	}
+
+	bytes = net_write(sockfd, timeout, heap, bytes);
+	mem_release(heap);
+
+	return bytes;
 }
 
 /*
@@ -4702,8 +4878,6 @@ An unpack C<?> indirect count argument is C<null>.
 
 =item C<ENOSPC>
 
-A message was too large to be sent with I<net_send(3)>.
-
 A packet was too small to store all of the data to be packed or unpacked.
 
 An unpack C<?> indirect count argument points to a number greater than the
@@ -5243,6 +5417,7 @@ int main(int ac, char **av)
 	pid_t pid;
 	int server;
 	int client;
+	int pair[2];
 	int errors = 0;
 	char *format;
 	void *a, *a2;
@@ -7379,8 +7554,58 @@ int main(int ac, char **av)
 #endif
 #endif
 
+	/* Test net_send() with long and plain formats, and net_writev() */
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1)
+		++errors, printf("Test706: socketpair() failed (%s)\n", strerror(errno));
+	else
+	{
+		static char big[20000], expected[40100], received[40100];
+		struct iovec iov[40];
+		ssize_t rc;
+		int i;
+
+		memset(big, 'x', sizeof big - 1);
+		big[sizeof big - 1] = '\0';
+
+		snprintf(expected, sizeof expected, "RCPT TO: <%s>\r\n", "a@b");
+		if ((rc = net_send(pair[0], 5, "RCPT TO: <%s>\r\n", "a@b")) != strlen(expected))
+			++errors, printf("Test706: net_send(plain) failed (returned %d, not %d)\n", (int)rc, (int)strlen(expected));
+		else if (net_read(pair[1], 5, received, rc) != rc || memcmp(received, expected, rc))
+			++errors, printf("Test707: net_send(plain) failed (received \"%.*s\", not \"%s\")\n", (int)rc, received, expected);
+
+		snprintf(expected, sizeof expected, "%s%%%s: %s 100%%", "To", big, big);
+		if ((rc = net_send(pair[0], 5, "%s%%%s: %s 100%%", "To", big, big)) != strlen(expected))
+			++errors, printf("Test708: net_send(plain, long) failed (returned %d, not %d)\n", (int)rc, (int)strlen(expected));
+		else if (net_read(pair[1], 5, received, rc) != rc || memcmp(received, expected, rc))
+			++errors, printf("Test709: net_send(plain, long) failed (received data differs)\n");
+
+		snprintf(expected, sizeof expected, "%d %-3s %s\r\n", 250, "ok", big);
+		if ((rc = net_send(pair[0], 5, "%d %-3s %s\r\n", 250, "ok", big)) != strlen(expected))
+			++errors, printf("Test710: net_send(long) failed (returned %d, not %d (%s))\n", (int)rc, (int)strlen(expected), strerror(errno));
+		else if (net_read(pair[1], 5, received, rc) != rc || memcmp(received, expected, rc))
+			++errors, printf("Test711: net_send(long) failed (received data differs)\n");
+
+		for (i = 0; i < 40; ++i)
+		{
+			iov[i].iov_base = big + i;
+			iov[i].iov_len = (i % 3) ? 1000 : 0;
+		}
+
+		for (*expected = '\0', i = 0; i < 40; ++i)
+			strncat(expected, big + i, iov[i].iov_len);
+
+		if ((rc = net_writev(pair[0], 5, iov, 40)) != strlen(expected))
+			++errors, printf("Test712: net_writev() failed (returned %d, not %d)\n", (int)rc, (int)strlen(expected));
+		else if (net_read(pair[1], 5, received, rc) != rc || memcmp(received, expected, rc))
+			++errors, printf("Test713: net_writev() failed (received data differs)\n");
+
+		close(pair[0]);
+		close(pair[1]);
+	}
+
 	if (errors)
-		printf("%d/705 tests failed\n", errors);
+		printf("%d/713 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
@@ -25,6 +25,7 @@
 #include <stdarg.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 
@@ -132,6 +133,7 @@ ssize_t unpack(void *buf, size_t size, const char *format, ...);
 ssize_t vunpack(void *buf, size_t size, const char *format, va_list args);
 ssize_t net_read(int sockfd, long timeout, char *buf, size_t count);
 ssize_t net_write(int sockfd, long timeout, const char *buf, size_t count);
+ssize_t net_writev(int sockfd, long timeout, const struct iovec *iov, int iovcnt);
 ssize_t net_expect(int sockfd, long timeout, const char *format, ...);
 ssize_t net_vexpect(int sockfd, long timeout, const char *format, va_list args);
 ssize_t net_send(int sockfd, long timeout, const char *format, ...);
@@ -93,6 +93,7 @@ I<libslack(prog)> - program framework module
     Msg *prog_set_err(Msg *err);
     Msg *prog_set_dbg(Msg *dbg);
     Msg *prog_set_alert(Msg *alert);
+    Trace *prog_set_trace(Trace *trace);
     ssize_t prog_set_debug_level(size_t debug_level);
     ssize_t prog_set_verbosity_level(size_t verbosity_level);
     int prog_set_locker(Locker *locker);
@@ -111,6 +112,7 @@ I<libslack(prog)> - program framework module
     Msg *prog_err(void);
     Msg *prog_dbg(void);
     Msg *prog_alert(void);
+    Trace *prog_trace(void);
     size_t prog_debug_level(void);
     size_t prog_verbosity_level(void);
     int prog_out_fd(int fd);
@@ -199,6 +201,7 @@ module.
 #include "err.h"
 #include "mem.h"
 #include "prog.h"
+#include "trace.h"
 
 #ifndef HAVE_SNPRINTF
 #include "snprintf.h"
@@ -223,6 +226,7 @@ struct Prog
 	Msg *err;
 	Msg *dbg;
 	Msg *log;
+	Trace *trace;
 	size_t debug_level;
 	size_t verbosity_level;
 	Locker *locker;
@@ -233,7 +237,7 @@ struct Prog
 static Prog g =
 {
 	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-	NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, NULL
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, NULL
 };
 
 /*
@@ -572,6 +576,32 @@ Msg *prog_set_alert(Msg *alert)
 
 /*
 
+=item C<Trace *prog_set_trace(Trace *trace)>
+
+Sets the program's debug message trace to C<trace>. When the program has a
+trace, I<debug(3)> records messages in it (to be formatted later) instead of
+sending them to the program's debug message destination. There is no trace
+by default. Releases the previous trace (if any). Setting it to C<null>
+sends debug messages to the debug message destination again. See I<trace(3)>
+for details. On success, returns C<trace>. On error, returns C<null> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+Trace *prog_set_trace(Trace *trace)
+{
+	WRLOCK(NULL)
+	if (g.trace && g.trace != trace)
+		trace_release(g.trace);
+	g.trace = trace;
+	UNLOCK(NULL)
+	return trace;
+}
+
+/*
+
 =item C<ssize_t prog_set_debug_level(size_t debug_level)>
 
 Sets the program's debug level to C<debug_level>. This is used when
@@ -906,6 +936,22 @@ Msg *prog_alert(void)
 
 /*
 
+=item C<Trace *prog_trace(void)>
+
+Returns the program's debug message trace as set by I<prog_set_trace(3)>.
+If there is none, or on error, returns C<null>.
+
+=cut
+
+*/
+
+Trace *prog_trace(void)
+{
+	PROG_GET_PTR_AND_RETURN(g.trace);
+}
+
+/*
+
 =item C<size_t prog_debug_level(void)>
 
 Returns the program's debug level as set by I<prog_set_debug_level(3)>. On
@@ -2633,6 +2679,7 @@ I<err(3)>,
 I<msg(3)>,
 I<prop(3)>,
 I<sig(3)>,
+I<trace(3)>,
 I<locker(3)>
 
 =head1 AUTHOR
@@ -26,6 +26,7 @@
 
 #include <slack/hdr.h>
 #include <slack/msg.h>
+#include <slack/trace.h>
 
 #ifndef PATH_SEP
 #define PATH_SEP '/'
@@ -101,6 +102,7 @@ Msg *prog_set_out(Msg *out);
 Msg *prog_set_err(Msg *err);
 Msg *prog_set_dbg(Msg *dbg);
 Msg *prog_set_alert(Msg *alert);
+Trace *prog_set_trace(Trace *trace);
 ssize_t prog_set_debug_level(size_t debug_level);
 ssize_t prog_set_verbosity_level(size_t verbosity_level);
 int prog_set_locker(Locker *locker);
@@ -119,6 +121,7 @@ Msg *prog_out(void);
 Msg *prog_err(void);
 Msg *prog_dbg(void);
 Msg *prog_alert(void);
+Trace *prog_trace(void);
 size_t prog_debug_level(void);
 size_t prog_verbosity_level(void);
 int prog_out_fd(int fd);
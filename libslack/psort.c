@@ -0,0 +1,643 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<libslack(psort)> - pattern-defeating quicksort
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/psort.h>
+
+    typedef int psort_cmp_t(const void *a, const void *b);
+    typedef int psort_closure_cmp_t(const void *a, const void *b, const void *data);
+
+    void psort(void *base, size_t n, size_t size, psort_cmp_t *cmp);
+    void psort_closure(void *base, size_t n, size_t size, psort_closure_cmp_t *cmp, const void *data);
+    void psort_ptr(void **base, size_t n, psort_cmp_t *cmp);
+    #define psort_define(name, type, less)
+
+=head1 DESCRIPTION
+
+This module sorts arrays in place with a pattern-defeating quicksort
+(Orson Peters' I<pdqsort>): a quicksort with median-of-3 (or ninther)
+pivots and insertion sorted leaves. It recognises partitions that are
+already sorted (finishing them with a bounded insertion sort), gathers
+elements equal to the pivot in one pass (so arrays with many duplicates
+take linear time), and shuffles a few elements to break up patterns that
+produce unbalanced partitions. If there are too many of those, it falls
+back to heap sort, so the worst case is I<O(n log n)>, like I<hsort(3)>,
+but it is usually several times faster than I<hsort(3)> (whose scattered
+memory accesses are hard on caches) and faster than I<qsort(3)>.
+
+I<psort(3)> is a drop-in replacement for I<qsort(3)>. When the comparison
+function is known at compile time, I<psort_define(3)> generates a sort for a
+particular element type with the comparison inlined, which is much faster
+again, especially for arrays of pointers.
+
+=over 4
+
+=cut
+
+*/
+
+#include "std.h"
+
+#include "psort.h"
+
+/* The generic sort: elements of any size, and a comparison function */
+
+typedef struct PsortBytes PsortBytes;
+
+struct PsortBytes
+{
+	char *base;                /* the array */
+	size_t size;               /* the size of each element */
+	psort_cmp_t *plain;        /* the comparison function (for psort()) */
+	psort_closure_cmp_t *cmp;  /* the comparison function (for psort_closure()) */
+	const void *data;          /* the data for cmp */
+};
+
+/* Sorting pointers with a qsort()-style comparison function (given the element addresses) */
+
+typedef struct PsortPtr PsortPtr;
+
+struct PsortPtr
+{
+	psort_cmp_t *cmp;          /* the comparison function */
+};
+
+#ifndef TEST
+
+static int bytes_less(PsortBytes *c, size_t i, size_t j)
+{
+	const char *a = c->base + i * c->size;
+	const char *b = c->base + j * c->size;
+
+	return ((c->plain) ? c->plain(a, b) : c->cmp(a, b, c->data)) < 0;
+}
+
+static void bytes_swap(PsortBytes *c, size_t i, size_t j)
+{
+	char *a = c->base + i * c->size;
+	char *b = c->base + j * c->size;
+	char tmp[64];
+	size_t n, chunk;
+
+	/* Constant sized copies of the commonest sizes compile to single moves */
+
+	if (c->size == sizeof(int))
+	{
+		memcpy(tmp, a, sizeof(int));
+		memcpy(a, b, sizeof(int));
+		memcpy(b, tmp, sizeof(int));
+		return;
+	}
+
+	if (c->size == sizeof(void *))
+	{
+		memcpy(tmp, a, sizeof(void *));
+		memcpy(a, b, sizeof(void *));
+		memcpy(b, tmp, sizeof(void *));
+		return;
+	}
+
+	for (n = c->size; n; n -= chunk, a += chunk, b += chunk)
+	{
+		chunk = (n < sizeof tmp) ? n : sizeof tmp;
+		memcpy(tmp, a, chunk);
+		memcpy(a, b, chunk);
+		memcpy(b, tmp, chunk);
+	}
+}
+
+psort_engine(bytes, PsortBytes, bytes_less, bytes_swap)
+
+#define ptr_less(a, b, data) (((const PsortPtr *)(data))->cmp(&(a), &(b)) < 0)
+
+psort_define(ptr_sort, void *, ptr_less)
+
+/*
+
+=item C<void psort(void *base, size_t n, size_t size, psort_cmp_t *cmp)>
+
+Sorts the C<n> elements of C<size> bytes at C<base> into ascending order,
+using the comparison function C<cmp>, which is called with pointers to two
+elements, and must return an integer less than, equal to, or greater than
+zero, if the first element is to be considered less than, equal to, or
+greater than the second. This is a drop-in replacement for I<qsort(3)>.
+
+=cut
+
+*/
+
+void psort(void *base, size_t n, size_t size, psort_cmp_t *cmp)
+{
+	PsortBytes c[1];
+
+	if (!base || n < 2 || !size || !cmp)
+		return;
+
+	c->base = base;
+	c->size = size;
+	c->plain = cmp;
+	c->cmp = NULL;
+	c->data = NULL;
+
+	bytes_run(c, n);
+}
+
+/*
+
+=item C<void psort_closure(void *base, size_t n, size_t size, psort_closure_cmp_t *cmp, const void *data)>
+
+Equivalent to I<psort(3)> except that C<data> is passed to C<cmp> as its
+third argument.
+
+=cut
+
+*/
+
+void psort_closure(void *base, size_t n, size_t size, psort_closure_cmp_t *cmp, const void *data)
+{
+	PsortBytes c[1];
+
+	if (!base || n < 2 || !size || !cmp)
+		return;
+
+	c->base = base;
+	c->size = size;
+	c->plain = NULL;
+	c->cmp = cmp;
+	c->data = data;
+
+	bytes_run(c, n);
+}
+
+/*
+
+=item C<void psort_ptr(void **base, size_t n, psort_cmp_t *cmp)>
+
+Equivalent to I<psort(base, n, sizeof(void *), cmp)> but faster, because it
+moves the elements as pointers rather than as bytes. As with I<qsort(3)>,
+C<cmp> is passed the addresses of two elements (i.e. C<void **>), not the
+elements themselves. I<list_sort(3)> uses this.
+
+=cut
+
+*/
+
+void psort_ptr(void **base, size_t n, psort_cmp_t *cmp)
+{
+	PsortPtr ptr[1];
+
+	if (!base || n < 2 || !cmp)
+		return;
+
+	ptr->cmp = cmp;
+	ptr_sort(base, n, ptr);
+}
+
+#endif
+
+/*
+
+=item C< #define psort_define(name, type, less)>
+
+Defines a static function:
+
+    void name(type *base, size_t n, const void *data);
+
+that sorts the C<n> elements of type C<type> at C<base> into ascending
+order, where C<less> is a function or macro, called as C<less(a, b, data)>
+with two elements (not their addresses) and the C<data> argument, that
+returns whether C<a> sorts before C<b>. Since C<less> is known at compile
+time, it is inlined, and elements are moved by assignment, which makes this
+much faster than I<psort(3)> (e.g. 2 to 3 times for arrays of strings).
+
+=cut
+
+=back
+
+=head1 NOTES
+
+Like I<qsort(3)> and I<hsort(3)>, this is not a stable sort: the order in
+the output of two elements which compare as equal is unpredictable (but it
+is deterministic).
+
+The comparison function must be consistent (i.e. a total order). The
+partitioning loops rely on it to stop at the ends of each partition without
+checking bounds, so the behaviour with an inconsistent comparison function
+(e.g. one that compares floating point NaNs) is undefined.
+
+I<psort(3)> and I<psort_closure(3)> do nothing if C<base> or C<cmp> is
+C<null>, or if C<n> is less than 2.
+
+=head1 MT-Level
+
+I<MT-Safe>
+
+Note that the array being sorted will still have to be write-locked during
+I<psort(3)> if it is accessed by other threads.
+
+=head1 EXAMPLE
+
+This example sorts some strings twice: by calling a comparison function,
+and with a sort that has the comparison inlined.
+
+    #include <slack/std.h>
+    #include <slack/psort.h>
+
+    static int cmp(const void *a, const void *b)
+    {
+        return strcmp(*(char * const *)a, *(char * const *)b);
+    }
+
+    #define str_less(a, b, data) (strcmp((a), (b)) < 0)
+
+    psort_define(sort_strings, char *, str_less)
+
+    int main(int ac, char **av)
+    {
+        char *string[4] = { "jkl", "ghi", "def", "abc" };
+        int i;
+
+        psort(string, 4, sizeof string[0], cmp);
+        sort_strings(string, 4, NULL);
+
+        for (i = 0; i < 4; ++i)
+            printf("%s\n", string[i]);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<hsort(3)>,
+I<list(3)>,
+I<qsort(3)>
+
+=head1 AUTHOR
+
+20230330 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#ifdef TEST
+
+#include <time.h>
+
+#include "hsort.h"
+
+#define int_less(a, b, data) ((a) < (b))
+#define str_less(a, b, data) (strcmp((a), (b)) < 0)
+
+psort_define(sort_ints, int, int_less)
+psort_define(sort_strs, char *, str_less)
+
+typedef struct Triple Triple;
+
+struct Triple
+{
+	char key[3];
+};
+
+static int int_cmp(const void *a, const void *b)
+{
+	int x = *(const int *)a;
+	int y = *(const int *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int int_cmp_desc(const void *a, const void *b, const void *data)
+{
+	int x = *(const int *)a;
+	int y = *(const int *)b;
+
+	if (data != (const void *)"desc")
+		return 0;
+
+	return (x < y) - (x > y);
+}
+
+static int str_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int triple_cmp(const void *a, const void *b)
+{
+	return memcmp(((const Triple *)a)->key, ((const Triple *)b)->key, 3);
+}
+
+/* A comparison function that counts its calls (to check the worst case) */
+
+static unsigned long compares;
+
+static int counting_cmp(const void *a, const void *b)
+{
+	++compares;
+
+	return int_cmp(a, b);
+}
+
+static unsigned long long rand_state = 0x2545f4914f6cdd1dULL;
+
+static unsigned long long rnd(void)
+{
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+
+	return rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+#define PATTERNS 10
+
+/* Fills a with n ints in one of several patterns that trouble quicksorts */
+
+static void fill(int *a, size_t n, int pattern)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+	{
+		switch (pattern)
+		{
+			case 0: a[i] = (int)(rnd() % 1000000); break;   /* random */
+			case 1: a[i] = (int)i; break;                     /* ascending */
+			case 2: a[i] = (int)(n - i); break;               /* descending */
+			case 3: a[i] = 7; break;                          /* all equal */
+			case 4: a[i] = (int)(rnd() % 4); break;           /* few distinct */
+			case 5: a[i] = (int)((i < n / 2) ? i : n - i); break; /* organ pipe */
+			case 6: a[i] = (int)(i % 16); break;              /* sawtooth */
+			case 7: a[i] = (int)((i % 100) ? i : rnd() % n); break; /* nearly sorted */
+			case 8: a[i] = (int)((i & 1) ? i : n - i); break; /* interleaved */
+			case 9: a[i] = (int)((i + n / 2) % n); break;     /* rotated */
+		}
+	}
+}
+
+static int is_sorted(const int *a, size_t n)
+{
+	size_t i;
+
+	for (i = 1; i < n; ++i)
+		if (a[i - 1] > a[i])
+			return 0;
+
+	return 1;
+}
+
+static int same(const int *a, const int *b, size_t n)
+{
+	return !memcmp(a, b, n * sizeof *a);
+}
+
+static double wall(void)
+{
+	struct timespec ts[1];
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+#define BENCH_STRINGS 1000000
+#define BENCH_INTS 1000000
+
+/*
+
+Sorts a million random email addresses (by domain then local part, as
+strings) and a million random ints with qsort(), hsort(), psort(),
+psort_ptr() and a psort_define() sort.
+
+*/
+
+static void bench(void)
+{
+	static char *addr[BENCH_STRINGS], *copy[BENCH_STRINGS];
+	static int ints[BENCH_INTS], work[BENCH_INTS];
+	double start, secs[2][5];
+	size_t i;
+	int s;
+
+	for (i = 0; i < BENCH_STRINGS; ++i)
+	{
+		char buf[64];
+
+		snprintf(buf, sizeof buf, "example%d.org@user%llu", (int)(rnd() % 1000), rnd() % 1000000);
+		if (!(addr[i] = strdup(buf)))
+			exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < BENCH_INTS; ++i)
+		ints[i] = (int)(rnd() % 1000000000);
+
+	for (s = 0; s < 5; ++s)
+	{
+		memcpy(copy, addr, sizeof addr);
+		start = wall();
+		switch (s)
+		{
+			case 0: qsort(copy, BENCH_STRINGS, sizeof *copy, str_cmp); break;
+			case 1: hsort(copy, BENCH_STRINGS, sizeof *copy, str_cmp); break;
+			case 2: psort(copy, BENCH_STRINGS, sizeof *copy, str_cmp); break;
+			case 3: psort_ptr((void **)copy, BENCH_STRINGS, str_cmp); break;
+			case 4: sort_strs(copy, BENCH_STRINGS, NULL); break;
+		}
+		secs[0][s] = wall() - start;
+
+		memcpy(work, ints, sizeof ints);
+		start = wall();
+		switch (s)
+		{
+			case 0: qsort(work, BENCH_INTS, sizeof *work, int_cmp); break;
+			case 1: hsort(work, BENCH_INTS, sizeof *work, int_cmp); break;
+			case 2: psort(work, BENCH_INTS, sizeof *work, int_cmp); break;
+			case 3: secs[1][s] = 0; continue;
+			case 4: sort_ints(work, BENCH_INTS, NULL); break;
+		}
+		secs[1][s] = wall() - start;
+	}
+
+	printf("%-8s %10s %10s %10s %10s %10s (ms)\n", "1M", "qsort", "hsort", "psort", "psort_ptr", "defined");
+	printf("%-8s %10.1f %10.1f %10.1f %10.1f %10.1f\n", "strings", secs[0][0] * 1e3, secs[0][1] * 1e3, secs[0][2] * 1e3, secs[0][3] * 1e3, secs[0][4] * 1e3);
+	printf("%-8s %10.1f %10.1f %10.1f %10s %10.1f\n", "ints", secs[1][0] * 1e3, secs[1][1] * 1e3, secs[1][2] * 1e3, "-", secs[1][4] * 1e3);
+
+	for (i = 0; i < BENCH_STRINGS; ++i)
+		free(addr[i]);
+
+	exit(EXIT_SUCCESS);
+}
+
+int main(int ac, char **av)
+{
+	static const size_t sizes[] = { 0, 1, 2, 3, 5, 23, 24, 25, 100, 128, 129, 1000, 5000, 100000 };
+	static int a[100000], b[100000], c[100000];
+	int errors = 0;
+	size_t s, i;
+	int p;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s [bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench();
+
+	printf("Testing: %s\n", "psort");
+
+	/* Every pattern and size, against qsort(), generic and typed */
+
+	for (p = 0; p < PATTERNS; ++p)
+	{
+		for (s = 0; s < sizeof sizes / sizeof *sizes; ++s)
+		{
+			size_t n = sizes[s];
+
+			fill(a, n, p);
+			memcpy(b, a, n * sizeof *a);
+			memcpy(c, a, n * sizeof *a);
+
+			qsort(a, n, sizeof *a, int_cmp);
+			psort(b, n, sizeof *b, int_cmp);
+			sort_ints(c, n, NULL);
+
+			if (!is_sorted(b, n) || !same(a, b, n))
+				++errors, printf("Test1: psort(pattern %d, n %d) failed\n", p, (int)n);
+
+			if (!is_sorted(c, n) || !same(a, c, n))
+				++errors, printf("Test2: sort_ints(pattern %d, n %d) failed\n", p, (int)n);
+		}
+	}
+
+	/* The closure version (descending) */
+
+	fill(a, 5000, 0);
+	psort_closure(a, 5000, sizeof *a, int_cmp_desc, "desc");
+	for (i = 1; i < 5000; ++i)
+		if (a[i - 1] < a[i])
+			break;
+	if (i != 5000)
+		++errors, printf("Test3: psort_closure(desc) failed\n");
+
+	/* Odd sized elements */
+
+	{
+		static Triple t[3000], u[3000];
+
+		for (i = 0; i < 3000; ++i)
+		{
+			t[i].key[0] = (char)(rnd() % 3 + 'a');
+			t[i].key[1] = (char)(rnd() % 26 + 'a');
+			t[i].key[2] = (char)(rnd() % 26 + 'a');
+		}
+
+		memcpy(u, t, sizeof t);
+		qsort(t, 3000, sizeof *t, triple_cmp);
+		psort(u, 3000, sizeof *u, triple_cmp);
+
+		if (memcmp(t, u, sizeof t))
+			++errors, printf("Test4: psort(3 byte elements) failed\n");
+	}
+
+	/* Pointers: psort_ptr() and a defined sort of strings */
+
+	{
+		static char buf[2000][16];
+		static char *x[2000], *y[2000], *z[2000];
+
+		for (i = 0; i < 2000; ++i)
+		{
+			snprintf(buf[i], sizeof buf[i], "%llu", rnd() % 500);
+			x[i] = y[i] = z[i] = buf[i];
+		}
+
+		qsort(x, 2000, sizeof *x, str_cmp);
+		psort_ptr((void **)y, 2000, str_cmp);
+		sort_strs(z, 2000, NULL);
+
+		for (i = 0; i < 2000; ++i)
+			if (strcmp(x[i], y[i]))
+				break;
+		if (i != 2000)
+			++errors, printf("Test5: psort_ptr() failed\n");
+
+		for (i = 0; i < 2000; ++i)
+			if (strcmp(x[i], z[i]))
+				break;
+		if (i != 2000)
+			++errors, printf("Test6: sort_strs() failed\n");
+	}
+
+	/* The worst case stays O(n log n) for every pattern (within a generous constant) */
+
+	for (p = 0; p < PATTERNS; ++p)
+	{
+		fill(a, 100000, p);
+		compares = 0;
+		psort(a, 100000, sizeof *a, counting_cmp);
+
+		if (compares > 100000 * 17 * 3)
+			++errors, printf("Test7: psort(pattern %d) made %lu comparisons\n", p, compares);
+	}
+
+	/* Sorted input is linear, and so is input with few distinct values */
+
+	fill(a, 100000, 1);
+	compares = 0;
+	psort(a, 100000, sizeof *a, counting_cmp);
+	if (compares > 100000 * 3)
+		++errors, printf("Test8: psort(sorted) made %lu comparisons, not O(n)\n", compares);
+
+	fill(a, 100000, 3);
+	compares = 0;
+	psort(a, 100000, sizeof *a, counting_cmp);
+	if (compares > 100000 * 3)
+		++errors, printf("Test9: psort(all equal) made %lu comparisons, not O(n)\n", compares);
+
+	/* Bad arguments are ignored */
+
+	psort(NULL, 10, sizeof *a, int_cmp);
+	psort(a, 10, sizeof *a, NULL);
+	psort_ptr(NULL, 10, str_cmp);
+
+	if (errors)
+		printf("%d/9 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,339 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+#ifndef LIBSLACK_PSORT_H
+#define LIBSLACK_PSORT_H
+
+#include <stdlib.h>
+
+#include <slack/hdr.h>
+
+typedef int psort_cmp_t(const void *a, const void *b);
+typedef int psort_closure_cmp_t(const void *a, const void *b, const void *data);
+
+_begin_decls
+void psort(void *base, size_t n, size_t size, psort_cmp_t *cmp);
+void psort_closure(void *base, size_t n, size_t size, psort_closure_cmp_t *cmp, const void *data);
+void psort_ptr(void **base, size_t n, psort_cmp_t *cmp);
+_end_decls
+
+/*
+** Partitions smaller than this are insertion sorted, larger ones use the
+** median of 3 (or the ninther above PSORT_NINTHER) as the pivot, and a
+** partial insertion sort gives up after PSORT_PARTIAL moves.
+*/
+
+#define PSORT_INSERTION 24
+#define PSORT_NINTHER 128
+#define PSORT_PARTIAL 8
+
+/*
+** psort_engine() defines name##_run(c, n), a pattern-defeating quicksort of
+** the n elements that the context pointer c refers to (n must be > 1). It only compares and swaps elements by index, with the functions (or
+** macros) less(c, i, j) (whether element i < element j) and swap(c, i, j),
+** so the same code serves the generic psort() (any element size, comparison
+** function) and typed variants made with psort_define() (comparison inlined).
+*/
+
+#define psort_engine(name, ctx_t, less, swap) \
+\
+static void name##_sort2(ctx_t *c, size_t i, size_t j) \
+{ \
+	if (less(c, j, i)) \
+		swap(c, i, j); \
+} \
+\
+static void name##_sort3(ctx_t *c, size_t i, size_t j, size_t k) \
+{ \
+	name##_sort2(c, i, j); \
+	name##_sort2(c, j, k); \
+	name##_sort2(c, i, j); \
+} \
+\
+static void name##_insertion(ctx_t *c, size_t lo, size_t hi, int leftmost) \
+{ \
+	size_t i, j; \
+\
+	for (i = lo + 1; i < hi; ++i) \
+		for (j = i; (leftmost ? j > lo : 1) && less(c, j, j - 1); --j) \
+			swap(c, j, j - 1); \
+} \
+\
+static int name##_partial(ctx_t *c, size_t lo, size_t hi) \
+{ \
+	size_t i, j, moves = 0; \
+\
+	for (i = lo + 1; i < hi; ++i) \
+	{ \
+		for (j = i; j > lo && less(c, j, j - 1); --j) \
+			swap(c, j, j - 1); \
+\
+		if ((moves += i - j) > PSORT_PARTIAL) \
+			return 0; \
+	} \
+\
+	return 1; \
+} \
+\
+static void name##_sift(ctx_t *c, size_t lo, size_t root, size_t n) \
+{ \
+	size_t child; \
+\
+	while ((child = 2 * root + 1) < n) \
+	{ \
+		if (child + 1 < n && less(c, lo + child, lo + child + 1)) \
+			++child; \
+\
+		if (!less(c, lo + root, lo + child)) \
+			break; \
+\
+		swap(c, lo + root, lo + child); \
+		root = child; \
+	} \
+} \
+\
+static void name##_heap(ctx_t *c, size_t lo, size_t hi) \
+{ \
+	size_t n = hi - lo, i; \
+\
+	for (i = n / 2; i-- > 0; ) \
+		name##_sift(c, lo, i, n); \
+\
+	for (i = n - 1; i > 0; --i) \
+	{ \
+		swap(c, lo, lo + i); \
+		name##_sift(c, lo, 0, i); \
+	} \
+} \
+\
+static size_t name##_partition_right(ctx_t *c, size_t lo, size_t hi, int *done) \
+{ \
+	size_t first = lo, last = hi; \
+\
+	while (less(c, ++first, lo)) \
+		; \
+\
+	if (first - 1 == lo) \
+	{ \
+		while (first < last && !less(c, --last, lo)) \
+			; \
+	} \
+	else \
+	{ \
+		while (!less(c, --last, lo)) \
+			; \
+	} \
+\
+	*done = first >= last; \
+\
+	while (first < last) \
+	{ \
+		swap(c, first, last); \
+\
+		while (less(c, ++first, lo)) \
+			; \
+\
+		while (!less(c, --last, lo)) \
+			; \
+	} \
+\
+	swap(c, lo, first - 1); \
+\
+	return first - 1; \
+} \
+\
+static size_t name##_partition_left(ctx_t *c, size_t lo, size_t hi) \
+{ \
+	size_t first = lo, last = hi; \
+\
+	while (less(c, lo, --last)) \
+		; \
+\
+	if (last + 1 == hi) \
+	{ \
+		while (first < last && !less(c, lo, ++first)) \
+			; \
+	} \
+	else \
+	{ \
+		while (!less(c, lo, ++first)) \
+			; \
+	} \
+\
+	while (first < last) \
+	{ \
+		swap(c, first, last); \
+\
+		while (less(c, lo, --last)) \
+			; \
+\
+		while (!less(c, lo, ++first)) \
+			; \
+	} \
+\
+	swap(c, lo, last); \
+\
+	return last; \
+} \
+\
+static void name##_break(ctx_t *c, size_t lo, size_t hi) \
+{ \
+	size_t n = hi - lo, q = n / 4; \
+\
+	if (n < PSORT_INSERTION) \
+		return; \
+\
+	swap(c, lo, lo + q); \
+	swap(c, hi - 1, hi - q); \
+\
+	if (n > PSORT_NINTHER) \
+	{ \
+		swap(c, lo + 1, lo + q + 1); \
+		swap(c, lo + 2, lo + q + 2); \
+		swap(c, hi - 2, hi - q - 1); \
+		swap(c, hi - 3, hi - q - 2); \
+	} \
+} \
+\
+static void name##_loop(ctx_t *c, size_t lo, size_t hi, int bad, int leftmost) \
+{ \
+	for (;;) \
+	{ \
+		size_t n = hi - lo, half = n / 2, pivot; \
+		int done; \
+\
+		if (n < PSORT_INSERTION) \
+		{ \
+			name##_insertion(c, lo, hi, leftmost); \
+			return; \
+		} \
+\
+		if (n > PSORT_NINTHER) \
+		{ \
+			name##_sort3(c, lo, lo + half, hi - 1); \
+			name##_sort3(c, lo + 1, lo + half - 1, hi - 2); \
+			name##_sort3(c, lo + 2, lo + half + 1, hi - 3); \
+			name##_sort3(c, lo + half - 1, lo + half, lo + half + 1); \
+			swap(c, lo, lo + half); \
+		} \
+		else \
+			name##_sort3(c, lo + half, lo, hi - 1); \
+\
+		/* If the pivot equals its predecessor, put the (many) equal elements on the left, and move on */ \
+\
+		if (!leftmost && !less(c, lo - 1, lo)) \
+		{ \
+			lo = name##_partition_left(c, lo, hi) + 1; \
+			continue; \
+		} \
+\
+		pivot = name##_partition_right(c, lo, hi, &done); \
+\
+		if (pivot - lo < n / 8 || hi - pivot - 1 < n / 8) \
+		{ \
+			/* Unbalanced: shuffle some elements to break the pattern, or give up and heap sort */ \
+\
+			if (--bad == 0) \
+			{ \
+				name##_heap(c, lo, hi); \
+				return; \
+			} \
+\
+			name##_break(c, lo, pivot); \
+			name##_break(c, pivot + 1, hi); \
+		} \
+		else if (done && name##_partial(c, lo, pivot) && name##_partial(c, pivot + 1, hi)) \
+			return; \
+\
+		/* Recurse into the smaller side to bound the stack, and loop on the larger */ \
+\
+		if (pivot - lo < hi - pivot) \
+		{ \
+			name##_loop(c, lo, pivot, bad, leftmost); \
+			lo = pivot + 1; \
+			leftmost = 0; \
+		} \
+		else \
+		{ \
+			name##_loop(c, pivot + 1, hi, bad, 0); \
+			hi = pivot; \
+		} \
+	} \
+} \
+\
+static void name##_run(ctx_t *c, size_t n) \
+{ \
+	size_t bits = n; \
+	int bad = 1; \
+\
+	while (bits >>= 1) \
+		++bad; \
+\
+	name##_loop(c, 0, n, bad, 1); \
+}
+
+/*
+** psort_define(name, type, less) defines a static function:
+**
+**   void name(type *base, size_t n, const void *data)
+**
+** that sorts n elements of type at base, where less(a, b, data) is an
+** expression that is true when element a sorts before element b.
+*/
+
+#define psort_define(name, type, less) \
+\
+typedef struct name##_ctx name##_ctx_t; \
+\
+struct name##_ctx \
+{ \
+	type *base; \
+	const void *data; \
+}; \
+\
+static int name##_less(name##_ctx_t *c, size_t i, size_t j) \
+{ \
+	return less(c->base[i], c->base[j], c->data); \
+} \
+\
+static void name##_swap(name##_ctx_t *c, size_t i, size_t j) \
+{ \
+	type tmp = c->base[i]; \
+	c->base[i] = c->base[j]; \
+	c->base[j] = tmp; \
+} \
+\
+psort_engine(name, name##_ctx_t, name##_less, name##_swap) \
+\
+static void name(type *base, size_t n, const void *data) \
+{ \
+	name##_ctx_t c[1]; \
+\
+	c->base = base; \
+	c->data = data; \
+\
+	if (n > 1) \
+		name##_run(c, n); \
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,1364 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<libslack(queue)> - queue module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/queue.h>
+
+    typedef struct Ring Ring;
+    typedef struct Queue Queue;
+    typedef void queue_release_t(void *item);
+
+    Ring *ring_create(size_t size, queue_release_t *destroy);
+    void ring_release(Ring *ring);
+    void *ring_destroy(Ring **ring);
+    int ring_push(Ring *ring, void *item);
+    int ring_pop(Ring *ring, void **item);
+    size_t ring_size(const Ring *ring);
+    size_t ring_length(Ring *ring);
+    Queue *queue_create(queue_release_t *destroy);
+    void queue_release(Queue *queue);
+    void *queue_destroy(Queue **queue);
+    int queue_push(Queue *queue, void *item);
+    int queue_pop(Queue *queue, void **item);
+    int queue_wait(Queue *queue, void **item);
+    int queue_timedwait(Queue *queue, void **item, long sec, long usec);
+    int queue_close(Queue *queue);
+
+=head1 DESCRIPTION
+
+This module provides first-in, first-out queues for handing items from
+producer threads to consumer threads. Both kinds of queue may be used by
+any number of producers and consumers at the same time, and both take and
+return items in constant time.
+
+A I<Ring> is a bounded queue: a circular array with a fixed number of
+cells. Each cell has a sequence number that tells a producer whether the
+cell is free for the position it has claimed, and tells a consumer whether
+the cell holds the item for its position (Dmitry Vyukov's bounded MPMC
+queue). Positions are claimed with a compare-and-swap, so I<ring_push(3)>
+and I<ring_pop(3)> never take a lock, but they never wait either. They fail
+with C<EAGAIN> when the ring is full or empty.
+
+A I<Queue> is an unbounded queue: a linked list of arrays (segments) of
+C<256> items each, so items are stored without allocating memory for each
+one. Producers and consumers have separate locks, so they only contend with
+their own kind, and each lock is only held for long enough to store or take
+a single item. Consumers can wait for an item with I<queue_wait(3)> or
+I<queue_timedwait(3)>. Producers only touch the consumers' lock (to wake
+one) when a consumer is actually waiting. When there will be no more items,
+I<queue_close(3)> wakes all waiting consumers so they can finish.
+
+If the compiler doesn't support atomic operations, the lock-free parts of
+this module are protected by a single mutex instead.
+
+=over 4
+
+=cut
+
+*/
+
+#include "config.h"
+#include "std.h"
+
+#include "queue.h"
+#include "mem.h"
+#include "err.h"
+
+typedef struct RingCell RingCell;
+typedef struct QueueSegment QueueSegment;
+
+/* Padding that keeps fields used by producers and consumers on separate cache lines */
+
+#define QUEUE_LINE 64
+
+/* Number of items in each segment of a Queue */
+
+#define QUEUE_SEGMENT 256
+
+struct RingCell
+{
+	size_t seq;                   /* position the cell is ready to be pushed (seq == pos) or popped (seq == pos + 1) at */
+	void *item;                   /* the item */
+};
+
+struct Ring
+{
+	size_t mask;                  /* number of cells - 1 */
+	RingCell *cell;               /* array of cells */
+	queue_release_t *destroy;     /* destructor function for items */
+	char pad1[QUEUE_LINE];
+	size_t tail;                  /* position of the next push */
+	char pad2[QUEUE_LINE];
+	size_t head;                  /* position of the next pop */
+	char pad3[QUEUE_LINE];
+};
+
+struct QueueSegment
+{
+	QueueSegment *next;           /* the following segment */
+	size_t count;                 /* number of items pushed into this segment */
+	void *item[QUEUE_SEGMENT];    /* the items */
+};
+
+struct Queue
+{
+	queue_release_t *destroy;     /* destructor function for items */
+	QueueSegment *spare;          /* an emptied segment for reuse */
+	int closed;                   /* whether or not queue_close() has been called */
+	char pad1[QUEUE_LINE];
+	pthread_mutex_t tail_lock;    /* mutex lock for producers */
+	QueueSegment *tail;           /* the segment to push into */
+	char pad2[QUEUE_LINE];
+	pthread_mutex_t head_lock;    /* mutex lock for consumers */
+	pthread_cond_t ready;         /* signalled when an item is pushed for a waiting consumer */
+	QueueSegment *head;           /* the segment to pop from */
+	size_t index;                 /* index of the next item to pop in head */
+	size_t waiters;               /* number of waiting consumers */
+	char pad3[QUEUE_LINE];
+};
+
+#ifndef TEST
+
+/* Largest number of cells in a Ring */
+
+#define RING_MAX ((size_t)1 << (sizeof(size_t) * 8 - 2))
+
+#ifdef __GNUC__
+
+#define queue_atomic_load(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define queue_atomic_load_relaxed(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define queue_atomic_store(var, val) __atomic_store_n(&(var), (val), __ATOMIC_RELEASE)
+#define queue_atomic_cas(var, expected, desired) __atomic_compare_exchange_n(&(var), &(expected), (desired), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#define queue_atomic_swap(var, val) __atomic_exchange_n(&(var), (val), __ATOMIC_ACQ_REL)
+#define queue_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define queue_enter()
+#define queue_leave()
+
+/* Whether a producer needs to wake a consumer (see queue_wait_until()) */
+
+#define queue_waiting(queue) (queue_atomic_fence(), queue_atomic_load_relaxed((queue)->waiters) != 0)
+
+#else
+
+static struct
+{
+	pthread_mutex_t lock;         /* Mutex lock instead of atomic operations */
+}
+g =
+{
+	PTHREAD_MUTEX_INITIALIZER     /* lock */
+};
+
+#define queue_atomic_load(var) (var)
+#define queue_atomic_load_relaxed(var) (var)
+#define queue_atomic_store(var, val) ((var) = (val))
+#define queue_atomic_cas(var, expected, desired) (((var) == (expected)) ? ((var) = (desired), 1) : ((expected) = (var), 0))
+#define queue_atomic_swap(var, val) queue_swap(&(var), (val))
+#define queue_atomic_fence()
+#define queue_enter() pthread_mutex_lock(&g.lock)
+#define queue_leave() pthread_mutex_unlock(&g.lock)
+#define queue_waiting(queue) 1
+
+/*
+
+C<static QueueSegment *queue_swap(QueueSegment **var, QueueSegment *val)>
+
+Stores C<val> in C<*var> and returns the previous value of C<*var>.
+
+*/
+
+static QueueSegment *queue_swap(QueueSegment **var, QueueSegment *val)
+{
+	QueueSegment *old = *var;
+
+	*var = val;
+
+	return old;
+}
+
+#endif
+
+/*
+
+=item C<Ring *ring_create(size_t size, queue_release_t *destroy)>
+
+Creates a I<Ring> that can hold C<size> items (rounded up to a power of
+two). If C<destroy> is not C<null>, it is used to destroy any items still in
+the ring when it is released. It is the caller's responsibility to
+deallocate the new ring with I<ring_release(3)> or I<ring_destroy(3)>. On
+success, returns the new ring. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+Ring *ring_create(size_t size, queue_release_t *destroy)
+{
+	Ring *ring;
+	size_t i;
+
+	if (!size || size > RING_MAX)
+		return set_errnull(EINVAL);
+
+	for (i = 2; i < size; i <<= 1)
+	{}
+
+	if (!(ring = mem_new(Ring)))
+		return NULL;
+
+	if (!(ring->cell = mem_create(i, RingCell)))
+	{
+		mem_release(ring);
+		return NULL;
+	}
+
+	ring->mask = i - 1;
+	ring->destroy = destroy;
+	ring->head = ring->tail = 0;
+
+	for (i = 0; i <= ring->mask; ++i)
+		ring->cell[i].seq = i;
+
+	return ring;
+}
+
+/*
+
+=item C<void ring_release(Ring *ring)>
+
+Releases (deallocates) C<ring>, destroying any items still in it if it was
+created with a destroy function. No other thread may be using C<ring>.
+
+=cut
+
+*/
+
+void ring_release(Ring *ring)
+{
+	void *item = NULL;
+
+	if (!ring)
+		return;
+
+	if (ring->destroy)
+		while (ring_pop(ring, &item) == 0)
+			ring->destroy(item);
+
+	mem_release(ring->cell);
+	mem_release(ring);
+}
+
+/*
+
+=item C<void *ring_destroy(Ring **ring)>
+
+Destroys (deallocates and sets to C<null>) C<*ring>. Returns C<null>.
+
+=cut
+
+*/
+
+void *ring_destroy(Ring **ring)
+{
+	if (ring && *ring)
+	{
+		ring_release(*ring);
+		*ring = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<int ring_push(Ring *ring, void *item)>
+
+Adds C<item> to the end of C<ring>, without taking a lock. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set appropriately
+(C<EAGAIN> if C<ring> is full).
+
+=cut
+
+*/
+
+int ring_push(Ring *ring, void *item)
+{
+	RingCell *cell;
+	size_t pos, seq;
+
+	if (!ring)
+		return set_errno(EINVAL);
+
+	queue_enter();
+
+	for (pos = queue_atomic_load_relaxed(ring->tail);;)
+	{
+		cell = ring->cell + (pos & ring->mask);
+		seq = queue_atomic_load(cell->seq);
+
+		if (seq == pos)
+		{
+			if (queue_atomic_cas(ring->tail, pos, pos + 1))
+				break;
+		}
+		else if ((ssize_t)(seq - pos) < 0)
+		{
+			queue_leave();
+			return set_errno(EAGAIN);
+		}
+		else
+			pos = queue_atomic_load_relaxed(ring->tail);
+	}
+
+	cell->item = item;
+	queue_atomic_store(cell->seq, pos + 1);
+	queue_leave();
+
+	return 0;
+}
+
+/*
+
+=item C<int ring_pop(Ring *ring, void **item)>
+
+Removes the item at the start of C<ring> and stores it in C<*item>, without
+taking a lock. On success, returns C<0>. On error, returns C<-1> with
+C<errno> set appropriately (C<EAGAIN> if C<ring> is empty).
+
+=cut
+
+*/
+
+int ring_pop(Ring *ring, void **item)
+{
+	RingCell *cell;
+	size_t pos, seq;
+
+	if (!ring || !item)
+		return set_errno(EINVAL);
+
+	queue_enter();
+
+	for (pos = queue_atomic_load_relaxed(ring->head);;)
+	{
+		cell = ring->cell + (pos & ring->mask);
+		seq = queue_atomic_load(cell->seq);
+
+		if (seq == pos + 1)
+		{
+			if (queue_atomic_cas(ring->head, pos, pos + 1))
+				break;
+		}
+		else if ((ssize_t)(seq - (pos + 1)) < 0)
+		{
+			queue_leave();
+			return set_errno(EAGAIN);
+		}
+		else
+			pos = queue_atomic_load_relaxed(ring->head);
+	}
+
+	*item = cell->item;
+	queue_atomic_store(cell->seq, pos + ring->mask + 1);
+	queue_leave();
+
+	return 0;
+}
+
+/*
+
+=item C<size_t ring_size(const Ring *ring)>
+
+Returns the number of items that C<ring> can hold. On error, returns C<0>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+size_t ring_size(const Ring *ring)
+{
+	if (!ring)
+	{
+		errno = EINVAL;
+		return 0;
+	}
+
+	return ring->mask + 1;
+}
+
+/*
+
+=item C<size_t ring_length(Ring *ring)>
+
+Returns the number of items in C<ring>. If other threads are using C<ring>,
+this is only an approximation. On error, returns C<0> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+size_t ring_length(Ring *ring)
+{
+	size_t head, tail;
+
+	if (!ring)
+	{
+		errno = EINVAL;
+		return 0;
+	}
+
+	queue_enter();
+	head = queue_atomic_load(ring->head);
+	tail = queue_atomic_load(ring->tail);
+	queue_leave();
+
+	if ((ssize_t)(tail - head) < 0)
+		return 0;
+
+	return (tail - head > ring->mask + 1) ? ring->mask + 1 : tail - head;
+}
+
+/*
+
+=item C<Queue *queue_create(queue_release_t *destroy)>
+
+Creates an empty I<Queue>. If C<destroy> is not C<null>, it is used to
+destroy any items still in the queue when it is released. It is the
+caller's responsibility to deallocate the new queue with
+I<queue_release(3)> or I<queue_destroy(3)>. On success, returns the new
+queue. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Queue *queue_create(queue_release_t *destroy)
+{
+	Queue *queue;
+	int err;
+
+	if (!(queue = mem_new(Queue)))
+		return NULL;
+
+	if (!(queue->head = queue->tail = mem_new(QueueSegment)))
+	{
+		mem_release(queue);
+		return NULL;
+	}
+
+	if ((err = pthread_mutex_init(&queue->tail_lock, NULL)))
+		goto mutex_failed;
+
+	if ((err = pthread_mutex_init(&queue->head_lock, NULL)))
+		goto mutex2_failed;
+
+	if ((err = pthread_cond_init(&queue->ready, NULL)))
+		goto cond_failed;
+
+	queue->head->next = NULL;
+	queue->head->count = 0;
+	queue->destroy = destroy;
+	queue->spare = NULL;
+	queue->closed = 0;
+	queue->index = 0;
+	queue->waiters = 0;
+
+	return queue;
+
+cond_failed:
+	pthread_mutex_destroy(&queue->head_lock);
+mutex2_failed:
+	pthread_mutex_destroy(&queue->tail_lock);
+mutex_failed:
+	mem_release(queue->head);
+	mem_release(queue);
+
+	return set_errnull(err);
+}
+
+/*
+
+C<static int queue_take(Queue *queue, void **item)>
+
+Removes the item at the start of C<queue> and stores it in C<*item>.
+Segments that have been emptied are kept for reuse (one at a time) or
+deallocated. Must be called with C<queue>'s consumer lock held. Returns C<1>
+if there was an item, or C<0> if C<queue> is empty.
+
+*/
+
+static int queue_take(Queue *queue, void **item)
+{
+	QueueSegment *head, *next;
+
+	queue_enter();
+
+	for (head = queue->head;; head = next)
+	{
+		if (queue->index < queue_atomic_load(head->count))
+		{
+			*item = head->item[queue->index++];
+			queue_leave();
+			return 1;
+		}
+
+		if (queue->index < QUEUE_SEGMENT || !(next = queue_atomic_load(head->next)))
+		{
+			queue_leave();
+			return 0;
+		}
+
+		queue->head = next;
+		queue->index = 0;
+		mem_release(queue_atomic_swap(queue->spare, head));
+	}
+}
+
+/*
+
+=item C<void queue_release(Queue *queue)>
+
+Releases (deallocates) C<queue>, destroying any items still in it if it was
+created with a destroy function. No other thread may be using C<queue>.
+
+=cut
+
+*/
+
+void queue_release(Queue *queue)
+{
+	QueueSegment *segment;
+	void *item;
+
+	if (!queue)
+		return;
+
+	while (queue_take(queue, &item))
+		if (queue->destroy)
+			queue->destroy(item);
+
+	while ((segment = queue->head))
+	{
+		queue->head = segment->next;
+		mem_release(segment);
+	}
+
+	mem_release(queue->spare);
+	pthread_cond_destroy(&queue->ready);
+	pthread_mutex_destroy(&queue->head_lock);
+	pthread_mutex_destroy(&queue->tail_lock);
+	mem_release(queue);
+}
+
+/*
+
+=item C<void *queue_destroy(Queue **queue)>
+
+Destroys (deallocates and sets to C<null>) C<*queue>. Returns C<null>.
+
+=cut
+
+*/
+
+void *queue_destroy(Queue **queue)
+{
+	if (queue && *queue)
+	{
+		queue_release(*queue);
+		*queue = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<int queue_push(Queue *queue, void *item)>
+
+Adds C<item> to the end of C<queue>, and wakes a consumer if any are
+waiting. On success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately (C<EPIPE> if C<queue> has been closed).
+
+=cut
+
+*/
+
+int queue_push(Queue *queue, void *item)
+{
+	QueueSegment *tail, *segment;
+	size_t count;
+	int err;
+
+	if (!queue)
+		return set_errno(EINVAL);
+
+	if ((err = pthread_mutex_lock(&queue->tail_lock)))
+		return set_errno(err);
+
+	if (queue->closed)
+	{
+		pthread_mutex_unlock(&queue->tail_lock);
+		return set_errno(EPIPE);
+	}
+
+	tail = queue->tail;
+	count = tail->count;
+
+	if (count == QUEUE_SEGMENT)
+	{
+		queue_enter();
+		segment = queue_atomic_swap(queue->spare, NULL);
+		queue_leave();
+
+		if (!segment && !(segment = mem_new(QueueSegment)))
+		{
+			pthread_mutex_unlock(&queue->tail_lock);
+			return -1;
+		}
+
+		segment->next = NULL;
+		segment->count = 0;
+
+		queue_enter();
+		queue_atomic_store(tail->next, segment);
+		queue_leave();
+
+		queue->tail = tail = segment;
+		count = 0;
+	}
+
+	tail->item[count] = item;
+
+	queue_enter();
+	queue_atomic_store(tail->count, count + 1);
+	queue_leave();
+
+	pthread_mutex_unlock(&queue->tail_lock);
+
+	if (queue_waiting(queue))
+	{
+		if ((err = pthread_mutex_lock(&queue->head_lock)))
+			return set_errno(err);
+
+		pthread_cond_signal(&queue->ready);
+		pthread_mutex_unlock(&queue->head_lock);
+	}
+
+	return 0;
+}
+
+/*
+
+=item C<int queue_pop(Queue *queue, void **item)>
+
+Removes the item at the start of C<queue> and stores it in C<*item>, without
+waiting. On success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately (C<EAGAIN> if C<queue> is empty).
+
+=cut
+
+*/
+
+int queue_pop(Queue *queue, void **item)
+{
+	int err, found;
+
+	if (!queue || !item)
+		return set_errno(EINVAL);
+
+	if ((err = pthread_mutex_lock(&queue->head_lock)))
+		return set_errno(err);
+
+	found = queue_take(queue, item);
+	pthread_mutex_unlock(&queue->head_lock);
+
+	return (found) ? 0 : set_errno(EAGAIN);
+}
+
+/*
+
+C<static int queue_wait_until(Queue *queue, void **item, const struct timespec *deadline)>
+
+Removes the item at the start of C<queue> and stores it in C<*item>,
+waiting until C<deadline> (or forever if C<deadline> is C<null>) for one to
+be pushed if necessary. A waiting consumer is counted in C<queue>'s
+C<waiters> before it checks for an item for the last time, and a producer
+checks C<waiters> after it has stored its item, with a full memory barrier
+between the store and the load on both sides. So either the consumer sees
+the item or the producer sees the consumer and wakes it. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set appropriately
+(C<EPIPE> if C<queue> is closed and empty, C<ETIMEDOUT> if the deadline
+passed).
+
+*/
+
+static int queue_wait_until(Queue *queue, void **item, const struct timespec *deadline)
+{
+	int err, closed;
+
+	if (!queue || !item)
+		return set_errno(EINVAL);
+
+	if ((err = pthread_mutex_lock(&queue->head_lock)))
+		return set_errno(err);
+
+	if (queue_take(queue, item))
+	{
+		pthread_mutex_unlock(&queue->head_lock);
+		return 0;
+	}
+
+	queue_atomic_store(queue->waiters, queue->waiters + 1);
+	queue_atomic_fence();
+
+	for (;;)
+	{
+		closed = queue_atomic_load(queue->closed);
+
+		if (queue_take(queue, item))
+		{
+			err = 0;
+			break;
+		}
+
+		if (closed)
+		{
+			err = EPIPE;
+			break;
+		}
+
+		if (err)
+			break;
+
+		err = (deadline) ? pthread_cond_timedwait(&queue->ready, &queue->head_lock, deadline) : pthread_cond_wait(&queue->ready, &queue->head_lock);
+	}
+
+	queue_atomic_store(queue->waiters, queue->waiters - 1);
+	pthread_mutex_unlock(&queue->head_lock);
+
+	return (err) ? set_errno(err) : 0;
+}
+
+/*
+
+=item C<int queue_wait(Queue *queue, void **item)>
+
+Removes the item at the start of C<queue> and stores it in C<*item>,
+waiting for one to be pushed if C<queue> is empty. On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately (C<EPIPE> if
+C<queue> has been closed and is empty).
+
+=cut
+
+*/
+
+int queue_wait(Queue *queue, void **item)
+{
+	return queue_wait_until(queue, item, NULL);
+}
+
+/*
+
+=item C<int queue_timedwait(Queue *queue, void **item, long sec, long usec)>
+
+Equivalent to I<queue_wait(3)> except that it gives up waiting after C<sec>
+seconds and C<usec> microseconds, returning C<-1> with C<errno> set to
+C<ETIMEDOUT>.
+
+=cut
+
+*/
+
+int queue_timedwait(Queue *queue, void **item, long sec, long usec)
+{
+	struct timespec deadline[1];
+
+	if (sec < 0 || usec < 0)
+		return set_errno(EINVAL);
+
+	if (clock_gettime(CLOCK_REALTIME, deadline) == -1)
+		return -1;
+
+	deadline->tv_sec += sec + usec / 1000000;
+	deadline->tv_nsec += (usec % 1000000) * 1000;
+
+	if (deadline->tv_nsec >= 1000000000)
+	{
+		deadline->tv_sec += 1;
+		deadline->tv_nsec -= 1000000000;
+	}
+
+	return queue_wait_until(queue, item, deadline);
+}
+
+/*
+
+=item C<int queue_close(Queue *queue)>
+
+Marks C<queue> as closed, so that no more items can be pushed, and wakes
+all waiting consumers. Consumers still receive the items that are already
+in C<queue>, after which I<queue_wait(3)> and I<queue_timedwait(3)> fail
+with C<EPIPE> rather than waiting. On success, returns C<0>. On error,
+returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int queue_close(Queue *queue)
+{
+	int err;
+
+	if (!queue)
+		return set_errno(EINVAL);
+
+	if ((err = pthread_mutex_lock(&queue->tail_lock)))
+		return set_errno(err);
+
+	queue_atomic_store(queue->closed, 1);
+	pthread_mutex_unlock(&queue->tail_lock);
+
+	if ((err = pthread_mutex_lock(&queue->head_lock)))
+		return set_errno(err);
+
+	pthread_cond_broadcast(&queue->ready);
+	pthread_mutex_unlock(&queue->head_lock);
+
+	return 0;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments are C<null> or out of range.
+
+=item C<EAGAIN>
+
+When I<ring_push(3)> finds the ring full, or when I<ring_pop(3)> or
+I<queue_pop(3)> find the ring or queue empty.
+
+=item C<EPIPE>
+
+When I<queue_push(3)> is called after I<queue_close(3)>, or when
+I<queue_wait(3)> or I<queue_timedwait(3)> find the queue closed and empty.
+
+=item C<ETIMEDOUT>
+
+When I<queue_timedwait(3)> times out.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Safe>
+
+=head1 EXAMPLES
+
+A spool scanner handing files to a pool of worker threads:
+
+    #include <slack/std.h>
+    #include <slack/queue.h>
+
+    #define WORKERS 4
+
+    static void *worker(void *arg)
+    {
+        Queue *queue = arg;
+        void *path;
+
+        while (queue_wait(queue, &path) == 0)
+        {
+            printf("sending %s\n", (char *)path);
+            free(path);
+        }
+
+        return NULL;
+    }
+
+    int main(int ac, char **av)
+    {
+        pthread_t id[WORKERS];
+        Queue *queue;
+        int i;
+
+        if (!(queue = queue_create(free)))
+            return EXIT_FAILURE;
+
+        for (i = 0; i < WORKERS; ++i)
+            pthread_create(id + i, NULL, worker, queue);
+
+        for (i = 1; i < ac; ++i)
+            queue_push(queue, mem_strdup(av[i]));
+
+        queue_close(queue);
+
+        for (i = 0; i < WORKERS; ++i)
+            pthread_join(id[i], NULL);
+
+        queue_destroy(&queue);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<list(3)>,
+I<locker(3)>
+
+=head1 AUTHOR
+
+20230330 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#include <sched.h>
+
+#include "list.h"
+#include "locker.h"
+
+#define TEST_THREADS 4
+#define TEST_ITEMS 100000
+
+typedef struct TestThread TestThread;
+
+struct TestThread
+{
+	Ring *ring;                   /* the ring, if testing a Ring */
+	Queue *queue;                 /* the queue, if testing a Queue */
+	List *list;                   /* the list, if benchmarking a locked List */
+	long id;                      /* thread number */
+	long items;                   /* number of items to push or pop */
+	long last[TEST_THREADS];      /* last item received from each producer */
+	long received;                /* number of items received */
+	int errors;                   /* number of errors */
+};
+
+static int destroyed = 0;
+
+static void destroy_counted(void *item)
+{
+	++destroyed;
+}
+
+/* Items encode the producer and a sequence number starting at 1 */
+
+#define test_item(id, i) ((void *)((id) * TEST_ITEMS * 16L + (i)))
+#define test_item_id(item) ((long)(item) / (TEST_ITEMS * 16L))
+#define test_item_seq(item) ((long)(item) % (TEST_ITEMS * 16L))
+
+static void *produce(void *arg)
+{
+	TestThread *test = arg;
+	long i;
+
+	for (i = 1; i <= test->items; ++i)
+	{
+		void *item = test_item(test->id, i);
+
+		if (test->ring)
+		{
+			while (ring_push(test->ring, item) == -1)
+				if (errno == EAGAIN)
+					sched_yield();
+				else
+				{
+					++test->errors;
+					break;
+				}
+		}
+		else if (test->queue)
+		{
+			if (queue_push(test->queue, item) == -1)
+				++test->errors;
+		}
+		else if (!list_append(test->list, item))
+			++test->errors;
+	}
+
+	return NULL;
+}
+
+/* Consumers check that each producer's items arrive in order */
+
+static void receive(TestThread *test, void *item)
+{
+	long id = test_item_id(item), seq = test_item_seq(item);
+
+	if (id < 0 || id >= TEST_THREADS || seq <= test->last[id])
+		++test->errors;
+	else
+		test->last[id] = seq;
+
+	++test->received;
+}
+
+static void *consume(void *arg)
+{
+	TestThread *test = arg;
+	void *item;
+
+	if (test->queue)
+	{
+		while (queue_wait(test->queue, &item) == 0)
+			receive(test, item);
+
+		if (errno != EPIPE)
+			++test->errors;
+	}
+	else
+	{
+		while (test->received < test->items)
+		{
+			if (test->ring)
+			{
+				if (ring_pop(test->ring, &item) == -1)
+				{
+					sched_yield();
+					continue;
+				}
+			}
+			else if (!(item = list_shift(test->list)))
+			{
+				sched_yield();
+				continue;
+			}
+
+			receive(test, item);
+		}
+	}
+
+	return NULL;
+}
+
+/* Runs producers and consumers over a Ring, Queue or List, and returns the seconds taken */
+
+static double run(Ring *ring, Queue *queue, List *list, int producers, int consumers, long items, int *errors, long *received)
+{
+	pthread_t pid[TEST_THREADS], cid[TEST_THREADS];
+	TestThread ptest[TEST_THREADS], ctest[TEST_THREADS];
+	struct timespec start[1], end[1];
+	int i, j;
+
+	clock_gettime(CLOCK_MONOTONIC, start);
+
+	for (i = 0; i < consumers; ++i)
+	{
+		ctest[i].ring = ring;
+		ctest[i].queue = queue;
+		ctest[i].list = list;
+		ctest[i].id = i;
+		ctest[i].items = items * producers / consumers;
+		ctest[i].received = 0;
+		ctest[i].errors = 0;
+		for (j = 0; j < TEST_THREADS; ++j)
+			ctest[i].last[j] = 0;
+		pthread_create(cid + i, NULL, consume, ctest + i);
+	}
+
+	for (i = 0; i < producers; ++i)
+	{
+		ptest[i].ring = ring;
+		ptest[i].queue = queue;
+		ptest[i].list = list;
+		ptest[i].id = i;
+		ptest[i].items = items;
+		ptest[i].errors = 0;
+		pthread_create(pid + i, NULL, produce, ptest + i);
+	}
+
+	for (i = 0; i < producers; ++i)
+	{
+		pthread_join(pid[i], NULL);
+		*errors += ptest[i].errors;
+	}
+
+	if (queue)
+		queue_close(queue);
+
+	*received = 0;
+
+	for (i = 0; i < consumers; ++i)
+	{
+		pthread_join(cid[i], NULL);
+		*errors += ctest[i].errors;
+		*received += ctest[i].received;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, end);
+
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+
+Compares the throughput of a Ring, a Queue, and a List protected by a mutex
+Locker, with 1 producer and 1 consumer, and with 4 producers and 4
+consumers.
+
+*/
+
+static void bench(void)
+{
+	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	Locker *locker;
+	Ring *ring;
+	Queue *queue;
+	List *list;
+	long received;
+	int threads, errors = 0;
+
+	printf("%7s %10s %10s %10s (Mitems/s, %d items per producer)\n", "threads", "ring", "queue", "list", TEST_ITEMS);
+
+	for (threads = 1; threads <= TEST_THREADS; threads *= TEST_THREADS)
+	{
+		double secs[3];
+
+		ring = ring_create(1024, NULL);
+		secs[0] = run(ring, NULL, NULL, threads, threads, TEST_ITEMS, &errors, &received);
+		ring_destroy(&ring);
+
+		queue = queue_create(NULL);
+		secs[1] = run(NULL, queue, NULL, threads, threads, TEST_ITEMS, &errors, &received);
+		queue_destroy(&queue);
+
+		locker = locker_create_mutex(&mutex);
+		list = list_create_with_locker(locker, NULL);
+		secs[2] = run(NULL, NULL, list, threads, threads, TEST_ITEMS, &errors, &received);
+		list_destroy(&list);
+		locker_destroy(&locker);
+
+		printf("%3dx%-3d %10.2f %10.2f %10.2f\n", threads, threads, threads * TEST_ITEMS / secs[0] / 1e6, threads * TEST_ITEMS / secs[1] / 1e6, threads * TEST_ITEMS / secs[2] / 1e6);
+	}
+
+	if (errors)
+		printf("%d errors\n", errors);
+
+	exit((errors) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+#define TEST_ACT(i, action) \
+	if (!(action)) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_INT_ACT(i, action) \
+	if ((action) == -1) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_EQ(i, action, value) \
+	if ((val = (long)(action)) != (long)(value)) \
+		++errors, printf("Test%d: %s failed (returned %ld, not %ld)\n", (i), (#action), val, (long)(value));
+
+#define TEST_ERR(i, action, err) \
+	if ((action) != -1 || errno != (err)) \
+		++errors, printf("Test%d: %s failed (errno %d, not %s)\n", (i), (#action), errno, (#err));
+
+int main(int ac, char **av)
+{
+	Ring *ring;
+	Queue *queue;
+	void *item;
+	long i, val, received;
+	int errors = 0, run_errors;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s [bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench();
+
+	printf("Testing: %s\n", "queue");
+
+	/* Test ring_create, ring_push, ring_pop, ring_size, ring_length */
+
+	TEST_ACT(1, ring = ring_create(3, NULL))
+	else
+	{
+		TEST_EQ(2, ring_size(ring), 4)
+		TEST_EQ(3, ring_length(ring), 0)
+		TEST_ERR(4, ring_pop(ring, &item), EAGAIN)
+
+		for (i = 1; i <= 4; ++i)
+			TEST_INT_ACT(5, ring_push(ring, (void *)i))
+
+		TEST_ERR(6, ring_push(ring, (void *)5L), EAGAIN)
+		TEST_EQ(7, ring_length(ring), 4)
+
+		for (i = 1; i <= 4; ++i)
+		{
+			item = NULL;
+			TEST_INT_ACT(8, ring_pop(ring, &item))
+			TEST_EQ(8, item, i)
+		}
+
+		TEST_ERR(9, ring_pop(ring, &item), EAGAIN)
+
+		/* Wrap around many times */
+
+		for (i = 1; i <= 1000; ++i)
+		{
+			item = NULL;
+			TEST_INT_ACT(10, ring_push(ring, (void *)i))
+			TEST_INT_ACT(10, ring_pop(ring, &item))
+			TEST_EQ(10, item, i)
+		}
+
+		TEST_EQ(11, ring_length(ring), 0)
+		ring_destroy(&ring);
+		if (ring)
+			++errors, printf("Test12: ring_destroy(&ring) failed (%p, not NULL)\n", (void *)ring);
+	}
+
+	TEST_ACT(13, ring = ring_create(8, destroy_counted))
+	else
+	{
+		destroyed = 0;
+		for (i = 1; i <= 5; ++i)
+			TEST_INT_ACT(13, ring_push(ring, (void *)i))
+		TEST_INT_ACT(13, ring_pop(ring, &item))
+		ring_destroy(&ring);
+		TEST_EQ(14, destroyed, 4)
+	}
+
+	if ((ring = ring_create(0, NULL)) || errno != EINVAL)
+		++errors, printf("Test15: ring_create(0) failed (errno %d, not EINVAL)\n", errno);
+
+	/* Test queue_create, queue_push, queue_pop over several segments */
+
+	TEST_ACT(16, queue = queue_create(NULL))
+	else
+	{
+		TEST_ERR(17, queue_pop(queue, &item), EAGAIN)
+
+		for (i = 1; i <= 1000; ++i)
+			TEST_INT_ACT(18, queue_push(queue, (void *)i))
+
+		for (i = 1; i <= 1000; ++i)
+		{
+			item = NULL;
+			TEST_INT_ACT(19, queue_pop(queue, &item))
+			TEST_EQ(19, item, i)
+		}
+
+		TEST_ERR(20, queue_pop(queue, &item), EAGAIN)
+
+		/* Interleaved pushes and pops across segment boundaries */
+
+		for (i = 1; i <= 2000; ++i)
+		{
+			TEST_INT_ACT(21, queue_push(queue, (void *)i))
+			TEST_INT_ACT(21, queue_push(queue, (void *)-i))
+			TEST_INT_ACT(21, queue_pop(queue, &item))
+			TEST_EQ(21, item, (i & 1) ? (i + 1) / 2 : -(i / 2))
+		}
+
+		TEST_INT_ACT(22, queue_timedwait(queue, &item, 0, 0))
+		TEST_EQ(22, item, 1001)
+
+		queue_destroy(&queue);
+		if (queue)
+			++errors, printf("Test23: queue_destroy(&queue) failed (%p, not NULL)\n", (void *)queue);
+	}
+
+	/* Test queue_timedwait, queue_close */
+
+	TEST_ACT(24, queue = queue_create(destroy_counted))
+	else
+	{
+		TEST_ERR(25, queue_timedwait(queue, &item, 0, 10000), ETIMEDOUT)
+		TEST_INT_ACT(26, queue_push(queue, (void *)1L))
+		TEST_INT_ACT(26, queue_push(queue, (void *)2L))
+		TEST_INT_ACT(26, queue_push(queue, (void *)3L))
+		TEST_INT_ACT(27, queue_timedwait(queue, &item, 0, 10000))
+		TEST_EQ(27, item, 1)
+		TEST_INT_ACT(28, queue_close(queue))
+		TEST_ERR(29, queue_push(queue, (void *)4L), EPIPE)
+		TEST_INT_ACT(30, queue_wait(queue, &item))
+		TEST_EQ(30, item, 2)
+		destroyed = 0;
+		queue_destroy(&queue);
+		TEST_EQ(31, destroyed, 1)
+	}
+
+	/* Test multiple producers and consumers */
+
+	TEST_ACT(32, ring = ring_create(64, NULL))
+	else
+	{
+		run_errors = 0;
+		run(ring, NULL, NULL, TEST_THREADS, TEST_THREADS, TEST_ITEMS, &run_errors, &received);
+		TEST_EQ(33, run_errors, 0)
+		TEST_EQ(34, received, TEST_THREADS * TEST_ITEMS)
+		TEST_EQ(35, ring_length(ring), 0)
+		ring_destroy(&ring);
+	}
+
+	TEST_ACT(36, queue = queue_create(NULL))
+	else
+	{
+		run_errors = 0;
+		run(NULL, queue, NULL, TEST_THREADS, TEST_THREADS, TEST_ITEMS, &run_errors, &received);
+		TEST_EQ(37, run_errors, 0)
+		TEST_EQ(38, received, TEST_THREADS * TEST_ITEMS)
+		TEST_ERR(39, queue_pop(queue, &item), EAGAIN)
+		queue_destroy(&queue);
+	}
+
+	if (errors)
+		printf("%d/39 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -31,7 +31,7 @@ $(SLACK_TARGET): $(SLACK_OFILES)
 	$(AR) cr $(SLACK_TARGET) $(SLACK_OFILES)
 	$(RANLIB) $(SLACK_TARGET)
 
-.PHONY: ready-slack test-slack man-slack html-slack
+.PHONY: ready-slack test-slack bench-slack man-slack html-slack
 
 ready-slack:
 	@[ -h $(SLACK_INCLINK) ] || ln -s . $(SLACK_INCLINK)
@@ -39,6 +39,9 @@ ready-slack:
 test-slack: $(SLACK_TESTS)
 	@cd $(SLACK_TESTDIR); for test in $(patsubst $(SLACK_TESTDIR)/%, %, $(SLACK_TESTS)); do echo; ./$$test; done
 
+bench-slack: $(SLACK_BENCH)
+	@cd $(SLACK_TESTDIR); ./bench
+
 man-slack: $(SLACK_LIB_MANFILES) $(SLACK_APP_MANFILES)
 
 html-slack: $(SLACK_LIB_HTMLFILES) $(SLACK_APP_HTMLFILES)
@@ -509,6 +512,7 @@ help::
 	echo " uninstall-slack-man   -- uninstalls $(SLACK_NAME) manpages from $(DESTDIR)$(LIB_MANDIR)"; \
 	echo " uninstall-slack-html  -- uninstalls $(SLACK_NAME) html manpages from $(DESTDIR)$(SLACK_HTMLDIR)"; \
 	echo " test-slack            -- makes and runs library unit tests"; \
+	echo " bench-slack           -- makes and runs library microbenchmarks"; \
 	echo " dist-slack            -- makes a source tarball for libslack"; \
 	echo " dist-html-slack       -- makes a tarball of libslack's html manpages"; \
 	echo " rpm-slack             -- makes binary and source rpm packages for libslack"; \
@@ -550,6 +554,7 @@ help-macros::
 	echo "SLACK_RPM_FILES = $(SLACK_RPM_FILES)"; \
 	echo "SLACK_RPM_DOCFILES = $(SLACK_RPM_DOCFILES)"; \
 	echo "SLACK_TESTS = $(SLACK_TESTS)"; \
+	echo "SLACK_BENCH = $(SLACK_BENCH)"; \
 	echo "SLACK_DEFINES = $(SLACK_DEFINES)"; \
 	echo "SLACK_CPPFLAGS = $(SLACK_CPPFLAGS)"; \
 	echo "SLACK_CCFLAGS = $(SLACK_CCFLAGS)"; \
@@ -572,6 +577,10 @@ distclean::
 $(SLACK_SRCDIR)/%.o: $(SLACK_SRCDIR)/%.c
 	$(CC) $(SLACK_CFLAGS) -o $@ -c $<
 
+$(SLACK_BENCH): $(SLACK_SRCDIR)/bench.c $(SLACK_TARGET)
+	@[ -d $(SLACK_TESTDIR) ] || mkdir $(SLACK_TESTDIR) 2>/dev/null || [ -d $(SLACK_TESTDIR) ]
+	$(CC) $(SLACK_CFLAGS) -o $@ $< $(SLACK_TEST_LDFLAGS)
+
 $(SLACK_TESTDIR)/%: $(SLACK_SRCDIR)/%.c $(SLACK_TARGET)
 	@[ -d $(SLACK_TESTDIR) ] || mkdir $(SLACK_TESTDIR) 2>/dev/null || [ -d $(SLACK_TESTDIR) ]
 	$(CC) -DTEST $(SLACK_TEST_CFLAGS) -o $@ $< $(SLACK_TEST_LDFLAGS)
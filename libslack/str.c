@@ -91,6 +91,8 @@ I<libslack(str)> - string module
     String *str_create_with_locker_sized(Locker *locker, size_t size, const char *format, ...);
     String *str_vcreate_sized(size_t size, const char *format, va_list args);
     String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *format, va_list args);
+    String *str_create_in(Pool *pool, const char *format, ...);
+    String *str_vcreate_in(Pool *pool, const char *format, va_list args);
     String *str_copy(const String *str);
     String *str_copy_unlocked(const String *str);
     String *str_copy_with_locker(Locker *locker, const String *str);
@@ -330,19 +332,35 @@ operators in I<perlfunc(1)> and I<perlop(1)>. Others came from I<OpenBSD>.
 #include "str.h"
 #include "mem.h"
 #include "fio.h"
+#include "cache.h"
 
 #ifndef HAVE_SNPRINTF
 #include "snprintf.h"
 #endif
 
+/* Bytes stored inside the String itself before spilling onto the heap */
+
+#ifndef STR_INLINE_SIZE
+#define STR_INLINE_SIZE 24
+#endif
+
 struct String
 {
-	size_t size;    /* number of bytes allocated */
-	size_t length;  /* number of bytes used (including nul) */
-	char *str;      /* vector of characters */
-	Locker *locker; /* locking strategy for this string */
+	size_t size;                /* number of bytes allocated */
+	size_t length;              /* number of bytes used (including nul) */
+	char *str;                  /* vector of characters (buf or heap) */
+	Locker *locker;             /* locking strategy for this string */
+	Pool *pool;                 /* pool the string lives in, if any */
+	char buf[STR_INLINE_SIZE];  /* storage for short strings */
 };
 
+#define str_is_inline(s) ((s)->str == (s)->buf)
+
+/* String headers (not in pools) are recycled by a size class object cache */
+
+#define string_alloc() ((String *)cache_alloc(cache_class(sizeof(String))))
+#define string_free(str) cache_free(cache_class(sizeof(String)), (str))
+
 #define CHARSET 256
 
 struct StringTR
@@ -392,26 +410,49 @@ void (funlockfile)(FILE *stream);
 C<int grow(String *str, size_t bytes)>
 
 Allocates enough memory to add C<bytes> extra bytes to C<str> if necessary.
-On success, returns C<0>. On error, returns C<-1>.
+When C<str> outgrows its inline buffer, its contents are moved onto the
+heap (or into its pool). On success, returns C<0>. On error, returns C<-1>.
 
 */
 
 static int grow(String *str, size_t bytes)
 {
-	int grown = 0;
+	size_t size = (str_is_inline(str)) ? 0 : str->size;
+	char *heap;
+
+	if (str->length + bytes <= str->size)
+		return 0;
 
-	while (str->length + bytes > str->size)
+	while (str->length + bytes > size)
 	{
-		if (str->size)
-			str->size <<= 1;
+		if (size)
+			size <<= 1;
 		else
-			str->size = MIN_STRING_SIZE;
+			size = MIN_STRING_SIZE;
+	}
+
+	if (str->pool)
+	{
+		if (!(heap = pool_resize(str->pool, (str_is_inline(str)) ? NULL : str->str, (str_is_inline(str)) ? 0 : str->size, size)))
+			return -1;
 
-		grown = 1;
+		if (str_is_inline(str))
+			memcpy(heap, str->buf, str->length);
+
+		str->str = heap;
 	}
+	else if (str_is_inline(str))
+	{
+		if (!(heap = mem_create(size, char)))
+			return -1;
 
-	if (grown)
-		return mem_resize(&str->str, str->size) ? 0 : -1;
+		memcpy(heap, str->buf, str->length);
+		str->str = heap;
+	}
+	else if (!mem_resize(&str->str, size))
+		return -1;
+
+	str->size = size;
 
 	return 0;
 }
@@ -421,7 +462,7 @@ static int grow(String *str, size_t bytes)
 C<int shrink(String *str, size_t bytes)>
 
 Allocates less memory for removing C<bytes> bytes from C<str> if necessary.
-On success, returns C<0>. On error, returns C<-1>.
+Strings in their inline buffer or in a pool are left alone. On success, returns C<0>. On error, returns C<-1>.
 
 */
 
@@ -429,6 +470,9 @@ static int shrink(String *str, size_t bytes)
 {
 	int shrunk = 0;
 
+	if (str_is_inline(str) || str->pool)
+		return 0;
+
 	while (str->length - bytes < str->size >> 1)
 	{
 		if (str->size <= MIN_EMPTY_STRING_SIZE)
@@ -536,7 +580,7 @@ String *str_create(const char *format, ...)
 	String *str;
 	va_list args;
 	va_start(args, format);
-	str = str_vcreate_with_locker_sized(NULL, MIN_STRING_SIZE, format, args);
+	str = str_vcreate_with_locker_sized(NULL, STR_INLINE_SIZE, format, args);
 	va_end(args);
 	return str;
 }
@@ -557,7 +601,7 @@ String *str_create_with_locker(Locker *locker, const char *format, ...)
 	String *str;
 	va_list args;
 	va_start(args, format);
-	str = str_vcreate_with_locker_sized(locker, MIN_STRING_SIZE, format, args);
+	str = str_vcreate_with_locker_sized(locker, STR_INLINE_SIZE, format, args);
 	va_end(args);
 	return str;
 }
@@ -575,7 +619,7 @@ directly as for I<vprintf(3)>.
 
 String *str_vcreate(const char *format, va_list args)
 {
-	return str_vcreate_with_locker_sized(NULL, MIN_STRING_SIZE, format, args);
+	return str_vcreate_with_locker_sized(NULL, STR_INLINE_SIZE, format, args);
 }
 
 /*
@@ -591,7 +635,7 @@ new string will be synchronized by C<locker>.
 
 String *str_vcreate_with_locker(Locker *locker, const char *format, va_list args)
 {
-	return str_vcreate_with_locker_sized(locker, MIN_STRING_SIZE, format, args);
+	return str_vcreate_with_locker_sized(locker, STR_INLINE_SIZE, format, args);
 }
 
 /*
@@ -672,14 +716,55 @@ the new string will be synchronised by C<locker>.
 #define va_copy(dst, src) __va_copy((dst), (src))
 #endif
 
-String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *format, va_list args)
+/*
+
+C<String *str_vcreate_in_with_locker_sized(Pool *pool, Locker *locker, size_t size, const char *format, va_list args)>
+
+Creates a string as for I<str_vcreate_with_locker_sized(3)>. If C<pool> is
+not C<null>, the string and its contents are allocated from C<pool>.
+
+*/
+
+static String *str_vcreate_in_with_locker_sized(Pool *pool, Locker *locker, size_t size, const char *format, va_list args)
 {
 	String *str;
 	char *buf = NULL;
-	ssize_t length;
+	ssize_t length = -1;
+	size_t buf_size = 0;
 	unsigned int bit;
 	va_list args_copy;
 
+	if (!format)
+		format = "";
+
+	if (!(str = (pool) ? pool_new(pool, String) : string_alloc()))
+		return NULL;
+
+	str->locker = locker;
+	str->pool = pool;
+
+	/* Short strings live in the inline buffer (a single allocation) */
+
+	if (size <= STR_INLINE_SIZE)
+	{
+		va_copy(args_copy, args);
+		length = vsnprintf(str->buf, STR_INLINE_SIZE, format, args_copy);
+		va_end(args_copy);
+
+		if (length != -1 && length < STR_INLINE_SIZE)
+		{
+			str->size = STR_INLINE_SIZE;
+			str->length = length + 1;
+			str->str = str->buf;
+
+			return str;
+		}
+
+		/* vsnprintf() told us how much space is needed (unless it's old) */
+
+		size = (length == -1) ? MIN_STRING_SIZE : length + 1;
+	}
+
 	for (bit = 1; bit; bit <<= 1)
 	{
 		if (bit >= size)
@@ -690,16 +775,28 @@ String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *f
 	}
 
 	if (!bit)
+	{
+		if (!pool)
+			string_free(str);
 		return set_errnull(EINVAL);
-
-	if (!format)
-		format = "";
+	}
 
 	for (;; size <<= 1)
 	{
-		if (!mem_resize(&buf, size))
+		if (pool)
+		{
+			char *resized;
+
+			if (!(resized = pool_resize(pool, buf, buf_size, size)))
+				return NULL;
+
+			buf = resized;
+			buf_size = size;
+		}
+		else if (!mem_resize(&buf, size))
 		{
 			mem_release(buf);
+			string_free(str);
 			return NULL;
 		}
 
@@ -714,20 +811,66 @@ String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *f
 			break;
 	}
 
-	if (!(str = mem_new(String))) /* XXX decouple */
-	{
-		mem_release(buf);
-		return NULL;
-	}
-
 	str->size = size;
 	str->length = length + 1;
 	str->str = buf;
-	str->locker = locker;
 
 	return str;
 }
 
+String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *format, va_list args)
+{
+	return str_vcreate_in_with_locker_sized(NULL, locker, size, format, args);
+}
+
+/*
+
+=item C<String *str_create_in(Pool *pool, const char *format, ...)>
+
+Equivalent to I<str_create(3)> except that the new string, and any memory it
+needs as it grows, are allocated from C<pool> (preferably one created with
+I<pool_create_growable(3)>). Such strings can still be passed to
+I<str_release(3)> or I<str_destroy(3)> (e.g. as a list's item destructor),
+but their memory is only reclaimed when C<pool> is cleared or released, at
+which point the string must no longer be used. This makes it possible to
+free a whole working set of strings with a single I<pool_clear(3)>. Strings
+created from a pool string (e.g. by I<str_copy(3)> or I<str_split(3)>) are
+allocated normally, not from the pool. On error, returns C<null> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+String *str_create_in(Pool *pool, const char *format, ...)
+{
+	String *str;
+	va_list args;
+	va_start(args, format);
+	str = str_vcreate_in(pool, format, args);
+	va_end(args);
+	return str;
+}
+
+/*
+
+=item C<String *str_vcreate_in(Pool *pool, const char *format, va_list args)>
+
+Equivalent to I<str_create_in(3)> with the variable argument list specified
+directly as for I<vprintf(3)>.
+
+=cut
+
+*/
+
+String *str_vcreate_in(Pool *pool, const char *format, va_list args)
+{
+	if (!pool)
+		return set_errnull(EINVAL);
+
+	return str_vcreate_in_with_locker_sized(pool, NULL, STR_INLINE_SIZE, format, args);
+}
+
 /*
 
 =item C<String *str_copy(const String *str)>
@@ -864,7 +1007,8 @@ String *str_fgetline_with_locker(Locker *locker, FILE *stream)
 
 =item C<void str_release(String *str)>
 
-Releases (deallocates) C<str>.
+Releases (deallocates) C<str>. The memory of strings created with
+I<str_create_in(3)> is left for their pool to reclaim.
 
 =cut
 
@@ -881,8 +1025,12 @@ void str_release(String *str)
 		return;
 
 	locker = str->locker;
-	mem_release(str->str);
-	mem_release(str);
+	if (!str->pool)
+	{
+		if (!str_is_inline(str))
+			mem_release(str->str);
+		string_free(str);
+	}
 	locker_unlock(locker);
 }
 
@@ -6869,7 +7017,10 @@ int vasprintf(char **str, const char *format, va_list args)
 	String *tmp;
 	int len;
 
-	if (!(tmp = str_vcreate(format, args)))
+	/* Not str_vcreate(): the data must be on the heap so it can be taken */
+	/* (strings sized past STR_INLINE_SIZE never use the inline buffer) */
+
+	if (!(tmp = str_vcreate_sized((MIN_STRING_SIZE > STR_INLINE_SIZE) ? MIN_STRING_SIZE : STR_INLINE_SIZE + 1, format, args)))
 	{
 		*str = NULL;
 		return -1;
@@ -6878,7 +7029,7 @@ int vasprintf(char **str, const char *format, va_list args)
 	if (str)
 		*str = cstr(tmp);
 	len = str_length(tmp);
-	free(tmp);
+	string_free(tmp);
 
 	return len;
 }
@@ -8078,6 +8229,36 @@ void mt_test(int test, Locker *locker)
 	}
 }
 
+static void bench(void)
+{
+	const int iterations = 200000;
+	const char *addrs[] = { "a@b.org", "raf@raf.org", "postmaster@example.com", "some.longer.name@mail.example.org" };
+	clock_t start;
+	double secs;
+	int i, j;
+
+	for (j = 0; j < 4; ++j)
+	{
+		start = clock();
+
+		for (i = 0; i < iterations; ++i)
+		{
+			List *addrlist = list_create((list_release_t *)str_release);
+			int k;
+
+			for (k = 0; k < 8; ++k)
+				list_append(addrlist, str_create("%s", addrs[j]));
+
+			list_release(addrlist);
+		}
+
+		secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+		printf("%-40s %8.1f ns/address\n", addrs[j], secs * 1e9 / (iterations * 8));
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
 int main(int ac, char **av)
 {
 	const char * const testfile = "str_fgetline.test";
@@ -8093,10 +8274,13 @@ int main(int ac, char **av)
 
 	if (ac == 2 && !strcmp(av[1], "help"))
 	{
-		printf("usage: %s [debug]\n", *av);
+		printf("usage: %s [debug|bench]\n", *av);
 		return EXIT_SUCCESS;
 	}
 
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench();
+
 	printf("Testing: %s\n", "str");
 
 #define TEST_ACT(i, action) \
@@ -9702,8 +9886,55 @@ int main(int ac, char **av)
 		locker_destroy(&locker);
 	}
 
+	/* Test growing strings out of the inline buffer */
+
+	TEST_ACT(758, a = str_create("%s", "0123456789"))
+	TEST_ACT(758, str_is_inline(a))
+	TEST_ACT(759, str_append(a, "%s", "0123456789abcdefghij"))
+	TEST_ACT(759, !str_is_inline(a))
+	CHECK_STR(759, str_append(), a, 30, "0123456789" "0123456789abcdefghij")
+	TEST_ACT(760, str_prepend(a, "%s", "<"))
+	CHECK_STR(760, str_prepend(), a, 31, "<0123456789" "0123456789abcdefghij")
+	str_destroy(&a);
+	TEST_ACT(761, a = str_create("%s", "x"))
+	TEST_ACT(761, str_clear(a) == a)
+	for (i = 0; i < 100; ++i)
+		str_append(a, "%c", 'a' + i % 26);
+	TEST_ACT(761, str_length(a) == 100 && !str_is_inline(a))
+	str_destroy(&a);
+
+	/* Test str_create_in() */
+
+	{
+		Pool *pool;
+
+		TEST_ACT(762, !str_create_in(NULL, "abc"))
+		TEST_ACT(763, pool = pool_create_growable(64))
+		if (pool)
+		{
+			TEST_ACT(764, a = str_create_in(pool, "%s", "short"))
+			CHECK_STR(764, str_create_in(), a, 5, "short")
+			TEST_ACT(765, b = str_create_in(pool, "%s", "a string that's too long for the inline buffer"))
+			CHECK_STR(765, str_create_in(), b, 46, "a string that's too long for the inline buffer")
+			for (i = 0; i < 100; ++i)
+				str_append(a, "%d", i % 10);
+			TEST_ACT(766, str_length(a) == 105 && !str_is_inline(a))
+			TEST_ACT(766, !strncmp(cstr(a), "short0123456789", 15))
+			TEST_ACT(767, str_remove_range(a, 5, 100))
+			CHECK_STR(767, str_remove_range(), a, 5, "short")
+			TEST_ACT(768, list = list_create_in(pool, (list_release_t *)str_release))
+			if (list)
+			{
+				TEST_ACT(768, list_append(list, a))
+				TEST_ACT(768, list_append(list, b))
+				list_destroy(&list);
+			}
+			pool_destroy(&pool);
+		}
+	}
+
 	if (errors)
-		printf("%d/757 tests failed\n", errors);
+		printf("%d/768 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
@@ -30,6 +30,7 @@
 #include <slack/hdr.h>
 #include <slack/list.h>
 #include <slack/locker.h>
+#include <slack/mem.h>
 
 typedef struct String String;
 typedef struct StringTR StringTR;
@@ -62,6 +63,8 @@ String *str_create_sized(size_t size, const char *format, ...);
 String *str_create_with_locker_sized(Locker *locker, size_t size, const char *format, ...);
 String *str_vcreate_sized(size_t size, const char *format, va_list args);
 String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *format, va_list args);
+String *str_create_in(Pool *pool, const char *format, ...);
+String *str_vcreate_in(Pool *pool, const char *format, va_list args);
 String *str_copy(const String *str);
 String *str_copy_unlocked(const String *str);
 String *str_copy_with_locker(Locker *locker, const String *str);
@@ -0,0 +1,99 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<decode-trace> - format the debug messages in libslack trace files
+
+=head1 SYNOPSIS
+
+    decode-trace [trace-file...]
+
+=head1 DESCRIPTION
+
+The I<trace(3)> module of I<libslack(3)> records debug messages in binary
+trace files rather than formatting them as they happen. Each message's
+format string, arguments, level, time and thread number are recorded. This
+program formats the messages in each trace file on the command line (or
+standard input, if there are none) and writes them to standard output, one
+per line, preceded by the time that they were recorded and the number of
+the thread that recorded them. The output can be sorted by time with
+I<sort(1)>.
+
+Trace files must be decoded on a host with the same byte order and type
+sizes as the host that recorded them.
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<trace(3)>,
+I<prog(3)>
+
+=head1 AUTHOR
+
+20230330 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#include <slack/std.h>
+#include <slack/prog.h>
+#include <slack/err.h>
+#include <slack/trace.h>
+
+#include <fcntl.h>
+
+int main(int ac, char **av)
+{
+	int errors = 0;
+	int a, fd;
+
+	prog_init();
+	prog_set_name("decode-trace");
+
+	if (ac == 1 && trace_decode(STDIN_FILENO, prog_out()) == -1)
+		fatalsys("failed to decode standard input");
+
+	for (a = 1; a < ac; ++a)
+	{
+		if ((fd = open(av[a], O_RDONLY)) == -1)
+		{
+			errorsys("failed to open %s", av[a]);
+			++errors;
+			continue;
+		}
+
+		if (trace_decode(fd, prog_out()) == -1)
+		{
+			errorsys("failed to decode %s", av[a]);
+			++errors;
+		}
+
+		close(fd);
+	}
+
+	return (errors) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,963 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<libslack(tpool)> - thread pool module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/tpool.h>
+
+    typedef struct ThreadPool ThreadPool;
+    typedef void tpool_task_t(size_t start, size_t end, void *data);
+
+    ThreadPool *tpool_create(int threads);
+    void tpool_release(ThreadPool *pool);
+    void *tpool_destroy(ThreadPool **pool);
+    int tpool_threads(const ThreadPool *pool);
+    int tpool_run(ThreadPool *pool, size_t n, size_t chunk, tpool_task_t *task, void *data);
+
+=head1 DESCRIPTION
+
+This module provides pools of worker threads for running data-parallel
+loops. I<tpool_run(3)> splits a range of indexes, C<0> to C<n - 1>, into
+chunks, and the pool's threads call a task function for each chunk. The
+thread that calls I<tpool_run(3)> works on the chunks as well, and it
+returns when every chunk is done.
+
+The range is first divided into one contiguous slice per thread, so that
+each thread starts with its own neighbouring items. Each thread claims
+chunks from the front of its own slice until it is empty, and then steals
+chunks from the other slices in turn, so threads that finish early take
+over the work of slower ones. A chunk is claimed by atomically advancing
+the start of its slice, so no lock is taken while the chunks are being
+processed. The worker threads only sleep and wake between calls to
+I<tpool_run(3)>.
+
+The chunks that each thread processes, and the order in which they are
+processed, are not predictable. Tasks that store the result for each index
+at that index (see I<list_map_parallel(3)>) produce the same results in the
+same order, no matter how many threads there are.
+
+If the compiler doesn't support atomic operations, chunks are claimed under
+a single mutex instead.
+
+=over 4
+
+=cut
+
+*/
+
+#include "config.h"
+#include "std.h"
+
+#include "tpool.h"
+#include "mem.h"
+#include "err.h"
+
+typedef struct TpoolSlice TpoolSlice;
+typedef struct TpoolJob TpoolJob;
+typedef struct TpoolWorker TpoolWorker;
+
+/* Padding that keeps each slice on its own cache line */
+
+#define TPOOL_LINE 64
+
+/* Largest number of threads in a pool */
+
+#define TPOOL_MAX 256
+
+/* Number of chunks per thread when the chunk size is chosen automatically */
+
+#define TPOOL_CHUNKS 8
+
+struct TpoolSlice
+{
+	size_t next;                  /* start of the next unclaimed chunk */
+	size_t end;                   /* end of the slice */
+	char pad[TPOOL_LINE - 2 * sizeof(size_t)];
+};
+
+struct TpoolJob
+{
+	tpool_task_t *task;           /* the task function */
+	void *data;                   /* the task function's data */
+	size_t chunk;                 /* most indexes in each chunk */
+	int slices;                   /* number of slices (one per thread) */
+	TpoolSlice *slice;            /* the slices */
+};
+
+struct TpoolWorker
+{
+	ThreadPool *pool;             /* the pool the worker belongs to */
+	pthread_t id;                 /* the worker's thread */
+	int index;                    /* the worker's own slice in each job */
+};
+
+struct ThreadPool
+{
+	int threads;                  /* number of threads, including the caller of tpool_run() */
+	int started;                  /* number of worker threads started */
+	TpoolWorker *worker;          /* the worker threads */
+	pthread_mutex_t run;          /* mutex lock that serialises tpool_run() */
+	pthread_mutex_t lock;         /* mutex lock for the following */
+	pthread_cond_t posted;        /* signalled when a job is posted or the pool is stopping */
+	pthread_cond_t finished;      /* signalled when the last worker finishes a job */
+	TpoolJob *job;                /* the current job */
+	unsigned long generation;     /* number of jobs posted */
+	int busy;                     /* number of workers still working on the current job */
+	int stopping;                 /* whether or not the pool is being released */
+};
+
+#ifndef TEST
+
+#ifdef __GNUC__
+
+#define tpool_atomic_load(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define tpool_atomic_add(var, val) __atomic_fetch_add(&(var), (val), __ATOMIC_RELAXED)
+
+/* The pool whose job the current thread is working on (see tpool_run()) */
+
+static __thread ThreadPool *tpool_self;
+
+#define tpool_inside(pool) (tpool_self == (pool))
+#define tpool_enter(pool, outer) ((outer) = tpool_self, tpool_self = (pool))
+#define tpool_leave(outer) (tpool_self = (outer))
+
+#else
+
+static struct
+{
+	pthread_mutex_t lock;         /* Mutex lock instead of atomic operations */
+}
+g =
+{
+	PTHREAD_MUTEX_INITIALIZER     /* lock */
+};
+
+#define tpool_atomic_load(var) (var)
+#define tpool_atomic_add(var, val) tpool_add(&(var), (val))
+#define tpool_inside(pool) 0
+#define tpool_enter(pool, outer) ((outer) = NULL)
+#define tpool_leave(outer)
+
+/*
+
+C<static size_t tpool_add(size_t *var, size_t val)>
+
+Adds C<val> to C<*var> and returns the previous value of C<*var>.
+
+*/
+
+static size_t tpool_add(size_t *var, size_t val)
+{
+	size_t old;
+
+	pthread_mutex_lock(&g.lock);
+	old = *var;
+	*var += val;
+	pthread_mutex_unlock(&g.lock);
+
+	return old;
+}
+
+#endif
+
+/*
+
+C<static void tpool_work(TpoolJob *job, int self)>
+
+Processes chunks of C<job>, starting with the slice numbered C<self>, and
+then stealing chunks from the following slices, until every slice is empty.
+
+*/
+
+static void tpool_work(TpoolJob *job, int self)
+{
+	TpoolSlice *slice;
+	size_t start;
+	int i;
+
+	for (i = 0; i < job->slices; ++i)
+	{
+		slice = job->slice + (self + i) % job->slices;
+
+		while (tpool_atomic_load(slice->next) < slice->end)
+		{
+			if ((start = tpool_atomic_add(slice->next, job->chunk)) >= slice->end)
+				break;
+
+			job->task(start, (slice->end - start > job->chunk) ? start + job->chunk : slice->end, job->data);
+		}
+	}
+}
+
+/*
+
+C<static void *tpool_worker(void *arg)>
+
+The worker thread. Waits for each job to be posted, works on it, and
+signals the caller of I<tpool_run(3)> when it is the last worker to finish.
+
+*/
+
+static void *tpool_worker(void *arg)
+{
+	TpoolWorker *worker = arg;
+	ThreadPool *pool = worker->pool;
+	ThreadPool *outer;
+	unsigned long generation = 0;
+	TpoolJob *job;
+
+	tpool_enter(pool, outer);
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;)
+	{
+		while (!pool->stopping && pool->generation == generation)
+			pthread_cond_wait(&pool->posted, &pool->lock);
+
+		if (pool->stopping)
+			break;
+
+		generation = pool->generation;
+		job = pool->job;
+		pthread_mutex_unlock(&pool->lock);
+
+		tpool_work(job, worker->index);
+
+		pthread_mutex_lock(&pool->lock);
+
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->finished);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	tpool_leave(outer);
+
+	return NULL;
+}
+
+/*
+
+=item C<ThreadPool *tpool_create(int threads)>
+
+Creates a thread pool that runs tasks with C<threads> threads, including
+the thread that calls I<tpool_run(3)>, so C<threads - 1> worker threads are
+started. If C<threads> is zero or negative, the number of online processors
+is used. A pool with one thread runs every task in the calling thread. The
+worker threads block all signals, so signals are delivered to the rest of
+the program's threads. It is the caller's responsibility to deallocate the
+new pool with I<tpool_release(3)> or I<tpool_destroy(3)>. On success,
+returns the new pool. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+ThreadPool *tpool_create(int threads)
+{
+	ThreadPool *pool;
+	sigset_t all, mask;
+	int i, err;
+
+	if (threads <= 0)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = (cpus < 1) ? 1 : (cpus > TPOOL_MAX) ? TPOOL_MAX : (int)cpus;
+	}
+
+	if (threads > TPOOL_MAX)
+		return set_errnull(EINVAL);
+
+	if (!(pool = mem_new(ThreadPool)))
+		return NULL;
+
+	if (!(pool->worker = mem_create(threads, TpoolWorker)))
+	{
+		mem_release(pool);
+		return NULL;
+	}
+
+	pool->threads = threads;
+	pool->started = 0;
+	pool->job = NULL;
+	pool->generation = 0;
+	pool->busy = 0;
+	pool->stopping = 0;
+	pthread_mutex_init(&pool->run, NULL);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->posted, NULL);
+	pthread_cond_init(&pool->finished, NULL);
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &mask);
+
+	for (i = 1; i < threads; ++i)
+	{
+		pool->worker[i].pool = pool;
+		pool->worker[i].index = i;
+
+		if ((err = pthread_create(&pool->worker[i].id, NULL, tpool_worker, pool->worker + i)))
+		{
+			pthread_sigmask(SIG_SETMASK, &mask, NULL);
+			tpool_release(pool);
+			return set_errnull(err);
+		}
+
+		++pool->started;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+	return pool;
+}
+
+/*
+
+=item C<void tpool_release(ThreadPool *pool)>
+
+Releases (deallocates) C<pool>, after stopping its worker threads. No other
+thread may be using C<pool>.
+
+=cut
+
+*/
+
+void tpool_release(ThreadPool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->posted);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 1; i <= pool->started; ++i)
+		pthread_join(pool->worker[i].id, NULL);
+
+	pthread_cond_destroy(&pool->finished);
+	pthread_cond_destroy(&pool->posted);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_mutex_destroy(&pool->run);
+	mem_release(pool->worker);
+	mem_release(pool);
+}
+
+/*
+
+=item C<void *tpool_destroy(ThreadPool **pool)>
+
+Destroys (deallocates and sets to C<null>) C<*pool>. Returns C<null>.
+
+=cut
+
+*/
+
+void *tpool_destroy(ThreadPool **pool)
+{
+	if (pool && *pool)
+	{
+		tpool_release(*pool);
+		*pool = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<int tpool_threads(const ThreadPool *pool)>
+
+Returns the number of threads that run tasks in C<pool>, including the
+caller of I<tpool_run(3)>. If C<pool> is C<null>, returns C<1>, because
+I<tpool_run(3)> runs every task in the calling thread.
+
+=cut
+
+*/
+
+int tpool_threads(const ThreadPool *pool)
+{
+	return (pool) ? pool->threads : 1;
+}
+
+/*
+
+=item C<int tpool_run(ThreadPool *pool, size_t n, size_t chunk, tpool_task_t *task, void *data)>
+
+Calls C<task> for consecutive ranges of the indexes C<0> to C<n - 1>, using
+the threads in C<pool>, and returns when all of them have been processed.
+The arguments passed to C<task> are the first index in the range, the index
+after the last index in the range, and C<data>. Each range has at most
+C<chunk> indexes. If C<chunk> is zero, a chunk size that gives each thread
+several chunks is chosen. Smaller chunks balance uneven work better, and
+larger chunks cost less to claim. Every index is in exactly one range, but
+C<task> may be called in any order and by any of the threads at the same
+time, so it must be thread-safe. If C<pool> is C<null> or has one thread,
+or if there is only one chunk, every range is processed by the calling
+thread in order. Only one call to I<tpool_run(3)> runs on a pool at a time.
+Other calls wait their turn, except that calls made by C<task> itself, on
+the same pool, run in the calling thread rather than deadlocking. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int tpool_run(ThreadPool *pool, size_t n, size_t chunk, tpool_task_t *task, void *data)
+{
+	ThreadPool *outer;
+	TpoolJob job;
+	size_t start, slice, extra;
+	int i, err;
+
+	if (!task)
+		return set_errno(EINVAL);
+
+	if (!n)
+		return 0;
+
+	if (!chunk && !(chunk = n / ((size_t)tpool_threads(pool) * TPOOL_CHUNKS)))
+		chunk = 1;
+
+	if (!pool || pool->threads == 1 || n <= chunk || tpool_inside(pool))
+	{
+		for (start = 0; start < n; start += chunk)
+			task(start, (n - start > chunk) ? start + chunk : n, data);
+
+		return 0;
+	}
+
+	job.task = task;
+	job.data = data;
+	job.chunk = chunk;
+	job.slices = pool->threads;
+
+	if (!(job.slice = mem_create(job.slices, TpoolSlice)))
+		return -1;
+
+	slice = n / job.slices;
+	extra = n % job.slices;
+
+	for (start = 0, i = 0; i < job.slices; ++i)
+	{
+		job.slice[i].next = start;
+		start += slice + (i < extra);
+		job.slice[i].end = start;
+	}
+
+	if ((err = pthread_mutex_lock(&pool->run)))
+	{
+		mem_release(job.slice);
+		return set_errno(err);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->job = &job;
+	pool->busy = pool->started;
+	++pool->generation;
+	pthread_cond_broadcast(&pool->posted);
+	pthread_mutex_unlock(&pool->lock);
+
+	tpool_enter(pool, outer);
+	tpool_work(&job, 0);
+	tpool_leave(outer);
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (pool->busy)
+		pthread_cond_wait(&pool->finished, &pool->lock);
+
+	pool->job = NULL;
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_unlock(&pool->run);
+	mem_release(job.slice);
+
+	return 0;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments are C<null> or out of range.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Safe>
+
+=head1 NOTES
+
+A thread that calls I<tpool_run(3)> from inside a task running on the same
+pool would wait forever for its own call to finish, so such nested calls
+are detected and run in the calling thread. Detecting them needs
+thread-local storage, so without a compiler that supports it (e.g. C<gcc>),
+tasks must not call I<tpool_run(3)> on their own pool.
+
+Tasks should not block for long (e.g. waiting for network replies). The
+other threads can't take over a chunk that has already been claimed, so
+the job finishes no sooner than its slowest chunk.
+
+=head1 EXAMPLES
+
+Lowercase the domains of a large array of recipient addresses:
+
+    #include <slack/std.h>
+    #include <slack/tpool.h>
+
+    static void lowercase_domains(size_t start, size_t end, void *data)
+    {
+        char **addr = data;
+        char *s;
+
+        for (; start < end; ++start)
+            if ((s = strrchr(addr[start], '@')))
+                for (; *s; ++s)
+                    *s = tolower((unsigned char)*s);
+    }
+
+    int main(int ac, char **av)
+    {
+        ThreadPool *pool;
+
+        if (!(pool = tpool_create(0)))
+            return EXIT_FAILURE;
+
+        tpool_run(pool, ac - 1, 0, lowercase_domains, av + 1);
+        tpool_destroy(&pool);
+
+        while (*++av)
+            printf("%s\n", *av);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<list(3)>,
+I<queue(3)>
+
+=head1 AUTHOR
+
+20230330 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#include <sched.h>
+
+#include "list.h"
+
+#define TEST_ITEMS 100003
+
+typedef struct TestRun TestRun;
+typedef struct TestNest TestNest;
+
+struct TestRun
+{
+	ThreadPool *pool;             /* the pool running the test */
+	size_t n;                     /* number of indexes */
+	size_t chunk;                 /* chunk size passed to tpool_run() */
+	unsigned char *seen;          /* number of times each index was processed */
+	pthread_t *thread;            /* the thread that processed each index */
+	int sleepy;                   /* indexes below this take a while */
+	pthread_t caller;             /* the thread that called tpool_run() */
+	int unblocked;                /* number of chunks processed by workers with SIGTERM unblocked */
+	int errors;                   /* number of bad ranges */
+	pthread_mutex_t lock;         /* mutex lock for unblocked and errors */
+};
+
+struct TestNest
+{
+	TestRun *test;                /* the test */
+	size_t offset;                /* the start of the outer range */
+};
+
+static void count(size_t start, size_t end, void *data)
+{
+	TestRun *test = data;
+	size_t chunk = (test->chunk) ? test->chunk : test->n;
+
+	if (start >= end || end > test->n || end - start > chunk)
+	{
+		pthread_mutex_lock(&test->lock);
+		++test->errors;
+		pthread_mutex_unlock(&test->lock);
+		return;
+	}
+
+	for (; start < end; ++start)
+	{
+		++test->seen[start];
+
+		if (test->thread)
+			test->thread[start] = pthread_self();
+
+		if ((int)start < test->sleepy)
+		{
+			struct timespec nap = { 0, 2000000 };
+			nanosleep(&nap, NULL);
+		}
+	}
+}
+
+static void count_nested(size_t start, size_t end, void *data)
+{
+	TestNest *nest = data;
+
+	count(nest->offset + start, nest->offset + end, nest->test);
+}
+
+static void nested(size_t start, size_t end, void *data)
+{
+	TestNest nest[1];
+
+	nest->test = data;
+	nest->offset = start;
+
+	if (tpool_run(nest->test->pool, end - start, 1, count_nested, nest) == -1)
+	{
+		pthread_mutex_lock(&nest->test->lock);
+		++nest->test->errors;
+		pthread_mutex_unlock(&nest->test->lock);
+	}
+}
+
+static void masked(size_t start, size_t end, void *data)
+{
+	TestRun *test = data;
+	sigset_t mask;
+
+	pthread_sigmask(SIG_BLOCK, NULL, &mask);
+
+	if (!pthread_equal(pthread_self(), test->caller) && !sigismember(&mask, SIGTERM))
+	{
+		pthread_mutex_lock(&test->lock);
+		++test->unblocked;
+		pthread_mutex_unlock(&test->lock);
+	}
+}
+
+/* Counts the indexes that weren't processed exactly once */
+
+static int missed(TestRun *test)
+{
+	size_t i;
+	int missed = 0;
+
+	for (i = 0; i < test->n; ++i)
+		if (test->seen[i] != 1)
+			++missed;
+
+	return missed;
+}
+
+static void test_init(TestRun *test, ThreadPool *pool, size_t n, size_t chunk)
+{
+	test->pool = pool;
+	test->n = n;
+	test->chunk = chunk;
+	memset(test->seen, 0, TEST_ITEMS);
+	test->thread = NULL;
+	test->sleepy = 0;
+	test->caller = pthread_self();
+	test->unblocked = 0;
+	test->errors = 0;
+}
+
+/*
+
+Normalises a million recipient addresses with list_map_parallel() (copying
+each one with its domain in lower case), validates their syntax with
+list_grep_parallel(), and sorts them with list_sort_parallel(), with pools
+of increasing numbers of threads, up to the number of processors.
+
+*/
+
+#define BENCH_ITEMS 1000000
+
+static void *normalise(void *item, size_t *index, void *data)
+{
+	char *addr = mem_strdup(item), *s;
+
+	if (addr && (s = strrchr(addr, '@')))
+		for (; *s; ++s)
+			*s = tolower((unsigned char)*s);
+
+	return addr;
+}
+
+static int valid(void *item, size_t *index, void *data)
+{
+	const char *addr = item, *at, *s;
+
+	if (!(at = strchr(addr, '@')) || at == addr || strchr(at + 1, '@') || !strchr(at + 1, '.'))
+		return 0;
+
+	for (s = addr; *s; ++s)
+		if (!isalnum((unsigned char)*s) && !strchr("@.-_+", *s))
+			return 0;
+
+	return 1;
+}
+
+static int addr_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static double wall(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void bench(void)
+{
+	List *addrs, *mapped, *valids;
+	ThreadPool *pool;
+	double start, secs[3], base[3];
+	char buf[64];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long seed = 1;
+	int threads, i;
+
+	if (!(addrs = list_create(free)))
+		exit(EXIT_FAILURE);
+
+	for (i = 0; i < BENCH_ITEMS; ++i)
+	{
+		seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+		snprintf(buf, sizeof buf, "%s%lu@%s%lu.Example.COM", (i % 100) ? "user" : "bad user", (seed >> 33) % 100000, (seed & 64) ? "Mail" : "MX", (seed >> 20) % 1000);
+		list_append(addrs, mem_strdup(buf));
+	}
+
+	printf("%7s %10s %10s %10s (Mitems/s and speedup, %d items)\n", "threads", "map", "grep", "sort", BENCH_ITEMS);
+
+	for (threads = 1; threads <= cpus || threads == 1; threads = (threads * 2 > cpus && threads < cpus) ? cpus : threads * 2)
+	{
+		if (!(pool = tpool_create(threads)))
+			exit(EXIT_FAILURE);
+
+		start = wall();
+		mapped = list_map_parallel(addrs, pool, free, normalise, NULL);
+		secs[0] = wall() - start;
+
+		start = wall();
+		valids = list_grep_parallel(mapped, pool, valid, NULL);
+		secs[1] = wall() - start;
+
+		start = wall();
+		list_sort_parallel(valids, pool, addr_cmp);
+		secs[2] = wall() - start;
+
+		if (threads == 1)
+			for (i = 0; i < 3; ++i)
+				base[i] = secs[i];
+
+		printf("%7d %5.1f %4.1fx %5.1f %4.1fx %5.1f %4.1fx\n", threads,
+			BENCH_ITEMS / secs[0] / 1e6, base[0] / secs[0],
+			BENCH_ITEMS / secs[1] / 1e6, base[1] / secs[1],
+			BENCH_ITEMS / secs[2] / 1e6, base[2] / secs[2]);
+
+		list_destroy(&valids);
+		list_destroy(&mapped);
+		tpool_destroy(&pool);
+	}
+
+	list_destroy(&addrs);
+
+	exit(EXIT_SUCCESS);
+}
+
+#define TEST_ACT(i, action) \
+	if (!(action)) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_INT_ACT(i, action) \
+	if ((action) == -1) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_EQ(i, action, value) \
+	if ((val = (long)(action)) != (long)(value)) \
+		++errors, printf("Test%d: %s failed (returned %ld, not %ld)\n", (i), (#action), val, (long)(value));
+
+#define TEST_ERR(i, action, err) \
+	if ((action) != -1 || errno != (err)) \
+		++errors, printf("Test%d: %s failed (errno %d, not %s)\n", (i), (#action), errno, (#err));
+
+int main(int ac, char **av)
+{
+	static unsigned char seen[TEST_ITEMS];
+	static const size_t chunks[] = { 0, 1, 7, 1000, TEST_ITEMS * 2 };
+	pthread_t thread[64];
+	ThreadPool *pool[3];
+	TestRun test[1];
+	long val;
+	int errors = 0, p, c, i, stolen;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s [bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench();
+
+	printf("Testing: %s\n", "tpool");
+
+	pthread_mutex_init(&test->lock, NULL);
+	test->seen = seen;
+
+	/* Test tpool_create, tpool_threads */
+
+	pool[0] = NULL;
+	TEST_EQ(1, tpool_threads(pool[0]), 1)
+	TEST_ACT(2, pool[1] = tpool_create(1))
+	TEST_EQ(3, tpool_threads(pool[1]), 1)
+	TEST_ACT(4, pool[2] = tpool_create(4))
+	TEST_EQ(5, tpool_threads(pool[2]), 4)
+	TEST_ACT(6, !tpool_create(TPOOL_MAX + 1) && errno == EINVAL)
+
+	/* Test tpool_run: every index exactly once, in ranges of at most chunk */
+
+	TEST_ERR(7, tpool_run(pool[2], 10, 1, NULL, NULL), EINVAL)
+	test_init(test, pool[2], 0, 1);
+	TEST_INT_ACT(8, tpool_run(pool[2], 0, 1, count, test))
+	TEST_EQ(8, test->errors, 0)
+
+	for (p = 0; p < 3; ++p)
+	{
+		if (p && !pool[p])
+			continue;
+
+		for (c = 0; c < sizeof chunks / sizeof *chunks; ++c)
+		{
+			test_init(test, pool[p], TEST_ITEMS, chunks[c]);
+
+			if (tpool_run(pool[p], TEST_ITEMS, chunks[c], count, test) == -1)
+				++errors, printf("Test9: tpool_run(pool %d, chunk %d) failed (%s)\n", p, (int)chunks[c], strerror(errno));
+			if (test->errors)
+				++errors, printf("Test10: tpool_run(pool %d, chunk %d) failed (%d bad ranges)\n", p, (int)chunks[c], test->errors);
+			if ((i = missed(test)))
+				++errors, printf("Test11: tpool_run(pool %d, chunk %d) failed (%d indexes not processed once)\n", p, (int)chunks[c], i);
+		}
+	}
+
+	if (pool[2])
+	{
+		/* Test many small jobs in a row */
+
+		for (i = 0; i < 2000; ++i)
+		{
+			test_init(test, pool[2], 64, 1);
+
+			if (tpool_run(pool[2], 64, 1, count, test) == -1 || test->errors || missed(test))
+			{
+				++errors, printf("Test12: tpool_run() job %d failed\n", i);
+				break;
+			}
+		}
+
+		/* Test that chunks of a slow slice are stolen by the other threads */
+
+		test_init(test, pool[2], 64, 1);
+		test->thread = thread;
+		test->sleepy = 16;
+		TEST_INT_ACT(13, tpool_run(pool[2], 64, 1, count, test))
+		TEST_EQ(13, missed(test), 0)
+
+		for (stolen = 0, i = 1; i < 16; ++i)
+			if (!pthread_equal(thread[i], thread[0]))
+				++stolen;
+
+		if (!stolen)
+			++errors, printf("Test14: tpool_run() failed (no chunks were stolen from a slow thread)\n");
+
+		/* Test that nested calls on the same pool don't deadlock */
+
+#ifdef __GNUC__
+		test_init(test, pool[2], 1000, 1);
+		TEST_INT_ACT(15, tpool_run(pool[2], 1000, 10, nested, test))
+		TEST_EQ(15, test->errors, 0)
+		TEST_EQ(15, missed(test), 0)
+#endif
+
+		/* Test that the worker threads block signals */
+
+		test_init(test, pool[2], 1000, 1);
+		TEST_INT_ACT(16, tpool_run(pool[2], 1000, 1, masked, test))
+		TEST_EQ(16, test->unblocked, 0)
+	}
+
+	/* Test tpool_destroy */
+
+	tpool_destroy(&pool[2]);
+	TEST_ACT(17, !pool[2])
+	tpool_destroy(&pool[1]);
+	TEST_ACT(17, !pool[1])
+
+	TEST_ACT(18, pool[0] = tpool_create(0))
+	TEST_ACT(18, tpool_threads(pool[0]) >= 1)
+	tpool_destroy(&pool[0]);
+
+	if (errors)
+		printf("%d/18 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,42 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+#ifndef LIBSLACK_TPOOL_H
+#define LIBSLACK_TPOOL_H
+
+#include <stdlib.h>
+
+#include <slack/hdr.h>
+
+typedef struct ThreadPool ThreadPool;
+typedef void tpool_task_t(size_t start, size_t end, void *data);
+
+_begin_decls
+ThreadPool *tpool_create(int threads);
+void tpool_release(ThreadPool *pool);
+void *tpool_destroy(ThreadPool **pool);
+int tpool_threads(const ThreadPool *pool);
+int tpool_run(ThreadPool *pool, size_t n, size_t chunk, tpool_task_t *task, void *data);
+_end_decls
+
+#endif
+
+/* vi:set ts=4 sw=4: */
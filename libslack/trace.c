@@ -0,0 +1,1659 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<libslack(trace)> - debug message trace module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/trace.h>
+
+    typedef struct Trace Trace;
+
+    Trace *trace_create(int fd);
+    Trace *trace_create_file(const char *path);
+    void trace_release(Trace *trace);
+    void *trace_destroy(Trace **trace);
+    int trace_out(Trace *trace, size_t level, const char *format, ...);
+    int vtrace_out(Trace *trace, size_t level, const char *format, va_list args);
+    int trace_flush(Trace *trace);
+    int trace_decode(int fd, Msg *mesg);
+
+=head1 DESCRIPTION
+
+This module provides debug message traces: a binary record of each debug
+message's time, level, thread, format string and arguments, which is only
+formatted later (if ever), by I<trace_decode(3)> or the I<decode-trace>
+program in the I<libslack> source distribution. Recording a message costs
+a few copies of its arguments rather than a call to I<vsnprintf(3)> and a
+system call, so traces can be left on when formatting every debug message
+would cost too much. I<debug(3)> records messages in the trace set by
+I<prog_set_trace(3)> (when there is one) instead of formatting them.
+
+Each format string is recorded once, the first time it is used, along with
+a number that identifies it. After that, each message records just the
+number, and the arguments that the format string consumes. Integers,
+pointers, and floating point numbers are recorded as 8 bytes each (C<long
+double> arguments lose precision), and strings are copied. Format strings
+are recognised by their address, so they should be string literals (or at
+least not change). Formats that can't be recorded safely (i.e. with C<%n>,
+C<%m>, positional arguments, wide characters, or C<%j>), and messages in
+traces that already have 1024 different format strings, are formatted
+immediately and recorded as text.
+
+Each thread records messages into its own 64KB buffer, which is written to
+the trace's file descriptor when it fills up, when I<trace_flush(3)> is
+called, when the thread exits, when the trace is released, and when the
+process calls I<exit(3)>. I<fatal(3)> and I<dump(3)> also flush the
+program's trace. Messages from each thread are in order, but messages from
+different threads are only grouped in order within each buffer. Decoded
+messages are preceded by their time, so they can be sorted. Traces must be
+decoded on a host with the same byte order and type sizes as the host that
+recorded them.
+
+=over 4
+
+=cut
+
+*/
+
+#include "config.h"
+#include "std.h"
+
+#include <fcntl.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "mem.h"
+#include "err.h"
+
+#ifndef HAVE_SNPRINTF
+#include "snprintf.h"
+#endif
+
+typedef struct TraceHeader TraceHeader;
+typedef struct TraceRecord TraceRecord;
+typedef struct TraceFormat TraceFormat;
+typedef struct TraceBuffer TraceBuffer;
+
+#define TRACE_MAGIC "SLKTRACE"
+#define TRACE_VERSION 1
+#define TRACE_ORDER 0x01020304
+
+/* Sizes: each thread's buffer, the largest record, formats per trace */
+
+#define TRACE_BUFFER 65536
+#define TRACE_RECORD MSG_SIZE
+#define TRACE_FORMATS 1024
+#define TRACE_ARGS 32
+
+/* A format record's id is its number. An event record's is 0 for text. */
+
+#define TRACE_FORMAT_RECORD 1
+#define TRACE_EVENT_RECORD 2
+
+#define TRACE_NULL ((unsigned int)-1)
+
+/* The types of argument that a format string can consume */
+
+enum
+{
+	TRACE_INT = 1, TRACE_UINT, TRACE_SCHAR, TRACE_UCHAR, TRACE_SHORT, TRACE_USHORT,
+	TRACE_LONG, TRACE_ULONG, TRACE_LLONG, TRACE_ULLONG, TRACE_SIZE, TRACE_SSIZE,
+	TRACE_PTRDIFF, TRACE_DOUBLE, TRACE_LDOUBLE, TRACE_STRING, TRACE_POINTER
+};
+
+struct TraceHeader
+{
+	char magic[8];        /* TRACE_MAGIC */
+	unsigned int version; /* TRACE_VERSION */
+	unsigned int order;   /* TRACE_ORDER (in the recording host's byte order) */
+};
+
+struct TraceRecord
+{
+	unsigned int size;    /* bytes in the record, including this header */
+	unsigned int type;    /* TRACE_FORMAT_RECORD or TRACE_EVENT_RECORD */
+	unsigned int thread;  /* the recording thread's number */
+	unsigned int level;   /* the debug level */
+	long long sec;        /* the time (seconds) */
+	unsigned int nsec;    /* the time (nanoseconds) */
+	unsigned int id;      /* the format's number (0 for text) */
+};
+
+struct TraceFormat
+{
+	const char *format;   /* the format string (its address identifies it) */
+	unsigned int id;      /* its number in the trace */
+	int nargs;            /* number of arguments (-1 if recorded as text) */
+	char args[TRACE_ARGS];/* the type of each argument */
+};
+
+struct TraceBuffer
+{
+	TraceBuffer *next;    /* the next thread's buffer */
+	Trace *trace;         /* the trace that this buffer belongs to */
+	pthread_mutex_t lock; /* the thread, or a flush, is using buf */
+	unsigned int thread;  /* the thread's number */
+	size_t length;        /* bytes recorded in buf */
+	char buf[TRACE_BUFFER]; /* records */
+};
+
+struct Trace
+{
+	int fd;               /* file descriptor to write to */
+	int close;            /* whether or not to close fd on release */
+	pthread_key_t key;    /* each thread's buffer */
+	pthread_mutex_t lock; /* guards buffers, formats, threads (and the list of traces) */
+	pthread_mutex_t write_lock; /* one thread writes to fd at a time */
+	TraceBuffer *buffers; /* all threads' buffers */
+	TraceFormat *formats[TRACE_FORMATS]; /* formats, hashed by address */
+	unsigned int nformats; /* number of formats */
+	unsigned int threads; /* number of buffers created */
+	Trace *next;          /* the next trace (for exit) */
+};
+
+#ifndef TEST
+
+#ifdef __GNUC__
+
+#define trace_atomic_load(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define trace_atomic_store(var, val) __atomic_store_n(&(var), (val), __ATOMIC_RELEASE)
+#define trace_enter(trace)
+#define trace_leave(trace)
+
+#else
+
+#define trace_atomic_load(var) (var)
+#define trace_atomic_store(var, val) ((var) = (val))
+#define trace_enter(trace) pthread_mutex_lock(&(trace)->lock)
+#define trace_leave(trace) pthread_mutex_unlock(&(trace)->lock)
+
+#endif
+
+#define trace_hash(format) (((size_t)(format) >> 3) * 2654435761UL >> 12 & (TRACE_FORMATS - 1))
+
+static struct
+{
+	pthread_once_t once;  /* registers trace_exit() */
+	pthread_mutex_t lock; /* guards list */
+	Trace *list;          /* all traces */
+}
+g = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, NULL };
+
+/*
+
+C<int trace_spec(const char **pos, char *args)>
+
+Parses the conversion specification at C<*pos> (which points to a C<'%'>
+character), and stores the types of the arguments that it consumes in
+C<args> (at most three: a width, a precision and a value). Advances C<*pos>
+past the conversion specification. Returns the number of arguments, or
+C<-1> if the conversion can't be recorded.
+
+*/
+
+static int trace_spec(const char **pos, char *args)
+{
+	const char *p = *pos + 1;
+	int n = 0, mod = 0;
+
+	if (*p == '%')
+	{
+		*pos = p + 1;
+		return 0;
+	}
+
+	while (*p && strchr("-+ #0'I", *p))
+		++p;
+
+	if (*p == '*')
+		args[n++] = TRACE_INT, ++p;
+
+	while (isdigit((int)(unsigned char)*p))
+		++p;
+
+	if (*p == '$')
+		return -1;
+
+	if (*p == '.')
+	{
+		if (*++p == '*')
+			args[n++] = TRACE_INT, ++p;
+
+		while (isdigit((int)(unsigned char)*p))
+			++p;
+
+		if (*p == '$')
+			return -1;
+	}
+
+	switch (*p)
+	{
+		case 'h': mod = (p[1] == 'h') ? (++p, 'H') : 'h'; ++p; break;
+		case 'l': mod = (p[1] == 'l') ? (++p, 'q') : 'l'; ++p; break;
+		case 'q': case 'L': mod = *p++; break;
+		case 'z': case 'Z': mod = 'z'; ++p; break;
+		case 't': mod = 't'; ++p; break;
+	}
+
+	switch (*p)
+	{
+		case 'd': case 'i':
+			switch (mod)
+			{
+				case 0: args[n] = TRACE_INT; break;
+				case 'H': args[n] = TRACE_SCHAR; break;
+				case 'h': args[n] = TRACE_SHORT; break;
+				case 'l': args[n] = TRACE_LONG; break;
+				case 'q': case 'L': args[n] = TRACE_LLONG; break;
+				case 'z': args[n] = TRACE_SSIZE; break;
+				case 't': args[n] = TRACE_PTRDIFF; break;
+			}
+			break;
+
+		case 'o': case 'u': case 'x': case 'X':
+			switch (mod)
+			{
+				case 0: args[n] = TRACE_UINT; break;
+				case 'H': args[n] = TRACE_UCHAR; break;
+				case 'h': args[n] = TRACE_USHORT; break;
+				case 'l': args[n] = TRACE_ULONG; break;
+				case 'q': case 'L': args[n] = TRACE_ULLONG; break;
+				case 'z': args[n] = TRACE_SIZE; break;
+				case 't': args[n] = TRACE_PTRDIFF; break;
+			}
+			break;
+
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			args[n] = (mod == 'L') ? TRACE_LDOUBLE : (mod == 0 || mod == 'l') ? TRACE_DOUBLE : 0;
+			break;
+
+		case 'c':
+			args[n] = (mod == 0) ? TRACE_INT : 0;
+			break;
+
+		case 's':
+			args[n] = (mod == 0) ? TRACE_STRING : 0;
+			break;
+
+		case 'p':
+			args[n] = (mod == 0) ? TRACE_POINTER : 0;
+			break;
+
+		default:
+			return -1;
+	}
+
+	if (!args[n])
+		return -1;
+
+	*pos = p + 1;
+
+	return n + 1;
+}
+
+/*
+
+C<int trace_parse(const char *format, char *args)>
+
+Stores the types of the arguments consumed by C<format> in C<args> (which
+has room for C<TRACE_ARGS> types). Returns the number of arguments, or
+C<-1> if C<format> can't be recorded (or consumes too many arguments).
+
+*/
+
+static int trace_parse(const char *format, char *args)
+{
+	char spec[3];
+	int nargs = 0, n;
+
+	while ((format = strchr(format, '%')))
+	{
+		if ((n = trace_spec(&format, spec)) == -1 || nargs + n > TRACE_ARGS)
+			return -1;
+
+		memcpy(args + nargs, spec, n);
+		nargs += n;
+	}
+
+	return nargs;
+}
+
+/*
+
+C<int trace_write(Trace *trace, const void *buf, size_t size)>
+
+Writes C<size> bytes of C<buf> to C<trace>'s file descriptor. C<trace>'s
+C<write_lock> must be locked. On success, returns C<0>. On error, returns
+C<-1> with C<errno> set appropriately.
+
+*/
+
+static int trace_write(Trace *trace, const void *buf, size_t size)
+{
+	const char *p = buf;
+	ssize_t bytes;
+
+	while (size)
+	{
+		if ((bytes = write(trace->fd, p, size)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		p += bytes;
+		size -= bytes;
+	}
+
+	return 0;
+}
+
+/*
+
+C<int trace_flush_buffer(TraceBuffer *buffer)>
+
+Writes and empties C<buffer>. C<buffer>'s C<lock> must be locked. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+*/
+
+static int trace_flush_buffer(TraceBuffer *buffer)
+{
+	Trace *trace = buffer->trace;
+	int rc;
+
+	if (!buffer->length)
+		return 0;
+
+	pthread_mutex_lock(&trace->write_lock);
+	rc = trace_write(trace, buffer->buf, buffer->length);
+	pthread_mutex_unlock(&trace->write_lock);
+	buffer->length = 0;
+
+	return rc;
+}
+
+/*
+
+C<void trace_buffer_release(void *buffer)>
+
+Writes and deallocates a thread's buffer when the thread exits.
+
+*/
+
+static void trace_buffer_release(void *buffer)
+{
+	TraceBuffer *buf = buffer, **link;
+	Trace *trace = buf->trace;
+
+	pthread_mutex_lock(&trace->lock);
+
+	for (link = &trace->buffers; *link; link = &(*link)->next)
+	{
+		if (*link == buf)
+		{
+			*link = buf->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&trace->lock);
+
+	trace_flush_buffer(buf);
+	pthread_mutex_destroy(&buf->lock);
+	mem_release(buf);
+}
+
+/*
+
+C<TraceBuffer *trace_buffer(Trace *trace)>
+
+Returns the calling thread's buffer for C<trace>, creating it if
+necessary. On error, returns C<null> with C<errno> set appropriately.
+
+*/
+
+static TraceBuffer *trace_buffer(Trace *trace)
+{
+	TraceBuffer *buffer;
+	int err;
+
+	if ((buffer = pthread_getspecific(trace->key)))
+		return buffer;
+
+	if (!(buffer = mem_new(TraceBuffer)))
+		return NULL;
+
+	buffer->trace = trace;
+	buffer->length = 0;
+	pthread_mutex_init(&buffer->lock, NULL);
+
+	if ((err = pthread_setspecific(trace->key, buffer)))
+	{
+		pthread_mutex_destroy(&buffer->lock);
+		mem_release(buffer);
+		return set_errnull(err);
+	}
+
+	pthread_mutex_lock(&trace->lock);
+	buffer->thread = ++trace->threads;
+	buffer->next = trace->buffers;
+	trace->buffers = buffer;
+	pthread_mutex_unlock(&trace->lock);
+
+	return buffer;
+}
+
+/*
+
+C<TraceFormat *trace_format(Trace *trace, const char *format)>
+
+Returns C<trace>'s record of C<format>. The first time C<format> is seen,
+parses it and records it in C<trace>'s file (before any message that uses
+it can be written). Returns C<null> if C<trace> has no room for another
+format, or on error.
+
+*/
+
+static TraceFormat *trace_format(Trace *trace, const char *format)
+{
+	TraceFormat *fmt = NULL;
+	size_t i;
+
+	trace_enter(trace);
+
+	for (i = trace_hash(format); (fmt = trace_atomic_load(trace->formats[i])); i = (i + 1) & (TRACE_FORMATS - 1))
+		if (fmt->format == format)
+			break;
+
+	trace_leave(trace);
+
+	if (fmt)
+		return fmt;
+
+	pthread_mutex_lock(&trace->lock);
+
+	for (i = trace_hash(format); (fmt = trace->formats[i]); i = (i + 1) & (TRACE_FORMATS - 1))
+		if (fmt->format == format)
+			break;
+
+	if (!fmt && trace->nformats < TRACE_FORMATS * 3 / 4 && (fmt = mem_new(TraceFormat)))
+	{
+		size_t length = strlen(format);
+		TraceRecord record[1];
+
+		fmt->format = format;
+		fmt->id = trace->nformats + 1;
+		fmt->nargs = trace_parse(format, fmt->args);
+
+		if (length > TRACE_RECORD - sizeof(TraceRecord))
+			length = TRACE_RECORD - sizeof(TraceRecord), fmt->nargs = -1;
+
+		memset(record, 0, sizeof(TraceRecord));
+		record->size = sizeof(TraceRecord) + length;
+		record->type = TRACE_FORMAT_RECORD;
+		record->id = fmt->id;
+
+		pthread_mutex_lock(&trace->write_lock);
+
+		if (trace_write(trace, record, sizeof(TraceRecord)) == -1 || trace_write(trace, format, length) == -1)
+		{
+			pthread_mutex_unlock(&trace->write_lock);
+			pthread_mutex_unlock(&trace->lock);
+			mem_release(fmt);
+			return NULL;
+		}
+
+		pthread_mutex_unlock(&trace->write_lock);
+
+		++trace->nformats;
+		trace_atomic_store(trace->formats[i], fmt);
+	}
+
+	pthread_mutex_unlock(&trace->lock);
+
+	return fmt;
+}
+
+/*
+
+C<void trace_exit(void)>
+
+Writes all threads' buffers for all traces when the process calls
+I<exit(3)>.
+
+*/
+
+static void trace_exit(void)
+{
+	Trace *trace;
+
+	pthread_mutex_lock(&g.lock);
+
+	for (trace = g.list; trace; trace = trace->next)
+		trace_flush(trace);
+
+	pthread_mutex_unlock(&g.lock);
+}
+
+/*
+
+C<void trace_init(void)>
+
+Arranges for I<trace_exit()> to be called at exit.
+
+*/
+
+static void trace_init(void)
+{
+	atexit(trace_exit);
+}
+
+/*
+
+=item C<Trace *trace_create(int fd)>
+
+Creates a I<Trace> that records debug messages in file descriptor C<fd>,
+which is not closed when the trace is released. It is the caller's
+responsibility to deallocate the new I<Trace> with I<trace_release(3)> or
+I<trace_destroy(3)>. It is strongly recommended to use I<trace_destroy(3)>,
+because it also sets the pointer variable to C<null>. On success, returns
+the new I<Trace>. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+Trace *trace_create(int fd)
+{
+	TraceHeader header[1];
+	Trace *trace;
+	int err;
+
+	if (fd < 0)
+		return set_errnull(EINVAL);
+
+	memset(header, 0, sizeof(TraceHeader));
+	memcpy(header->magic, TRACE_MAGIC, sizeof header->magic);
+	header->version = TRACE_VERSION;
+	header->order = TRACE_ORDER;
+
+	if (!(trace = mem_new(Trace)))
+		return NULL;
+
+	memset(trace, 0, sizeof(Trace));
+	trace->fd = fd;
+
+	if (trace_write(trace, header, sizeof(TraceHeader)) == -1)
+	{
+		mem_release(trace);
+		return NULL;
+	}
+
+	if ((err = pthread_key_create(&trace->key, trace_buffer_release)))
+	{
+		mem_release(trace);
+		return set_errnull(err);
+	}
+
+	pthread_mutex_init(&trace->lock, NULL);
+	pthread_mutex_init(&trace->write_lock, NULL);
+
+	pthread_once(&g.once, trace_init);
+	pthread_mutex_lock(&g.lock);
+	trace->next = g.list;
+	g.list = trace;
+	pthread_mutex_unlock(&g.lock);
+
+	return trace;
+}
+
+/*
+
+=item C<Trace *trace_create_file(const char *path)>
+
+Creates a I<Trace> that records debug messages in the file C<path>, which
+is created (or truncated) with mode C<0640> (modified by the process's
+umask). The file is closed when the trace is released. It is the caller's
+responsibility to deallocate the new I<Trace> with I<trace_release(3)> or
+I<trace_destroy(3)>. On success, returns the new I<Trace>. On error,
+returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Trace *trace_create_file(const char *path)
+{
+	Trace *trace;
+	int fd;
+
+	if (!path)
+		return set_errnull(EINVAL);
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP)) == -1)
+		return NULL;
+
+	if (!(trace = trace_create(fd)))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	trace->close = 1;
+
+	return trace;
+}
+
+/*
+
+=item C<void trace_release(Trace *trace)>
+
+Writes any messages still in C<trace>'s buffers, and releases (deallocates)
+C<trace>. No thread may use C<trace> after this.
+
+=cut
+
+*/
+
+void trace_release(Trace *trace)
+{
+	Trace **link;
+	TraceBuffer *buffer;
+	size_t i;
+
+	if (!trace)
+		return;
+
+	pthread_mutex_lock(&g.lock);
+
+	for (link = &g.list; *link; link = &(*link)->next)
+	{
+		if (*link == trace)
+		{
+			*link = trace->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&g.lock);
+
+	pthread_key_delete(trace->key);
+
+	while ((buffer = trace->buffers))
+	{
+		trace->buffers = buffer->next;
+		trace_flush_buffer(buffer);
+		pthread_mutex_destroy(&buffer->lock);
+		mem_release(buffer);
+	}
+
+	for (i = 0; i < TRACE_FORMATS; ++i)
+		mem_release(trace->formats[i]);
+
+	if (trace->close)
+		close(trace->fd);
+
+	pthread_mutex_destroy(&trace->write_lock);
+	pthread_mutex_destroy(&trace->lock);
+	mem_release(trace);
+}
+
+/*
+
+=item C<void *trace_destroy(Trace **trace)>
+
+Destroys (deallocates and sets to C<null>) C<*trace>. Returns C<null>.
+
+=cut
+
+*/
+
+void *trace_destroy(Trace **trace)
+{
+	if (trace && *trace)
+	{
+		trace_release(*trace);
+		*trace = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<int trace_out(Trace *trace, size_t level, const char *format, ...)>
+
+Records a message in C<trace>. C<level> is the message's debug level (see
+I<debugf(3)>). C<format> is a I<printf(3)>-like format string, and the
+remaining arguments are the ones that it consumes. The message is not
+formatted until it is decoded (unless C<format> can't be recorded). On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int trace_out(Trace *trace, size_t level, const char *format, ...)
+{
+	va_list args;
+	int rc;
+
+	va_start(args, format);
+	rc = vtrace_out(trace, level, format, args);
+	va_end(args);
+
+	return rc;
+}
+
+/*
+
+=item C<int vtrace_out(Trace *trace, size_t level, const char *format, va_list args)>
+
+Equivalent to I<trace_out(3)> with the variable argument list specified
+directly as for I<vprintf(3)>.
+
+=cut
+
+*/
+
+int vtrace_out(Trace *trace, size_t level, const char *format, va_list args)
+{
+	TraceBuffer *buffer;
+	TraceFormat *fmt;
+	TraceRecord record[1];
+	struct timespec now[1];
+	char *pos, *end;
+	int i, rc = 0;
+
+	if (!trace || !format)
+		return set_errno(EINVAL);
+
+	if (!(buffer = trace_buffer(trace)))
+		return -1;
+
+	fmt = trace_format(trace, format);
+	clock_gettime(CLOCK_REALTIME, now);
+
+	pthread_mutex_lock(&buffer->lock);
+
+	if (buffer->length > TRACE_BUFFER - TRACE_RECORD)
+		rc = trace_flush_buffer(buffer);
+
+	pos = buffer->buf + buffer->length + sizeof(TraceRecord);
+	end = buffer->buf + buffer->length + TRACE_RECORD;
+
+	if (fmt && fmt->nargs != -1)
+	{
+		for (i = 0; i < fmt->nargs; ++i)
+		{
+			long long integer = 0;
+			double real;
+			const char *str;
+			unsigned int length;
+
+			switch (fmt->args[i])
+			{
+				case TRACE_INT: integer = va_arg(args, int); break;
+				case TRACE_UINT: integer = va_arg(args, unsigned int); break;
+				case TRACE_SCHAR: integer = (signed char)va_arg(args, int); break;
+				case TRACE_UCHAR: integer = (unsigned char)va_arg(args, unsigned int); break;
+				case TRACE_SHORT: integer = (short)va_arg(args, int); break;
+				case TRACE_USHORT: integer = (unsigned short)va_arg(args, unsigned int); break;
+				case TRACE_LONG: integer = va_arg(args, long); break;
+				case TRACE_ULONG: integer = va_arg(args, unsigned long); break;
+				case TRACE_LLONG: integer = va_arg(args, long long); break;
+				case TRACE_ULLONG: integer = va_arg(args, unsigned long long); break;
+				case TRACE_SIZE: integer = va_arg(args, size_t); break;
+				case TRACE_SSIZE: integer = va_arg(args, ssize_t); break;
+				case TRACE_PTRDIFF: integer = va_arg(args, ptrdiff_t); break;
+				case TRACE_POINTER: integer = (long long)(size_t)va_arg(args, void *); break;
+
+				case TRACE_DOUBLE:
+				case TRACE_LDOUBLE:
+					real = (fmt->args[i] == TRACE_LDOUBLE) ? (double)va_arg(args, long double) : va_arg(args, double);
+					memcpy(pos, &real, sizeof real);
+					pos += sizeof real;
+					continue;
+
+				case TRACE_STRING:
+					str = va_arg(args, const char *);
+					length = (str) ? strlen(str) : TRACE_NULL;
+
+					/* Truncate strings that don't fit (leaving room for the rest) */
+
+					if (str && length > (size_t)(end - pos) - sizeof length - (fmt->nargs - i - 1) * sizeof(long long))
+						length = (end - pos) - sizeof length - (fmt->nargs - i - 1) * sizeof(long long);
+
+					memcpy(pos, &length, sizeof length);
+					pos += sizeof length;
+
+					if (str)
+						memcpy(pos, str, length), pos += length;
+
+					continue;
+			}
+
+			memcpy(pos, &integer, sizeof integer);
+			pos += sizeof integer;
+		}
+	}
+	else
+	{
+		int length = vsnprintf(pos, end - pos, format, args);
+
+		if (length > 0)
+			pos += (length < end - pos) ? length : end - pos - 1;
+
+		fmt = NULL;
+	}
+
+	record->size = pos - (buffer->buf + buffer->length);
+	record->type = TRACE_EVENT_RECORD;
+	record->thread = buffer->thread;
+	record->level = (unsigned int)level;
+	record->sec = now->tv_sec;
+	record->nsec = now->tv_nsec;
+	record->id = (fmt) ? fmt->id : 0;
+	memcpy(buffer->buf + buffer->length, record, sizeof(TraceRecord));
+	buffer->length += record->size;
+
+	pthread_mutex_unlock(&buffer->lock);
+
+	return rc;
+}
+
+/*
+
+=item C<int trace_flush(Trace *trace)>
+
+Writes the messages in all threads' buffers for C<trace>. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int trace_flush(Trace *trace)
+{
+	TraceBuffer *buffer;
+	int rc = 0;
+
+	if (!trace)
+		return set_errno(EINVAL);
+
+	pthread_mutex_lock(&trace->lock);
+
+	for (buffer = trace->buffers; buffer; buffer = buffer->next)
+	{
+		pthread_mutex_lock(&buffer->lock);
+
+		if (trace_flush_buffer(buffer) == -1)
+			rc = -1;
+
+		pthread_mutex_unlock(&buffer->lock);
+	}
+
+	pthread_mutex_unlock(&trace->lock);
+
+	return rc;
+}
+
+/*
+
+C<int trace_read(int fd, void *buf, size_t size)>
+
+Reads exactly C<size> bytes from C<fd> into C<buf>. Returns C<1> on
+success, C<0> at the end of input (before any bytes), and C<-1> on error,
+or at the end of input part way through, with C<errno> set appropriately.
+
+*/
+
+static int trace_read(int fd, void *buf, size_t size)
+{
+	char *p = buf;
+	ssize_t bytes;
+
+	while (size)
+	{
+		if ((bytes = read(fd, p, size)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if (bytes == 0)
+			return (p == buf) ? 0 : set_errno(EINVAL);
+
+		p += bytes;
+		size -= bytes;
+	}
+
+	return 1;
+}
+
+/* Formats one argument with the width and precision arguments in stars */
+
+#define trace_spec_out(value) \
+	((nstars == 0) ? snprintf(out, outsize, spec, value) : \
+	(nstars == 1) ? snprintf(out, outsize, spec, stars[0], value) : \
+	snprintf(out, outsize, spec, stars[0], stars[1], value))
+
+/*
+
+C<int trace_format_event(char *out, size_t outsize, const char *format, const char *data, size_t size)>
+
+Formats the message with the format string C<format> and the recorded
+arguments C<data> (which is C<size> bytes long) into C<out> (which is
+C<outsize> bytes long). On success, returns C<0>. On error (i.e. the
+arguments are corrupt), returns C<-1> with C<errno> set appropriately.
+
+*/
+
+static int trace_format_event(char *out, size_t outsize, const char *format, const char *data, size_t size)
+{
+	const char *end = data + size;
+	char spec[64], args[3];
+
+	while (*format && outsize > 1)
+	{
+		const char *start = format;
+		long long integer;
+		double real;
+		int stars[2];
+		int nstars, nargs, i, length = 0;
+
+		if (*format != '%')
+		{
+			const char *next = strchr(format, '%');
+			size_t len = (next) ? next - format : strlen(format);
+
+			if (len >= outsize)
+				len = outsize - 1;
+
+			memcpy(out, format, len);
+			out += len, outsize -= len, format += len;
+			continue;
+		}
+
+		if ((nargs = trace_spec(&format, args)) == -1)
+			return set_errno(EINVAL);
+
+		if (nargs == 0)
+		{
+			*out++ = '%', --outsize;
+			continue;
+		}
+
+		if (format - start >= (ptrdiff_t)sizeof spec)
+			return set_errno(EINVAL);
+
+		memcpy(spec, start, format - start);
+		spec[format - start] = '\0';
+
+		for (nstars = 0, i = 0; i < nargs - 1; ++i)
+		{
+			if (end - data < (ptrdiff_t)sizeof integer)
+				return set_errno(EINVAL);
+
+			memcpy(&integer, data, sizeof integer);
+			data += sizeof integer;
+			stars[nstars++] = (int)integer;
+		}
+
+		if (args[nargs - 1] == TRACE_STRING)
+		{
+			unsigned int len;
+			char *str;
+
+			if (end - data < (ptrdiff_t)sizeof len)
+				return set_errno(EINVAL);
+
+			memcpy(&len, data, sizeof len);
+			data += sizeof len;
+
+			if (len == TRACE_NULL)
+				length = trace_spec_out("(null)");
+			else
+			{
+				if ((size_t)(end - data) < len || !(str = mem_create(len + 1, char)))
+					return set_errno(EINVAL);
+
+				memcpy(str, data, len);
+				str[len] = '\0';
+				data += len;
+				length = trace_spec_out(str);
+				mem_release(str);
+			}
+		}
+		else
+		{
+			if (end - data < (ptrdiff_t)sizeof integer)
+				return set_errno(EINVAL);
+
+			memcpy(&integer, data, sizeof integer);
+			memcpy(&real, data, sizeof real);
+			data += sizeof integer;
+
+			switch (args[nargs - 1])
+			{
+				case TRACE_INT: case TRACE_SCHAR: case TRACE_SHORT: length = trace_spec_out((int)integer); break;
+				case TRACE_UINT: case TRACE_UCHAR: case TRACE_USHORT: length = trace_spec_out((unsigned int)integer); break;
+				case TRACE_LONG: length = trace_spec_out((long)integer); break;
+				case TRACE_ULONG: length = trace_spec_out((unsigned long)integer); break;
+				case TRACE_LLONG: length = trace_spec_out(integer); break;
+				case TRACE_ULLONG: length = trace_spec_out((unsigned long long)integer); break;
+				case TRACE_SIZE: length = trace_spec_out((size_t)integer); break;
+				case TRACE_SSIZE: length = trace_spec_out((ssize_t)integer); break;
+				case TRACE_PTRDIFF: length = trace_spec_out((ptrdiff_t)integer); break;
+				case TRACE_POINTER: length = trace_spec_out((void *)(size_t)integer); break;
+				case TRACE_DOUBLE: length = trace_spec_out(real); break;
+				case TRACE_LDOUBLE: length = trace_spec_out((long double)real); break;
+			}
+		}
+
+		if (length < 0)
+			return -1;
+
+		if ((size_t)length >= outsize)
+			length = outsize - 1;
+
+		out += length, outsize -= length;
+	}
+
+	*out = '\0';
+
+	return 0;
+}
+
+/*
+
+=item C<int trace_decode(int fd, Msg *mesg)>
+
+Reads a trace from file descriptor C<fd>, and sends each of its messages to
+C<mesg>, formatted as by I<debugf(3)>, but preceded by the time the message
+was recorded (with microseconds) and the number of the thread that recorded
+it (e.g. C<"20230330 12:34:56.123456 [1] debug: message">). On success,
+returns C<0>. On error (including a truncated or corrupt trace), returns
+C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int trace_decode(int fd, Msg *mesg)
+{
+	TraceHeader header[1];
+	TraceRecord record[1];
+	char **formats = NULL;
+	size_t nformats = 0, i;
+	char *data = NULL;
+	char text[MSG_SIZE];
+	int rc = -1;
+
+	if (fd < 0 || !mesg)
+		return set_errno(EINVAL);
+
+	if (trace_read(fd, header, sizeof(TraceHeader)) != 1)
+		return set_errno(EINVAL);
+
+	if (memcmp(header->magic, TRACE_MAGIC, sizeof header->magic) || header->version != TRACE_VERSION || header->order != TRACE_ORDER)
+		return set_errno(EINVAL);
+
+	if (!(data = mem_create(TRACE_RECORD + 1, char)))
+		return -1;
+
+	for (;;)
+	{
+		size_t size;
+		int got;
+
+		if ((got = trace_read(fd, record, sizeof(TraceRecord))) != 1)
+		{
+			rc = got;
+			break;
+		}
+
+		if (record->size < sizeof(TraceRecord) || record->size > TRACE_RECORD)
+		{
+			errno = EINVAL;
+			break;
+		}
+
+		size = record->size - sizeof(TraceRecord);
+
+		if (size && trace_read(fd, data, size) != 1)
+		{
+			errno = EINVAL;
+			break;
+		}
+
+		data[size] = '\0';
+
+		if (record->type == TRACE_FORMAT_RECORD)
+		{
+			if (record->id != nformats + 1 || !mem_resize(&formats, nformats + 1) || !(formats[nformats] = mem_strdup(data)))
+			{
+				if (record->id != nformats + 1)
+					errno = EINVAL;
+
+				break;
+			}
+
+			++nformats;
+		}
+		else if (record->type == TRACE_EVENT_RECORD)
+		{
+			char stamp[32], prefix[32] = "";
+			time_t t = (time_t)record->sec;
+			struct tm tm[1];
+
+			if (record->id > nformats)
+			{
+				errno = EINVAL;
+				break;
+			}
+
+			if (record->id && trace_format_event(text, MSG_SIZE, formats[record->id - 1], data, size) == -1)
+				break;
+
+			if (!localtime_r(&t, tm) || !strftime(stamp, sizeof stamp, "%Y%m%d %H:%M:%S", tm))
+				*stamp = '\0';
+
+			if (record->level & 0xffffff00)
+				snprintf(prefix, 32, " [%d]", (int)((record->level & 0xffffff00) >> 8));
+
+			msg_out(mesg, "%s.%06u [%u] debug:%s%*s%s\n", stamp, record->nsec / 1000, record->thread, prefix, (int)(record->level & 0xff), "", (record->id) ? text : data);
+		}
+		else
+		{
+			errno = EINVAL;
+			break;
+		}
+	}
+
+	for (i = 0; i < nformats; ++i)
+		mem_release(formats[i]);
+
+	mem_release(formats);
+	mem_release(data);
+
+	return rc;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set by underlying functions or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+An argument was invalid, or a trace being decoded was truncated or
+corrupt.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Safe>
+
+=head1 EXAMPLE
+
+Record debug messages in a trace file, and decode them later:
+
+    #include <slack/std.h>
+    #include <slack/prog.h>
+    #include <slack/err.h>
+    #include <slack/trace.h>
+    #include <fcntl.h>
+
+    int main(int ac, char **av)
+    {
+        Trace *trace;
+        int fd;
+
+        prog_init();
+        prog_set_debug_level(1);
+
+        if (!(trace = trace_create_file("/tmp/junk.trace")))
+            return EXIT_FAILURE;
+
+        prog_set_trace(trace);
+        debug((1, "traced: %d %s", 42, "strings are copied"))
+        prog_set_trace(NULL);
+
+        if ((fd = open("/tmp/junk.trace", O_RDONLY)) == -1)
+            return EXIT_FAILURE;
+
+        trace_decode(fd, prog_dbg());
+        close(fd);
+        unlink("/tmp/junk.trace");
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<err(3)>,
+I<msg(3)>,
+I<prog(3)>
+
+=head1 AUTHOR
+
+20230330 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#include "prog.h"
+
+#define MAX_LINES 30000
+#define THREADS 4
+#define THREAD_EVENTS 5000
+#define FORMATS 800
+
+static char *lines[MAX_LINES];
+static int nlines = 0;
+
+/* A message destination that keeps decoded lines */
+
+static void keep_out(void *data, const void *mesg, size_t mesglen)
+{
+	if (nlines < MAX_LINES && (lines[nlines] = mem_create(mesglen + 1, char)))
+	{
+		memcpy(lines[nlines], mesg, mesglen);
+		lines[nlines++][mesglen] = '\0';
+	}
+}
+
+static void forget_lines(void)
+{
+	while (nlines)
+		mem_release(lines[--nlines]);
+}
+
+/* Decodes the trace file at path into lines */
+
+static int decode(const char *path)
+{
+	Msg *keep = msg_create(7, keep_out, NULL, NULL);
+	int fd, rc = -1;
+
+	forget_lines();
+
+	if (keep && (fd = open(path, O_RDONLY)) != -1)
+	{
+		rc = trace_decode(fd, keep);
+		close(fd);
+	}
+
+	msg_release(keep);
+
+	return rc;
+}
+
+/* Returns the decoded line's text after "debug:" */
+
+static const char *message(int i)
+{
+	const char *m;
+
+	return (i < nlines && (m = strstr(lines[i], "] debug:"))) ? m + 8 : "";
+}
+
+static Trace *thread_trace;
+
+static void *tracer(void *arg)
+{
+	int i;
+
+	for (i = 0; i < THREAD_EVENTS; ++i)
+		trace_out(thread_trace, 1, "%d %d", (int)(long)arg, i);
+
+	return NULL;
+}
+
+static double wall(void)
+{
+	struct timespec ts[1];
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+#define BENCH_MESSAGES 1000000
+
+/*
+
+Times debug() with the debug message destination set to /dev/null (each
+message formatted and written), and with a trace writing to /dev/null
+(each message recorded for formatting later).
+
+*/
+
+static void bench(void)
+{
+	double start, secs[2];
+	int fd, i;
+
+	if ((fd = open("/dev/null", O_WRONLY)) == -1)
+	{
+		printf("Failed to open /dev/null\n");
+		exit(EXIT_FAILURE);
+	}
+
+	prog_set_debug_level(1);
+	prog_dbg_fd(fd);
+
+	start = wall();
+	for (i = 0; i < BENCH_MESSAGES; ++i)
+		debugf(1, "bench: %s message %d of %d (%f)", "debug", i, BENCH_MESSAGES, i / 3.0);
+	secs[0] = wall() - start;
+
+	prog_set_trace(trace_create(fd));
+
+	start = wall();
+	for (i = 0; i < BENCH_MESSAGES; ++i)
+		debugf(1, "bench: %s message %d of %d (%f)", "debug", i, BENCH_MESSAGES, i / 3.0);
+	secs[1] = wall() - start;
+
+	prog_set_trace(NULL);
+	close(fd);
+
+	printf("%10s %10s (ns/message)\n", "formatted", "traced");
+	printf("%10.1f %10.1f\n", secs[0] * 1e9 / BENCH_MESSAGES, secs[1] * 1e9 / BENCH_MESSAGES);
+
+	exit(EXIT_SUCCESS);
+}
+
+/* Records a message and remembers how printf(3) would format it */
+
+#define TRACE(level, format, ...) \
+	(snprintf(expected[nexpected], MSG_SIZE, (format), __VA_ARGS__), \
+	levels[nexpected++] = (level), \
+	trace_out(trace, (level), (format), __VA_ARGS__))
+
+int main(int ac, char **av)
+{
+	const char *path = "./trace.test";
+	static char expected[16][MSG_SIZE];
+	char *formats[FORMATS];
+	char want[MSG_SIZE + 64], prefix[32];
+	size_t levels[16];
+	int nexpected = 0;
+	int errors = 0;
+	Trace *trace;
+	char *big;
+	int i, fd;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s [bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
+		bench();
+
+	printf("Testing: %s\n", "trace");
+
+	/* Test trace_create, trace_out, trace_decode: messages are formatted as by printf */
+
+	if (!(trace = trace_create_file(path)))
+		++errors, printf("Test1: trace_create_file(%s) failed (%s)\n", path, strerror(errno));
+	else
+	{
+		if (!(big = mem_create(3 * MSG_SIZE, char)))
+			return EXIT_FAILURE;
+
+		memset(big, 'x', 3 * MSG_SIZE - 1);
+		big[3 * MSG_SIZE - 1] = '\0';
+
+		TRACE(1, "%s", "plain text");
+		TRACE(1, "%d %i %u %x %X %o", -5, 7, 4000000000U, 255, 255, 8);
+		TRACE(2, "%hhd %hhu %hd %hu", 300, 300, 70000, 70000);
+		TRACE(3, "%ld %lu %lld %llu %zu %zd %td", -123456789L, 123456789UL, -1234567890123LL, 1234567890123ULL, (size_t)42, (ssize_t)-42, (ptrdiff_t)-7);
+		TRACE(1, "%5.2f %e %g %Lf %a", 3.14159, 1e10, 0.5, (long double)2.5, 1.0);
+		TRACE(1, "[%s] [%.3s] [%-6s] [%s]", "abc", "abcdef", "ab", (char *)NULL);
+		TRACE(1, "%*d|%-*.*f|%.*s|", 5, 42, 8, 2, 3.14159, 2, "abc");
+		TRACE(1, "%c%c%% %#x %+d % d %05d", 'o', 'k', 255, 3, 3, 42);
+		TRACE(1, "%p", (void *)&errors);
+		TRACE(1, "%2$s %1$s", "world", "hello");
+		TRACE(0x102, "%s", "section 1, level 2");
+		TRACE(1, "%d %s", 1, big);
+
+		if (trace_flush(trace) == -1)
+			++errors, printf("Test2: trace_flush() failed (%s)\n", strerror(errno));
+
+		trace_destroy(&trace);
+		mem_release(big);
+
+		if (trace)
+			++errors, printf("Test3: trace_destroy() failed\n");
+
+		if (decode(path) == -1)
+			++errors, printf("Test4: trace_decode() failed (%s)\n", strerror(errno));
+		else if (nlines != nexpected)
+			++errors, printf("Test4: trace_decode() failed (%d lines, not %d)\n", nlines, nexpected);
+		else
+		{
+			for (i = 0; i < nexpected; ++i)
+			{
+				*prefix = '\0';
+
+				if (levels[i] & 0xffffff00)
+					snprintf(prefix, 32, " [%d]", (int)((levels[i] & 0xffffff00) >> 8));
+
+				snprintf(want, sizeof want, "%s%*s%s\n", prefix, (int)(levels[i] & 0xff), "", expected[i]);
+
+				/* The last message's string was truncated to fit a record */
+
+				if (i == nexpected - 1)
+				{
+					if (strncmp(message(i), want, 64) || strlen(message(i)) < MSG_SIZE / 2 || strlen(message(i)) > MSG_SIZE)
+						++errors, printf("Test%d: trace_decode() failed (truncated string, length %d)\n", 5 + i, (int)strlen(message(i)));
+				}
+				else if (strcmp(message(i), want))
+					++errors, printf("Test%d: trace_decode() failed:\n  %s  (not %s)", 5 + i, message(i), want);
+			}
+		}
+
+		if (nlines && strncmp(lines[0], "20", 2))
+			++errors, printf("Test17: trace_decode() failed (no timestamp: %s)", lines[0]);
+	}
+
+	/* Test threads: each thread's messages are in order, and written when it exits */
+
+	if (!(thread_trace = trace_create_file(path)))
+		++errors, printf("Test18: trace_create_file(%s) failed (%s)\n", path, strerror(errno));
+	else
+	{
+		pthread_t thread[THREADS];
+		int next[THREADS], thread_of[THREADS + 1];
+		int ok = 1;
+
+		for (i = 0; i < THREADS; ++i)
+			next[i] = 0, pthread_create(&thread[i], NULL, tracer, (void *)(long)i);
+
+		for (i = 0; i < THREADS; ++i)
+			pthread_join(thread[i], NULL);
+
+		/* The buffers of exited threads have already been written */
+
+		if (decode(path) == -1 || nlines != THREADS * THREAD_EVENTS)
+			++errors, printf("Test18: thread exit failed (%d lines, not %d)\n", nlines, THREADS * THREAD_EVENTS);
+
+		for (i = 0; i <= THREADS; ++i)
+			thread_of[i] = -1;
+
+		for (i = 0; i < nlines; ++i)
+		{
+			unsigned int number;
+			int t, n;
+
+			if (sscanf(strchr(lines[i], '['), "[%u] debug: %d %d", &number, &t, &n) != 3 || t < 0 || t >= THREADS || number < 1 || number > THREADS || n != next[t]++)
+				ok = 0;
+			else if (thread_of[number] == -1)
+				thread_of[number] = t;
+			else if (thread_of[number] != t)
+				ok = 0;
+		}
+
+		if (!ok)
+			++errors, printf("Test19: threads failed (messages out of order or misattributed)\n");
+
+		trace_destroy(&thread_trace);
+	}
+
+	/* Test formats beyond the limit are recorded as text */
+
+	if (!(trace = trace_create_file(path)))
+		++errors, printf("Test20: trace_create_file(%s) failed (%s)\n", path, strerror(errno));
+	else
+	{
+		int ok = 1;
+
+		for (i = 0; i < FORMATS; ++i)
+		{
+			formats[i] = mem_create(32, char);
+			snprintf(formats[i], 32, "format %d: %%d", i);
+			trace_out(trace, 1, formats[i], i);
+		}
+
+		trace_destroy(&trace);
+
+		for (i = 0; i < FORMATS; ++i)
+			mem_release(formats[i]);
+
+		if (decode(path) == -1 || nlines != FORMATS)
+			++errors, printf("Test20: too many formats failed (%d lines, not %d)\n", nlines, FORMATS);
+
+		for (i = 0; i < nlines; ++i)
+		{
+			snprintf(want, sizeof want, " format %d: %d\n", i, i);
+
+			if (strcmp(message(i), want))
+				ok = 0;
+		}
+
+		if (!ok)
+			++errors, printf("Test21: too many formats failed (wrong messages)\n");
+	}
+
+	/* Test debugf() records messages in the program's trace */
+
+	prog_set_debug_level(1);
+
+	if (!prog_set_trace(trace_create_file(path)))
+		++errors, printf("Test22: prog_set_trace() failed (%s)\n", strerror(errno));
+	else
+	{
+		debugf(1, "traced %d", 42);
+		debugf(2, "not traced %d", 42);
+
+		if (!prog_trace())
+			++errors, printf("Test23: prog_trace() failed\n");
+
+		prog_set_trace(NULL);
+
+		if (decode(path) == -1 || nlines != 1 || strcmp(message(0), " traced 42\n"))
+			++errors, printf("Test24: debugf() failed to trace (%d lines: %s)\n", nlines, nlines ? lines[0] : "");
+	}
+
+	/* Test errors: invalid arguments, truncated and corrupt traces */
+
+	if (trace_create(-1) || errno != EINVAL)
+		++errors, printf("Test25: trace_create(-1) failed\n");
+
+	if (trace_create_file(NULL) || errno != EINVAL)
+		++errors, printf("Test26: trace_create_file(NULL) failed\n");
+
+	if (trace_out(NULL, 1, "%d", 1) != -1 || errno != EINVAL)
+		++errors, printf("Test27: trace_out(NULL) failed\n");
+
+	if (trace_flush(NULL) != -1 || errno != EINVAL)
+		++errors, printf("Test28: trace_flush(NULL) failed\n");
+
+	if (trace_decode(-1, NULL) != -1 || errno != EINVAL)
+		++errors, printf("Test29: trace_decode(-1, NULL) failed\n");
+
+	if ((trace = trace_create_file(path)))
+	{
+		trace_out(trace, 1, "%s %d", "truncated", 1);
+		trace_destroy(&trace);
+		truncate(path, 30);
+
+		if (decode(path) != -1)
+			++errors, printf("Test30: trace_decode() failed to detect a truncated trace\n");
+	}
+
+	if ((fd = open(path, O_WRONLY | O_TRUNC)) != -1)
+	{
+		if (write(fd, "not a trace at all", 18) != 18)
+			++errors, printf("Test31: failed to write %s\n", path);
+
+		close(fd);
+
+		if (decode(path) != -1 || errno != EINVAL)
+			++errors, printf("Test31: trace_decode() failed to detect a corrupt trace\n");
+	}
+
+	forget_lines();
+	unlink(path);
+
+	if (errors)
+		printf("%d/31 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
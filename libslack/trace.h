@@ -0,0 +1,46 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2002, 2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+
+#ifndef LIBSLACK_TRACE_H
+#define LIBSLACK_TRACE_H
+
+#include <stdarg.h>
+
+#include <slack/hdr.h>
+#include <slack/msg.h>
+
+typedef struct Trace Trace;
+
+_begin_decls
+Trace *trace_create(int fd);
+Trace *trace_create_file(const char *path);
+void trace_release(Trace *trace);
+void *trace_destroy(Trace **trace);
+int trace_out(Trace *trace, size_t level, const char *format, ...);
+int vtrace_out(Trace *trace, size_t level, const char *format, va_list args);
+int trace_flush(Trace *trace);
+int trace_decode(int fd, Msg *mesg);
+_end_decls
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -49,6 +49,7 @@ LAUNCH_DEFINES += -DHAVE_GETOPT_LONG=1
 # LAUNCH_DEFINES += -DNO_XOPEN_SOURCE=1
 
 LAUNCH_TARGET := $(LAUNCH_SRCDIR)/$(LAUNCH_NAME)
+LAUNCH_SINK := $(LAUNCH_SRCDIR)/test/smtpsink
 LAUNCH_MODULES := launchmail
 
 LAUNCH_CFILES := $(patsubst %, $(LAUNCH_SRCDIR)/%.c, $(LAUNCH_MODULES))
@@ -77,9 +78,10 @@ INSTALL_TARGETS += install-launchmail
 UNINSTALL_TARGETS += uninstall-launchmail
 endif
 DIST_TARGETS += dist-launchmail
+BENCH_TARGETS += bench-launchmail
 
 CLEAN_FILES += $(LAUNCH_OFILES) $(LAUNCH_MANFILES) $(LAUNCH_HTMLFILES)
-CLOBBER_FILES += $(LAUNCH_TARGET) $(LAUNCH_SRCDIR)/tags
+CLOBBER_FILES += $(LAUNCH_TARGET) $(LAUNCH_SINK) $(LAUNCH_SRCDIR)/tags
 
 # Uncomment these on MacOSX to create universal binaries
 #
@@ -30,6 +30,14 @@ endif
 $(LAUNCH_TARGET): $(LAUNCH_OFILES) $(LAUNCH_SUBTARGETS)
 	$(CC) -o $(LAUNCH_TARGET) $(LAUNCH_OFILES) $(LAUNCH_LDFLAGS)
 
+$(LAUNCH_SINK): $(LAUNCH_SINK).c $(LAUNCH_SUBTARGETS)
+	$(CC) $(LAUNCH_CFLAGS) -o $(LAUNCH_SINK) $(LAUNCH_SINK).c $(LAUNCH_LDFLAGS)
+
+.PHONY: bench-launchmail
+
+bench-launchmail: $(LAUNCH_TARGET) $(LAUNCH_SINK)
+	perl $(LAUNCH_SRCDIR)/test/bench
+
 .PHONY: man-launchmail html-launchmail
 
 man-launchmail: $(LAUNCH_MANFILES)
@@ -95,6 +103,7 @@ help::
 	echo " uninstall-launchmail      -- uninstalls $(LAUNCH_NAME) and its manpage"; \
 	echo " uninstall-launchmail-bin  -- uninstalls $(LAUNCH_NAME) from $(APP_INSDIR)"; \
 	echo " uninstall-launchmail-man  -- uninstalls the $(LAUNCH_NAME) manpage from $(APP_MANDIR)"; \
+	echo " bench-launchmail          -- benchmarks $(LAUNCH_NAME) against $(LAUNCH_SINK)"; \
 	echo " dist-launchmail           -- makes a source tarball for launchmail"; \
 	echo
 endif
@@ -105,6 +114,7 @@ help-macros::
 	echo "LAUNCH_ID = $(LAUNCH_ID)"; \
 	echo "LAUNCH_DIST = $(LAUNCH_DIST)"; \
 	echo "LAUNCH_TARGET = $(LAUNCH_TARGET)"; \
+	echo "LAUNCH_SINK = $(LAUNCH_SINK)"; \
 	echo "LAUNCH_MODULES = $(LAUNCH_MODULES)"; \
 	echo "LAUNCH_SRCDIR = $(LAUNCH_SRCDIR)"; \
 	echo "LAUNCH_INCDIRS = $(LAUNCH_INCDIRS)"; \
@@ -0,0 +1,658 @@
+/*
+* launchmail - https://libslack.org/launchmail
+*
+* Copyright (C) 2000, 2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230330 raf <raf@raf.org>
+*/
+
+
+/*
+
+=head1 NAME
+
+I<smtpsink> - an SMTP server that accepts mail and throws it away
+
+=head1 SYNOPSIS
+
+ smtpsink [options]
+ options:
+
+  -h, --help                 - Print a help message then exit
+  -V, --version              - Print a version message then exit
+  -v, --verbose=level        - Set the verbosity level
+  -d, --debug=level          - Set the debug level
+
+  -i, --interface=address    - Interface to listen on (default 127.0.0.1)
+  -P, --port=#               - Port to listen on (default 2525)
+  -l, --latency=#            - Milliseconds to wait before each reply
+  -F, --tempfail=#           - Percentage of replies that are 4xx errors
+  -s, --seed=#               - Seed for choosing the replies that fail
+  -p, --pipelining           - Advertise PIPELINING in reply to EHLO
+  -c, --chunking             - Advertise and accept CHUNKING (BDAT)
+  -n, --messages=#           - Exit after accepting this many messages
+
+=head1 DESCRIPTION
+
+I<smtpsink> is an SMTP server for testing and benchmarking SMTP clients
+(e.g. I<launchmail>). It accepts mail from any number of concurrent
+clients, counts it, and throws it away. When it is terminated (by C<SIGTERM>
+or C<SIGINT>), or after accepting C<--messages> messages (once that client
+disconnects), it prints a single line to standard output like:
+
+ connections=10 messages=10 recipients=20 bytes=10240 tempfails=0 user=0.002 sys=0.004
+
+where C<bytes> is the total size of the messages accepted, and C<user> and
+C<sys> are the CPU time (in seconds) that I<smtpsink> used.
+
+It understands C<HELO>, C<EHLO>, C<MAIL>, C<RCPT>, C<DATA>, C<BDAT> (with
+C<--chunking>), C<RSET>, C<NOOP> and C<QUIT>. Commands that arrive together
+(i.e. pipelined) are replied to together, like a real server that supports
+C<PIPELINING> would.
+
+With C<--latency>, each reply (or group of replies to pipelined commands) is
+delayed, as though the server were busy or far away. Delays are in units of
+10ms (see I<agent(3)>). With C<--tempfail>, that percentage of the replies
+to C<MAIL>, C<RCPT>, C<DATA> and the end of each message are C<451>
+(temporary failure) instead, chosen at random (but the same ones each time
+for the same C<--seed>).
+
+=head1 SEE ALSO
+
+I<launchmail(1)>,
+I<agent(3)>,
+I<net(3)>
+
+=head1 AUTHOR
+
+20230330 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#include <slack/std.h>
+#include <slack/lib.h>
+
+#include <sys/resource.h>
+
+#define SINK_NAME "smtpsink"
+#define SINK_BUFSIZ 65536
+#define SINK_OUTSIZ 4096
+#define SINK_CHECK 100000 /* microseconds between checks for signals */
+
+typedef struct Session Session;
+
+enum { COMMAND, DATA, BDAT };
+
+struct Session
+{
+	int fd;               /* the client's socket */
+	int state;            /* COMMAND, DATA or BDAT */
+	int reading;          /* fd is connected to the agent */
+	int busy;             /* replies are waiting to be sent later */
+	int quit;             /* close the connection after the replies */
+	int mail;             /* MAIL has been accepted */
+	int rcpts;            /* recipients accepted for the current message */
+	int bol;              /* in DATA: at the beginning of a line */
+	int last;             /* in BDAT: this is the last chunk */
+	size_t chunk;         /* in BDAT: bytes still to come */
+	size_t size;          /* bytes in the current message so far */
+	size_t start;         /* offset of the unhandled input in buf */
+	size_t length;        /* bytes of unhandled input in buf */
+	char buf[SINK_BUFSIZ]; /* input from the client */
+	size_t outlen;        /* bytes in out */
+	char out[SINK_OUTSIZ]; /* replies to send */
+};
+
+/* Configuration and totals */
+
+static struct
+{
+	const char *interface;     /* the interface to listen on */
+	int port;                  /* the port to listen on */
+	int latency;               /* milliseconds before each reply */
+	int tempfail;              /* percentage of replies that fail */
+	int seed;                  /* seed for random() */
+	int pipelining;            /* advertise PIPELINING */
+	int chunking;              /* advertise CHUNKING */
+	int limit;                 /* messages to accept before exiting */
+	Agent *agent;              /* reacts to clients */
+	int stop;                  /* SIGTERM or SIGINT was received */
+	unsigned long connections; /* clients accepted */
+	unsigned long messages;    /* messages accepted */
+	unsigned long recipients;  /* recipients of messages accepted */
+	unsigned long long bytes;  /* size of messages accepted */
+	unsigned long tempfails;   /* 4xx replies injected */
+}
+g =
+{
+	"127.0.0.1", /* interface */
+	2525,        /* port */
+	0,           /* latency */
+	0,           /* tempfail */
+	1,           /* seed */
+	0,           /* pipelining */
+	0,           /* chunking */
+	0,           /* limit */
+	null,        /* agent */
+	0,           /* stop */
+	0, 0, 0, 0, 0
+};
+
+/* Adds a reply to those waiting to be sent */
+
+void reply(Session *session, const char *format, ...)
+{
+	size_t room = SINK_OUTSIZ - session->outlen - 2;
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	len = vsnprintf(session->out + session->outlen, room, format, args);
+	va_end(args);
+
+	if (len < 0 || len >= room)
+		return;
+
+	session->outlen += len;
+	session->out[session->outlen++] = '\r';
+	session->out[session->outlen++] = '\n';
+}
+
+/* Decides whether to inject a temporary failure */
+
+int tempfail(void)
+{
+	if (!g.tempfail || random() % 100 >= g.tempfail)
+		return 0;
+
+	++g.tempfails;
+
+	return 1;
+}
+
+void end_session(Session *session)
+{
+	debug((1, "closing connection %d", session->fd))
+
+	if (session->reading)
+		agent_disconnect(g.agent, session->fd);
+
+	close(session->fd);
+	mem_release(session);
+
+	/* Stop once the client that sent the last message has finished with it */
+
+	if (g.limit && g.messages >= g.limit)
+		agent_stop(g.agent);
+}
+
+/* The current message has been received */
+
+void end_message(Session *session)
+{
+	if (tempfail())
+		reply(session, "451 4.3.0 Temporary failure (injected)");
+	else
+	{
+		reply(session, "250 2.0.0 Message accepted");
+		++g.messages;
+		g.recipients += session->rcpts;
+		g.bytes += session->size;
+	}
+
+	session->state = COMMAND;
+	session->mail = session->rcpts = 0;
+	session->size = 0;
+}
+
+void command(Session *session, const char *line)
+{
+	debug((2, "%d: %s", session->fd, line))
+
+	if (!strncasecmp(line, "EHLO", 4))
+	{
+		reply(session, "250-%s Hello", SINK_NAME);
+
+		if (g.pipelining)
+			reply(session, "250-PIPELINING");
+
+		if (g.chunking)
+			reply(session, "250-CHUNKING");
+
+		reply(session, "250 8BITMIME");
+	}
+	else if (!strncasecmp(line, "HELO", 4))
+		reply(session, "250 %s Hello", SINK_NAME);
+	else if (!strncasecmp(line, "MAIL", 4))
+	{
+		if (tempfail())
+			reply(session, "451 4.3.0 Temporary failure (injected)");
+		else
+		{
+			reply(session, "250 2.1.0 Sender ok");
+			session->mail = 1;
+			session->rcpts = 0;
+		}
+	}
+	else if (!strncasecmp(line, "RCPT", 4))
+	{
+		if (!session->mail)
+			reply(session, "503 5.5.1 Need MAIL first");
+		else if (tempfail())
+			reply(session, "451 4.3.0 Temporary failure (injected)");
+		else
+		{
+			reply(session, "250 2.1.5 Recipient ok");
+			++session->rcpts;
+		}
+	}
+	else if (!strncasecmp(line, "DATA", 4))
+	{
+		if (!session->rcpts)
+			reply(session, "503 5.5.1 Need RCPT first");
+		else if (tempfail())
+			reply(session, "451 4.3.0 Temporary failure (injected)");
+		else
+		{
+			reply(session, "354 End data with <CR><LF>.<CR><LF>");
+			session->state = DATA;
+			session->bol = 1;
+		}
+	}
+	else if (!strncasecmp(line, "BDAT", 4) && g.chunking)
+	{
+		char *end;
+
+		session->chunk = strtoul(line + 4, &end, 10);
+		session->last = !strncasecmp(end, " LAST", 5);
+		session->state = BDAT;
+	}
+	else if (!strncasecmp(line, "RSET", 4))
+	{
+		reply(session, "250 2.0.0 Reset");
+		session->mail = session->rcpts = 0;
+		session->size = 0;
+	}
+	else if (!strncasecmp(line, "NOOP", 4))
+		reply(session, "250 2.0.0 Ok");
+	else if (!strncasecmp(line, "QUIT", 4))
+	{
+		reply(session, "221 2.0.0 Bye");
+		session->quit = 1;
+	}
+	else
+		reply(session, "502 5.5.2 Command not implemented");
+}
+
+/*
+** Handles as much of the client's input as possible (stopping after QUIT,
+** and when there are enough replies to send). The input that's been handled
+** is skipped rather than moved, so each byte is only moved once, by
+** reader(), however many lines arrive in each read.
+*/
+
+void handle(Session *session)
+{
+	char *buf = session->buf + session->start, *nl;
+	size_t used;
+
+	while (!session->quit && session->outlen < SINK_OUTSIZ / 2)
+	{
+		if (session->state == COMMAND)
+		{
+			if (!(nl = memchr(buf, '\n', session->length)))
+			{
+				if (session->length == SINK_BUFSIZ)
+				{
+					reply(session, "500 5.5.6 Line too long");
+					session->start = session->length = 0;
+				}
+
+				break;
+			}
+
+			*nl = '\0';
+
+			if (nl > buf && nl[-1] == '\r')
+				nl[-1] = '\0';
+
+			used = nl + 1 - buf;
+			command(session, buf);
+		}
+		else if (session->state == DATA)
+		{
+			if (!session->length)
+				break;
+
+			/* The message ends with a line containing only "." */
+
+			if (session->bol && buf[0] == '.')
+			{
+				if (session->length < 2 || (buf[1] == '\r' && session->length < 3))
+					break;
+
+				if (buf[1] == '\n' || (buf[1] == '\r' && buf[2] == '\n'))
+				{
+					used = (buf[1] == '\n') ? 2 : 3;
+					end_message(session);
+					buf += used;
+					session->start += used;
+					session->length -= used;
+					continue;
+				}
+			}
+
+			nl = memchr(buf, '\n', session->length);
+			used = (nl) ? nl + 1 - buf : session->length;
+			session->bol = (nl != NULL);
+			session->size += used;
+		}
+		else /* BDAT */
+		{
+			used = (session->chunk < session->length) ? session->chunk : session->length;
+			session->chunk -= used;
+			session->size += used;
+
+			if (session->chunk)
+			{
+				if (!used)
+					break;
+			}
+			else if (session->last)
+				end_message(session);
+			else
+			{
+				reply(session, "250 2.0.0 %lu octets received", (unsigned long)session->size);
+				session->state = COMMAND;
+			}
+		}
+
+		buf += used;
+		session->start += used;
+		session->length -= used;
+	}
+}
+
+int replier(Agent *agent, void *arg);
+int reader(Agent *agent, int fd, int revents, void *arg);
+
+/*
+** Handles the client's input, and sends the replies (now, or after the
+** latency, in which case the client isn't read until then). Returns -1 if
+** the session has ended.
+*/
+
+int process(Session *session)
+{
+	for (;;)
+	{
+		handle(session);
+
+		if (!session->outlen)
+			return 0;
+
+		if (g.latency)
+		{
+			if (session->reading)
+			{
+				agent_disconnect(g.agent, session->fd);
+				session->reading = 0;
+			}
+
+			if (!agent_schedule(g.agent, g.latency / 1000, g.latency % 1000 * 1000, replier, session))
+			{
+				errorsys("failed to schedule reply");
+				end_session(session);
+				return -1;
+			}
+
+			session->busy = 1;
+
+			return 0;
+		}
+
+		if (net_write(session->fd, 10, session->out, session->outlen) == -1 || session->quit)
+		{
+			end_session(session);
+			return -1;
+		}
+
+		session->outlen = 0;
+	}
+}
+
+/* Sends the replies when the latency has elapsed */
+
+int replier(Agent *agent, void *arg)
+{
+	Session *session = arg;
+
+	session->busy = 0;
+
+	if (net_write(session->fd, 10, session->out, session->outlen) == -1 || session->quit)
+	{
+		end_session(session);
+		return 0;
+	}
+
+	session->outlen = 0;
+
+	if (process(session) == -1 || session->busy)
+		return 0;
+
+	if (agent_connect(agent, session->fd, R_OK, reader, session) == -1)
+	{
+		errorsys("failed to connect client to agent");
+		end_session(session);
+		return 0;
+	}
+
+	session->reading = 1;
+
+	return 0;
+}
+
+int reader(Agent *agent, int fd, int revents, void *arg)
+{
+	Session *session = arg;
+	ssize_t bytes;
+
+	if (session->start)
+	{
+		memmove(session->buf, session->buf + session->start, session->length);
+		session->start = 0;
+	}
+
+	if ((bytes = read(fd, session->buf + session->length, SINK_BUFSIZ - session->length)) <= 0)
+	{
+		end_session(session);
+		return 0;
+	}
+
+	session->length += bytes;
+	process(session);
+
+	return 0;
+}
+
+int acceptor(Agent *agent, int fd, int revents, void *arg)
+{
+	Session *session;
+	int sockfd;
+
+	if ((sockfd = accept(fd, null, null)) == -1)
+		return 0;
+
+	if (!(session = mem_new(Session)))
+	{
+		close(sockfd);
+		return 0;
+	}
+
+	debug((1, "accepted connection %d", sockfd))
+	++g.connections;
+	memset(session, 0, offsetof(Session, buf));
+	session->outlen = 0;
+	session->fd = sockfd;
+
+	if (agent_connect(agent, sockfd, R_OK, reader, session) == -1)
+	{
+		errorsys("failed to connect client to agent");
+		close(sockfd);
+		mem_release(session);
+		return 0;
+	}
+
+	session->reading = 1;
+	reply(session, "220 %s ESMTP", SINK_NAME);
+	process(session);
+
+	return 0;
+}
+
+void stop(int signo)
+{
+	g.stop = 1;
+}
+
+/* Signals might not interrupt poll(2), so check for them regularly */
+
+int check_signals(Agent *agent, void *arg)
+{
+	signal_handle_all();
+
+	if (g.stop)
+		return agent_stop(agent);
+
+	if (!agent_schedule(agent, 0, SINK_CHECK, check_signals, null))
+		return -1;
+
+	return 0;
+}
+
+static Option smtpsink_options_table[] =
+{
+	{
+		"interface", 'i', "address", "Interface to listen on (default 127.0.0.1)",
+		required_argument, OPT_STRING, OPT_VARIABLE, &g.interface, null
+	},
+	{
+		"port", 'P', "#", "Port to listen on (default 2525)",
+		required_argument, OPT_INTEGER, OPT_VARIABLE, &g.port, null
+	},
+	{
+		"latency", 'l', "#", "Milliseconds to wait before each reply",
+		required_argument, OPT_INTEGER, OPT_VARIABLE, &g.latency, null
+	},
+	{
+		"tempfail", 'F', "#", "Percentage of replies that are 4xx errors",
+		required_argument, OPT_INTEGER, OPT_VARIABLE, &g.tempfail, null
+	},
+	{
+		"seed", 's', "#", "Seed for choosing the replies that fail",
+		required_argument, OPT_INTEGER, OPT_VARIABLE, &g.seed, null
+	},
+	{
+		"pipelining", 'p', null, "Advertise PIPELINING in reply to EHLO",
+		no_argument, OPT_INTEGER, OPT_VARIABLE, &g.pipelining, null
+	},
+	{
+		"chunking", 'c', null, "Advertise and accept CHUNKING (BDAT)",
+		no_argument, OPT_INTEGER, OPT_VARIABLE, &g.chunking, null
+	},
+	{
+		"messages", 'n', "#", "Exit after accepting this many messages",
+		required_argument, OPT_INTEGER, OPT_VARIABLE, &g.limit, null
+	},
+	{
+		null, '\0', null, null, 0, 0, 0, null, null
+	}
+};
+
+static Options options[1] = {{ prog_options_table, smtpsink_options_table }};
+
+int main(int ac, char **av)
+{
+	struct rusage usage[1];
+	int sockfd;
+
+	prog_init();
+	prog_set_name(SINK_NAME);
+	prog_set_version(LAUNCH_VERSION);
+	prog_set_date(LAUNCH_DATE);
+	prog_set_syntax("[options]");
+	prog_set_options(options);
+	prog_set_author("raf <raf@raf.org>");
+	prog_set_contact(prog_author());
+	prog_set_url(LAUNCH_URL);
+	prog_set_desc
+	(
+		"smtpsink - an SMTP server that accepts mail and throws it away.\n"
+		"See the comments at the top of test/smtpsink.c for more information.\n"
+	);
+
+	if (prog_opt_process(ac, av) != ac)
+		prog_usage_msg("Wrong number of arguments");
+
+	if (g.latency < 0)
+		prog_usage_msg("Invalid --latency argument: %d", g.latency);
+
+	if (g.tempfail < 0 || g.tempfail > 100)
+		prog_usage_msg("Invalid --tempfail argument: %d (must be from 0 to 100)", g.tempfail);
+
+	srandom(g.seed);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (signal_set_handler(SIGTERM, 0, stop) == -1 || signal_set_handler(SIGINT, 0, stop) == -1)
+		fatalsys("failed to set signal handlers");
+
+	if ((sockfd = net_server(g.interface, null, g.port, 0, 0, null, null)) == -1)
+		fatalsys("failed to listen on %s:%d", g.interface, g.port);
+
+	if (!(g.agent = agent_create()))
+		fatalsys("failed to create agent");
+
+	if (agent_connect(g.agent, sockfd, R_OK, acceptor, null) == -1)
+		fatalsys("failed to connect server socket to agent");
+
+	if (!agent_schedule(g.agent, 0, SINK_CHECK, check_signals, null))
+		fatalsys("failed to schedule signal checks");
+
+	while (agent_start(g.agent) == -1)
+	{
+		if (errno != EINTR)
+			fatalsys("agent failed");
+
+		signal_handle_all();
+
+		if (g.stop)
+			break;
+	}
+
+	if (getrusage(RUSAGE_SELF, usage) == -1)
+		memset(usage, 0, sizeof usage);
+
+	printf("connections=%lu messages=%lu recipients=%lu bytes=%llu tempfails=%lu user=%.3f sys=%.3f\n",
+		g.connections, g.messages, g.recipients, g.bytes, g.tempfails,
+		usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+		usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6);
+
+	return EXIT_SUCCESS;
+}
+
+/* vi:set ts=4 sw=4: */